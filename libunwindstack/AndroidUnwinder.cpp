@@ -38,6 +38,8 @@
 #include <unwindstack/RegsGetLocal.h>
 #include <unwindstack/Unwinder.h>
 
+#include "MemoryStackSnapshot.h"
+
 #if defined(__BIONIC__)
 
 //#include <bionic/reserved_signals.h>
@@ -167,6 +169,11 @@ bool AndroidUnwinder::Unwind(void* ucontext, AndroidUnwinderData& data) {
 }
 
 bool AndroidUnwinder::Unwind(Regs* initial_regs, AndroidUnwinderData& data) {
+  return UnwindWithStepMemory(initial_regs, nullptr, data);
+}
+
+bool AndroidUnwinder::UnwindWithStepMemory(Regs* initial_regs, std::shared_ptr<Memory> step_memory,
+                                           AndroidUnwinderData& data) {
   if (initial_regs == nullptr) {
     data.error.code = ERROR_INVALID_PARAMETER;
     return false;
@@ -189,6 +196,7 @@ bool AndroidUnwinder::Unwind(Regs* initial_regs, AndroidUnwinderData& data) {
                     process_memory_);
   unwinder.SetJitDebug(jit_debug_.get());
   unwinder.SetDexFiles(dex_files_.get());
+  unwinder.SetStepMemory(step_memory);
   unwinder.Unwind(data.show_all_frames ? nullptr : &initial_map_names_to_skip_,
                   &map_suffixes_to_ignore_);
   data.frames = unwinder.ConsumeFrames();
@@ -253,7 +261,38 @@ bool AndroidRemoteUnwinder::InternalUnwind(std::optional<pid_t> tid, AndroidUnwi
   if (regs == nullptr) {
     return false;
   }
-  return AndroidUnwinder::Unwind(regs.get(), data);
+  if (!stack_prefetch_) {
+    return AndroidUnwinder::Unwind(regs.get(), data);
+  }
+
+  size_t prefetch_size = GetStackPrefetchSize(*tid);
+  std::shared_ptr<MemoryStackSnapshot> snapshot =
+      MemoryStackSnapshot::Create(process_memory_, maps_.get(), regs->sp(), prefetch_size);
+  bool unwound = UnwindWithStepMemory(regs.get(), snapshot, data);
+  if (snapshot != nullptr) {
+    SetStackPrefetchSize(
+        *tid, MemoryStackSnapshot::NextSize(prefetch_size, snapshot->StackBytesUsed()));
+  }
+  return unwound;
+}
+
+size_t AndroidRemoteUnwinder::GetStackPrefetchSize(pid_t tid) {
+  std::lock_guard<std::mutex> guard(stack_prefetch_lock_);
+  auto entry = stack_prefetch_sizes_.find(tid);
+  if (entry == stack_prefetch_sizes_.end()) {
+    return MemoryStackSnapshot::kInitialSize;
+  }
+  return entry->second;
+}
+
+void AndroidRemoteUnwinder::SetStackPrefetchSize(pid_t tid, size_t size) {
+  std::lock_guard<std::mutex> guard(stack_prefetch_lock_);
+  if (stack_prefetch_sizes_.size() >= kMaxStackPrefetchThreads &&
+      stack_prefetch_sizes_.count(tid) == 0) {
+    // Threads come and go, so start over rather than grow forever.
+    stack_prefetch_sizes_.clear();
+  }
+  stack_prefetch_sizes_[tid] = size;
 }
 
 }  // namespace unwindstack
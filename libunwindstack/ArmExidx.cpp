@@ -17,7 +17,6 @@
 #include <inttypes.h>
 #include <stdint.h>
 
-#include <deque>
 #include <string>
 
 #include <android-base/stringprintf.h>
@@ -53,16 +52,30 @@ bool ArmExidx::ExtractEntryData(uint32_t entry_offset) {
   }
 
   // Each entry is a 32 bit prel31 offset followed by 32 bits
-  // of unwind information. If bit 31 of the unwind data is zero,
-  // then this is a prel31 offset to the start of the unwind data.
-  // If the unwind data is 1, then this is a cant unwind entry.
-  // Otherwise, this data is the compact form of the unwind information.
+  // of unwind information.
   uint32_t data;
   if (!elf_memory_->Read32(entry_offset + 4, &data)) {
     status_ = ARM_STATUS_READ_FAILED;
     status_address_ = entry_offset + 4;
     return false;
   }
+  return ExtractEntryData(entry_offset, data);
+}
+
+bool ArmExidx::ExtractEntryData(uint32_t entry_offset, uint32_t data) {
+  data_.clear();
+  status_ = ARM_STATUS_NONE;
+
+  if (entry_offset & 1) {
+    // The offset needs to be at least two byte aligned.
+    status_ = ARM_STATUS_INVALID_ALIGNMENT;
+    return false;
+  }
+
+  // If bit 31 of the unwind data is zero, then this is a prel31 offset
+  // to the start of the unwind data. If the unwind data is 1, then this
+  // is a cant unwind entry. Otherwise, this data is the compact form of
+  // the unwind information.
   if (data == 1) {
     // This is a CANT UNWIND entry.
     status_ = ARM_STATUS_NO_UNWIND;
@@ -18,9 +18,10 @@
 
 #include <stdint.h>
 
-#include <deque>
 #include <map>
 
+#include "Check.h"
+
 namespace unwindstack {
 
 // Forward declarations.
@@ -50,6 +51,39 @@ enum ArmLogType : uint8_t {
   ARM_LOG_BY_REG,
 };
 
+// The unwind opcodes of a single entry. This is a fixed size queue so that
+// extracting and evaluating an entry never allocates. The largest entry is
+// three bytes from the first word, five more words and an added finish op.
+class ArmExidxData {
+ public:
+  static constexpr size_t kMaxSize = 32;
+
+  void clear() { start_ = end_ = 0; }
+  bool empty() const { return start_ == end_; }
+  size_t size() const { return end_ - start_; }
+
+  void push_back(uint8_t byte) {
+    CHECK(end_ < kMaxSize);
+    data_[end_++] = byte;
+  }
+  void pop_front() { start_++; }
+
+  uint8_t front() const { return data_[start_]; }
+  uint8_t back() const { return data_[end_ - 1]; }
+  uint8_t at(size_t index) const {
+    CHECK(index < size());
+    return data_[start_ + index];
+  }
+
+  const uint8_t* begin() const { return &data_[start_]; }
+  const uint8_t* end() const { return &data_[end_]; }
+
+ private:
+  uint8_t data_[kMaxSize];
+  uint8_t start_ = 0;
+  uint8_t end_ = 0;
+};
+
 class ArmExidx {
  public:
   ArmExidx(RegsArm* regs, Memory* elf_memory, Memory* process_memory)
@@ -62,11 +96,14 @@ class ArmExidx {
 
   bool ExtractEntryData(uint32_t entry_offset);
 
+  // Same as above, but the second word of the entry has already been read.
+  bool ExtractEntryData(uint32_t entry_offset, uint32_t data);
+
   bool Eval();
 
   bool Decode();
 
-  std::deque<uint8_t>* data() { return &data_; }
+  ArmExidxData* data() { return &data_; }
 
   ArmStatus status() { return status_; }
   uint64_t status_address() { return status_address_; }
@@ -105,7 +142,7 @@ class ArmExidx {
 
   RegsArm* regs_ = nullptr;
   uint32_t cfa_ = 0;
-  std::deque<uint8_t> data_;
+  ArmExidxData data_;
   ArmStatus status_ = ARM_STATUS_NONE;
   uint64_t status_address_ = 0;
 
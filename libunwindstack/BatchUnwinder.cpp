@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unwindstack/BatchUnwinder.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/Unwinder.h>
+
+namespace unwindstack {
+
+// The owner takes tasks from the back, and thieves from the front, so the
+// owner keeps working on the samples it just touched.
+class BatchUnwinder::TaskQueue {
+ public:
+  void Push(const Task& task) {
+    std::lock_guard<std::mutex> guard(lock_);
+    tasks_.push_back(task);
+  }
+
+  bool Pop(Task* task) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = tasks_.back();
+    tasks_.pop_back();
+    return true;
+  }
+
+  bool Steal(Task* task) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    *task = tasks_.front();
+    tasks_.pop_front();
+    return true;
+  }
+
+ private:
+  std::mutex lock_;
+  std::deque<Task> tasks_;
+};
+
+BatchUnwinder::BatchUnwinder(size_t num_threads, size_t max_frames)
+    : num_threads_(std::max<size_t>(num_threads, 1)), max_frames_(max_frames) {}
+
+void BatchUnwinder::AddMaps(pid_t pid, uint64_t maps_generation, std::shared_ptr<Maps> maps) {
+  groups_[std::make_pair(pid, maps_generation)].maps = std::move(maps);
+}
+
+void BatchUnwinder::AddSample(BatchUnwindSample&& sample) {
+  Group& group = groups_[std::make_pair(sample.pid, sample.maps_generation)];
+  group.samples.emplace_back(std::move(sample));
+  num_samples_++;
+}
+
+void BatchUnwinder::Unwind(Group* group, BatchUnwindSample* sample, const Callback& callback) {
+  BatchUnwindResult result;
+  result.id = sample->id;
+  result.pid = sample->pid;
+
+  Unwinder unwinder(max_frames_, group->maps.get(), sample->regs.get(), sample->process_memory);
+  unwinder.SetResolveNames(resolve_names_);
+  unwinder.Unwind();
+  result.frames = unwinder.ConsumeFrames();
+  result.error = unwinder.LastError();
+
+  // Release the sample data as soon as it is no longer needed.
+  sample->regs.reset();
+  sample->process_memory.reset();
+  callback(result);
+}
+
+void BatchUnwinder::Run(const Callback& callback) {
+  std::vector<TaskQueue> queues(num_threads_);
+  size_t queue_index = 0;
+  for (auto& [key, group] : groups_) {
+    if (group.samples.empty()) {
+      continue;
+    }
+    if (group.maps == nullptr) {
+      group.maps.reset(new Maps);
+    }
+    // All of the tasks of a group start on the same thread, to keep the
+    // threads from creating the same Elf objects at the same time.
+    TaskQueue& queue = queues[queue_index++ % num_threads_];
+    BatchUnwindSample* samples = group.samples.data();
+    size_t num_samples = group.samples.size();
+    for (size_t i = 0; i < num_samples; i += kSamplesPerTask) {
+      queue.Push(Task{.group = &group,
+                      .begin = &samples[i],
+                      .end = &samples[std::min(i + kSamplesPerTask, num_samples)]});
+    }
+  }
+
+  // No tasks are added once the threads start, so a thread is done when
+  // it finds no task in any queue.
+  std::atomic<size_t> num_stolen_tasks = 0;
+  auto worker = [&](size_t index) {
+    Task task;
+    while (true) {
+      if (!queues[index].Pop(&task)) {
+        bool stolen = false;
+        for (size_t i = 1; i < num_threads_ && !stolen; i++) {
+          stolen = queues[(index + i) % num_threads_].Steal(&task);
+        }
+        if (!stolen) {
+          return;
+        }
+        num_stolen_tasks++;
+      }
+      for (BatchUnwindSample* sample = task.begin; sample != task.end; sample++) {
+        Unwind(task.group, sample, callback);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads_; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  num_stolen_tasks_ = num_stolen_tasks;
+
+  for (auto& [key, group] : groups_) {
+    group.samples.clear();
+  }
+  num_samples_ = 0;
+}
+
+}  // namespace unwindstack
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/Demangle.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Unwinder.h>
+
+namespace unwindstack {
+
+static size_t HashEdge(const void* parent, const MapInfo* map_info, uint64_t pc) {
+  uint64_t hash = reinterpret_cast<uintptr_t>(parent) * 0x9e3779b97f4a7c15ULL;
+  hash ^= reinterpret_cast<uintptr_t>(map_info) + 0x632be59bd9b4e019ULL + (hash << 6);
+  hash ^= pc * 0xc2b2ae3d27d4eb4fULL + (hash >> 2);
+  return hash ^ (hash >> 29);
+}
+
+CallingContextTrie::CallingContextTrie(size_t num_buckets) : num_buckets_(1) {
+  pthread_rwlock_init(&buckets_rwlock_, nullptr);
+  while (num_buckets_ < num_buckets) {
+    num_buckets_ <<= 1;
+  }
+  buckets_.reset(new std::atomic<Node*>[num_buckets_]);
+  for (size_t i = 0; i < num_buckets_; i++) {
+    buckets_[i] = nullptr;
+  }
+}
+
+CallingContextTrie::~CallingContextTrie() {
+  for (size_t i = 0; i < num_buckets_; i++) {
+    Node* node = buckets_[i].load(std::memory_order_relaxed);
+    while (node != nullptr) {
+      Node* next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+  pthread_rwlock_destroy(&buckets_rwlock_);
+}
+
+CallingContextTrie::Node* CallingContextTrie::FindOrAddChild(
+    Node* parent, const std::shared_ptr<MapInfo>& map_info_ptr, uint64_t pc,
+    const FrameData* frame) {
+  MapInfo* map_info = map_info_ptr.get();
+  auto matches = [parent, map_info, pc](const Node* node) {
+    return node->parent == parent && node->map_info == map_info && node->pc == pc;
+  };
+
+  std::atomic<Node*>& bucket = buckets_[HashEdge(parent, map_info, pc) & (num_buckets_ - 1)];
+  Node* head = bucket.load(std::memory_order_acquire);
+  for (Node* node = head; node != nullptr; node = node->next) {
+    if (matches(node)) {
+      return node;
+    }
+  }
+
+  Node* new_node = new Node;
+  new_node->parent = parent;
+  new_node->map_info = map_info;
+  new_node->pc = pc;
+  if (frame != nullptr && !frame->function_name.empty()) {
+    new_node->has_name = true;
+    new_node->function_name = frame->function_name;
+    new_node->function_offset = frame->function_offset;
+  }
+
+  // Nodes are only ever added at the head of a bucket, so when another
+  // thread wins the race, only the nodes it added need to be checked.
+  new_node->next = head;
+  while (!bucket.compare_exchange_weak(new_node->next, new_node, std::memory_order_release,
+                                       std::memory_order_acquire)) {
+    for (Node* node = new_node->next; node != head; node = node->next) {
+      if (matches(node)) {
+        delete new_node;
+        return node;
+      }
+    }
+    head = new_node->next;
+  }
+  num_nodes_.fetch_add(1, std::memory_order_relaxed);
+
+  if (map_info != nullptr) {
+    std::lock_guard<std::mutex> guard(maps_lock_);
+    maps_.emplace(map_info, map_info_ptr);
+  }
+  return new_node;
+}
+
+void CallingContextTrie::AddSample(const std::vector<FrameData>& frames, uint64_t count) {
+  if (frames.empty()) {
+    return;
+  }
+  pthread_rwlock_rdlock(&buckets_rwlock_);
+  Node* node = nullptr;
+  for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+    const FrameData& frame = *it;
+    node = FindOrAddChild(node, frame.map_info,
+                          frame.map_info != nullptr ? frame.rel_pc : frame.pc, &frame);
+  }
+  node->count.fetch_add(count, std::memory_order_relaxed);
+  pthread_rwlock_unlock(&buckets_rwlock_);
+  MaybeRehash();
+}
+
+void CallingContextTrie::AddSample(Maps* maps, const uint64_t* pcs, size_t num_pcs,
+                                   uint64_t count) {
+  if (num_pcs == 0) {
+    return;
+  }
+  pthread_rwlock_rdlock(&buckets_rwlock_);
+  Node* node = nullptr;
+  // Most callers are in the same map as the frame before them.
+  std::shared_ptr<MapInfo> map_info;
+  Elf* elf = nullptr;
+  for (size_t i = num_pcs; i-- > 0;) {
+    uint64_t pc = pcs[i];
+    if (map_info == nullptr || pc < map_info->start() || pc >= map_info->end()) {
+      map_info = maps->Find(pc);
+      elf = map_info != nullptr ? map_info->GetElfObj() : nullptr;
+    }
+    uint64_t rel_pc = pc;
+    if (elf != nullptr) {
+      rel_pc = elf->GetRelPc(pc, map_info.get());
+    } else if (map_info != nullptr) {
+      rel_pc = pc - map_info->start() + map_info->elf_offset();
+    }
+    node = FindOrAddChild(node, map_info, rel_pc, nullptr);
+  }
+  node->count.fetch_add(count, std::memory_order_relaxed);
+  pthread_rwlock_unlock(&buckets_rwlock_);
+  MaybeRehash();
+}
+
+void CallingContextTrie::MaybeRehash() {
+  if (NumNodes() <= num_buckets_) {
+    return;
+  }
+  pthread_rwlock_wrlock(&buckets_rwlock_);
+  size_t num_nodes = NumNodes();
+  if (num_nodes > num_buckets_) {
+    size_t num_buckets = num_buckets_;
+    while (num_buckets < num_nodes) {
+      num_buckets <<= 1;
+    }
+    num_buckets <<= 1;
+    std::unique_ptr<std::atomic<Node*>[]> buckets(new std::atomic<Node*>[num_buckets]);
+    for (size_t i = 0; i < num_buckets; i++) {
+      buckets[i] = nullptr;
+    }
+    for (size_t i = 0; i < num_buckets_; i++) {
+      Node* node = buckets_[i].load(std::memory_order_relaxed);
+      while (node != nullptr) {
+        Node* next = node->next;
+        std::atomic<Node*>& bucket =
+            buckets[HashEdge(node->parent, node->map_info, node->pc) & (num_buckets - 1)];
+        node->next = bucket.load(std::memory_order_relaxed);
+        bucket.store(node, std::memory_order_relaxed);
+        node = next;
+      }
+    }
+    buckets_ = std::move(buckets);
+    num_buckets_ = num_buckets;
+  }
+  pthread_rwlock_unlock(&buckets_rwlock_);
+}
+
+template <typename Callback>
+void CallingContextTrie::ForEachNode(Callback callback) const {
+  pthread_rwlock_rdlock(&buckets_rwlock_);
+  for (size_t i = 0; i < num_buckets_; i++) {
+    for (Node* node = buckets_[i].load(std::memory_order_acquire); node != nullptr;
+         node = node->next) {
+      callback(node);
+    }
+  }
+  pthread_rwlock_unlock(&buckets_rwlock_);
+}
+
+uint64_t CallingContextTrie::NumSamples() const {
+  uint64_t num_samples = 0;
+  ForEachNode([&num_samples](Node* node) {
+    num_samples += node->count.load(std::memory_order_relaxed);
+  });
+  return num_samples;
+}
+
+size_t CallingContextTrie::MemoryUsage() const {
+  pthread_rwlock_rdlock(&buckets_rwlock_);
+  size_t usage = num_buckets_ * sizeof(std::atomic<Node*>) + NumNodes() * sizeof(Node);
+  pthread_rwlock_unlock(&buckets_rwlock_);
+  return usage;
+}
+
+void CallingContextTrie::Symbolize(Node* node) {
+  std::call_once(node->symbolize_once, [node]() {
+    if (!node->has_name && node->map_info != nullptr) {
+      node->has_name =
+          node->map_info->GetFunctionName(node->pc, &node->function_name, &node->function_offset);
+    }
+  });
+}
+
+std::string CallingContextTrie::GetFrameName(Node* node) {
+  Symbolize(node);
+  if (node->has_name && !node->function_name.empty()) {
+    return DemangleNameIfNeeded(node->function_name);
+  }
+  MapInfo* map_info = node->map_info;
+  if (map_info == nullptr) {
+    return android::base::StringPrintf("0x%" PRIx64, node->pc);
+  }
+  if (map_info->name().empty()) {
+    return android::base::StringPrintf("<anonymous:%" PRIx64 ">+0x%" PRIx64, map_info->start(),
+                                       node->pc);
+  }
+  return android::base::StringPrintf("%s+0x%" PRIx64,
+                                     android::base::Basename(map_info->name()).c_str(), node->pc);
+}
+
+std::string CallingContextTrie::DumpFolded() {
+  std::unordered_map<const Node*, std::string> names;
+  std::vector<std::string> lines;
+  ForEachNode([&](Node* leaf) {
+    uint64_t count = leaf->count.load(std::memory_order_relaxed);
+    if (count == 0) {
+      return;
+    }
+    std::vector<Node*> path;
+    for (Node* node = leaf; node != nullptr; node = node->parent) {
+      path.push_back(node);
+    }
+    std::string line;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      auto entry = names.find(*it);
+      if (entry == names.end()) {
+        std::string name = GetFrameName(*it);
+        // Demangled names and map names can have both.
+        std::replace_if(
+            name.begin(), name.end(), [](char c) { return c == ';' || c == ' '; }, '_');
+        entry = names.emplace(*it, std::move(name)).first;
+      }
+      if (!line.empty()) {
+        line += ';';
+      }
+      line += entry->second;
+    }
+    lines.push_back(line + android::base::StringPrintf(" %" PRIu64 "\n", count));
+  });
+  std::sort(lines.begin(), lines.end());
+
+  std::string folded;
+  for (const auto& line : lines) {
+    folded += line;
+  }
+  return folded;
+}
+
+}  // namespace unwindstack
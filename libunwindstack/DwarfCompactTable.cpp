@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+#include <unwindstack/Arch.h>
+#include <unwindstack/DwarfCompactTable.h>
+#include <unwindstack/DwarfLocation.h>
+#include <unwindstack/DwarfSection.h>
+#include <unwindstack/DwarfStructs.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+
+namespace unwindstack {
+
+static bool GetInt16(uint64_t value, int16_t* result) {
+  int64_t signed_value = static_cast<int64_t>(value);
+  if (signed_value < INT16_MIN || signed_value > INT16_MAX) {
+    return false;
+  }
+  *result = static_cast<int16_t>(signed_value);
+  return true;
+}
+
+DwarfCompactTable::DwarfCompactTable(ArchEnum arch) : arch_(arch) {
+  switch (arch) {
+    case ARCH_ARM64:
+      sp_reg_ = ARM64_REG_SP;
+      fp_reg_ = ARM64_REG_R29;
+      ra_reg_ = ARM64_REG_LR;
+      total_regs_ = ARM64_REG_LAST;
+      break;
+    case ARCH_X86_64:
+      sp_reg_ = X86_64_REG_SP;
+      fp_reg_ = X86_64_REG_RBP;
+      ra_reg_ = X86_64_REG_PC;
+      total_regs_ = X86_64_REG_LAST;
+      break;
+    default:
+      break;
+  }
+  // Entries without other saved registers use the first set.
+  saved_regs_.emplace_back();
+  saved_regs_index_[saved_regs_[0]] = 0;
+}
+
+bool DwarfCompactTable::IsArchSupported(ArchEnum arch) {
+  return arch == ARCH_ARM64 || arch == ARCH_X86_64;
+}
+
+bool DwarfCompactTable::ConvertRow(const DwarfCie* cie, const DwarfLocations& loc_regs,
+                                   Entry* entry) {
+  if (!IsArchSupported(arch_) || cie == nullptr || cie->is_signal_frame ||
+      cie->return_address_register != ra_reg_) {
+    return false;
+  }
+
+  auto cfa_entry = loc_regs.find(CFA_REG);
+  if (cfa_entry == loc_regs.end() || cfa_entry->second.type != DWARF_LOCATION_REGISTER) {
+    return false;
+  }
+  const DwarfLocation& cfa = cfa_entry->second;
+  if (cfa.values[0] == sp_reg_) {
+    entry->cfa_reg = CFA_SP;
+  } else if (cfa.values[0] == fp_reg_) {
+    entry->cfa_reg = CFA_FP;
+  } else {
+    return false;
+  }
+  if (!GetInt16(cfa.values[1], &entry->cfa_offset)) {
+    return false;
+  }
+
+  entry->flags = 0;
+  // The locations are not in register order, the offsets are packed into
+  // a set after all of them are known.
+  uint64_t saved_mask = 0;
+  int16_t reg_offsets[64];
+  for (const auto& [reg, loc] : loc_regs) {
+    if (reg == CFA_REG) {
+      continue;
+    }
+    if (reg == ra_reg_) {
+      if (loc.type == DWARF_LOCATION_OFFSET) {
+        if (!GetInt16(loc.values[0], &entry->ra_offset)) {
+          return false;
+        }
+        entry->flags |= RA_SAVED;
+      } else if (loc.type == DWARF_LOCATION_UNDEFINED) {
+        entry->flags |= RA_UNDEFINED;
+      } else {
+        return false;
+      }
+    } else if (reg == fp_reg_) {
+      if (loc.type == DWARF_LOCATION_OFFSET) {
+        if (!GetInt16(loc.values[0], &entry->fp_offset)) {
+          return false;
+        }
+        entry->flags |= FP_SAVED;
+      } else if (loc.type != DWARF_LOCATION_UNDEFINED) {
+        return false;
+      }
+    } else if (reg == sp_reg_) {
+      // The sp is always set to the cfa.
+      if (loc.type != DWARF_LOCATION_UNDEFINED) {
+        return false;
+      }
+    } else if (reg >= total_regs_) {
+      // The full evaluation skips these, other than pseudo registers.
+      if (loc.type == DWARF_LOCATION_PSEUDO_REGISTER) {
+        return false;
+      }
+    } else {
+      switch (loc.type) {
+        case DWARF_LOCATION_OFFSET:
+          if (!GetInt16(loc.values[0], &reg_offsets[reg])) {
+            return false;
+          }
+          saved_mask |= 1ULL << reg;
+          break;
+        case DWARF_LOCATION_UNDEFINED:
+        case DWARF_LOCATION_INVALID:
+          // The register keeps its value.
+          break;
+        default:
+          // Anything computed from the cfa or other registers, or that can
+          // fail or change state when evaluated, is left to the full
+          // evaluation.
+          return false;
+      }
+    }
+  }
+
+  if (static_cast<size_t>(__builtin_popcountll(saved_mask)) > kMaxSavedRegs) {
+    return false;
+  }
+  SavedRegs saved;
+  saved.mask = saved_mask;
+  size_t num_saved = 0;
+  for (uint64_t mask = saved_mask; mask != 0; mask &= mask - 1, num_saved++) {
+    saved.offsets[num_saved] = reg_offsets[__builtin_ctzll(mask)];
+  }
+
+  auto it = saved_regs_index_.find(saved);
+  if (it == saved_regs_index_.end()) {
+    if (saved_regs_.size() >= kMaxSavedRegSets) {
+      return false;
+    }
+    it = saved_regs_index_.emplace(saved, saved_regs_.size()).first;
+    saved_regs_.push_back(saved);
+  }
+  entry->saved_regs = it->second;
+  return true;
+}
+
+bool DwarfCompactTable::AddFde(DwarfSection* section, const DwarfFde* fde) {
+  stats_.fdes++;
+  if (fde->cie == nullptr || fde->pc_end <= fde->pc_start) {
+    return fde->cie != nullptr;
+  }
+  stats_.bytes += fde->pc_end - fde->pc_start;
+
+  uint64_t pc = fde->pc_start;
+  while (pc < fde->pc_end) {
+    DwarfLocations loc_regs;
+    if (!section->GetCfaLocationInfo(pc, fde, &loc_regs, arch_)) {
+      return false;
+    }
+    uint64_t pc_end = std::min(loc_regs.pc_end, fde->pc_end);
+    if (pc_end <= pc) {
+      return false;
+    }
+    stats_.rows++;
+    Entry entry;
+    if (ConvertRow(fde->cie, loc_regs, &entry)) {
+      stats_.compact_rows++;
+      stats_.compact_bytes += pc_end - pc;
+      AddRow(pc, pc_end, entry);
+    }
+    pc = pc_end;
+  }
+  return true;
+}
+
+void DwarfCompactTable::AddRow(uint64_t pc_start, uint64_t pc_end, const Entry& entry) {
+  if (pc_start >= pc_end || entry.cfa_reg == CFA_NONE) {
+    return;
+  }
+  pending_.emplace_back(pc_start, pc_end, entry);
+}
+
+void DwarfCompactTable::Finalize() {
+  if (pending_.empty()) {
+    return;
+  }
+
+  // Rebuild the table from the existing rows followed by the new ones. The
+  // sort is stable so that rows already in the table win any overlap.
+  std::vector<std::tuple<uint64_t, uint64_t, Entry>> rows;
+  for (size_t i = 0; i + 1 < pcs_.size(); i++) {
+    if (entries_[i].cfa_reg != CFA_NONE) {
+      rows.emplace_back(base_pc_ + pcs_[i], base_pc_ + pcs_[i + 1], entries_[i]);
+    }
+  }
+  rows.insert(rows.end(), pending_.begin(), pending_.end());
+  pending_.clear();
+  pending_.shrink_to_fit();
+  std::stable_sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+    return std::get<0>(a) < std::get<0>(b);
+  });
+
+  pcs_.clear();
+  entries_.clear();
+  base_pc_ = std::get<0>(rows[0]);
+  auto append = [this](uint64_t pc, const Entry& entry) {
+    if (!entries_.empty() && entries_.back() == entry) {
+      return;
+    }
+    pcs_.push_back(static_cast<uint32_t>(pc - base_pc_));
+    entries_.push_back(entry);
+  };
+  uint64_t last_end = base_pc_;
+  for (auto [pc_start, pc_end, entry] : rows) {
+    pc_start = std::max(pc_start, last_end);
+    if (pc_start >= pc_end) {
+      continue;
+    }
+    if (pc_end - base_pc_ > UINT32_MAX) {
+      // Only 32 bit offsets are supported, leave the rest to dwarf.
+      break;
+    }
+    if (pc_start > last_end) {
+      append(last_end, Entry());
+    }
+    append(pc_start, entry);
+    last_end = pc_end;
+  }
+  append(last_end, Entry());
+  pcs_.shrink_to_fit();
+  entries_.shrink_to_fit();
+}
+
+const DwarfCompactTable::Entry* DwarfCompactTable::Find(uint64_t pc) const {
+  if (pcs_.empty() || pc < base_pc_ || pc - base_pc_ > UINT32_MAX) {
+    return nullptr;
+  }
+  uint32_t offset = static_cast<uint32_t>(pc - base_pc_);
+  // The first row is always at offset zero, so the row containing offset
+  // is always in [base, base + num). This form compiles to conditional
+  // moves rather than unpredictable branches.
+  const uint32_t* base = pcs_.data();
+  size_t num = pcs_.size();
+  while (num > 1) {
+    size_t half = num / 2;
+    base = (base[half] <= offset) ? base + half : base;
+    num -= half;
+  }
+  const Entry* entry = &entries_[base - pcs_.data()];
+  return entry->cfa_reg == CFA_NONE ? nullptr : entry;
+}
+
+bool DwarfCompactTable::Step(uint64_t pc, Regs* regs, Memory* process_memory,
+                             bool* finished) const {
+  const Entry* entry = Find(pc);
+  if (entry == nullptr || regs->Arch() != arch_) {
+    return false;
+  }
+
+  // Both supported architectures are 64 bit.
+  RegsImpl<uint64_t>* cur_regs = reinterpret_cast<RegsImpl<uint64_t>*>(regs);
+  uint64_t cfa = (*cur_regs)[entry->cfa_reg == CFA_SP ? sp_reg_ : fp_reg_] + entry->cfa_offset;
+
+  uint64_t return_address = 0;
+  if (entry->flags & RA_SAVED) {
+    if (!process_memory->Read64(cfa + entry->ra_offset, &return_address)) {
+      return false;
+    }
+  } else if (!(entry->flags & RA_UNDEFINED)) {
+    return_address = (*cur_regs)[ra_reg_];
+  }
+  const SavedRegs& saved = saved_regs_[entry->saved_regs];
+  uint64_t values[kMaxSavedRegs];
+  size_t num_saved = 0;
+  for (uint64_t mask = saved.mask; mask != 0; mask &= mask - 1, num_saved++) {
+    if (!process_memory->Read64(cfa + saved.offsets[num_saved], &values[num_saved])) {
+      return false;
+    }
+  }
+  uint64_t fp;
+  if (entry->flags & FP_SAVED) {
+    if (!process_memory->Read64(cfa + entry->fp_offset, &fp)) {
+      return false;
+    }
+    (*cur_regs)[fp_reg_] = fp;
+  }
+  num_saved = 0;
+  for (uint64_t mask = saved.mask; mask != 0; mask &= mask - 1, num_saved++) {
+    (*cur_regs)[__builtin_ctzll(mask)] = values[num_saved];
+  }
+
+  cur_regs->set_dex_pc(0);
+  regs->ResetPseudoRegisters();
+  if (entry->flags & RA_SAVED) {
+    (*cur_regs)[ra_reg_] = return_address;
+  }
+  cur_regs->set_pc(return_address);
+  *finished = cur_regs->pc() == 0;
+  cur_regs->set_sp(cfa);
+  return true;
+}
+
+}  // namespace unwindstack
@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 
+#include <memory>
 #include <vector>
 
 #include <unwindstack/DwarfSection.h>
@@ -42,6 +43,11 @@ class DwarfDebugFrame : public DwarfSectionImpl<AddressType> {
   }
 
   uint64_t AdjustPcFromFde(uint64_t pc) override { return pc; }
+
+ protected:
+  std::unique_ptr<DwarfSectionImpl<AddressType>> CreateIndexWorker(Memory* memory) override {
+    return std::make_unique<DwarfDebugFrame<AddressType>>(memory);
+  }
 };
 
 }  // namespace unwindstack
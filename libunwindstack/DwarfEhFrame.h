@@ -18,6 +18,8 @@
 
 #include <stdint.h>
 
+#include <memory>
+
 #include <unwindstack/DwarfSection.h>
 #include <unwindstack/Memory.h>
 
@@ -41,6 +43,11 @@ class DwarfEhFrame : public DwarfSectionImpl<AddressType> {
     // The eh_frame uses relative pcs.
     return pc + this->memory_.cur_offset() - 4;
   }
+
+ protected:
+  std::unique_ptr<DwarfSectionImpl<AddressType>> CreateIndexWorker(Memory* memory) override {
+    return std::make_unique<DwarfEhFrame<AddressType>>(memory);
+  }
 };
 
 }  // namespace unwindstack
@@ -193,6 +193,32 @@ bool DwarfEhFrameWithHdr<AddressType>::GetFdeOffsetFromPc(uint64_t pc, uint64_t*
   return false;
 }
 
+template <typename AddressType>
+bool DwarfEhFrameWithHdr<AddressType>::GetPcRanges(
+    std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  // The table only has the start of each fde, so use one range from the
+  // first start to the end of the last fde. Only the last fde is read, and
+  // a failure to read is not an error for the section.
+  if (fde_count_ == 0) {
+    return false;
+  }
+  DwarfErrorData last_error = last_error_;
+  const FdeInfo* first = GetFdeInfoFromIndex(0);
+  uint64_t pc_start = first != nullptr ? first->pc : 0;
+  const FdeInfo* last = GetFdeInfoFromIndex(fde_count_ - 1);
+  const DwarfFde* fde =
+      first != nullptr && last != nullptr ? this->GetFdeFromOffset(last->offset) : nullptr;
+  last_error_ = last_error;
+  // A zero length fde makes GetFdeFromPc search the eh_frame directly,
+  // which can find fdes beyond the table.
+  if (fde == nullptr || fde->pc_start == fde->pc_end || fde->pc_end <= pc_start) {
+    return false;
+  }
+  ranges->clear();
+  ranges->emplace_back(pc_start, fde->pc_end);
+  return true;
+}
+
 template <typename AddressType>
 void DwarfEhFrameWithHdr<AddressType>::GetFdes(std::vector<const DwarfFde*>* fdes) {
   for (size_t i = 0; i < fde_count_; i++) {
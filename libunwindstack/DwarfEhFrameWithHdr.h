@@ -19,6 +19,8 @@
 #include <stdint.h>
 
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/DwarfSection.h>
 
@@ -67,6 +69,12 @@ class DwarfEhFrameWithHdr : public DwarfSectionImpl<AddressType> {
 
   void GetFdes(std::vector<const DwarfFde*>* fdes) override;
 
+  // The eh_frame_hdr table is the index, the full index is only built
+  // when the table is missing entries.
+  bool GetFdeIndex(const DwarfSection::FdeIndexEntry**, size_t*) override { return false; }
+
+  bool GetPcRanges(std::vector<std::pair<uint64_t, uint64_t>>* ranges) override;
+
  protected:
   uint8_t version_ = 0;
   uint8_t table_encoding_ = 0;
@@ -16,8 +16,15 @@
 
 #include <stdint.h>
 
+#include <string.h>
+
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <tuple>
 #include <utility>
 #include <vector>
@@ -37,14 +44,92 @@
 #include "DwarfEhFrame.h"
 #include "DwarfEncoding.h"
 #include "DwarfOp.h"
+#include "MemoryOfflineBuffer.h"
 #include "RegsInfo.h"
 
 namespace unwindstack {
 
+std::atomic<size_t> DwarfSection::index_threads_ = 1;
+std::atomic_bool DwarfSection::compact_tables_ = false;
+
+// The threads that build the fde indexes of all sections. Threads are only
+// created when a build asks for more than there are, up to the number of
+// cpus, and are kept for the life of the process.
+class IndexThreadPool {
+ public:
+  static IndexThreadPool* Get() {
+    static IndexThreadPool* pool = new IndexThreadPool;
+    return pool;
+  }
+
+  // Runs the functions on up to num_threads threads, including the calling
+  // thread, and returns once they are all done.
+  void Run(const std::vector<std::function<void()>>& functions, size_t num_threads) {
+    std::unique_lock<std::mutex> lock(lock_);
+    size_t pending = functions.size();
+    for (const auto& function : functions) {
+      queue_.push_back({function, &pending});
+    }
+    size_t max_threads = std::max(1U, std::thread::hardware_concurrency());
+    while (num_threads_ + 1 < std::min(num_threads, max_threads)) {
+      std::thread(&IndexThreadPool::Worker, this).detach();
+      num_threads_++;
+    }
+    work_cv_.notify_all();
+
+    // Run queued functions until these are done, so they finish even if
+    // the pool threads are busy with another build.
+    while (pending != 0) {
+      if (queue_.empty()) {
+        done_cv_.wait(lock);
+      } else {
+        RunQueued(lock);
+      }
+    }
+  }
+
+ private:
+  struct Task {
+    std::function<void()> function;
+    size_t* pending;
+  };
+
+  void Worker() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+      work_cv_.wait(lock, [this] { return !queue_.empty(); });
+      RunQueued(lock);
+    }
+  }
+
+  void RunQueued(std::unique_lock<std::mutex>& lock) {
+    Task task = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    task.function();
+    lock.lock();
+    if (--*task.pending == 0) {
+      done_cv_.notify_all();
+    }
+  }
+
+  std::mutex lock_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Task> queue_;
+  size_t num_threads_ = 0;
+};
+
 DwarfSection::DwarfSection(Memory* memory) : memory_(memory) {}
 
 bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
                         bool* is_signal_frame) {
+  if (compact_table_ != nullptr && compact_table_->Step(pc, regs, process_memory, finished)) {
+    last_error_.code = DWARF_ERROR_NONE;
+    *is_signal_frame = false;
+    return true;
+  }
+
   // Lookup the pc in the cache.
   auto it = loc_regs_.upper_bound(pc);
   if (it == loc_regs_.end() || pc < it->second.pc_start) {
@@ -55,6 +140,16 @@ bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* f
       return false;
     }
 
+    if (compact_tables_ && DwarfCompactTable::IsArchSupported(regs->Arch()) &&
+        compact_fdes_.insert(fde).second) {
+      // Rows that cannot be compiled fall through to the full evaluation.
+      AddFdeToCompactTable(fde, regs->Arch());
+      if (compact_table_->Step(pc, regs, process_memory, finished)) {
+        *is_signal_frame = false;
+        return true;
+      }
+    }
+
     // Now get the location information for this pc.
     DwarfLocations loc_regs;
     if (!GetCfaLocationInfo(pc, fde, &loc_regs, regs->Arch())) {
@@ -72,6 +167,42 @@ bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* f
   return Eval(it->second.cie, process_memory, it->second, regs, finished);
 }
 
+bool DwarfSection::BuildCompactTable(ArchEnum arch) {
+  if (!DwarfCompactTable::IsArchSupported(arch)) {
+    return false;
+  }
+  std::vector<const DwarfFde*> fdes;
+  GetFdes(&fdes);
+  for (const DwarfFde* fde : fdes) {
+    AddFdeRowsToCompactTable(fde, arch);
+  }
+  if (compact_table_ != nullptr) {
+    compact_table_->Finalize();
+  }
+  return true;
+}
+
+bool DwarfSection::AddFdeToCompactTable(const DwarfFde* fde, ArchEnum arch) {
+  if (!DwarfCompactTable::IsArchSupported(arch)) {
+    return false;
+  }
+  bool added = AddFdeRowsToCompactTable(fde, arch);
+  compact_table_->Finalize();
+  return added;
+}
+
+bool DwarfSection::AddFdeRowsToCompactTable(const DwarfFde* fde, ArchEnum arch) {
+  if (compact_table_ == nullptr) {
+    compact_table_.reset(new DwarfCompactTable(arch));
+  }
+  // Failing to compile an fde only means it is left to the full
+  // evaluation, it is not an error for the section.
+  DwarfErrorData last_error = last_error_;
+  bool added = compact_table_->AddFde(this, fde);
+  last_error_ = last_error;
+  return added;
+}
+
 template <typename AddressType>
 const DwarfCie* DwarfSectionImpl<AddressType>::GetCieFromOffset(uint64_t offset) {
   auto cie_entry = cie_entries_.find(offset);
@@ -423,6 +554,11 @@ bool DwarfSectionImpl<AddressType>::EvalExpression(const DwarfLocation& loc, Mem
   return true;
 }
 
+// Registers saved at an offset from the cfa are loaded with a single
+// ReadMany call, so a remote unwind needs one read per row instead of one
+// per register. Flush the batch when it fills up.
+static constexpr size_t kMaxBatchedRegisterReads = 32;
+
 template <typename AddressType>
 struct EvalInfo {
   const DwarfLocations* loc_regs;
@@ -431,8 +567,27 @@ struct EvalInfo {
   AddressType cfa;
   bool return_address_undefined = false;
   RegsInfo<AddressType> regs_info;
+  Memory::ReadRequest reads[kMaxBatchedRegisterReads];
+  size_t num_reads = 0;
 };
 
+template <typename AddressType>
+static bool ReadBatchedRegisters(EvalInfo<AddressType>* eval_info, DwarfErrorData* last_error) {
+  size_t num_reads = eval_info->num_reads;
+  eval_info->num_reads = 0;
+  if (num_reads == 0 || eval_info->regular_memory->ReadMany(eval_info->reads, num_reads)) {
+    return true;
+  }
+  for (size_t i = 0; i < num_reads; i++) {
+    if (!eval_info->reads[i].success) {
+      last_error->code = DWARF_ERROR_MEMORY_INVALID;
+      last_error->address = eval_info->reads[i].addr;
+      break;
+    }
+  }
+  return false;
+}
+
 template <typename AddressType>
 bool DwarfSectionImpl<AddressType>::EvalRegister(const DwarfLocation* loc, uint32_t reg,
                                                  AddressType* reg_ptr, void* info) {
@@ -440,11 +595,18 @@ bool DwarfSectionImpl<AddressType>::EvalRegister(const DwarfLocation* loc, uint3
   Memory* regular_memory = eval_info->regular_memory;
   switch (loc->type) {
     case DWARF_LOCATION_OFFSET:
-      if (!regular_memory->ReadFully(eval_info->cfa + loc->values[0], reg_ptr, sizeof(AddressType))) {
-        last_error_.code = DWARF_ERROR_MEMORY_INVALID;
-        last_error_.address = eval_info->cfa + loc->values[0];
+      // The read is deferred, the original value of the register is still
+      // available to any other rule through regs_info.
+      if (eval_info->num_reads == kMaxBatchedRegisterReads &&
+          !ReadBatchedRegisters(eval_info, &last_error_)) {
         return false;
       }
+      eval_info->reads[eval_info->num_reads++] = {
+          .addr = eval_info->cfa + loc->values[0],
+          .dst = reg_ptr,
+          .size = sizeof(AddressType),
+          .success = false,
+      };
       break;
     case DWARF_LOCATION_VAL_OFFSET:
       *reg_ptr = eval_info->cfa + loc->values[0];
@@ -521,7 +683,11 @@ bool DwarfSectionImpl<AddressType>::Eval(const DwarfCie* cie, Memory* regular_me
   EvalInfo<AddressType> eval_info{.loc_regs = &loc_regs,
                                   .cie = cie,
                                   .regular_memory = regular_memory,
-                                  .regs_info = RegsInfo<AddressType>(cur_regs)};
+                                  .cfa = 0,
+                                  .return_address_undefined = false,
+                                  .regs_info = RegsInfo<AddressType>(cur_regs),
+                                  .reads = {},
+                                  .num_reads = 0};
   const DwarfLocation* loc = &cfa_entry->second;
   // Only a few location types are valid for the cfa.
   switch (loc->type) {
@@ -560,15 +726,21 @@ bool DwarfSectionImpl<AddressType>::Eval(const DwarfCie* cie, Memory* regular_me
       }
       if (!eval_info.regs_info.regs->SetPseudoRegister(reg, entry.second.values[0])) {
         last_error_.code = DWARF_ERROR_ILLEGAL_VALUE;
+        // A failed read of an earlier register takes precedence.
+        ReadBatchedRegisters(&eval_info, &last_error_);
         return false;
       }
     } else {
       reg_ptr = eval_info.regs_info.Save(reg);
       if (!EvalRegister(&entry.second, reg, reg_ptr, &eval_info)) {
+        ReadBatchedRegisters(&eval_info, &last_error_);
         return false;
       }
     }
   }
+  if (!ReadBatchedRegisters(&eval_info, &last_error_)) {
+    return false;
+  }
 
   // Find the return address location.
   if (eval_info.return_address_undefined) {
@@ -729,56 +901,212 @@ bool DwarfSectionImpl<AddressType>::GetNextCieOrFde(uint64_t& next_entries_offse
 
 template <typename AddressType>
 void DwarfSectionImpl<AddressType>::GetFdes(std::vector<const DwarfFde*>* fdes) {
-  if (fde_index_.empty()) {
+  if (fde_index_size_ == 0) {
     BuildFdeIndex();
   }
-  for (auto& it : fde_index_) {
-    fdes->push_back(GetFdeFromOffset(it.second));
+  for (size_t i = 0; i < fde_index_size_; i++) {
+    fdes->push_back(GetFdeFromOffset(fde_index_[i].fde_offset));
   }
 }
 
+template <typename AddressType>
+bool DwarfSectionImpl<AddressType>::GetFdeIndex(const FdeIndexEntry** index, size_t* size) {
+  if (fde_index_size_ == 0) {
+    BuildFdeIndex();
+  }
+  *index = fde_index_;
+  *size = fde_index_size_;
+  return true;
+}
+
+template <typename AddressType>
+void DwarfSectionImpl<AddressType>::SetFdeIndex(const FdeIndexEntry* index, size_t size) {
+  fde_index_storage_.clear();
+  fde_index_storage_.shrink_to_fit();
+  fde_index_ = index;
+  fde_index_size_ = size;
+}
+
 template <typename AddressType>
 const DwarfFde* DwarfSectionImpl<AddressType>::GetFdeFromPc(uint64_t pc) {
   // Ensure that the binary search table is initialized.
-  if (fde_index_.empty()) {
+  if (fde_index_size_ == 0) {
     BuildFdeIndex();
   }
 
   // Find the FDE offset in the binary search table.
-  auto comp = [](uint64_t pc, auto& entry) { return pc < entry.first; };
-  auto it = std::upper_bound(fde_index_.begin(), fde_index_.end(), pc, comp);
-  if (it == fde_index_.end()) {
+  auto comp = [](uint64_t pc, const FdeIndexEntry& entry) { return pc < entry.pc_end; };
+  const FdeIndexEntry* end = fde_index_ + fde_index_size_;
+  const FdeIndexEntry* it = std::upper_bound(fde_index_, end, pc, comp);
+  if (it == end) {
     return nullptr;
   }
 
   // Load the full FDE entry based on the offset.
-  const DwarfFde* fde = GetFdeFromOffset(/*fde_offset=*/it->second);
+  const DwarfFde* fde = GetFdeFromOffset(it->fde_offset);
   return fde != nullptr && fde->pc_start <= pc ? fde : nullptr;
 }
 
+template <typename AddressType>
+bool DwarfSectionImpl<AddressType>::GetPcRanges(
+    std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  // The index only has the end of each fde, so use one range from the
+  // start of the fde of the first entry, which has the lowest start of all
+  // of the fdes, to the end of the last entry. Only that fde is read, and
+  // a failure to read is not an error for the section.
+  if (fde_index_size_ == 0) {
+    BuildFdeIndex();
+  }
+  ranges->clear();
+  if (fde_index_size_ == 0) {
+    return true;
+  }
+  DwarfErrorData last_error = last_error_;
+  const DwarfFde* fde = GetFdeFromOffset(fde_index_[0].fde_offset);
+  last_error_ = last_error;
+  if (fde == nullptr) {
+    return false;
+  }
+  ranges->emplace_back(fde->pc_start, fde_index_[fde_index_size_ - 1].pc_end);
+  return true;
+}
+
+template <typename AddressType>
+typename DwarfSectionImpl<AddressType>::ScanResult DwarfSectionImpl<AddressType>::ScanFdes(
+    uint64_t* offset, uint64_t end, std::vector<FdeInfo>* fdes) {
+  while (*offset < end) {
+    uint64_t next_offset = *offset;
+    std::optional<DwarfFde> fde;
+    if (!GetNextCieOrFde(next_offset, fde)) {
+      return SCAN_FAILED;
+    }
+    if (fde.has_value() && /* defensive check */ (fde->pc_start < fde->pc_end)) {
+      fdes->push_back({fde->pc_start, fde->pc_end, *offset});
+    }
+    if (next_offset <= *offset) {
+      return SCAN_STOPPED;  // Jump back. Simply consider the processing done in this case.
+    }
+    *offset = next_offset;
+  }
+  return SCAN_DONE;
+}
+
+template <typename AddressType>
+bool DwarfSectionImpl<AddressType>::ScanFdesInParallel(size_t num_threads,
+                                                       std::vector<FdeInfo>* fdes) {
+  uint64_t size = entries_end_ - entries_offset_;
+  size_t num_chunks = std::min<uint64_t>(num_threads, size / kMinIndexChunkSize);
+  if (num_chunks < 2) {
+    return false;
+  }
+
+  // The workers need memory that can be read from any thread, so use the
+  // section data directly if it is mapped, otherwise read a copy of it.
+  Memory* memory = memory_.memory();
+  const uint8_t* data = memory->GetPtr(entries_offset_);
+  std::vector<uint8_t> copy;
+  if (data == nullptr || memory->GetPtr(entries_end_ - 1) != data + size - 1) {
+    copy.resize(size);
+    if (!memory->ReadFully(entries_offset_, copy.data(), size)) {
+      return false;
+    }
+    data = copy.data();
+  }
+
+  // Find the chunk boundaries using only the length of each entry.
+  uint64_t chunk_size = size / num_chunks;
+  std::vector<uint64_t> chunk_starts{entries_offset_};
+  for (uint64_t offset = entries_offset_; chunk_starts.size() < num_chunks;) {
+    uint64_t data_offset = offset - entries_offset_;
+    if (data_offset + sizeof(uint32_t) > size) {
+      break;
+    }
+    uint32_t length32;
+    memcpy(&length32, &data[data_offset], sizeof(length32));
+    uint64_t next_offset = offset + sizeof(uint32_t) + length32;
+    if (length32 == static_cast<uint32_t>(-1)) {
+      if (data_offset + sizeof(uint32_t) + sizeof(uint64_t) > size) {
+        break;
+      }
+      uint64_t length64;
+      memcpy(&length64, &data[data_offset + sizeof(uint32_t)], sizeof(length64));
+      next_offset = offset + sizeof(uint32_t) + sizeof(uint64_t) + length64;
+    }
+    if (next_offset <= offset || next_offset >= entries_end_) {
+      break;
+    }
+    offset = next_offset;
+    if (offset >= entries_offset_ + chunk_starts.size() * chunk_size) {
+      chunk_starts.push_back(offset);
+    }
+  }
+  if (chunk_starts.size() < 2) {
+    return false;
+  }
+
+  struct Chunk {
+    std::unique_ptr<DwarfSectionImpl<AddressType>> section;
+    uint64_t start;
+    uint64_t offset;
+    uint64_t end;
+    ScanResult result;
+    std::vector<FdeInfo> fdes;
+  };
+  MemoryOfflineBuffer buffer(data, entries_offset_, entries_end_);
+  std::vector<Chunk> chunks(chunk_starts.size());
+  for (size_t i = 0; i < chunks.size(); i++) {
+    Chunk& chunk = chunks[i];
+    chunk.section = CreateIndexWorker(&buffer);
+    if (chunk.section == nullptr) {
+      return false;
+    }
+    chunk.section->Init(entries_offset_, size, section_bias_);
+    chunk.start = chunk.offset = chunk_starts[i];
+    chunk.end = i + 1 < chunks.size() ? chunk_starts[i + 1] : entries_end_;
+  }
+
+  std::vector<std::function<void()>> scans;
+  for (Chunk& chunk : chunks) {
+    scans.emplace_back([&chunk]() {
+      chunk.result = chunk.section->ScanFdes(&chunk.offset, chunk.end, &chunk.fdes);
+    });
+  }
+  IndexThreadPool::Get()->Run(scans, num_threads);
+
+  // Merge the chunks in order. A chunk that did not end exactly where the
+  // next one starts, or an entry that could not be read from the section
+  // data alone, ends the merge and the rest is scanned serially so that
+  // the result is always the same as a serial scan.
+  uint64_t offset = entries_offset_;
+  for (Chunk& chunk : chunks) {
+    if (chunk.start != offset) {
+      break;
+    }
+    fdes->insert(fdes->end(), chunk.fdes.begin(), chunk.fdes.end());
+    offset = chunk.offset;
+    if (chunk.result == SCAN_STOPPED) {
+      return true;
+    }
+    if (chunk.result == SCAN_FAILED) {
+      break;
+    }
+  }
+  ScanFdes(&offset, entries_end_, fdes);
+  return true;
+}
+
 // Create binary search table to make FDE lookups fast (sorted by pc_end).
-// We store only the FDE offset rather than the full entry to save memory.
+// We store only the FDE range and offset rather than the full entry to save memory.
 //
 // If there are overlapping entries, it inserts additional entries to ensure
 // that one of the overlapping entries is found (it is undefined which one).
 template <typename AddressType>
 void DwarfSectionImpl<AddressType>::BuildFdeIndex() {
-  struct FdeInfo {
-    uint64_t pc_start, pc_end, fde_offset;
-  };
   std::vector<FdeInfo> fdes;
-  for (uint64_t offset = entries_offset_; offset < entries_end_;) {
-    const uint64_t initial_offset = offset;
-    std::optional<DwarfFde> fde;
-    if (!GetNextCieOrFde(offset, fde)) {
-      break;
-    }
-    if (fde.has_value() && /* defensive check */ (fde->pc_start < fde->pc_end)) {
-      fdes.push_back({fde->pc_start, fde->pc_end, initial_offset});
-    }
-    if (offset <= initial_offset) {
-      break;  // Jump back. Simply consider the processing done in this case.
-    }
+  size_t num_threads = index_threads_;
+  if (num_threads <= 1 || !ScanFdesInParallel(num_threads, &fdes)) {
+    uint64_t offset = entries_offset_;
+    ScanFdes(&offset, entries_end_, &fdes);
   }
   std::sort(fdes.begin(), fdes.end(), [](const FdeInfo& a, const FdeInfo& b) {
     return std::tie(a.pc_end, a.fde_offset) < std::tie(b.pc_end, b.fde_offset);
@@ -803,13 +1131,18 @@ void DwarfSectionImpl<AddressType>::BuildFdeIndex() {
   }
 
   // Copy data to the final binary search table (pc_end, fde_offset) and sort it.
-  fde_index_.reserve(fdes.size());
+  fde_index_storage_.reserve(fdes.size());
   for (const FdeInfo& it : fdes) {
-    fde_index_.emplace_back(it.pc_end, it.fde_offset);
+    fde_index_storage_.push_back({.pc_end = it.pc_end, .fde_offset = it.fde_offset});
   }
-  if (!std::is_sorted(fde_index_.begin(), fde_index_.end())) {
-    std::sort(fde_index_.begin(), fde_index_.end());
+  auto comp = [](const FdeIndexEntry& a, const FdeIndexEntry& b) {
+    return std::tie(a.pc_end, a.fde_offset) < std::tie(b.pc_end, b.fde_offset);
+  };
+  if (!std::is_sorted(fde_index_storage_.begin(), fde_index_storage_.end(), comp)) {
+    std::sort(fde_index_storage_.begin(), fde_index_storage_.end(), comp);
   }
+  fde_index_ = fde_index_storage_.data();
+  fde_index_size_ = fde_index_storage_.size();
 }
 
 // Explicitly instantiate DwarfSectionImpl
@@ -23,6 +23,7 @@
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <android-base/stringprintf.h>
 
@@ -36,6 +37,7 @@
 
 #include <android-base/stringprintf.h>
 
+#include "ElfCacheFile.h"
 #include "ElfInterfaceArm.h"
 #include "Symbols.h"
 
@@ -44,6 +46,8 @@ namespace unwindstack {
 bool Elf::cache_enabled_;
 std::unordered_map<std::string, std::unordered_map<uint64_t, std::shared_ptr<Elf>>>* Elf::cache_;
 std::mutex* Elf::cache_lock_;
+std::atomic<Memory::PrefetchMode> Elf::section_prefetch_ = Memory::PREFETCH_NONE;
+std::string* Elf::cache_directory_;
 
 bool Elf::Init() {
   load_bias_ = 0;
@@ -58,8 +62,34 @@ bool Elf::Init() {
 
   valid_ = interface_->Init(&load_bias_);
   if (valid_) {
+    if (section_prefetch_ == Memory::PREFETCH_NONE && CacheDirectory().empty()) {
+      // Only the elf header and the program headers have been read, which
+      // is enough for the load bias and usually the build id. The section
+      // headers, the unwind sections and the .gnu_debugdata are set up
+      // the first time they are needed.
+      gnu_debugdata_initialized_ = false;
+      interface_->SetGnuDebugdataLoader([this]() { InitGnuDebugdata(); });
+      return true;
+    }
+
+    // Prefetching and the cache file need all of the sections up front.
+    gnu_debugdata_initialized_ = true;
+    // Start the prefetch before the headers of the sections are read.
+    interface_->Prefetch(section_prefetch_);
     interface_->InitHeaders();
-    InitGnuDebugdata();
+    // The fingerprint is taken before .gnu_debugdata is initialized, which
+    // clears the section if it cannot be decompressed.
+    std::string build_id;
+    uint64_t fingerprint;
+    std::string cache_path = GetCacheFilePath(&build_id, &fingerprint);
+    if (cache_path.empty() || !LoadCacheFile(cache_path, build_id, fingerprint)) {
+      InitGnuDebugdata();
+      // Switch to the new file right away, this drops the tables that
+      // were just built and the decompressed .gnu_debugdata.
+      if (!cache_path.empty() && WriteCacheFile(cache_path, build_id, fingerprint)) {
+        LoadCacheFile(cache_path, build_id, fingerprint);
+      }
+    }
   } else {
     interface_.reset(nullptr);
   }
@@ -69,11 +99,18 @@ bool Elf::Init() {
 // It is expensive to initialize the .gnu_debugdata section. Provide a method
 // to initialize this data separately.
 void Elf::InitGnuDebugdata() {
-  if (!valid_ || interface_->gnu_debugdata_offset() == 0) {
-    return;
+  if (valid_) {
+    interface_->SetGnuDebugdataLoader(nullptr);
+    if (interface_->gnu_debugdata_offset() != 0) {
+      gnu_debugdata_memory_ = interface_->CreateGnuDebugdataMemory();
+      InitGnuDebugdataInterface();
+    }
   }
+  gnu_debugdata_initialized_.store(true, std::memory_order_release);
+}
 
-  gnu_debugdata_memory_ = interface_->CreateGnuDebugdataMemory();
+void Elf::InitGnuDebugdataInterface() {
+  interface_->SetGnuDebugdataInterface(nullptr);
   gnu_debugdata_interface_.reset(CreateInterfaceFromMemory(gnu_debugdata_memory_.get()));
   ElfInterface* gnu = gnu_debugdata_interface_.get();
   if (gnu == nullptr) {
@@ -93,11 +130,90 @@ void Elf::InitGnuDebugdata() {
   }
 }
 
+std::string Elf::GetCacheFilePath(std::string* build_id, uint64_t* fingerprint) {
+  std::string dir = CacheDirectory();
+  if (dir.empty()) {
+    return "";
+  }
+  *build_id = interface_->GetBuildID();
+  *fingerprint = interface_->GetCacheFingerprint();
+  return ElfCacheFile::GetPath(dir, *build_id, *fingerprint);
+}
+
+bool Elf::LoadCacheFile(const std::string& path, const std::string& build_id,
+                        uint64_t fingerprint) {
+  std::shared_ptr<ElfCacheFile> file = ElfCacheFile::Load(path, build_id, fingerprint);
+  if (file == nullptr) {
+    return false;
+  }
+
+  // There is no table if the section could not be decompressed when the
+  // file was written.
+  size_t size;
+  if (interface_->gnu_debugdata_offset() != 0 &&
+      file->FindTable(ElfCacheFile::TABLE_GNU_DEBUGDATA, ElfCacheFile::kMainInterface, &size) !=
+          nullptr) {
+    gnu_debugdata_memory_ =
+        file->CreateTableMemory(ElfCacheFile::TABLE_GNU_DEBUGDATA, ElfCacheFile::kMainInterface);
+    if (gnu_debugdata_memory_ == nullptr) {
+      // The file was replaced after it was loaded.
+      return false;
+    }
+    InitGnuDebugdataInterface();
+  }
+
+  interface_->UseCacheTables(*file, ElfCacheFile::kMainInterface);
+  if (gnu_debugdata_interface_ != nullptr) {
+    gnu_debugdata_interface_->UseCacheTables(*file, ElfCacheFile::kGnuDebugdataInterface);
+  }
+  cache_file_ = std::move(file);
+  return true;
+}
+
+bool Elf::WriteCacheFile(const std::string& path, const std::string& build_id,
+                         uint64_t fingerprint) {
+  ElfCacheFileWriter writer;
+  interface_->AddCacheTables(&writer, ElfCacheFile::kMainInterface);
+  std::vector<uint8_t> gnu_debugdata;
+  if (gnu_debugdata_interface_ != nullptr) {
+    // The decompressed data is read out in full, in blocks, to avoid
+    // needing to know its size up front.
+    constexpr size_t kBlockSize = 64 * 1024;
+    size_t bytes = 0;
+    do {
+      gnu_debugdata.resize(gnu_debugdata.size() + kBlockSize);
+      bytes = gnu_debugdata_memory_->Read(gnu_debugdata.size() - kBlockSize,
+                                          &gnu_debugdata[gnu_debugdata.size() - kBlockSize],
+                                          kBlockSize);
+      gnu_debugdata.resize(gnu_debugdata.size() - kBlockSize + bytes);
+    } while (bytes == kBlockSize);
+    writer.AddTable(ElfCacheFile::TABLE_GNU_DEBUGDATA, ElfCacheFile::kMainInterface,
+                    gnu_debugdata.data(), gnu_debugdata.size());
+    gnu_debugdata_interface_->AddCacheTables(&writer, ElfCacheFile::kGnuDebugdataInterface);
+  }
+  if (!writer.Write(path, build_id, fingerprint)) {
+    Log::Error("Failed to write the cache file %s.", path.c_str());
+    return false;
+  }
+  return true;
+}
+
 void Elf::Invalidate() {
   interface_.reset(nullptr);
   valid_ = false;
 }
 
+void Elf::AddFramePointerCheck(bool matched) {
+  if (!matched) {
+    frame_pointer_state_ = FRAME_POINTER_UNSAFE;
+    return;
+  }
+  if (frame_pointer_matches_.fetch_add(1) + 1 >= kFramePointerChecks) {
+    FramePointerState expected = FRAME_POINTER_UNKNOWN;
+    frame_pointer_state_.compare_exchange_strong(expected, FRAME_POINTER_SAFE);
+  }
+}
+
 std::string Elf::GetSoname() {
   std::lock_guard<std::mutex> guard(lock_);
   if (!valid_) {
@@ -110,11 +226,31 @@ uint64_t Elf::GetRelPc(uint64_t pc, MapInfo* map_info) {
   return pc - map_info->start() + load_bias_ + map_info->elf_offset();
 }
 
+ElfInterface* Elf::GetGnuDebugdataInterface() {
+  if (!gnu_debugdata_initialized_.load(std::memory_order_relaxed)) {
+    InitGnuDebugdata();
+  }
+  return gnu_debugdata_interface_.get();
+}
+
+ElfInterface* Elf::gnu_debugdata_interface() {
+  if (!gnu_debugdata_initialized_.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> guard(lock_);
+    return GetGnuDebugdataInterface();
+  }
+  return gnu_debugdata_interface_.get();
+}
+
 bool Elf::GetFunctionName(uint64_t addr, SharedString* name, uint64_t* func_offset) {
   std::lock_guard<std::mutex> guard(lock_);
-  return valid_ && (interface_->GetFunctionName(addr, name, func_offset) ||
-                    (gnu_debugdata_interface_ &&
-                     gnu_debugdata_interface_->GetFunctionName(addr, name, func_offset)));
+  if (!valid_) {
+    return false;
+  }
+  if (interface_->GetFunctionName(addr, name, func_offset)) {
+    return true;
+  }
+  ElfInterface* gnu = GetGnuDebugdataInterface();
+  return gnu != nullptr && gnu->GetFunctionName(addr, name, func_offset);
 }
 
 bool Elf::GetGlobalVariableOffset(const std::string& name, uint64_t* memory_offset) {
@@ -122,11 +258,13 @@ bool Elf::GetGlobalVariableOffset(const std::string& name, uint64_t* memory_offs
     return false;
   }
 
+  std::lock_guard<std::mutex> guard(lock_);
   uint64_t vaddr;
-  if (!interface_->GetGlobalVariable(name, &vaddr) &&
-      (gnu_debugdata_interface_ == nullptr ||
-       !gnu_debugdata_interface_->GetGlobalVariable(name, &vaddr))) {
-    return false;
+  if (!interface_->GetGlobalVariable(name, &vaddr)) {
+    ElfInterface* gnu = GetGnuDebugdataInterface();
+    if (gnu == nullptr || !gnu->GetGlobalVariable(name, &vaddr)) {
+      return false;
+    }
   }
 
   if (arch() == ARCH_ARM64) {
@@ -251,17 +389,26 @@ bool Elf::IsValidPc(uint64_t pc) {
     return false;
   }
 
-  if (interface_->IsValidPc(pc)) {
+  if (InterfaceIsValidPc(interface_.get(), pc)) {
     return true;
   }
 
-  if (gnu_debugdata_interface_ != nullptr && gnu_debugdata_interface_->IsValidPc(pc)) {
+  ElfInterface* gnu = gnu_debugdata_interface();
+  if (gnu != nullptr && InterfaceIsValidPc(gnu, pc)) {
     return true;
   }
 
   return false;
 }
 
+bool Elf::InterfaceIsValidPc(ElfInterface* interface, uint64_t pc) {
+  if (!interface->pt_loads().empty()) {
+    return interface->IsValidPc(pc);
+  }
+  std::lock_guard<std::mutex> guard(lock_);
+  return interface->IsValidPc(pc);
+}
+
 bool Elf::GetTextRange(uint64_t* addr, uint64_t* size) {
   if (!valid_) {
     return false;
@@ -272,7 +419,8 @@ bool Elf::GetTextRange(uint64_t* addr, uint64_t* size) {
     return true;
   }
 
-  if (gnu_debugdata_interface_ != nullptr && gnu_debugdata_interface_->GetTextRange(addr, size)) {
+  ElfInterface* gnu = gnu_debugdata_interface();
+  if (gnu != nullptr && gnu->GetTextRange(addr, size)) {
     *addr += load_bias_;
     return true;
   }
@@ -365,6 +513,15 @@ void Elf::SetCachingEnabled(bool enable) {
   }
 }
 
+void Elf::SetCacheDirectory(const std::string& dir) {
+  delete cache_directory_;
+  cache_directory_ = dir.empty() ? nullptr : new std::string(dir);
+}
+
+std::string Elf::CacheDirectory() {
+  return cache_directory_ == nullptr ? "" : *cache_directory_;
+}
+
 void Elf::CacheLock() {
   cache_lock_->lock();
 }
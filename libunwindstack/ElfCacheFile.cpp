@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+
+#include <unwindstack/Elf.h>
+#include <unwindstack/Log.h>
+
+#include "ElfCacheFile.h"
+#include "MemoryFileAtOffset.h"
+
+namespace unwindstack {
+
+static_assert(sizeof(ElfCacheFile::Header) == 112, "Unexpected cache file header size");
+static_assert(sizeof(ElfCacheFile::TableEntry) == 32, "Unexpected cache file table entry size");
+
+// All tables start on this alignment, relative to the start of the file.
+static constexpr uint64_t kTableAlignment = 8;
+
+ElfCacheFile::~ElfCacheFile() = default;
+
+// A multiply and rotate hash over 64 bit words. It is not cryptographic,
+// it only needs to catch truncated or corrupted files, and be fast enough
+// to run over the decompressed .gnu_debugdata on every load.
+uint64_t ElfCacheFile::Checksum(const void* data, size_t size, uint64_t seed) {
+  constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+  constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+  auto round = [](uint64_t hash, uint64_t word) {
+    hash += word * kPrime2;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * kPrime1;
+  };
+
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1};
+  size_t offset = 0;
+  for (; offset + sizeof(uint64_t) * 4 <= size; offset += sizeof(uint64_t) * 4) {
+    uint64_t words[4];
+    memcpy(words, &bytes[offset], sizeof(words));
+    for (size_t i = 0; i < 4; i++) {
+      lanes[i] = round(lanes[i], words[i]);
+    }
+  }
+  uint64_t hash = size;
+  for (size_t i = 0; i < 4; i++) {
+    hash = round(hash, lanes[i]);
+  }
+  for (; offset < size; offset += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    memcpy(&word, &bytes[offset], std::min(sizeof(word), size - offset));
+    hash = round(hash, word);
+  }
+  hash ^= hash >> 29;
+  return hash * kPrime2;
+}
+
+std::string ElfCacheFile::GetPath(const std::string& dir, const std::string& build_id,
+                                  uint64_t fingerprint) {
+  if (dir.empty() || build_id.empty() || build_id.size() > kMaxBuildIdSize) {
+    return "";
+  }
+  std::string name(build_id);
+  return android::base::StringPrintf("%s/%s-%016" PRIx64 ".unwind_cache", dir.c_str(),
+                                     Elf::GetPrintableBuildID(name).c_str(), fingerprint);
+}
+
+std::shared_ptr<ElfCacheFile> ElfCacheFile::Load(const std::string& path,
+                                                 const std::string& build_id,
+                                                 uint64_t fingerprint) {
+  std::shared_ptr<ElfCacheFile> file(new ElfCacheFile);
+  file->memory_.reset(new MemoryFileAtOffset);
+  if (!file->memory_->Init(path, 0)) {
+    return nullptr;
+  }
+  size_t size = file->memory_->Size();
+  const uint8_t* data = file->memory_->GetPtr(0);
+  if (data == nullptr || size < sizeof(Header)) {
+    return nullptr;
+  }
+
+  Header header;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kMagic || header.version != kVersion || header.file_size != size ||
+      header.fingerprint != fingerprint || header.build_id_size != build_id.size() ||
+      build_id.size() > kMaxBuildIdSize ||
+      memcmp(header.build_id, build_id.data(), build_id.size()) != 0) {
+    return nullptr;
+  }
+  if (header.num_tables > (size - sizeof(Header)) / sizeof(TableEntry)) {
+    return nullptr;
+  }
+
+  uint64_t checksum = header.checksum;
+  header.checksum = 0;
+  const TableEntry* tables = reinterpret_cast<const TableEntry*>(&data[sizeof(Header)]);
+  size_t tables_size = header.num_tables * sizeof(TableEntry);
+  if (checksum != Checksum(tables, tables_size, Checksum(&header, sizeof(header)))) {
+    Log::Error("Cache file %s has a bad header checksum.", path.c_str());
+    return nullptr;
+  }
+  for (size_t i = 0; i < header.num_tables; i++) {
+    const TableEntry& table = tables[i];
+    uint64_t end;
+    if (table.offset % kTableAlignment != 0 ||
+        __builtin_add_overflow(table.offset, table.size, &end) || end > size ||
+        table.offset < sizeof(Header) + tables_size) {
+      return nullptr;
+    }
+    if (table.checksum != Checksum(&data[table.offset], table.size)) {
+      Log::Error("Cache file %s has a bad checksum for table %zu.", path.c_str(), i);
+      return nullptr;
+    }
+  }
+
+  file->path_ = path;
+  file->data_ = data;
+  file->tables_ = tables;
+  file->num_tables_ = header.num_tables;
+  return file;
+}
+
+const void* ElfCacheFile::FindTable(TableType type, uint32_t id, size_t* size) const {
+  for (size_t i = 0; i < num_tables_; i++) {
+    if (tables_[i].type == type && tables_[i].id == id) {
+      *size = tables_[i].size;
+      return &data_[tables_[i].offset];
+    }
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Memory> ElfCacheFile::CreateTableMemory(TableType type, uint32_t id) const {
+  size_t size;
+  const void* data = FindTable(type, id, &size);
+  if (data == nullptr || size == 0) {
+    return nullptr;
+  }
+  // This shares the mapping of the whole file as long as the file has not
+  // been replaced since it was loaded. If it has, the data was not validated.
+  std::unique_ptr<MemoryFileAtOffset> memory(new MemoryFileAtOffset);
+  uint64_t offset = reinterpret_cast<const uint8_t*>(data) - data_;
+  if (!memory->Init(path_, offset, size) || memory->GetPtr(0) != data || memory->Size() != size) {
+    return nullptr;
+  }
+  return memory;
+}
+
+void ElfCacheFileWriter::AddTable(ElfCacheFile::TableType type, uint32_t id, const void* data,
+                                  size_t size) {
+  tables_.push_back({.type = type, .id = id, .data = data, .size = size});
+}
+
+bool ElfCacheFileWriter::Write(const std::string& path, const std::string& build_id,
+                               uint64_t fingerprint) {
+  if (path.empty() || build_id.empty() || build_id.size() > ElfCacheFile::kMaxBuildIdSize) {
+    return false;
+  }
+
+  ElfCacheFile::Header header = {};
+  header.magic = ElfCacheFile::kMagic;
+  header.version = ElfCacheFile::kVersion;
+  header.num_tables = tables_.size();
+  header.fingerprint = fingerprint;
+  header.build_id_size = build_id.size();
+  memcpy(header.build_id, build_id.data(), build_id.size());
+
+  std::vector<ElfCacheFile::TableEntry> entries(tables_.size());
+  uint64_t offset = sizeof(header) + entries.size() * sizeof(ElfCacheFile::TableEntry);
+  for (size_t i = 0; i < tables_.size(); i++) {
+    const Table& table = tables_[i];
+    offset = (offset + kTableAlignment - 1) & ~(kTableAlignment - 1);
+    entries[i] = {.type = table.type,
+                  .id = table.id,
+                  .offset = offset,
+                  .size = table.size,
+                  .checksum = ElfCacheFile::Checksum(table.data, table.size)};
+    offset += table.size;
+  }
+  header.file_size = offset;
+  header.checksum =
+      ElfCacheFile::Checksum(entries.data(), entries.size() * sizeof(ElfCacheFile::TableEntry),
+                             ElfCacheFile::Checksum(&header, sizeof(header)));
+
+  std::string tmp_path(path + ".XXXXXX");
+  android::base::unique_fd fd(mkstemp(tmp_path.data()));
+  if (fd == -1) {
+    return false;
+  }
+  bool written = android::base::WriteFully(fd, &header, sizeof(header)) &&
+                 android::base::WriteFully(fd, entries.data(),
+                                           entries.size() * sizeof(ElfCacheFile::TableEntry));
+  offset = sizeof(header) + entries.size() * sizeof(ElfCacheFile::TableEntry);
+  for (size_t i = 0; written && i < tables_.size(); i++) {
+    static constexpr uint8_t kPadding[kTableAlignment] = {};
+    written = android::base::WriteFully(fd, kPadding, entries[i].offset - offset) &&
+              android::base::WriteFully(fd, tables_[i].data, tables_[i].size);
+    offset = entries[i].offset + tables_[i].size;
+  }
+  fd.reset();
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace unwindstack
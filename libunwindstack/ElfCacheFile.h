@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unwindstack/Memory.h>
+
+namespace unwindstack {
+
+class MemoryFileAtOffset;
+
+// An on-disk copy of the lookup tables that are otherwise built every time
+// an elf is initialized: the sorted fde index of a dwarf section, the sorted
+// symbol table and the decompressed .gnu_debugdata. Files are keyed by the
+// build id of the elf and a fingerprint of its layout, so a stripped and an
+// unstripped copy of the same library do not share a file.
+//
+// The file is a header, a directory of tables and the table data. Every
+// table has its own checksum, and the header and directory are covered by
+// another one. The file is mapped and the tables are used in place.
+class ElfCacheFile {
+ public:
+  enum TableType : uint32_t {
+    TABLE_FDE_INDEX = 1,
+    TABLE_SYMBOL_REMAP,
+    TABLE_GNU_DEBUGDATA,
+  };
+
+  // Interface ids used to build table ids.
+  static constexpr uint32_t kMainInterface = 0;
+  static constexpr uint32_t kGnuDebugdataInterface = 1;
+
+  static constexpr uint32_t TableId(uint32_t interface_id, uint32_t index) {
+    return (interface_id << 16) | index;
+  }
+
+  static constexpr uint32_t kVersion = 3;
+  static constexpr size_t kMaxBuildIdSize = 64;
+
+  ElfCacheFile() = default;
+  ~ElfCacheFile();
+
+  // Returns the path of the file for an elf, or an empty string if the
+  // build id cannot be used as a key.
+  static std::string GetPath(const std::string& dir, const std::string& build_id,
+                             uint64_t fingerprint);
+
+  // Maps and validates a file. Returns nullptr if the file does not exist,
+  // is for a different elf, or any checksum does not match.
+  static std::shared_ptr<ElfCacheFile> Load(const std::string& path, const std::string& build_id,
+                                            uint64_t fingerprint);
+
+  // Returns the data of a table, or nullptr if the file has no such table.
+  const void* FindTable(TableType type, uint32_t id, size_t* size) const;
+
+  // Returns a memory object for the data of a table. The data is not copied.
+  std::unique_ptr<Memory> CreateTableMemory(TableType type, uint32_t id) const;
+
+  static uint64_t Checksum(const void* data, size_t size, uint64_t seed = 0);
+
+  struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_tables;
+    uint64_t fingerprint;
+    uint64_t file_size;
+    uint32_t build_id_size;
+    uint8_t build_id[kMaxBuildIdSize];
+    uint32_t reserved;
+    // Covers the header, with this field set to zero, and the directory.
+    uint64_t checksum;
+  };
+
+  struct TableEntry {
+    uint32_t type;
+    uint32_t id;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+  };
+
+  static constexpr uint64_t kMagic = 0x4548434143574e55ULL;  // "UNWCACHE"
+
+ private:
+  std::string path_;
+  std::unique_ptr<MemoryFileAtOffset> memory_;
+  const uint8_t* data_ = nullptr;
+  const TableEntry* tables_ = nullptr;
+  uint32_t num_tables_ = 0;
+};
+
+// Collects tables and writes them as an ElfCacheFile. The table data is
+// not copied, it must stay valid until Write returns.
+class ElfCacheFileWriter {
+ public:
+  void AddTable(ElfCacheFile::TableType type, uint32_t id, const void* data, size_t size);
+
+  // Writes to a temporary file in the same directory and renames it into
+  // place, so readers never see a partial file.
+  bool Write(const std::string& path, const std::string& build_id, uint64_t fingerprint);
+
+  size_t NumTables() const { return tables_.size(); }
+
+ private:
+  struct Table {
+    ElfCacheFile::TableType type;
+    uint32_t id;
+    const void* data;
+    size_t size;
+  };
+  std::vector<Table> tables_;
+};
+
+}  // namespace unwindstack
@@ -16,10 +16,15 @@
 
 #include <elf.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfSection.h>
@@ -30,6 +35,7 @@
 #include "DwarfDebugFrame.h"
 #include "DwarfEhFrame.h"
 #include "DwarfEhFrameWithHdr.h"
+#include "ElfCacheFile.h"
 #include "MemoryBuffer.h"
 #include "MemoryXz.h"
 #include "Symbols.h"
@@ -44,17 +50,13 @@ ElfInterface::~ElfInterface() {
 
 bool ElfInterface::IsValidPc(uint64_t pc) {
   if (!pt_loads_.empty()) {
-    for (auto& entry : pt_loads_) {
-      uint64_t start = entry.second.table_offset;
-      uint64_t end = start + entry.second.table_size;
-      if (pc >= start && pc < end) {
-        return true;
-      }
-    }
-    return false;
+    auto comp = [](uint64_t pc, const auto& range) { return pc < range.first; };
+    auto it = std::upper_bound(pt_load_ranges_.begin(), pt_load_ranges_.end(), pc, comp);
+    return it != pt_load_ranges_.begin() && pc < std::prev(it)->second;
   }
 
   // No PT_LOAD data, look for a fde for this pc in the section data.
+  InitHeadersIfNeeded();
   if (debug_frame_ != nullptr && debug_frame_->GetFdeFromPc(pc) != nullptr) {
     return true;
   }
@@ -66,7 +68,147 @@ bool ElfInterface::IsValidPc(uint64_t pc) {
   return false;
 }
 
+void ElfInterface::AddPtLoad(const LoadInfo& load) {
+  for (LoadInfo& entry : pt_loads_) {
+    if (entry.offset == load.offset) {
+      entry = load;
+      return;
+    }
+  }
+  pt_loads_.push_back(load);
+}
+
+void ElfInterface::FinishPtLoads() {
+  std::sort(pt_loads_.begin(), pt_loads_.end(), [](const LoadInfo& a, const LoadInfo& b) {
+    return std::tie(a.table_offset, a.offset) < std::tie(b.table_offset, b.offset);
+  });
+
+  pt_load_ranges_.clear();
+  for (const LoadInfo& load : pt_loads_) {
+    uint64_t start = load.table_offset;
+    uint64_t end;
+    if (__builtin_add_overflow(start, load.table_size, &end)) {
+      end = UINT64_MAX;
+    }
+    if (start == end) {
+      continue;
+    }
+    if (!pt_load_ranges_.empty() && start <= pt_load_ranges_.back().second) {
+      pt_load_ranges_.back().second = std::max(pt_load_ranges_.back().second, end);
+    } else {
+      pt_load_ranges_.emplace_back(start, end);
+    }
+  }
+}
+
+bool ElfInterface::GetDwarfPcRanges(std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  ranges->clear();
+  std::vector<std::pair<uint64_t, uint64_t>> section_ranges;
+  for (DwarfSection* section : {debug_frame_.get(), eh_frame_.get()}) {
+    if (section == nullptr) {
+      continue;
+    }
+    if (!section->GetPcRanges(&section_ranges)) {
+      return false;
+    }
+    ranges->insert(ranges->end(), section_ranges.begin(), section_ranges.end());
+  }
+  std::sort(ranges->begin(), ranges->end());
+  return true;
+}
+
+void ElfInterface::BuildCoverage() {
+  coverage_built_ = true;
+  coverage_.clear();
+
+  struct SectionRanges {
+    uint8_t section;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  };
+  size_t num_sections = (debug_frame_ != nullptr) + (eh_frame_ != nullptr) +
+                        (gnu_debugdata_interface_ != nullptr);
+  if (num_sections < 2) {
+    // Nothing to skip, so do not gather any ranges.
+    return;
+  }
+
+  std::vector<SectionRanges> sections;
+  if (debug_frame_ != nullptr) {
+    sections.push_back({.section = COVERAGE_DEBUG_FRAME, .ranges = {}});
+    if (!debug_frame_->GetPcRanges(&sections.back().ranges)) {
+      sections.back().ranges = {{0, UINT64_MAX}};
+    }
+  }
+  if (eh_frame_ != nullptr) {
+    sections.push_back({.section = COVERAGE_EH_FRAME, .ranges = {}});
+    if (!eh_frame_->GetPcRanges(&sections.back().ranges)) {
+      sections.back().ranges = {{0, UINT64_MAX}};
+    }
+  }
+  if (gnu_debugdata_interface_ != nullptr) {
+    sections.push_back({.section = COVERAGE_GNU_DEBUGDATA, .ranges = {}});
+    if (!gnu_debugdata_interface_->GetDwarfPcRanges(&sections.back().ranges)) {
+      sections.back().ranges = {{0, UINT64_MAX}};
+    }
+  }
+  // Every start and end is a point where the set of sections can change.
+  std::vector<uint64_t> points;
+  for (const SectionRanges& section : sections) {
+    for (const auto& [start, end] : section.ranges) {
+      points.push_back(start);
+      points.push_back(end);
+    }
+  }
+  std::sort(points.begin(), points.end());
+  points.erase(std::unique(points.begin(), points.end()), points.end());
+
+  // The ranges of one section may overlap, so count how many of them
+  // contain each point rather than toggling the section.
+  std::vector<std::vector<std::pair<uint64_t, int>>> deltas(sections.size());
+  for (size_t i = 0; i < sections.size(); i++) {
+    for (const auto& [start, end] : sections[i].ranges) {
+      deltas[i].emplace_back(start, 1);
+      deltas[i].emplace_back(end, -1);
+    }
+    std::sort(deltas[i].begin(), deltas[i].end());
+  }
+  std::vector<size_t> next(sections.size(), 0);
+  std::vector<int> active(sections.size(), 0);
+  uint8_t mask = 0;
+  for (uint64_t point : points) {
+    // The pcs before this point are in the sections of the previous one.
+    if (!coverage_.empty() && coverage_.back().sections == mask) {
+      coverage_.back().pc_end = point;
+    } else {
+      coverage_.push_back({.pc_end = point, .sections = mask});
+    }
+    mask = 0;
+    for (size_t i = 0; i < sections.size(); i++) {
+      while (next[i] < deltas[i].size() && deltas[i][next[i]].first <= point) {
+        active[i] += deltas[i][next[i]++].second;
+      }
+      if (active[i] > 0) {
+        mask |= sections[i].section;
+      }
+    }
+  }
+}
+
+uint8_t ElfInterface::GetCoverage(uint64_t pc) {
+  if (!coverage_built_) {
+    InitHeadersIfNeeded();
+    BuildCoverage();
+  }
+  if (coverage_.empty()) {
+    return COVERAGE_ALL;
+  }
+  auto comp = [](uint64_t pc, const CoverageEntry& entry) { return pc < entry.pc_end; };
+  auto it = std::upper_bound(coverage_.begin(), coverage_.end(), pc, comp);
+  return it == coverage_.end() ? 0 : it->sections;
+}
+
 bool ElfInterface::GetTextRange(uint64_t* addr, uint64_t* size) {
+  ReadSectionsIfNeeded();
   if (text_size_ != 0) {
     *addr = text_addr_;
     *size = text_size_;
@@ -75,7 +217,29 @@ bool ElfInterface::GetTextRange(uint64_t* addr, uint64_t* size) {
   return false;
 }
 
+void ElfInterface::Prefetch(Memory::PrefetchMode mode) {
+  if (mode == Memory::PREFETCH_NONE) {
+    return;
+  }
+  ReadSectionsIfNeeded();
+
+  if (eh_frame_hdr_offset_ != 0) {
+    // The fdes themselves are only read for the pcs that are looked up.
+    memory_->Prefetch(eh_frame_hdr_offset_, eh_frame_hdr_size_, mode);
+  } else if (eh_frame_offset_ != 0) {
+    // Without a search table, the whole section is scanned to find fdes.
+    memory_->Prefetch(eh_frame_offset_, eh_frame_size_, mode);
+  }
+  if (debug_frame_offset_ != 0) {
+    memory_->Prefetch(debug_frame_offset_, debug_frame_size_, mode);
+  }
+  for (auto symbol : symbols_) {
+    symbol->Prefetch(memory_, mode);
+  }
+}
+
 std::unique_ptr<Memory> ElfInterface::CreateGnuDebugdataMemory() {
+  ReadSectionsIfNeeded();
   if (gnu_debugdata_offset_ == 0 || gnu_debugdata_size_ == 0) {
     return nullptr;
   }
@@ -90,8 +254,50 @@ std::unique_ptr<Memory> ElfInterface::CreateGnuDebugdataMemory() {
   return decompressed;
 }
 
+uint64_t ElfInterface::GetCacheFingerprint() {
+  ReadSectionsIfNeeded();
+  std::vector<uint64_t> layout = {eh_frame_hdr_offset_, eh_frame_hdr_size_, eh_frame_offset_,
+                                  eh_frame_size_,       debug_frame_offset_, debug_frame_size_,
+                                  gnu_debugdata_offset_, gnu_debugdata_size_};
+  for (auto symbol : symbols_) {
+    layout.push_back(symbol->offset());
+    layout.push_back(symbol->count());
+  }
+  return ElfCacheFile::Checksum(layout.data(), layout.size() * sizeof(uint64_t));
+}
+
+void ElfInterface::AddCacheTables(ElfCacheFileWriter* writer, uint32_t interface_id) {
+  InitHeadersIfNeeded();
+  DwarfSection* sections[] = {eh_frame_.get(), debug_frame_.get()};
+  for (uint32_t i = 0; i < 2; i++) {
+    const DwarfSection::FdeIndexEntry* index;
+    size_t size;
+    if (sections[i] != nullptr && sections[i]->GetFdeIndex(&index, &size)) {
+      writer->AddTable(ElfCacheFile::TABLE_FDE_INDEX, ElfCacheFile::TableId(interface_id, i), index,
+                       size * sizeof(DwarfSection::FdeIndexEntry));
+    }
+  }
+}
+
+void ElfInterface::UseCacheTables(const ElfCacheFile& file, uint32_t interface_id) {
+  InitHeadersIfNeeded();
+  DwarfSection* sections[] = {eh_frame_.get(), debug_frame_.get()};
+  for (uint32_t i = 0; i < 2; i++) {
+    size_t size;
+    const void* index = file.FindTable(ElfCacheFile::TABLE_FDE_INDEX,
+                                       ElfCacheFile::TableId(interface_id, i), &size);
+    if (sections[i] != nullptr && index != nullptr &&
+        size % sizeof(DwarfSection::FdeIndexEntry) == 0) {
+      sections[i]->SetFdeIndex(reinterpret_cast<const DwarfSection::FdeIndexEntry*>(index),
+                               size / sizeof(DwarfSection::FdeIndexEntry));
+    }
+  }
+}
+
 template <typename ElfTypes>
 void ElfInterfaceImpl<ElfTypes>::InitHeaders() {
+  ReadSectionsIfNeeded();
+  coverage_built_ = false;
   if (eh_frame_hdr_offset_ != 0) {
     DwarfEhFrameWithHdr<AddressType>* eh_frame_hdr = new DwarfEhFrameWithHdr<AddressType>(memory_);
     eh_frame_.reset(eh_frame_hdr);
@@ -127,21 +333,21 @@ void ElfInterfaceImpl<ElfTypes>::InitHeaders() {
       debug_frame_size_ = static_cast<uint64_t>(-1);
     }
   }
+  headers_initialized_.store(true, std::memory_order_release);
 }
 
 template <typename ElfTypes>
 bool ElfInterfaceImpl<ElfTypes>::ReadAllHeaders(int64_t* load_bias) {
-  EhdrType ehdr;
-  if (!memory_->ReadFully(0, &ehdr, sizeof(ehdr))) {
+  if (!memory_->ReadFully(0, &ehdr_, sizeof(ehdr_))) {
     last_error_.code = ERROR_MEMORY_INVALID;
     last_error_.address = 0;
     return false;
   }
 
   // If we have enough information that this is an elf file, then allow
-  // malformed program and section headers.
-  ReadProgramHeaders(ehdr, load_bias);
-  ReadSectionHeaders(ehdr);
+  // malformed program and section headers. The section headers are read
+  // by ReadSectionsIfNeeded.
+  ReadProgramHeaders(ehdr_, load_bias);
   return true;
 }
 
@@ -169,12 +375,27 @@ int64_t ElfInterface::GetLoadBias(Memory* memory) {
 
 template <typename ElfTypes>
 void ElfInterfaceImpl<ElfTypes>::ReadProgramHeaders(const EhdrType& ehdr, int64_t* load_bias) {
+  // Read all of the headers with one read, which covers every elf in
+  // practice. Anything that does not fit, or that the bulk read could not
+  // get, is read one header at a time.
+  uint8_t buffer[4096];
+  size_t buffer_bytes = 0;
+  if (ehdr.e_phnum != 0) {
+    uint64_t phdrs_size =
+        static_cast<uint64_t>(ehdr.e_phnum - 1) * ehdr.e_phentsize + sizeof(PhdrType);
+    buffer_bytes =
+        memory_->Read(ehdr.e_phoff, buffer, std::min<uint64_t>(sizeof(buffer), phdrs_size));
+  }
+
   uint64_t offset = ehdr.e_phoff;
   bool first_exec_load_header = true;
   for (size_t i = 0; i < ehdr.e_phnum; i++, offset += ehdr.e_phentsize) {
     PhdrType phdr;
-    if (!memory_->ReadFully(offset, &phdr, sizeof(phdr))) {
-      return;
+    uint64_t buffer_offset = offset - ehdr.e_phoff;
+    if (buffer_offset + sizeof(phdr) <= buffer_bytes) {
+      memcpy(&phdr, &buffer[buffer_offset], sizeof(phdr));
+    } else if (!memory_->ReadFully(offset, &phdr, sizeof(phdr))) {
+      break;
     }
 
     switch (phdr.p_type) {
@@ -184,8 +405,7 @@ void ElfInterfaceImpl<ElfTypes>::ReadProgramHeaders(const EhdrType& ehdr, int64_
         continue;
       }
 
-      pt_loads_[phdr.p_offset] = LoadInfo{phdr.p_offset, phdr.p_vaddr,
-                                          static_cast<size_t>(phdr.p_memsz)};
+      AddPtLoad(LoadInfo{phdr.p_offset, phdr.p_vaddr, static_cast<size_t>(phdr.p_memsz)});
       // Only set the load bias from the first executable load header.
       if (first_exec_load_header) {
         *load_bias = static_cast<uint64_t>(phdr.p_vaddr) - phdr.p_offset;
@@ -201,6 +421,14 @@ void ElfInterfaceImpl<ElfTypes>::ReadProgramHeaders(const EhdrType& ehdr, int64_
       eh_frame_hdr_size_ = phdr.p_memsz;
       break;
 
+    case PT_NOTE:
+      // Notes with a larger alignment, such as .note.gnu.property, are not
+      // laid out the way ReadBuildIDFromNotes expects.
+      if (phdr.p_align <= 4) {
+        note_segments_.emplace_back(phdr.p_offset, phdr.p_filesz);
+      }
+      break;
+
     case PT_DYNAMIC:
       dynamic_offset_ = phdr.p_offset;
       dynamic_vaddr_start_ = phdr.p_vaddr;
@@ -216,33 +444,49 @@ void ElfInterfaceImpl<ElfTypes>::ReadProgramHeaders(const EhdrType& ehdr, int64_
       break;
     }
   }
+  FinishPtLoads();
 }
 
 template <typename ElfTypes>
 std::string ElfInterfaceImpl<ElfTypes>::ReadBuildID() {
+  // The build id is almost always in a PT_NOTE segment, which avoids
+  // reading the section headers.
+  for (const auto& [offset, size] : note_segments_) {
+    std::string build_id = ReadBuildIDFromNotes(offset, size);
+    if (!build_id.empty()) {
+      return build_id;
+    }
+  }
+  ReadSectionsIfNeeded();
+  return ReadBuildIDFromNotes(gnu_build_id_offset_, gnu_build_id_size_);
+}
+
+template <typename ElfTypes>
+std::string ElfInterfaceImpl<ElfTypes>::ReadBuildIDFromNotes(uint64_t notes_offset,
+                                                             uint64_t notes_size) {
   // Ensure there is no overflow in any of the calulations below.
   uint64_t tmp;
-  if (__builtin_add_overflow(gnu_build_id_offset_, gnu_build_id_size_, &tmp)) {
+  if (__builtin_add_overflow(notes_offset, notes_size, &tmp)) {
     return "";
   }
 
   uint64_t offset = 0;
-  while (offset < gnu_build_id_size_) {
-    if (gnu_build_id_size_ - offset < sizeof(NhdrType)) {
+  while (offset < notes_size) {
+    if (notes_size - offset < sizeof(NhdrType)) {
       return "";
     }
     NhdrType hdr;
-    if (!memory_->ReadFully(gnu_build_id_offset_ + offset, &hdr, sizeof(hdr))) {
+    if (!memory_->ReadFully(notes_offset + offset, &hdr, sizeof(hdr))) {
       return "";
     }
     offset += sizeof(hdr);
 
-    if (gnu_build_id_size_ - offset < hdr.n_namesz) {
+    if (notes_size - offset < hdr.n_namesz) {
       return "";
     }
     if (hdr.n_namesz > 0) {
       std::string name(hdr.n_namesz, '\0');
-      if (!memory_->ReadFully(gnu_build_id_offset_ + offset, &(name[0]), hdr.n_namesz)) {
+      if (!memory_->ReadFully(notes_offset + offset, &(name[0]), hdr.n_namesz)) {
         return "";
       }
 
@@ -254,11 +498,11 @@ std::string ElfInterfaceImpl<ElfTypes>::ReadBuildID() {
       offset += (hdr.n_namesz + 3) & ~3;
 
       if (name == "GNU" && hdr.n_type == NT_GNU_BUILD_ID) {
-        if (gnu_build_id_size_ - offset < hdr.n_descsz || hdr.n_descsz == 0) {
+        if (notes_size - offset < hdr.n_descsz || hdr.n_descsz == 0) {
           return "";
         }
         std::string build_id(hdr.n_descsz, '\0');
-        if (memory_->ReadFully(gnu_build_id_offset_ + offset, &build_id[0], hdr.n_descsz)) {
+        if (memory_->ReadFully(notes_offset + offset, &build_id[0], hdr.n_descsz)) {
           return build_id;
         }
         return "";
@@ -313,8 +557,10 @@ void ElfInterfaceImpl<ElfTypes>::ReadSectionHeaders(const EhdrType& ehdr) {
     } else if ((shdr.sh_type == SHT_PROGBITS || shdr.sh_type == SHT_NOBITS) && sec_size != 0) {
       // Look for the .debug_frame and .gnu_debugdata.
       if (shdr.sh_name < sec_size) {
-        std::string name;
-        if (memory_->ReadString(sec_offset + shdr.sh_name, &name, sec_size - shdr.sh_name)) {
+        std::string storage;
+        std::string_view name;
+        if (memory_->ReadStringView(sec_offset + shdr.sh_name, &name, sec_size - shdr.sh_name,
+                                    &storage)) {
           if (name == ".debug_frame") {
             debug_frame_offset_ = shdr.sh_offset;
             debug_frame_size_ = shdr.sh_size;
@@ -350,8 +596,10 @@ void ElfInterfaceImpl<ElfTypes>::ReadSectionHeaders(const EhdrType& ehdr) {
                                                             static_cast<uint64_t>(shdr.sh_offset)));
     } else if (shdr.sh_type == SHT_NOTE) {
       if (shdr.sh_name < sec_size) {
-        std::string name;
-        if (memory_->ReadString(sec_offset + shdr.sh_name, &name, sec_size - shdr.sh_name) &&
+        std::string storage;
+        std::string_view name;
+        if (memory_->ReadStringView(sec_offset + shdr.sh_name, &name, sec_size - shdr.sh_name,
+                                    &storage) &&
             name == ".note.gnu.build-id") {
           gnu_build_id_offset_ = shdr.sh_offset;
           gnu_build_id_size_ = shdr.sh_size;
@@ -371,6 +619,7 @@ std::string ElfInterfaceImpl<ElfTypes>::GetSoname() {
   }
 
   soname_type_ = SONAME_INVALID;
+  ReadSectionsIfNeeded();
 
   uint64_t soname_offset = 0;
   uint64_t strtab_addr = 0;
@@ -419,6 +668,7 @@ std::string ElfInterfaceImpl<ElfTypes>::GetSoname() {
 template <typename ElfTypes>
 bool ElfInterfaceImpl<ElfTypes>::GetFunctionName(uint64_t addr, SharedString* name,
                                                  uint64_t* func_offset) {
+  ReadSectionsIfNeeded();
   if (symbols_.empty()) {
     return false;
   }
@@ -434,6 +684,7 @@ bool ElfInterfaceImpl<ElfTypes>::GetFunctionName(uint64_t addr, SharedString* na
 template <typename ElfTypes>
 bool ElfInterfaceImpl<ElfTypes>::GetGlobalVariable(const std::string& name,
                                                    uint64_t* memory_address) {
+  ReadSectionsIfNeeded();
   if (symbols_.empty()) {
     return false;
   }
@@ -446,42 +697,103 @@ bool ElfInterfaceImpl<ElfTypes>::GetGlobalVariable(const std::string& name,
   return false;
 }
 
+template <typename ElfTypes>
+void ElfInterfaceImpl<ElfTypes>::AddCacheTables(ElfCacheFileWriter* writer,
+                                                uint32_t interface_id) {
+  ElfInterface::AddCacheTables(writer, interface_id);
+  for (uint32_t i = 0; i < symbols_.size(); i++) {
+    const uint32_t* table;
+    size_t size;
+    symbols_[i]->template GetRemapTable<SymType>(memory_, &table, &size);
+    writer->AddTable(ElfCacheFile::TABLE_SYMBOL_REMAP, ElfCacheFile::TableId(interface_id, i),
+                     table, size * sizeof(uint32_t));
+  }
+}
+
+template <typename ElfTypes>
+void ElfInterfaceImpl<ElfTypes>::UseCacheTables(const ElfCacheFile& file, uint32_t interface_id) {
+  ElfInterface::UseCacheTables(file, interface_id);
+  for (uint32_t i = 0; i < symbols_.size(); i++) {
+    size_t size;
+    const void* table = file.FindTable(ElfCacheFile::TABLE_SYMBOL_REMAP,
+                                       ElfCacheFile::TableId(interface_id, i), &size);
+    if (table != nullptr && size % sizeof(uint32_t) == 0) {
+      symbols_[i]->SetRemapTable(reinterpret_cast<const uint32_t*>(table),
+                                 size / sizeof(uint32_t));
+    }
+  }
+}
+
 bool ElfInterface::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
                         bool* is_signal_frame) {
   last_error_.code = ERROR_NONE;
   last_error_.address = 0;
+  InitHeadersIfNeeded();
+
+  // Skip the sections that have no unwind information for this pc.
+  uint8_t coverage = GetCoverage(pc);
+  // The sections that were actually tried.
+  uint8_t tried = 0;
 
   // Try the debug_frame first since it contains the most specific unwind
   // information.
   DwarfSection* debug_frame = debug_frame_.get();
-  if (debug_frame != nullptr &&
-      debug_frame->Step(pc, regs, process_memory, finished, is_signal_frame)) {
-    return true;
+  if (debug_frame != nullptr && (coverage & COVERAGE_DEBUG_FRAME)) {
+    if (debug_frame->Step(pc, regs, process_memory, finished, is_signal_frame)) {
+      return true;
+    }
+    tried |= COVERAGE_DEBUG_FRAME;
   }
 
   // Try the eh_frame next.
   DwarfSection* eh_frame = eh_frame_.get();
-  if (eh_frame != nullptr && eh_frame->Step(pc, regs, process_memory, finished, is_signal_frame)) {
-    return true;
+  if (eh_frame != nullptr && (coverage & COVERAGE_EH_FRAME)) {
+    if (eh_frame->Step(pc, regs, process_memory, finished, is_signal_frame)) {
+      return true;
+    }
+    tried |= COVERAGE_EH_FRAME;
   }
 
-  if (gnu_debugdata_interface_ != nullptr &&
-      gnu_debugdata_interface_->Step(pc, regs, process_memory, finished, is_signal_frame)) {
-    return true;
+  if (gnu_debugdata_loader_) {
+    // Only decompress the gnu_debugdata once there is a pc that the other
+    // sections cannot unwind. This adds the section to the coverage.
+    std::function<void()> loader(std::move(gnu_debugdata_loader_));
+    gnu_debugdata_loader_ = nullptr;
+    loader();
+    coverage = GetCoverage(pc);
+  }
+  if (gnu_debugdata_interface_ != nullptr && (coverage & COVERAGE_GNU_DEBUGDATA)) {
+    if (gnu_debugdata_interface_->Step(pc, regs, process_memory, finished, is_signal_frame)) {
+      return true;
+    }
+    tried |= COVERAGE_GNU_DEBUGDATA;
   }
 
-  // Set the error code based on the first error encountered.
+  // Set the error code based on the first section that was tried. The
+  // coverage can change when the gnu_debugdata is loaded, so it cannot be
+  // used here.
   DwarfSection* section = nullptr;
   if (debug_frame_ != nullptr) {
     section = debug_frame_.get();
+    tried &= COVERAGE_DEBUG_FRAME;
   } else if (eh_frame_ != nullptr) {
     section = eh_frame_.get();
+    tried &= COVERAGE_EH_FRAME;
   } else if (gnu_debugdata_interface_ != nullptr) {
-    last_error_ = gnu_debugdata_interface_->last_error();
+    if (tried & COVERAGE_GNU_DEBUGDATA) {
+      last_error_ = gnu_debugdata_interface_->last_error();
+    } else {
+      last_error_.code = ERROR_UNWIND_INFO;
+    }
     return false;
   } else {
     return false;
   }
+  if (tried == 0) {
+    // The section was skipped, which is the same as it not finding an fde.
+    last_error_.code = ERROR_UNWIND_INFO;
+    return false;
+  }
 
   // Convert the DWARF ERROR to an external error.
   DwarfErrorCode code = section->LastErrorCode();
@@ -577,9 +889,11 @@ bool GetBuildIDInfo(Memory* memory, uint64_t* build_id_offset, uint64_t* build_i
     if (!memory->ReadFully(offset, &shdr, sizeof(shdr))) {
       return false;
     }
-    std::string name;
+    std::string storage;
+    std::string_view name;
     if (shdr.sh_type == SHT_NOTE && shdr.sh_name < sec_size &&
-        memory->ReadString(sec_offset + shdr.sh_name, &name, sec_size - shdr.sh_name) &&
+        memory->ReadStringView(sec_offset + shdr.sh_name, &name, sec_size - shdr.sh_name,
+                               &storage) &&
         name == ".note.gnu.build-id") {
       *build_id_offset = shdr.sh_offset;
       *build_id_size = shdr.sh_size;
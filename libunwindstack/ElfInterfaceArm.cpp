@@ -17,6 +17,9 @@
 #include <elf.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <vector>
+
 #include <unwindstack/MachineArm.h>
 #include <unwindstack/Memory.h>
 #include <unwindstack/RegsArm.h>
@@ -40,6 +43,17 @@ bool ElfInterfaceArm::FindEntry(uint32_t pc, uint64_t* entry_offset) {
     return false;
   }
 
+  if (ReadTable()) {
+    auto it = std::upper_bound(table_.begin(), table_.end(), pc,
+                               [](uint32_t pc, const TableEntry& entry) { return pc < entry.pc; });
+    if (it == table_.begin()) {
+      last_error_.code = ERROR_UNWIND_INFO;
+      return false;
+    }
+    *entry_offset = start_offset_ + (it - table_.begin() - 1) * 8;
+    return true;
+  }
+
   size_t first = 0;
   size_t last = total_entries_;
   while (first < last) {
@@ -69,6 +83,33 @@ bool ElfInterfaceArm::FindEntry(uint32_t pc, uint64_t* entry_offset) {
   return false;
 }
 
+bool ElfInterfaceArm::ReadTable() {
+  if (table_state_ != TABLE_UNREAD) {
+    return table_state_ == TABLE_READ;
+  }
+  table_state_ = TABLE_UNAVAILABLE;
+  // Do not trust a huge size from a corrupt program header.
+  constexpr size_t kMaxEntries = 1 << 24;
+  if (start_offset_ == 0 || total_entries_ == 0 || total_entries_ > kMaxEntries) {
+    return false;
+  }
+
+  std::vector<uint32_t> words(total_entries_ * 2);
+  if (!memory_->ReadFully(start_offset_, words.data(), words.size() * sizeof(uint32_t))) {
+    return false;
+  }
+  table_.resize(total_entries_);
+  for (size_t i = 0; i < total_entries_; i++) {
+    // Sign extend the value if necessary.
+    uint32_t offset = start_offset_ + i * 8;
+    int32_t value = (static_cast<int32_t>(words[i * 2]) << 1) >> 1;
+    table_[i].pc = offset + value;
+    table_[i].data = words[i * 2 + 1];
+  }
+  table_state_ = TABLE_READ;
+  return true;
+}
+
 bool ElfInterfaceArm::GetPrel31Addr(uint32_t offset, uint32_t* addr) {
   uint32_t data;
   if (!memory_->Read32(offset, &data)) {
@@ -98,6 +139,8 @@ void ElfInterfaceArm::HandleUnknownType(uint32_t type, uint64_t ph_offset, uint6
   // Always use filesz instead of memsz. In most cases they are the same,
   // but some shared libraries wind up setting one correctly and not the other.
   total_entries_ = ph_filesz / 8;
+  table_.clear();
+  table_state_ = TABLE_UNREAD;
 }
 
 bool ElfInterfaceArm::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
@@ -126,8 +169,15 @@ bool ElfInterfaceArm::StepExidx(uint64_t pc, Regs* regs, Memory* process_memory,
 
   ArmExidx arm(regs_arm, memory_, process_memory);
   arm.set_cfa(regs_arm->sp());
+  bool extracted;
+  if (table_state_ == TABLE_READ) {
+    // The entry data was read along with the table.
+    extracted = arm.ExtractEntryData(entry_offset, table_[(entry_offset - start_offset_) / 8].data);
+  } else {
+    extracted = arm.ExtractEntryData(entry_offset);
+  }
   bool return_value = false;
-  if (arm.ExtractEntryData(entry_offset) && arm.Eval()) {
+  if (extracted && arm.Eval()) {
     // If the pc was not set, then use the LR registers for the PC.
     if (!arm.pc_set()) {
       (*regs_arm)[ARM_REG_PC] = (*regs_arm)[ARM_REG_LR];
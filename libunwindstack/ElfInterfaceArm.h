@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <unordered_map>
+#include <vector>
 
 #include <unwindstack/ElfInterface.h>
 #include <unwindstack/Memory.h>
@@ -50,6 +51,9 @@ class ElfInterfaceArm : public ElfInterface32 {
     bool operator!=(const iterator& rhs) { return this->index_ != rhs.index_; }
 
     uint32_t operator*() {
+      if (interface_->ReadTable()) {
+        return interface_->table_[index_].pc;
+      }
       uint32_t addr = interface_->addrs_[index_];
       if (addr == 0) {
         if (!interface_->GetPrel31Addr(interface_->start_offset_ + index_ * 8, &addr)) {
@@ -74,6 +78,11 @@ class ElfInterfaceArm : public ElfInterface32 {
 
   bool FindEntry(uint32_t pc, uint64_t* entry_offset);
 
+  // Reads and decodes the whole exidx table the first time it is called.
+  // Returns false if the table could not be read in one piece, in which
+  // case the entries are read one at a time as they are needed.
+  bool ReadTable();
+
   void HandleUnknownType(uint32_t type, uint64_t ph_offset, uint64_t ph_filesz) override;
 
   bool Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
@@ -95,6 +104,21 @@ class ElfInterfaceArm : public ElfInterface32 {
   uint64_t load_bias_ = 0;
 
   std::unordered_map<size_t, uint32_t> addrs_;
+
+  struct TableEntry {
+    // The resolved prel31 address of the function.
+    uint32_t pc;
+    // The second word of the entry: the compact unwind data, a cant unwind
+    // marker, or the prel31 offset of the extab data.
+    uint32_t data;
+  };
+  enum TableState : uint8_t {
+    TABLE_UNREAD = 0,
+    TABLE_READ,
+    TABLE_UNAVAILABLE,
+  };
+  std::vector<TableEntry> table_;
+  TableState table_state_ = TABLE_UNREAD;
 };
 
 }  // namespace unwindstack
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <unwindstack/Epoch.h>
+
+namespace unwindstack {
+
+// The epoch of a thread that is not in a read section.
+static constexpr uint64_t kQuiescent = UINT64_MAX;
+
+struct EpochSlot {
+  // The global epoch when the outermost read section started.
+  std::atomic<uint64_t> epoch = kQuiescent;
+  uint32_t depth = 0;
+  EpochSlot* prev = nullptr;
+  EpochSlot* next = nullptr;
+};
+
+struct EpochState {
+  std::atomic<uint64_t> epoch = 0;
+
+  // Every thread that has entered a read section has a slot in this list.
+  std::mutex slots_lock;
+  EpochSlot* slots = nullptr;
+
+  std::mutex retired_lock;
+  std::vector<std::pair<uint64_t, std::shared_ptr<void>>> retired;
+  // The lowest epoch in retired, or kQuiescent if it is empty, so that Exit
+  // can check it without the lock.
+  std::atomic<uint64_t> oldest_retired = kQuiescent;
+
+  pthread_key_t slot_key;
+};
+
+static thread_local EpochSlot* g_epoch_slot = nullptr;
+
+static void RemoveSlot(void* data);
+
+static EpochState* GetState() {
+  // Never freed so that threads exiting after the static destructors
+  // have run can still remove their slots.
+  static EpochState* state = [] {
+    EpochState* state = new EpochState;
+    pthread_key_create(&state->slot_key, RemoveSlot);
+    return state;
+  }();
+  return state;
+}
+
+static void RemoveSlot(void* data) {
+  EpochSlot* slot = reinterpret_cast<EpochSlot*>(data);
+  EpochState* state = GetState();
+  {
+    std::lock_guard<std::mutex> guard(state->slots_lock);
+    if (slot->prev != nullptr) {
+      slot->prev->next = slot->next;
+    } else {
+      state->slots = slot->next;
+    }
+    if (slot->next != nullptr) {
+      slot->next->prev = slot->prev;
+    }
+  }
+  delete slot;
+  // This runs on the exiting thread, clear the slot in case a later
+  // destructor on this thread enters a read section again.
+  g_epoch_slot = nullptr;
+}
+
+static EpochSlot* GetSlot() {
+  if (g_epoch_slot == nullptr) {
+    EpochState* state = GetState();
+    EpochSlot* slot = new EpochSlot;
+    {
+      std::lock_guard<std::mutex> guard(state->slots_lock);
+      slot->next = state->slots;
+      if (slot->next != nullptr) {
+        slot->next->prev = slot;
+      }
+      state->slots = slot;
+    }
+    pthread_setspecific(state->slot_key, slot);
+    g_epoch_slot = slot;
+  }
+  return g_epoch_slot;
+}
+
+void Epoch::Enter() {
+  EpochSlot* slot = GetSlot();
+  if (slot->depth++ == 0) {
+    slot->epoch.store(GetState()->epoch.load(std::memory_order_relaxed));
+  }
+}
+
+void Epoch::Exit() {
+  EpochSlot* slot = GetSlot();
+  if (slot->depth > 0 && --slot->depth == 0) {
+    uint64_t epoch = slot->epoch.load(std::memory_order_relaxed);
+    // Sequentially consistent, paired with Retire, so that either this
+    // sees the retired object or the Reclaim after the Retire sees this
+    // read section has ended.
+    slot->epoch.store(kQuiescent);
+    // Only a read section that started before the oldest retired object
+    // was retired can be holding on to it. If this was one of them, it
+    // might have been the last, so release the objects now instead of
+    // waiting for the next Reclaim. Every other read section ends without
+    // taking a lock.
+    uint64_t oldest_retired = GetState()->oldest_retired.load();
+    if (oldest_retired != kQuiescent && epoch <= oldest_retired) {
+      Reclaim();
+    }
+  }
+}
+
+void Epoch::Retire(std::shared_ptr<void> object) {
+  if (object == nullptr) {
+    return;
+  }
+  EpochState* state = GetState();
+  // A read section that starts after this sees a later epoch, and can no
+  // longer find the object.
+  uint64_t epoch = state->epoch.fetch_add(1);
+  std::lock_guard<std::mutex> guard(state->retired_lock);
+  state->retired.emplace_back(epoch, std::move(object));
+  if (epoch < state->oldest_retired.load(std::memory_order_relaxed)) {
+    state->oldest_retired.store(epoch);
+  }
+}
+
+void Epoch::Reclaim() {
+  EpochState* state = GetState();
+  // Objects retired after this point might be in use by a read section
+  // that starts after the slots are checked.
+  uint64_t oldest_epoch = state->epoch.load();
+  {
+    std::lock_guard<std::mutex> guard(state->slots_lock);
+    for (EpochSlot* slot = state->slots; slot != nullptr; slot = slot->next) {
+      oldest_epoch = std::min(oldest_epoch, slot->epoch.load());
+    }
+  }
+
+  // Release the objects after dropping the lock, their destructors can
+  // take a while.
+  std::vector<std::pair<uint64_t, std::shared_ptr<void>>> released;
+  {
+    std::lock_guard<std::mutex> guard(state->retired_lock);
+    auto it = std::stable_partition(state->retired.begin(), state->retired.end(),
+                                    [oldest_epoch](const auto& entry) {
+                                      return entry.first >= oldest_epoch;
+                                    });
+    released.insert(released.end(), std::make_move_iterator(it),
+                    std::make_move_iterator(state->retired.end()));
+    state->retired.erase(it, state->retired.end());
+    uint64_t oldest_retired = kQuiescent;
+    for (const auto& entry : state->retired) {
+      oldest_retired = std::min(oldest_retired, entry.first);
+    }
+    state->oldest_retired.store(oldest_retired);
+  }
+}
+
+size_t Epoch::NumRetired() {
+  EpochState* state = GetState();
+  std::lock_guard<std::mutex> guard(state->retired_lock);
+  return state->retired.size();
+}
+
+}  // namespace unwindstack
@@ -222,13 +222,16 @@ Memory* MapInfo::CreateMemory(const std::shared_ptr<Memory>& process_memory) {
     // in the next map. Since this should be a very uncommon path, just
     // redo the work. If this happens, the elf for this map will eventually
     // be discarded.
-    MemoryRanges* ranges = new MemoryRanges;
-    ranges->Insert(new MemoryRange(process_memory, start(), end() - start(), 0));
+    std::unique_ptr<MemoryRanges> ranges(new MemoryRanges);
+    if (!ranges->Insert(memory.release())) {
+      return nullptr;
+    }
+    // This fails only when this map already covers all of the next map,
+    // and then the ranges hold all of the elf anyway.
     ranges->Insert(new MemoryRange(process_memory, next_real_map->start(),
                                    next_real_map->end() - next_real_map->start(),
                                    next_real_map->offset() - offset()));
-
-    return ranges;
+    return ranges.release();
   }
 
   auto prev_real_map = GetPrevRealMap();
@@ -253,9 +256,10 @@ Memory* MapInfo::CreateMemory(const std::shared_ptr<Memory>& process_memory) {
                                       prev_real_map->end() - prev_real_map->start(), 0))) {
     return nullptr;
   }
-  if (!ranges->Insert(new MemoryRange(process_memory, start(), end() - start(), elf_offset()))) {
-    return nullptr;
-  }
+  // The read-only map is often rounded up to a page boundary that overlaps
+  // the start of this map. The read-only map is read for the overlap, and
+  // if it covers all of this map there is nothing left to insert.
+  ranges->Insert(new MemoryRange(process_memory, start(), end() - start(), elf_offset()));
   return ranges.release();
 }
 
@@ -28,40 +28,161 @@
 #include <procinfo/process_map.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include <unwindstack/Elf.h>
+#include <unwindstack/Epoch.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 
 namespace unwindstack {
 
+static constexpr size_t kMapNotFound = SIZE_MAX;
+
+// Every search index, and every change to the maps, gets a unique
+// generation so that a lookaside entry can never match a different, or a
+// rebuilt, Maps object.
+static std::atomic_uint64_t g_generation;
+
+namespace {
+// Consecutive lookups from one thread tend to alternate between a couple of
+// maps (i.e. the pc and sp of each frame), so remember the last two hits.
+struct FindLookaside {
+  uint64_t generation;
+  size_t entries[2];
+  size_t next;
+};
+}  // namespace
+
+static thread_local FindLookaside g_find_lookaside;
+
+static size_t FillSearchTree(const std::vector<uint64_t>& sorted, std::vector<uint64_t>* keys,
+                             std::vector<uint32_t>* order, size_t index, size_t node) {
+  if (node < keys->size()) {
+    index = FillSearchTree(sorted, keys, order, index, 2 * node);
+    (*keys)[node] = sorted[index];
+    (*order)[node] = static_cast<uint32_t>(index);
+    index = FillSearchTree(sorted, keys, order, index + 1, 2 * node + 1);
+  }
+  return index;
+}
+
+void Maps::ClearSearchIndex() {
+  // Every change to maps_ clears the index.
+  generation_ = g_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+  search_generation_ = 0;
+  search_starts_.clear();
+  search_ends_.clear();
+  search_keys_.clear();
+  search_order_.clear();
+}
+
+void Maps::BuildSearchIndex() {
+  ClearSearchIndex();
+  if (maps_.empty() || maps_.size() >= UINT32_MAX) {
+    return;
+  }
+
+  search_starts_.reserve(maps_.size());
+  search_ends_.reserve(maps_.size());
+  for (const auto& info : maps_) {
+    if (info == nullptr || (!search_starts_.empty() && info->start() < search_starts_.back())) {
+      // Not sorted, Find will use the slow path.
+      ClearSearchIndex();
+      return;
+    }
+    search_starts_.push_back(info->start());
+    search_ends_.push_back(info->end());
+  }
+
+  // Slot 0 is unused so that the children of slot k are 2k and 2k + 1.
+  search_keys_.resize(maps_.size() + 1);
+  search_order_.resize(maps_.size() + 1);
+  FillSearchTree(search_starts_, &search_keys_, &search_order_, 0, 1);
+
+  search_generation_ = g_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+size_t Maps::FindIndex(uint64_t pc) {
+  size_t total = maps_.size();
+  if (search_generation_ == 0 || total == 0 || search_starts_.size() != total) {
+    size_t first = 0;
+    size_t last = total;
+    while (first < last) {
+      size_t index = (first + last) / 2;
+      const auto& cur = maps_[index];
+      if (pc >= cur->start() && pc < cur->end()) {
+        return index;
+      } else if (pc < cur->start()) {
+        last = index;
+      } else {
+        first = index + 1;
+      }
+    }
+    return kMapNotFound;
+  }
+
+  FindLookaside& lookaside = g_find_lookaside;
+  if (lookaside.generation == search_generation_) {
+    for (size_t entry : lookaside.entries) {
+      // Check the map that was hit last, and the one right after it.
+      for (size_t index = entry; index < total && index <= entry + 1; index++) {
+        if (pc >= search_starts_[index] && pc < search_ends_[index]) {
+          return index;
+        }
+      }
+    }
+  } else {
+    lookaside = {.generation = search_generation_, .entries = {0, 0}, .next = 0};
+  }
+
+  // Branch-free descent of the Eytzinger tree. Every step moves to the
+  // right child if the key is <= pc, so the path encodes the search result.
+  const uint64_t* keys = search_keys_.data();
+  size_t node = 1;
+  while (node <= total) {
+    node = 2 * node + (keys[node] <= pc);
+  }
+  // Strip the trailing right turns and the final left turn to get the
+  // node holding the first key that is > pc. Zero means no such key.
+  node >>= __builtin_ffsll(~static_cast<long long>(node));
+  size_t upper = node == 0 ? total : search_order_[node];
+  if (upper == 0) {
+    return kMapNotFound;
+  }
+  size_t index = upper - 1;
+  if (pc >= search_ends_[index]) {
+    return kMapNotFound;
+  }
+
+  lookaside.entries[lookaside.next] = index;
+  lookaside.next ^= 1;
+  return index;
+}
+
 std::shared_ptr<MapInfo> Maps::Find(uint64_t pc) {
-  if (maps_.empty()) {
+  size_t index = FindIndex(pc);
+  if (index == kMapNotFound) {
     return nullptr;
   }
-  size_t first = 0;
-  size_t last = maps_.size();
-  while (first < last) {
-    size_t index = (first + last) / 2;
-    const auto& cur = maps_[index];
-    if (pc >= cur->start() && pc < cur->end()) {
-      return cur;
-    } else if (pc < cur->start()) {
-      last = index;
-    } else {
-      first = index + 1;
-    }
+  return maps_[index];
+}
+
+MapInfo* Maps::FindMapInfo(uint64_t pc) {
+  size_t index = FindIndex(pc);
+  if (index == kMapNotFound) {
+    return nullptr;
   }
-  return nullptr;
+  return maps_[index].get();
 }
 
 bool Maps::Parse() {
   std::shared_ptr<MapInfo> prev_map;
-  return android::procinfo::ReadMapFile(GetMapsFile(),
+  bool parsed = android::procinfo::ReadMapFile(GetMapsFile(),
                       [&](const android::procinfo::MapInfo& mapinfo) {
     // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
     auto flags = mapinfo.flags;
@@ -73,6 +194,8 @@ bool Maps::Parse() {
         MapInfo::Create(prev_map, mapinfo.start, mapinfo.end, mapinfo.pgoff, flags, mapinfo.name));
     prev_map = maps_.back();
   });
+  BuildSearchIndex();
+  return parsed;
 }
 
 void Maps::Add(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
@@ -80,6 +203,7 @@ void Maps::Add(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
   std::shared_ptr<MapInfo> prev_map(maps_.empty() ? nullptr : maps_.back());
   auto map_info = MapInfo::Create(prev_map, start, end, offset, flags, name);
   maps_.emplace_back(std::move(map_info));
+  ClearSearchIndex();
 }
 
 void Maps::Add(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
@@ -88,6 +212,7 @@ void Maps::Add(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
   auto map_info = MapInfo::Create(prev_map, start, end, offset, flags, name);
   map_info->set_load_bias(load_bias);
   maps_.emplace_back(std::move(map_info));
+  ClearSearchIndex();
 }
 
 void Maps::Sort() {
@@ -111,12 +236,14 @@ void Maps::Sort() {
     }
     prev_map = map_info;
   }
+
+  BuildSearchIndex();
 }
 
 bool BufferMaps::Parse() {
   std::string content(buffer_);
   std::shared_ptr<MapInfo> prev_map;
-  return android::procinfo::ReadMapFileContent(
+  bool parsed = android::procinfo::ReadMapFileContent(
       &content[0], [&](const android::procinfo::MapInfo& mapinfo) {
         // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
         auto flags = mapinfo.flags;
@@ -128,12 +255,48 @@ bool BufferMaps::Parse() {
                                            flags, mapinfo.name));
         prev_map = maps_.back();
       });
+  BuildSearchIndex();
+  return parsed;
 }
 
 const std::string RemoteMaps::GetMapsFile() const {
   return "/proc/" + std::to_string(pid_) + "/maps";
 }
 
+void IncrementalMaps::Map(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags,
+                          const std::string& name) {
+  if (start >= end) {
+    return;
+  }
+
+  std::vector<std::shared_ptr<MapInfo>> maps;
+  maps.reserve(maps_.size() + 2);
+  for (auto& info : maps_) {
+    if (info->end() <= start || info->start() >= end) {
+      maps.emplace_back(std::move(info));
+      continue;
+    }
+    // Keep the parts of the old map on either side of the new one. These
+    // are new objects, since the elf data of a map depends on its start.
+    if (info->start() < start) {
+      maps.emplace_back(
+          MapInfo::Create(info->start(), start, info->offset(), info->flags(), info->name()));
+    }
+    if (info->end() > end) {
+      maps.emplace_back(MapInfo::Create(end, info->end(), info->offset() + end - info->start(),
+                                        info->flags(), info->name()));
+    }
+  }
+
+  // Mark a device map in /dev/ and not in /dev/ashmem/ specially.
+  if (strncmp(name.c_str(), "/dev/", 5) == 0 && strncmp(name.c_str() + 5, "ashmem/", 7) != 0) {
+    flags |= MAPS_FLAGS_DEVICE_MAP;
+  }
+  maps.emplace_back(MapInfo::Create(start, end, offset, flags, name));
+  maps_ = std::move(maps);
+  Sort();
+}
+
 const std::string LocalUpdatableMaps::GetMapsFile() const {
   return "/proc/self/maps";
 }
@@ -160,6 +323,29 @@ std::shared_ptr<MapInfo> LocalUpdatableMaps::Find(uint64_t pc) {
   return map_info;
 }
 
+MapInfo* LocalUpdatableMaps::FindMapInfo(uint64_t pc) {
+  pthread_rwlock_rdlock(&maps_rwlock_);
+  MapInfo* map_info = Maps::FindMapInfo(pc);
+  pthread_rwlock_unlock(&maps_rwlock_);
+
+  if (map_info == nullptr) {
+    pthread_rwlock_wrlock(&maps_rwlock_);
+    if (Reparse()) {
+      map_info = Maps::FindMapInfo(pc);
+    }
+    pthread_rwlock_unlock(&maps_rwlock_);
+  }
+
+  return map_info;
+}
+
+uint64_t LocalUpdatableMaps::Generation() {
+  pthread_rwlock_rdlock(&maps_rwlock_);
+  uint64_t generation = Maps::Generation();
+  pthread_rwlock_unlock(&maps_rwlock_);
+  return generation;
+}
+
 bool LocalUpdatableMaps::Parse() {
   pthread_rwlock_wrlock(&maps_rwlock_);
   bool parsed = Maps::Parse();
@@ -172,6 +358,7 @@ bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
   size_t last_map_idx = maps_.size();
   if (!Maps::Parse()) {
     maps_.resize(last_map_idx);
+    BuildSearchIndex();
     return false;
   }
 
@@ -216,11 +403,11 @@ bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
       // Never delete these maps, they may be in use. The assumption is
       // that there will only every be a handful of these so waiting
       // to destroy them is not too expensive.
-      // Since these are all shared_ptrs, we can just remove the references.
-      // Any code still holding on to the pointer, will still have a
-      // valid pointer after this.
+      // Code holding a shared_ptr keeps its own reference, and code using
+      // a pointer from FindMapInfo is in a read section that the retired
+      // reference outlives.
       search_map_idx = old_map_idx + 1;
-      maps_[old_map_idx] = nullptr;
+      Epoch::Retire(std::move(maps_[old_map_idx]));
       num_deleted_old_entries++;
     }
     if (search_map_idx >= last_map_idx) {
@@ -229,7 +416,7 @@ bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
   }
 
   for (size_t i = search_map_idx; i < last_map_idx; i++) {
-    maps_[i] = nullptr;
+    Epoch::Retire(std::move(maps_[i]));
     num_deleted_old_entries++;
   }
 
@@ -249,6 +436,9 @@ bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
     *any_changed = num_deleted_old_entries != 0 || maps_.size() != last_map_idx;
   }
 
+  BuildSearchIndex();
+  Epoch::Reclaim();
+
   return true;
 }
 
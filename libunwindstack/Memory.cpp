@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -26,29 +27,96 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include <android-base/unique_fd.h>
 #include <android-base/macros.h> // TEMP_FAILURE_RETRY
 
 #include <unwindstack/Log.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 
 #include "MemoryBuffer.h"
 #include "MemoryCache.h"
 #include "MemoryFileAtOffset.h"
+#include "MemoryIntervals.h"
 #include "MemoryLocal.h"
 #include "MemoryOffline.h"
 #include "MemoryOfflineBuffer.h"
 #include "MemoryRange.h"
 #include "MemoryRemote.h"
+#include "MemoryStackSnapshot.h"
+
+#if defined(__BIONIC__)
+#include <bionic/mte.h>
+#else
+#define mte_supported() false
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_HWADDRESS__)
+#define UNWINDSTACK_SANITIZED
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(hwaddress_sanitizer)
+#define UNWINDSTACK_SANITIZED
+#endif
+#endif
+
+#if !defined(MADV_POPULATE_READ)
+#define MADV_POPULATE_READ 22
+#endif
 
 namespace unwindstack {
 
-static size_t ProcessVmRead(pid_t pid, uint64_t remote_src, void* dst, size_t len) {
+// Handles every request that read_direct can satisfy by itself, and
+// passes the remaining requests to read_rest in batches. read_direct
+// returns false if it did not handle the request.
+template <typename ReadDirect, typename ReadRest>
+static bool SplitReadMany(Memory::ReadRequest* requests, size_t num_requests,
+                          ReadDirect read_direct, ReadRest read_rest) {
+  constexpr size_t kMaxForwarded = 32;
+  Memory::ReadRequest forwarded[kMaxForwarded];
+  size_t forwarded_index[kMaxForwarded];
+  size_t num_forwarded = 0;
+
+  bool all_read = true;
+  for (size_t i = 0; i <= num_requests; i++) {
+    if (i < num_requests) {
+      Memory::ReadRequest& request = requests[i];
+      if (read_direct(request)) {
+        all_read &= request.success;
+        continue;
+      }
+      forwarded[num_forwarded] = request;
+      forwarded_index[num_forwarded++] = i;
+      if (num_forwarded != kMaxForwarded) {
+        continue;
+      }
+    }
+    if (num_forwarded == 0) {
+      continue;
+    }
+    all_read &= read_rest(forwarded, num_forwarded);
+    for (size_t j = 0; j < num_forwarded; j++) {
+      requests[forwarded_index[j]].success = forwarded[j].success;
+    }
+    num_forwarded = 0;
+  }
+  return all_read;
+}
+
+// If syscalls is not null, it is incremented for every system call made.
+static size_t ProcessVmRead(pid_t pid, uint64_t remote_src, void* dst, size_t len,
+                            uint64_t* syscalls = nullptr) {
 
   // Split up the remote read across page boundaries.
   // From the manpage:
@@ -96,6 +164,9 @@ static size_t ProcessVmRead(pid_t pid, uint64_t remote_src, void* dst, size_t le
     }
 
     ssize_t rc = process_vm_readv(pid, &dst_iov, 1, src_iovs, iovecs_used, 0);
+    if (syscalls != nullptr) {
+      (*syscalls)++;
+    }
     if (rc == -1) {
       return total_read;
     }
@@ -104,7 +175,91 @@ static size_t ProcessVmRead(pid_t pid, uint64_t remote_src, void* dst, size_t le
   return total_read;
 }
 
-static bool PtraceReadLong(pid_t pid, uint64_t addr, long* value) {
+static bool ProcessVmReadMany(pid_t pid, Memory::ReadRequest* requests, size_t num_requests,
+                              uint64_t* syscalls = nullptr) {
+  // Pack as many requests as possible into a single process_vm_readv call.
+  // Every request gets one local iovec, and one remote iovec per page
+  // that it touches, so that a partial read always ends at an iovec
+  // boundary (see ProcessVmRead).
+  constexpr size_t kMaxIovecs = 64;
+  struct iovec src_iovs[kMaxIovecs];
+  struct iovec dst_iovs[kMaxIovecs];
+  size_t batch[kMaxIovecs];
+  size_t page_size = getpagesize();
+
+  bool all_read = true;
+  size_t next = 0;
+  while (next < num_requests) {
+    size_t src_used = 0;
+    size_t batch_size = 0;
+    while (next < num_requests) {
+      Memory::ReadRequest& request = requests[next];
+      uint64_t end;
+      if (request.size == 0) {
+        request.success = true;
+        next++;
+        continue;
+      }
+      if (__builtin_add_overflow(request.addr, request.size, &end) || end - 1 >= UINTPTR_MAX) {
+        request.success = false;
+        all_read = false;
+        next++;
+        continue;
+      }
+      size_t pages = ((end - 1) / page_size) - (request.addr / page_size) + 1;
+      if (src_used + pages > kMaxIovecs) {
+        if (batch_size == 0) {
+          // Too large to batch, do it by itself.
+          request.success =
+              ProcessVmRead(pid, request.addr, request.dst, request.size, syscalls) == request.size;
+          all_read &= request.success;
+          next++;
+        }
+        break;
+      }
+
+      uint64_t cur = request.addr;
+      while (cur < end) {
+        size_t iov_len = std::min(page_size - (cur & (page_size - 1)), end - cur);
+        src_iovs[src_used].iov_base = reinterpret_cast<void*>(cur);
+        src_iovs[src_used].iov_len = iov_len;
+        src_used++;
+        cur += iov_len;
+      }
+      dst_iovs[batch_size].iov_base = request.dst;
+      dst_iovs[batch_size].iov_len = request.size;
+      batch[batch_size++] = next++;
+    }
+    if (batch_size == 0) {
+      continue;
+    }
+
+    ssize_t rc = process_vm_readv(pid, dst_iovs, batch_size, src_iovs, src_used, 0);
+    if (syscalls != nullptr) {
+      (*syscalls)++;
+    }
+    size_t bytes = rc == -1 ? 0 : rc;
+    for (size_t i = 0; i < batch_size; i++) {
+      Memory::ReadRequest& request = requests[batch[i]];
+      if (bytes >= request.size) {
+        request.success = true;
+        bytes -= request.size;
+        continue;
+      }
+      // The transfer stopped in this request, retry it by itself to
+      // find out how much can be read, and start a new batch after it.
+      request.success =
+          ProcessVmRead(pid, request.addr, request.dst, request.size, syscalls) == request.size;
+      all_read &= request.success;
+      next = batch[i] + 1;
+      break;
+    }
+  }
+  return all_read;
+}
+
+static bool PtraceReadLong(pid_t pid, uint64_t addr, long* value, uint64_t* syscalls) {
+  (*syscalls)++;
   // ptrace() returns -1 and sets errno when the operation fails.
   // To disambiguate -1 from a valid result, we clear errno beforehand.
   errno = 0;
@@ -115,7 +270,7 @@ static bool PtraceReadLong(pid_t pid, uint64_t addr, long* value) {
   return true;
 }
 
-static size_t PtraceRead(pid_t pid, uint64_t addr, void* dst, size_t bytes) {
+static size_t PtraceRead(pid_t pid, uint64_t addr, void* dst, size_t bytes, uint64_t* syscalls) {
   // Make sure that there is no overflow.
   uint64_t max_size;
   if (__builtin_add_overflow(addr, bytes, &max_size)) {
@@ -126,7 +281,7 @@ static size_t PtraceRead(pid_t pid, uint64_t addr, void* dst, size_t bytes) {
   long data;
   size_t align_bytes = addr & (sizeof(long) - 1);
   if (align_bytes != 0) {
-    if (!PtraceReadLong(pid, addr & ~(sizeof(long) - 1), &data)) {
+    if (!PtraceReadLong(pid, addr & ~(sizeof(long) - 1), &data, syscalls)) {
       return 0;
     }
     size_t copy_bytes = std::min(sizeof(long) - align_bytes, bytes);
@@ -138,7 +293,7 @@ static size_t PtraceRead(pid_t pid, uint64_t addr, void* dst, size_t bytes) {
   }
 
   for (size_t i = 0; i < bytes / sizeof(long); i++) {
-    if (!PtraceReadLong(pid, addr, &data)) {
+    if (!PtraceReadLong(pid, addr, &data, syscalls)) {
       return bytes_read;
     }
     memcpy(dst, &data, sizeof(long));
@@ -149,7 +304,7 @@ static size_t PtraceRead(pid_t pid, uint64_t addr, void* dst, size_t bytes) {
 
   size_t left_over = bytes & (sizeof(long) - 1);
   if (left_over) {
-    if (!PtraceReadLong(pid, addr, &data)) {
+    if (!PtraceReadLong(pid, addr, &data, syscalls)) {
       return bytes_read;
     }
     memcpy(dst, &data, left_over);
@@ -163,34 +318,77 @@ bool Memory::ReadFully(uint64_t addr, void* dst, size_t size) {
   return rc == size;
 }
 
+bool Memory::ReadMany(ReadRequest* requests, size_t num_requests) {
+  bool all_read = true;
+  for (size_t i = 0; i < num_requests; i++) {
+    requests[i].success = ReadFully(requests[i].addr, requests[i].dst, requests[i].size);
+    all_read &= requests[i].success;
+  }
+  return all_read;
+}
+
 bool Memory::ReadString(uint64_t addr, std::string* dst, size_t max_read) {
   char buffer[256];  // Large enough for 99% of symbol names.
-  size_t size = 0;   // Number of bytes which were read into the buffer.
-  for (size_t offset = 0; offset < max_read; offset += size) {
-    // Look for null-terminator first, so we can allocate string of exact size.
-    // If we know the end of valid memory range, do the reads in larger blocks.
-    size_t read = std::min(sizeof(buffer), max_read - offset);
-    size = Read(addr + offset, buffer, read);
+  size_t size = Read(addr, buffer, std::min(sizeof(buffer), max_read));
+  if (size == 0) {
+    return false;
+  }
+  const char* nul = static_cast<const char*>(memchr(buffer, '\0', size));
+  if (nul != nullptr) {
+    dst->assign(buffer, nul - buffer);
+    return true;
+  }
+
+  // Keep what has been read and continue reading directly into the string,
+  // a page at a time, rather than reading the whole string a second time.
+  std::string str(buffer, size);
+  size_t page_size = getpagesize();
+  for (size_t offset = size; offset < max_read; offset += size) {
+    uint64_t cur;
+    if (__builtin_add_overflow(addr, offset, &cur)) {
+      return false;
+    }
+    size_t read = std::min(page_size - (cur & (page_size - 1)), max_read - offset);
+    str.resize(offset + read);
+    size = Read(cur, &str[offset], read);
     if (size == 0) {
       return false;  // We have not found end of string yet and we can not read more data.
     }
-    size_t length = strnlen(buffer, size);  // Index of the null-terminator.
-    if (length < size) {
-      // We found the null-terminator. Allocate the string and set its content.
-      if (offset == 0) {
-        // We did just single read, so the buffer already contains the whole string.
-        dst->assign(buffer, length);
-        return true;
-      } else {
-        // The buffer contains only the last block. Read the whole string again.
-        dst->assign(offset + length, '\0');
-        return ReadFully(addr, dst->data(), dst->size());
-      }
+    nul = static_cast<const char*>(memchr(&str[offset], '\0', size));
+    if (nul != nullptr) {
+      str.resize(nul - str.data());
+      *dst = std::move(str);
+      return true;
     }
   }
   return false;
 }
 
+bool Memory::ReadStringView(uint64_t addr, std::string_view* dst, size_t max_read,
+                            std::string* storage) {
+  if (!ReadString(addr, storage, max_read)) {
+    return false;
+  }
+  *dst = *storage;
+  return true;
+}
+
+// Finds the string at addr in size bytes of contiguous data.
+static bool ContiguousStringView(const uint8_t* data, size_t size, uint64_t addr, size_t max_read,
+                                 std::string_view* dst) {
+  if (addr >= size) {
+    return false;
+  }
+  const char* str = reinterpret_cast<const char*>(data + addr);
+  size_t length = std::min(size - static_cast<size_t>(addr), max_read);
+  const char* nul = static_cast<const char*>(memchr(str, '\0', length));
+  if (nul == nullptr) {
+    return false;
+  }
+  *dst = std::string_view(str, nul - str);
+  return true;
+}
+
 std::unique_ptr<Memory> Memory::CreateFileMemory(const std::string& path, uint64_t offset,
                                                  uint64_t size) {
   auto memory = std::make_unique<MemoryFileAtOffset>();
@@ -216,6 +414,13 @@ std::shared_ptr<Memory> Memory::CreateProcessMemoryCached(pid_t pid) {
   return std::shared_ptr<Memory>(new MemoryCache(new MemoryRemote(pid)));
 }
 
+std::shared_ptr<Memory> Memory::CreateProcessMemoryCached(pid_t pid, size_t max_cached_bytes) {
+  if (pid == getpid()) {
+    return std::shared_ptr<Memory>(new MemoryCache(new MemoryLocal(), max_cached_bytes));
+  }
+  return std::shared_ptr<Memory>(new MemoryCache(new MemoryRemote(pid), max_cached_bytes));
+}
+
 std::shared_ptr<Memory> Memory::CreateProcessMemoryThreadCached(pid_t pid) {
   if (pid == getpid()) {
     return std::shared_ptr<Memory>(new MemoryThreadCache(new MemoryLocal()));
@@ -223,6 +428,14 @@ std::shared_ptr<Memory> Memory::CreateProcessMemoryThreadCached(pid_t pid) {
   return std::shared_ptr<Memory>(new MemoryThreadCache(new MemoryRemote(pid)));
 }
 
+std::shared_ptr<Memory> Memory::CreateProcessMemoryThreadCached(pid_t pid,
+                                                                size_t max_cached_bytes) {
+  if (pid == getpid()) {
+    return std::shared_ptr<Memory>(new MemoryThreadCache(new MemoryLocal(), max_cached_bytes));
+  }
+  return std::shared_ptr<Memory>(new MemoryThreadCache(new MemoryRemote(pid), max_cached_bytes));
+}
+
 std::shared_ptr<Memory> Memory::CreateOfflineMemory(const uint8_t* data, uint64_t start,
                                                     uint64_t end) {
   return std::shared_ptr<Memory>(new MemoryOfflineBuffer(data, start, end));
@@ -241,6 +454,20 @@ size_t MemoryBuffer::Read(uint64_t addr, void* dst, size_t size) {
   return actual_len;
 }
 
+bool MemoryBuffer::ReadString(uint64_t addr, std::string* dst, size_t max_read) {
+  std::string_view view;
+  if (!ContiguousStringView(raw_, size_, addr, max_read, &view)) {
+    return false;
+  }
+  dst->assign(view);
+  return true;
+}
+
+bool MemoryBuffer::ReadStringView(uint64_t addr, std::string_view* dst, size_t max_read,
+                                  std::string*) {
+  return ContiguousStringView(raw_, size_, addr, max_read, dst);
+}
+
 uint8_t* MemoryBuffer::GetPtr(size_t offset) {
   if (offset < size_) {
     return &raw_[offset];
@@ -248,52 +475,157 @@ uint8_t* MemoryBuffer::GetPtr(size_t offset) {
   return nullptr;
 }
 
+// A read-only mapping of a page aligned window of a file.
+struct FileMapping {
+  ~FileMapping() { munmap(data, length); }
+
+  dev_t dev;
+  ino_t ino;
+  off_t file_size;
+  struct timespec mtime;
+  uint64_t offset;
+  size_t length;
+  uint8_t* data;
+
+  bool SameFile(const struct stat& buf) const {
+    return dev == buf.st_dev && ino == buf.st_ino && file_size == buf.st_size &&
+           mtime.tv_sec == buf.st_mtim.tv_sec && mtime.tv_nsec == buf.st_mtim.tv_nsec;
+  }
+};
+
+// Process wide set of the file mappings in use. It only holds weak
+// references, a mapping goes away with the last object using it.
+class FileMappings {
+ public:
+  std::shared_ptr<FileMapping> Find(const struct stat& buf, uint64_t offset, size_t length) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto entry = mappings_.find(std::make_pair(buf.st_dev, buf.st_ino));
+    if (entry == mappings_.end()) {
+      return nullptr;
+    }
+    for (const auto& weak_mapping : entry->second) {
+      std::shared_ptr<FileMapping> mapping = weak_mapping.lock();
+      if (mapping != nullptr && mapping->SameFile(buf) && mapping->offset <= offset &&
+          offset - mapping->offset + length <= mapping->length) {
+        return mapping;
+      }
+    }
+    return nullptr;
+  }
+
+  void Add(const std::shared_ptr<FileMapping>& mapping) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto& file_mappings = mappings_[std::make_pair(mapping->dev, mapping->ino)];
+    file_mappings.erase(std::remove_if(file_mappings.begin(), file_mappings.end(),
+                                       [](const std::weak_ptr<FileMapping>& weak_mapping) {
+                                         return weak_mapping.expired();
+                                       }),
+                        file_mappings.end());
+    file_mappings.emplace_back(mapping);
+
+    if (mappings_.size() > 2 * files_after_prune_) {
+      // Drop the files that are no longer mapped.
+      for (auto it = mappings_.begin(); it != mappings_.end();) {
+        bool in_use = std::any_of(it->second.begin(), it->second.end(),
+                                  [](const std::weak_ptr<FileMapping>& weak_mapping) {
+                                    return !weak_mapping.expired();
+                                  });
+        it = in_use ? std::next(it) : mappings_.erase(it);
+      }
+      files_after_prune_ = std::max<size_t>(mappings_.size(), kMinFilesToPrune);
+    }
+  }
+
+  static FileMappings* Get() {
+    static FileMappings* mappings = new FileMappings;
+    return mappings;
+  }
+
+ private:
+  static constexpr size_t kMinFilesToPrune = 64;
+
+  std::mutex lock_;
+  std::map<std::pair<dev_t, ino_t>, std::vector<std::weak_ptr<FileMapping>>> mappings_;
+  size_t files_after_prune_ = kMinFilesToPrune;
+};
+
 MemoryFileAtOffset::~MemoryFileAtOffset() {
   Clear();
 }
 
 void MemoryFileAtOffset::Clear() {
-  if (data_) {
-    munmap(&data_[-offset_], size_ + offset_);
-    data_ = nullptr;
-  }
+  mapping_.reset();
+  data_ = nullptr;
 }
 
 bool MemoryFileAtOffset::Init(const std::string& file, uint64_t offset, uint64_t size) {
   // Clear out any previous data if it exists.
   Clear();
 
-  android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(file.c_str(), O_RDONLY | O_CLOEXEC)));
-  if (fd == -1) {
-    return false;
-  }
+  // Only stat the file to start with, the file does not need to be opened
+  // if another object already has this part of the file mapped.
   struct stat buf;
-  if (fstat(fd, &buf) == -1) {
-    return false;
-  }
-  if (offset >= static_cast<uint64_t>(buf.st_size)) {
+  if (stat(file.c_str(), &buf) == -1) {
     return false;
   }
+  android::base::unique_fd fd;
+  uint64_t aligned_offset;
+  while (true) {
+    if (offset >= static_cast<uint64_t>(buf.st_size)) {
+      return false;
+    }
 
-  offset_ = offset & (getpagesize() - 1);
-  uint64_t aligned_offset = offset & ~(getpagesize() - 1);
-  if (aligned_offset > static_cast<uint64_t>(buf.st_size) ||
-      offset > static_cast<uint64_t>(buf.st_size)) {
-    return false;
-  }
+    offset_ = offset & (getpagesize() - 1);
+    aligned_offset = offset & ~(getpagesize() - 1);
+    if (aligned_offset > static_cast<uint64_t>(buf.st_size) ||
+        offset > static_cast<uint64_t>(buf.st_size)) {
+      return false;
+    }
 
-  size_ = buf.st_size - aligned_offset;
-  uint64_t max_size;
-  if (!__builtin_add_overflow(size, offset_, &max_size) && max_size < size_) {
-    // Truncate the mapped size.
-    size_ = max_size;
+    size_ = buf.st_size - aligned_offset;
+    uint64_t max_size;
+    if (!__builtin_add_overflow(size, offset_, &max_size) && max_size < size_) {
+      // Truncate the mapped size.
+      size_ = max_size;
+    }
+
+    mapping_ = FileMappings::Get()->Find(buf, aligned_offset, size_);
+    if (mapping_ != nullptr || fd != -1) {
+      break;
+    }
+
+    fd.reset(TEMP_FAILURE_RETRY(open(file.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+      return false;
+    }
+    struct stat fd_buf;
+    if (fstat(fd, &fd_buf) == -1) {
+      return false;
+    }
+    // Use what was actually opened, in case the file changed after the stat.
+    bool same_size = fd_buf.st_size == buf.st_size;
+    buf = fd_buf;
+    if (same_size) {
+      break;
+    }
   }
-  void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
-  if (map == MAP_FAILED) {
-    return false;
+
+  if (mapping_ == nullptr) {
+    void* map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, aligned_offset);
+    if (map == MAP_FAILED) {
+      return false;
+    }
+    mapping_.reset(new FileMapping{.dev = buf.st_dev,
+                                   .ino = buf.st_ino,
+                                   .file_size = buf.st_size,
+                                   .mtime = buf.st_mtim,
+                                   .offset = aligned_offset,
+                                   .length = size_,
+                                   .data = reinterpret_cast<uint8_t*>(map)});
+    FileMappings::Get()->Add(mapping_);
   }
 
-  data_ = &reinterpret_cast<uint8_t*>(map)[offset_];
+  data_ = &mapping_->data[aligned_offset - mapping_->offset + offset_];
   size_ -= offset_;
 
   return true;
@@ -312,6 +644,136 @@ size_t MemoryFileAtOffset::Read(uint64_t addr, void* dst, size_t size) {
   return actual_len;
 }
 
+bool MemoryFileAtOffset::ReadString(uint64_t addr, std::string* dst, size_t max_read) {
+  std::string_view view;
+  if (!ContiguousStringView(data_, size_, addr, max_read, &view)) {
+    return false;
+  }
+  dst->assign(view);
+  return true;
+}
+
+bool MemoryFileAtOffset::ReadStringView(uint64_t addr, std::string_view* dst, size_t max_read,
+                                        std::string*) {
+  return ContiguousStringView(data_, size_, addr, max_read, dst);
+}
+
+bool MemoryFileAtOffset::Prefetch(uint64_t addr, uint64_t size, PrefetchMode mode) {
+  if (mode == PREFETCH_NONE || addr >= size_ || size == 0) {
+    return false;
+  }
+
+  size_t len = std::min(static_cast<uint64_t>(size_ - addr), size);
+  // The mapping itself is page aligned, so aligning down stays inside it.
+  uintptr_t page_mask = getpagesize() - 1;
+  uintptr_t start = reinterpret_cast<uintptr_t>(data_ + addr) & ~page_mask;
+  uintptr_t end = reinterpret_cast<uintptr_t>(data_ + addr + len);
+  void* ptr = reinterpret_cast<void*>(start);
+  if (mode == PREFETCH_POPULATE && madvise(ptr, end - start, MADV_POPULATE_READ) == 0) {
+    return true;
+  }
+  // Kernels before 5.14 do not support populating, fall back to the hint.
+  return madvise(ptr, end - start, MADV_WILLNEED) == 0;
+}
+
+MemoryRemote::~MemoryRemote() {
+  int fd = proc_mem_fd_.load();
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+int MemoryRemote::GetProcMemFd() {
+  int fd = proc_mem_fd_.load();
+  if (fd != -1) {
+    return fd;
+  }
+  std::string path = "/proc/" + std::to_string(pid_) + "/mem";
+  int new_fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  // Remember failures too (as -2) so that the open is only tried once.
+  int value = new_fd >= 0 ? new_fd : -2;
+  if (!proc_mem_fd_.compare_exchange_strong(fd, value)) {
+    // Another thread opened the file first, use that one.
+    if (new_fd >= 0) {
+      close(new_fd);
+    }
+    return fd;
+  }
+  return value;
+}
+
+size_t MemoryRemote::ProcMemRead(uint64_t addr, void* dst, size_t size, uint64_t* syscalls) {
+  int fd = GetProcMemFd();
+  if (fd < 0) {
+    return 0;
+  }
+  // The file offset is the address, which must fit in an off64_t.
+  uint64_t max_size;
+  if (__builtin_add_overflow(addr, size, &max_size) || max_size > INT64_MAX) {
+    return 0;
+  }
+  // A single pread covers any number of pages. It stops at the first
+  // page that cannot be read, and fails if that is the first one.
+  size_t total_read = 0;
+  while (total_read < size) {
+    ssize_t bytes = TEMP_FAILURE_RETRY(pread64(fd, &reinterpret_cast<uint8_t*>(dst)[total_read],
+                                               size - total_read, addr + total_read));
+    (*syscalls)++;
+    if (bytes <= 0) {
+      break;
+    }
+    total_read += bytes;
+  }
+  return total_read;
+}
+
+size_t MemoryRemote::ReadWithBackend(Backend backend, uint64_t addr, void* dst, size_t size) {
+  std::chrono::steady_clock::time_point start;
+  if (collect_stats_) {
+    start = std::chrono::steady_clock::now();
+  }
+  size_t bytes;
+  uint64_t syscalls = 0;
+  switch (backend) {
+    case BACKEND_PROCESS_VM_READV:
+      bytes = ProcessVmRead(pid_, addr, dst, size, &syscalls);
+      break;
+    case BACKEND_PROC_MEM:
+      bytes = ProcMemRead(addr, dst, size, &syscalls);
+      break;
+    case BACKEND_PTRACE:
+      bytes = PtraceRead(pid_, addr, dst, size, &syscalls);
+      break;
+    default:
+      return 0;
+  }
+  if (collect_stats_) {
+    AddStats(backend, bytes, syscalls, std::chrono::steady_clock::now() - start);
+  }
+  return bytes;
+}
+
+void MemoryRemote::AddStats(Backend backend, uint64_t bytes, uint64_t syscalls,
+                            std::chrono::nanoseconds elapsed) {
+  AtomicBackendStats& stats = stats_[backend];
+  stats.reads.fetch_add(1, std::memory_order_relaxed);
+  stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  stats.syscalls.fetch_add(syscalls, std::memory_order_relaxed);
+  stats.nanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+MemoryRemote::BackendStats MemoryRemote::GetStats(Backend backend) {
+  BackendStats stats;
+  if (backend == BACKEND_NONE || backend > BACKEND_MAX) {
+    return stats;
+  }
+  stats.reads = stats_[backend].reads.load(std::memory_order_relaxed);
+  stats.bytes = stats_[backend].bytes.load(std::memory_order_relaxed);
+  stats.syscalls = stats_[backend].syscalls.load(std::memory_order_relaxed);
+  stats.nanoseconds = stats_[backend].nanoseconds.load(std::memory_order_relaxed);
+  return stats;
+}
+
 size_t MemoryRemote::Read(uint64_t addr, void* dst, size_t size) {
 #if !defined(__LP64__)
   // Cannot read an address greater than 32 bits in a 32 bit context.
@@ -320,33 +782,221 @@ size_t MemoryRemote::Read(uint64_t addr, void* dst, size_t size) {
   }
 #endif
 
-  size_t (*read_func)(pid_t, uint64_t, void*, size_t) =
-      reinterpret_cast<size_t (*)(pid_t, uint64_t, void*, size_t)>(read_redirect_func_.load());
-  if (read_func != nullptr) {
-    return read_func(pid_, addr, dst, size);
-  } else {
-    // Prefer process_vm_read, try it first. If it doesn't work, use the
-    // ptrace function. If at least one of them returns at least some data,
-    // set that as the permanent function to use.
-    // This assumes that if process_vm_read works once, it will continue
-    // to work.
-    size_t bytes = ProcessVmRead(pid_, addr, dst, size);
+  Backend backend = backend_.load();
+  if (backend != BACKEND_NONE) {
+    return ReadWithBackend(backend, addr, dst, size);
+  }
+
+  // Try each backend, preferring process_vm_readv. If one of them returns
+  // at least some data, set that as the permanent backend to use.
+  // This assumes that if a backend works once, it will continue to work.
+  for (uint8_t i = BACKEND_NONE + 1; i <= BACKEND_MAX; i++) {
+    backend = static_cast<Backend>(i);
+    size_t bytes = ReadWithBackend(backend, addr, dst, size);
     if (bytes > 0) {
-      read_redirect_func_ = reinterpret_cast<uintptr_t>(ProcessVmRead);
+      backend_ = backend;
       return bytes;
     }
-    bytes = PtraceRead(pid_, addr, dst, size);
-    if (bytes > 0) {
-      read_redirect_func_ = reinterpret_cast<uintptr_t>(PtraceRead);
+  }
+  return 0;
+}
+
+bool MemoryRemote::ReadMany(ReadRequest* requests, size_t num_requests) {
+  if (backend_.load() != BACKEND_PROCESS_VM_READV) {
+    // Only process_vm_readv can batch disjoint reads, or no read has
+    // been done yet to pick the backend.
+    return Memory::ReadMany(requests, num_requests);
+  }
+
+  if (!collect_stats_) {
+    return ProcessVmReadMany(pid_, requests, num_requests);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  uint64_t syscalls = 0;
+  bool all_read = ProcessVmReadMany(pid_, requests, num_requests, &syscalls);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < num_requests; i++) {
+    if (requests[i].success) {
+      bytes += requests[i].size;
     }
-    return bytes;
   }
+  AddStats(BACKEND_PROCESS_VM_READV, bytes, syscalls, elapsed);
+  return all_read;
+}
+
+// The part of the calling thread's stack above the current frame belongs
+// to live frames, so it is always mapped and can be read with plain loads
+// instead of a system call.
+struct ThreadStackBounds {
+  bool initialized = false;
+  uintptr_t start = 0;
+  uintptr_t end = 0;
+};
+
+static const ThreadStackBounds& GetThreadStackBounds() {
+  static thread_local ThreadStackBounds bounds;
+  if (bounds.initialized) {
+    return bounds;
+  }
+  bounds.initialized = true;
+
+#if defined(UNWINDSTACK_SANITIZED)
+  // Reading the frames of other functions trips the sanitizers.
+  return bounds;
+#else
+  if (mte_supported()) {
+    // Stack tagging would make loads through an untagged pointer fault.
+    return bounds;
+  }
+
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+    return bounds;
+  }
+  void* stack_addr;
+  size_t stack_size;
+  if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0) {
+    bounds.start = reinterpret_cast<uintptr_t>(stack_addr);
+    bounds.end = bounds.start + stack_size;
+  }
+  pthread_attr_destroy(&attr);
+  return bounds;
+#endif
+}
+
+bool MemoryLocal::CanReadDirectly(uint64_t addr, size_t size) {
+  const ThreadStackBounds& bounds = GetThreadStackBounds();
+  // The whole page holding the current frame is mapped, not only the part
+  // above the frame.
+  uintptr_t frame = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  uintptr_t start = frame & ~static_cast<uintptr_t>(getpagesize() - 1);
+  if (frame < bounds.start || frame >= bounds.end) {
+    // Running on a different stack, such as a signal alternate stack.
+    return false;
+  }
+  start = std::max(start, bounds.start);
+  return addr >= start && addr < bounds.end && size <= bounds.end - addr;
 }
 
 size_t MemoryLocal::Read(uint64_t addr, void* dst, size_t size) {
+  if (CanReadDirectly(addr, size)) {
+    memcpy(dst, reinterpret_cast<void*>(static_cast<uintptr_t>(addr)), size);
+    return size;
+  }
   return ProcessVmRead(getpid(), addr, dst, size);
 }
 
+bool MemoryLocal::ReadMany(ReadRequest* requests, size_t num_requests) {
+  return SplitReadMany(
+      requests, num_requests,
+      [](ReadRequest& request) {
+        if (!CanReadDirectly(request.addr, request.size)) {
+          return false;
+        }
+        memcpy(request.dst, reinterpret_cast<void*>(static_cast<uintptr_t>(request.addr)),
+               request.size);
+        request.success = true;
+        return true;
+      },
+      [](ReadRequest* forwarded, size_t num_forwarded) {
+        return ProcessVmReadMany(getpid(), forwarded, num_forwarded);
+      });
+}
+
+std::shared_ptr<MemoryStackSnapshot> MemoryStackSnapshot::Create(
+    const std::shared_ptr<Memory>& process_memory, Maps* maps, uint64_t sp, size_t size) {
+  std::shared_ptr<MapInfo> map_info = maps->Find(sp);
+  if (map_info == nullptr || !(map_info->flags() & PROT_READ) ||
+      (map_info->flags() & MAPS_FLAGS_DEVICE_MAP)) {
+    return nullptr;
+  }
+  std::shared_ptr<MemoryStackSnapshot> snapshot(new MemoryStackSnapshot(process_memory));
+  if (!snapshot->Snapshot(sp, map_info->end(), size)) {
+    return nullptr;
+  }
+  return snapshot;
+}
+
+bool MemoryStackSnapshot::Snapshot(uint64_t sp, uint64_t stack_end, size_t size) {
+  start_ = sp;
+  end_ = sp;
+  max_read_end_ = sp;
+  stack_end_ = stack_end;
+  if (sp >= stack_end) {
+    return false;
+  }
+  size = std::min<uint64_t>(size, stack_end - sp);
+  data_.reset(new uint8_t[size]);
+  capacity_ = size;
+  // This is done as one read so that the backing memory can get all of
+  // the pages in a single system call.
+  size_t bytes = process_memory_->Read(sp, data_.get(), size);
+  end_ = sp + bytes;
+  return bytes != 0;
+}
+
+void MemoryStackSnapshot::SetStack(uint64_t sp, const void* data, size_t size) {
+  if (size > capacity_) {
+    data_.reset(new uint8_t[size]);
+    capacity_ = size;
+  }
+  memcpy(data_.get(), data, size);
+  start_ = sp;
+  end_ = sp + size;
+  max_read_end_ = sp;
+  stack_end_ = end_;
+}
+
+size_t MemoryStackSnapshot::Read(uint64_t addr, void* dst, size_t size) {
+  if (addr >= start_ && addr < stack_end_) {
+    uint64_t read_end = size < stack_end_ - addr ? addr + size : stack_end_;
+    max_read_end_ = std::max(max_read_end_, read_end);
+  }
+  if (addr < start_ || addr >= end_) {
+    return process_memory_->Read(addr, dst, size);
+  }
+
+  size_t bytes = std::min<uint64_t>(size, end_ - addr);
+  memcpy(dst, &data_[addr - start_], bytes);
+  if (bytes == size) {
+    return bytes;
+  }
+  return bytes +
+         process_memory_->Read(end_, &reinterpret_cast<uint8_t*>(dst)[bytes], size - bytes);
+}
+
+bool MemoryStackSnapshot::ReadMany(ReadRequest* requests, size_t num_requests) {
+  return SplitReadMany(
+      requests, num_requests,
+      [this](ReadRequest& request) {
+        if (request.addr >= start_ && request.addr < end_ && request.size <= end_ - request.addr) {
+          request.success = Read(request.addr, request.dst, request.size) == request.size;
+          return true;
+        }
+        if (request.addr >= start_ && request.addr < stack_end_) {
+          uint64_t read_end =
+              request.size < stack_end_ - request.addr ? request.addr + request.size : stack_end_;
+          max_read_end_ = std::max(max_read_end_, read_end);
+        }
+        return false;
+      },
+      [this](ReadRequest* forwarded, size_t num_forwarded) {
+        return process_memory_->ReadMany(forwarded, num_forwarded);
+      });
+}
+
+size_t MemoryStackSnapshot::NextSize(size_t last_size, size_t bytes_used) {
+  size_t page_size = getpagesize();
+  // Leave some room for the unwind going a little deeper next time.
+  size_t size = bytes_used + bytes_used / 2 + page_size;
+  size = std::max(size, last_size / 2);
+  size = std::clamp(size, kMinSize, kMaxSize);
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
 MemoryRange::MemoryRange(const std::shared_ptr<Memory>& memory, uint64_t begin, uint64_t length,
                          uint64_t offset)
     : memory_(memory), begin_(begin), length_(length), offset_(offset) {}
@@ -370,6 +1020,88 @@ size_t MemoryRange::Read(uint64_t addr, void* dst, size_t size) {
   return memory_->Read(read_addr, dst, read_length);
 }
 
+bool MemoryIntervals::Insert(uint64_t start, uint64_t end, Memory* memory) {
+  if (start >= end) {
+    return false;
+  }
+  size_t index = UpperBound(start);
+  if (index != intervals_.size() && intervals_[index].start < end) {
+    return false;
+  }
+  intervals_.insert(intervals_.begin() + index, Interval{start, end, memory});
+  return true;
+}
+
+bool MemoryIntervals::InsertUncovered(uint64_t start, uint64_t end, Memory* memory) {
+  std::vector<Interval> gaps;
+  for (size_t index = UpperBound(start); index < intervals_.size() && start < end; index++) {
+    const Interval& interval = intervals_[index];
+    if (interval.start >= end) {
+      break;
+    }
+    if (interval.start > start) {
+      gaps.push_back(Interval{start, interval.start, memory});
+    }
+    start = interval.end;
+  }
+  if (start < end) {
+    gaps.push_back(Interval{start, end, memory});
+  }
+  for (const Interval& gap : gaps) {
+    Insert(gap.start, gap.end, gap.memory);
+  }
+  return !gaps.empty();
+}
+
+size_t MemoryIntervals::UpperBound(uint64_t addr) const {
+  const Interval* base = intervals_.data();
+  size_t num = intervals_.size();
+  if (num == 0) {
+    return 0;
+  }
+  // The first interval that ends after addr is always in [base, base + num].
+  while (num > 1) {
+    size_t half = num / 2;
+    base = (base[half - 1].end <= addr) ? base + half : base;
+    num -= half;
+  }
+  return (base - intervals_.data()) + (base->end <= addr);
+}
+
+size_t MemoryIntervals::FindIndex(uint64_t addr) {
+  size_t index = last_index_.load(std::memory_order_relaxed);
+  if (index < intervals_.size() && addr >= intervals_[index].start &&
+      addr < intervals_[index].end) {
+    return index;
+  }
+  index = UpperBound(addr);
+  if (index == intervals_.size() || addr < intervals_[index].start) {
+    return kNotFound;
+  }
+  last_index_.store(index, std::memory_order_relaxed);
+  return index;
+}
+
+size_t MemoryIntervals::Read(uint64_t addr, void* dst, size_t size) {
+  uint8_t* data = reinterpret_cast<uint8_t*>(dst);
+  size_t total = 0;
+  while (total < size) {
+    size_t index = FindIndex(addr);
+    if (index == kNotFound) {
+      break;
+    }
+    size_t bytes = intervals_[index].memory->Read(addr, &data[total], size - total);
+    if (bytes == 0) {
+      break;
+    }
+    total += bytes;
+    if (__builtin_add_overflow(addr, bytes, &addr)) {
+      break;
+    }
+  }
+  return total;
+}
+
 bool MemoryRanges::Insert(MemoryRange* memory) {
   uint64_t last_addr;
   if (__builtin_add_overflow(memory->offset(), memory->length(), &last_addr)) {
@@ -379,20 +1111,17 @@ bool MemoryRanges::Insert(MemoryRange* memory) {
     // value.
     last_addr = UINT64_MAX;
   }
-  auto entry = maps_.try_emplace(last_addr, memory);
-  if (entry.second) {
-    return true;
+  // When ranges overlap, the range inserted first is the one that is read.
+  if (!intervals_.InsertUncovered(memory->offset(), last_addr, memory)) {
+    delete memory;
+    return false;
   }
-  delete memory;
-  return false;
+  memories_.emplace_back(memory);
+  return true;
 }
 
 size_t MemoryRanges::Read(uint64_t addr, void* dst, size_t size) {
-  auto entry = maps_.upper_bound(addr);
-  if (entry != maps_.end()) {
-    return entry->second->Read(addr, dst, size);
-  }
-  return 0;
+  return intervals_.Read(addr, dst, size);
 }
 
 bool MemoryOffline::Init(const std::string& file, uint64_t offset) {
@@ -426,6 +1155,17 @@ bool MemoryOffline::Init(const std::string& file, uint64_t offset, uint64_t star
   return true;
 }
 
+bool MemoryOffline::GetRange(uint64_t* start, uint64_t* end) {
+  if (!memory_) {
+    return false;
+  }
+  *start = memory_->offset();
+  if (__builtin_add_overflow(memory_->offset(), memory_->length(), end)) {
+    *end = UINT64_MAX;
+  }
+  return true;
+}
+
 size_t MemoryOffline::Read(uint64_t addr, void* dst, size_t size) {
   if (!memory_) {
     return 0;
@@ -459,81 +1199,271 @@ MemoryOfflineParts::~MemoryOfflineParts() {
   }
 }
 
+void MemoryOfflineParts::Add(MemoryOffline* memory) {
+  memories_.push_back(memory);
+  uint64_t start;
+  uint64_t end;
+  if (memory->GetRange(&start, &end)) {
+    // When parts overlap, the part added first is the one that is read.
+    intervals_.InsertUncovered(start, end, memory);
+  }
+}
+
 size_t MemoryOfflineParts::Read(uint64_t addr, void* dst, size_t size) {
-  if (memories_.empty()) {
-    return 0;
+  return intervals_.Read(addr, dst, size);
+}
+
+bool MemoryCacheBase::ReadMany(ReadRequest* requests, size_t num_requests) {
+  // The requests that cannot be cached are passed along as is.
+  constexpr size_t kFromPages = SIZE_MAX;
+  // The index of each request that missed, and its index in forwarded
+  // or kFromPages.
+  std::vector<std::pair<size_t, size_t>> missed;
+  std::vector<ReadRequest> forwarded;
+  std::vector<uint64_t> pages;
+  for (size_t i = 0; i < num_requests; i++) {
+    ReadRequest& request = requests[i];
+    if (request.size <= kCacheSize && ReadIfCached(request.addr, request.dst, request.size)) {
+      request.success = true;
+      continue;
+    }
+    uint64_t last;
+    if (request.size > kCacheSize || request.size == 0 ||
+        __builtin_add_overflow(request.addr, request.size - 1, &last)) {
+      missed.emplace_back(i, forwarded.size());
+      forwarded.push_back(request);
+      continue;
+    }
+    missed.emplace_back(i, kFromPages);
+    for (uint64_t addr_page = request.addr >> kCacheBits; addr_page <= last >> kCacheBits;
+         addr_page++) {
+      if (std::find(pages.begin(), pages.end(), addr_page) == pages.end()) {
+        pages.push_back(addr_page);
+      }
+    }
+  }
+  if (missed.empty()) {
+    return true;
   }
 
-  // Do a read on each memory object, no support for reading across the
-  // different memory objects.
-  for (MemoryOffline* memory : memories_) {
-    size_t bytes = memory->Read(addr, dst, size);
-    if (bytes != 0) {
-      return bytes;
+  // Read the missing pages in the same call, and add them to the cache.
+  std::unique_ptr<uint8_t[]> page_data(new uint8_t[pages.size() * kCacheSize]);
+  size_t first_page = forwarded.size();
+  for (size_t i = 0; i < pages.size(); i++) {
+    forwarded.push_back(ReadRequest{.addr = pages[i] << kCacheBits,
+                                    .dst = &page_data[i * kCacheSize],
+                                    .size = kCacheSize,
+                                    .success = false});
+  }
+  impl_->ReadMany(forwarded.data(), forwarded.size());
+  for (size_t i = 0; i < pages.size(); i++) {
+    if (forwarded[first_page + i].success) {
+      AddPage(pages[i], &page_data[i * kCacheSize]);
     }
   }
-  return 0;
-}
 
-size_t MemoryCacheBase::InternalCachedRead(uint64_t addr, void* dst, size_t size,
-                                           CacheDataType* cache) {
-  uint64_t addr_page = addr >> kCacheBits;
-  auto entry = cache->find(addr_page);
-  uint8_t* cache_dst;
-  if (entry != cache->end()) {
-    cache_dst = entry->second;
-  } else {
-    cache_dst = (*cache)[addr_page];
-    if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
-      // Erase the entry.
-      cache->erase(addr_page);
-      return impl_->Read(addr, dst, size);
+  bool all_read = true;
+  for (const auto& [index, forwarded_index] : missed) {
+    ReadRequest& request = requests[index];
+    if (forwarded_index != kFromPages) {
+      request.success = forwarded[forwarded_index].success;
+      all_read &= request.success;
+      continue;
+    }
+    uint8_t* dst = reinterpret_cast<uint8_t*>(request.dst);
+    uint64_t addr = request.addr;
+    size_t left = request.size;
+    while (left > 0) {
+      size_t page = std::find(pages.begin(), pages.end(), addr >> kCacheBits) - pages.begin();
+      if (!forwarded[first_page + page].success) {
+        break;
+      }
+      size_t page_offset = addr & kCacheMask;
+      size_t bytes = std::min(left, kCacheSize - page_offset);
+      memcpy(dst, &page_data[page * kCacheSize + page_offset], bytes);
+      dst += bytes;
+      addr += bytes;
+      left -= bytes;
     }
+    // Like a cached read, read the data directly if a page is not there.
+    request.success = left == 0 || impl_->ReadFully(request.addr, request.dst, request.size);
+    all_read &= request.success;
   }
-  size_t max_read = ((addr_page + 1) << kCacheBits) - addr;
-  if (size <= max_read) {
-    memcpy(dst, &cache_dst[addr & kCacheMask], size);
-    return size;
+  return all_read;
+}
+
+MemoryCache::MemoryCache(Memory* memory, size_t max_cached_bytes, bool collect_stats)
+    : MemoryCacheBase(memory), collect_stats_(collect_stats) {
+  size_t max_sets = std::max(max_cached_bytes / (kCacheSize * kCacheWays), static_cast<size_t>(1));
+  set_bits_ = 0;
+  while ((static_cast<size_t>(1) << set_bits_) < max_sets) {
+    set_bits_++;
   }
+  num_sets_ = static_cast<size_t>(1) << set_bits_;
+  sets_.reset(new CacheSet[num_sets_]);
+}
 
-  // The read crossed into another cached entry, since a read can only cross
-  // into one extra cached page, duplicate the code rather than looping.
-  memcpy(dst, &cache_dst[addr & kCacheMask], max_read);
-  dst = &reinterpret_cast<uint8_t*>(dst)[max_read];
-  addr_page++;
+void MemoryCache::Clear() {
+  for (size_t i = 0; i < num_sets_; i++) {
+    CacheSet& set = sets_[i];
+    std::lock_guard<std::mutex> lock(set.lock);
+    set.valid = 0;
+    set.referenced = 0;
+  }
+}
+
+MemoryCacheStats MemoryCache::GetStats() {
+  MemoryCacheStats stats;
+  for (size_t i = 0; i < num_sets_; i++) {
+    CacheSet& set = sets_[i];
+    std::lock_guard<std::mutex> lock(set.lock);
+    stats.hits += set.stats.hits;
+    stats.misses += set.stats.misses;
+    stats.evictions += set.stats.evictions;
+  }
+  return stats;
+}
 
-  entry = cache->find(addr_page);
-  if (entry != cache->end()) {
-    cache_dst = entry->second;
-  } else {
-    cache_dst = (*cache)[addr_page];
-    if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
-      // Erase the entry.
-      cache->erase(addr_page);
-      return impl_->Read(addr_page << kCacheBits, dst, size - max_read) + max_read;
+size_t MemoryCache::PickVictim(CacheSet* set) {
+  // An empty way first, otherwise the first way that has not been
+  // referenced since the clock hand last passed it.
+  size_t way = 0;
+  if (set->valid != (1 << kCacheWays) - 1) {
+    while (set->valid & (1 << way)) {
+      way++;
+    }
+    return way;
+  }
+  while (true) {
+    way = set->hand;
+    set->hand = (set->hand + 1) % kCacheWays;
+    uint8_t bit = 1 << way;
+    if (!(set->referenced & bit)) {
+      break;
     }
+    set->referenced &= ~bit;
   }
-  memcpy(dst, cache_dst, size - max_read);
+  set->valid &= ~(1 << way);
+  if (collect_stats_) {
+    set->stats.evictions++;
+  }
+  return way;
+}
+
+size_t MemoryCache::ReadFromPage(uint64_t addr_page, size_t page_offset, void* dst, size_t size) {
+  CacheSet& set = sets_[SetIndex(addr_page)];
+  {
+    std::lock_guard<std::mutex> lock(set.lock);
+    for (size_t way = 0; way < kCacheWays; way++) {
+      uint8_t bit = 1 << way;
+      if ((set.valid & bit) && set.pages[way] == addr_page) {
+        set.referenced |= bit;
+        if (collect_stats_) {
+          set.stats.hits++;
+        }
+        memcpy(dst, &set.data[way][page_offset], size);
+        return size;
+      }
+    }
+    if (collect_stats_) {
+      set.stats.misses++;
+    }
+  }
+
+  // Read the page without the lock, so that other threads using this set
+  // do not wait for the underlying memory.
+  uint8_t page[kCacheSize];
+  if (!impl_->ReadFully(addr_page << kCacheBits, page, kCacheSize)) {
+    return impl_->Read((addr_page << kCacheBits) + page_offset, dst, size);
+  }
+  memcpy(dst, &page[page_offset], size);
+  InsertPage(addr_page, page, false);
   return size;
 }
 
-void MemoryCache::Clear() {
-  std::lock_guard<std::mutex> lock(cache_lock_);
-  cache_.clear();
+bool MemoryCache::CopyIfCached(uint64_t addr_page, size_t page_offset, void* dst, size_t size) {
+  CacheSet& set = sets_[SetIndex(addr_page)];
+  std::lock_guard<std::mutex> lock(set.lock);
+
+  for (size_t way = 0; way < kCacheWays; way++) {
+    uint8_t bit = 1 << way;
+    if ((set.valid & bit) && set.pages[way] == addr_page) {
+      set.referenced |= bit;
+      if (collect_stats_) {
+        set.stats.hits++;
+      }
+      memcpy(dst, &set.data[way][page_offset], size);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MemoryCache::ReadIfCached(uint64_t addr, void* dst, size_t size) {
+  uint64_t addr_page = addr >> kCacheBits;
+  size_t page_offset = addr & kCacheMask;
+  size_t max_read = kCacheSize - page_offset;
+  if (size <= max_read) {
+    return CopyIfCached(addr_page, page_offset, dst, size);
+  }
+  return addr_page < (UINT64_MAX >> kCacheBits) &&
+         CopyIfCached(addr_page, page_offset, dst, max_read) &&
+         CopyIfCached(addr_page + 1, 0, &reinterpret_cast<uint8_t*>(dst)[max_read],
+                      size - max_read);
+}
+
+void MemoryCache::AddPage(uint64_t addr_page, const uint8_t* data) {
+  InsertPage(addr_page, data, true);
+}
+
+void MemoryCache::InsertPage(uint64_t addr_page, const uint8_t* data, bool count_miss) {
+  CacheSet& set = sets_[SetIndex(addr_page)];
+  std::lock_guard<std::mutex> lock(set.lock);
+
+  for (size_t way = 0; way < kCacheWays; way++) {
+    if ((set.valid & (1 << way)) && set.pages[way] == addr_page) {
+      // Another thread got here first.
+      return;
+    }
+  }
+  if (count_miss && collect_stats_) {
+    set.stats.misses++;
+  }
+
+  size_t way = PickVictim(&set);
+  if (set.data[way] == nullptr) {
+    set.data[way].reset(new uint8_t[kCacheSize]);
+  }
+  memcpy(set.data[way].get(), data, kCacheSize);
+  set.pages[way] = addr_page;
+  set.valid |= 1 << way;
+  set.referenced |= 1 << way;
 }
 
 size_t MemoryCache::CachedRead(uint64_t addr, void* dst, size_t size) {
-  // Use a single lock since this object is not designed to be performant
-  // for multiple object reading from multiple threads.
-  std::lock_guard<std::mutex> lock(cache_lock_);
+  uint64_t addr_page = addr >> kCacheBits;
+  size_t page_offset = addr & kCacheMask;
+  size_t max_read = kCacheSize - page_offset;
+  if (size <= max_read) {
+    return ReadFromPage(addr_page, page_offset, dst, size);
+  }
 
-  return InternalCachedRead(addr, dst, size, &cache_);
+  // The read crosses into the next page. Only a single set lock is held
+  // at any time, so there is no lock ordering to worry about.
+  size_t bytes = ReadFromPage(addr_page, page_offset, dst, max_read);
+  if (bytes != max_read || ++addr_page > (UINT64_MAX >> kCacheBits)) {
+    return bytes;
+  }
+  return bytes + ReadFromPage(addr_page, 0, &reinterpret_cast<uint8_t*>(dst)[max_read],
+                              size - max_read);
 }
 
-MemoryThreadCache::MemoryThreadCache(Memory* memory) : MemoryCacheBase(memory) {
+MemoryThreadCache::MemoryThreadCache(Memory* memory, size_t max_cached_bytes)
+    : MemoryCacheBase(memory),
+      max_pages_(std::max(max_cached_bytes / kCacheSize, static_cast<size_t>(1))) {
   thread_cache_ = std::make_optional<pthread_t>();
   if (pthread_key_create(&*thread_cache_, [](void* memory) {
-        CacheDataType* cache = reinterpret_cast<CacheDataType*>(memory);
+        ThreadCache* cache = reinterpret_cast<ThreadCache*>(memory);
         delete cache;
       }) != 0) {
     Log::AsyncSafe("Failed to create pthread key.");
@@ -543,24 +1473,128 @@ MemoryThreadCache::MemoryThreadCache(Memory* memory) : MemoryCacheBase(memory) {
 
 MemoryThreadCache::~MemoryThreadCache() {
   if (thread_cache_) {
-    CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(*thread_cache_));
+    ThreadCache* cache = reinterpret_cast<ThreadCache*>(pthread_getspecific(*thread_cache_));
     delete cache;
     pthread_key_delete(*thread_cache_);
   }
 }
 
-size_t MemoryThreadCache::CachedRead(uint64_t addr, void* dst, size_t size) {
+std::list<MemoryThreadCache::CachedPage>::iterator MemoryThreadCache::NewPage(
+    ThreadCache* cache) {
+  if (cache->pages.size() < max_pages_) {
+    return cache->pages.emplace(cache->pages.begin());
+  }
+  // Reuse the least recently used page.
+  auto page = std::prev(cache->pages.end());
+  cache->index.erase(page->addr_page);
+  cache->pages.splice(cache->pages.begin(), cache->pages, page);
+  return page;
+}
+
+uint8_t* MemoryThreadCache::GetPage(ThreadCache* cache, uint64_t addr_page) {
+  auto entry = cache->index.find(addr_page);
+  if (entry != cache->index.end()) {
+    cache->pages.splice(cache->pages.begin(), cache->pages, entry->second);
+    return entry->second->data;
+  }
+
+  auto page = NewPage(cache);
+  if (!impl_->ReadFully(addr_page << kCacheBits, page->data, kCacheSize)) {
+    cache->pages.erase(page);
+    return nullptr;
+  }
+  page->addr_page = addr_page;
+  cache->index.emplace(addr_page, page);
+  return page->data;
+}
+
+MemoryThreadCache::ThreadCache* MemoryThreadCache::GetThreadCache() {
   if (!thread_cache_) {
-    return impl_->Read(addr, dst, size);
+    return nullptr;
   }
 
-  CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(*thread_cache_));
+  uint64_t epoch = epoch_.load(std::memory_order_acquire);
+  ThreadCache* cache = reinterpret_cast<ThreadCache*>(pthread_getspecific(*thread_cache_));
   if (cache == nullptr) {
-    cache = new CacheDataType;
+    cache = new ThreadCache;
+    cache->epoch = epoch;
     pthread_setspecific(*thread_cache_, cache);
+  } else if (cache->epoch != epoch) {
+    cache->pages.clear();
+    cache->index.clear();
+    cache->epoch = epoch;
+  }
+  return cache;
+}
+
+bool MemoryThreadCache::ReadIfCached(uint64_t addr, void* dst, size_t size) {
+  ThreadCache* cache = GetThreadCache();
+  if (cache == nullptr) {
+    return false;
+  }
+
+  uint64_t addr_page = addr >> kCacheBits;
+  size_t max_read = ((addr_page + 1) << kCacheBits) - addr;
+  auto first = cache->index.find(addr_page);
+  if (first == cache->index.end()) {
+    return false;
+  }
+  if (size <= max_read) {
+    cache->pages.splice(cache->pages.begin(), cache->pages, first->second);
+    memcpy(dst, &first->second->data[addr & kCacheMask], size);
+    return true;
+  }
+  auto second = cache->index.find(addr_page + 1);
+  if (second == cache->index.end()) {
+    return false;
+  }
+  cache->pages.splice(cache->pages.begin(), cache->pages, second->second);
+  cache->pages.splice(cache->pages.begin(), cache->pages, first->second);
+  memcpy(dst, &first->second->data[addr & kCacheMask], max_read);
+  memcpy(&reinterpret_cast<uint8_t*>(dst)[max_read], second->second->data, size - max_read);
+  return true;
+}
+
+void MemoryThreadCache::AddPage(uint64_t addr_page, const uint8_t* data) {
+  ThreadCache* cache = GetThreadCache();
+  if (cache == nullptr || cache->index.count(addr_page) != 0) {
+    return;
+  }
+  auto page = NewPage(cache);
+  memcpy(page->data, data, kCacheSize);
+  page->addr_page = addr_page;
+  cache->index.emplace(addr_page, page);
+}
+
+size_t MemoryThreadCache::CachedRead(uint64_t addr, void* dst, size_t size) {
+  ThreadCache* cache = GetThreadCache();
+  if (cache == nullptr) {
+    return impl_->Read(addr, dst, size);
   }
 
-  return InternalCachedRead(addr, dst, size, cache);
+  uint64_t addr_page = addr >> kCacheBits;
+  uint8_t* cache_src = GetPage(cache, addr_page);
+  if (cache_src == nullptr) {
+    return impl_->Read(addr, dst, size);
+  }
+  size_t max_read = ((addr_page + 1) << kCacheBits) - addr;
+  if (size <= max_read) {
+    memcpy(dst, &cache_src[addr & kCacheMask], size);
+    return size;
+  }
+
+  // The read crossed into another cached entry, since a read can only cross
+  // into one extra cached page, duplicate the code rather than looping.
+  memcpy(dst, &cache_src[addr & kCacheMask], max_read);
+  dst = &reinterpret_cast<uint8_t*>(dst)[max_read];
+  addr_page++;
+
+  cache_src = GetPage(cache, addr_page);
+  if (cache_src == nullptr) {
+    return impl_->Read(addr_page << kCacheBits, dst, size - max_read) + max_read;
+  }
+  memcpy(dst, cache_src, size - max_read);
+  return size;
 }
 
 void MemoryThreadCache::Clear() {
@@ -568,7 +1602,7 @@ void MemoryThreadCache::Clear() {
     return;
   }
 
-  CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(*thread_cache_));
+  ThreadCache* cache = reinterpret_cast<ThreadCache*>(pthread_getspecific(*thread_cache_));
   if (cache != nullptr) {
     delete cache;
     pthread_setspecific(*thread_cache_, nullptr);
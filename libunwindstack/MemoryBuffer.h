@@ -19,6 +19,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <unwindstack/Memory.h>
@@ -34,6 +35,11 @@ class MemoryBuffer : public Memory {
 
   uint8_t* GetPtr(size_t offset) override;
 
+  bool ReadString(uint64_t addr, std::string* dst, size_t max_read) override;
+
+  bool ReadStringView(uint64_t addr, std::string_view* dst, size_t max_read,
+                      std::string* storage) override;
+
   bool Resize(size_t size) {
     void* new_raw = realloc(raw_, size);
     if (new_raw == nullptr) {
@@ -19,6 +19,8 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -28,6 +30,12 @@
 
 namespace unwindstack {
 
+struct MemoryCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+};
+
 class MemoryCacheBase : public Memory {
  public:
   MemoryCacheBase(Memory* memory) : impl_(memory) {}
@@ -37,6 +45,8 @@ class MemoryCacheBase : public Memory {
 
   const std::shared_ptr<Memory>& UnderlyingMemory() { return impl_; }
 
+  virtual MemoryCacheStats GetStats() { return MemoryCacheStats(); }
+
   size_t Read(uint64_t addr, void* dst, size_t size) override {
     // Only look at the cache for small reads.
     if (size > 64) {
@@ -47,45 +57,147 @@ class MemoryCacheBase : public Memory {
 
   long ReadTag(uint64_t addr) override { return impl_->ReadTag(addr); }
 
+  // Copies the requests that are already cached. The pages needed by the
+  // rest are read with a single ReadMany on the underlying memory, and
+  // added to the cache.
+  bool ReadMany(ReadRequest* requests, size_t num_requests) override;
+
  protected:
   constexpr static size_t kCacheBits = 12;
   constexpr static size_t kCacheMask = (1 << kCacheBits) - 1;
   constexpr static size_t kCacheSize = 1 << kCacheBits;
 
-  using CacheDataType = std::unordered_map<uint64_t, uint8_t[kCacheSize]>;
-
   virtual size_t CachedRead(uint64_t addr, void* dst, size_t size) = 0;
 
-  size_t InternalCachedRead(uint64_t addr, void* dst, size_t size, CacheDataType* cache);
+  // Returns true if every page of the range is cached, and copies the
+  // data. Never reads the underlying memory.
+  virtual bool ReadIfCached(uint64_t addr, void* dst, size_t size) = 0;
+
+  // Adds a page read from the underlying memory, unless it is cached.
+  virtual void AddPage(uint64_t addr_page, const uint8_t* data) = 0;
 
   std::shared_ptr<Memory> impl_;
 };
 
+// A fixed size, set associative page cache. Every set has its own lock,
+// so threads sharing a cache only contend when they hit the same set, and
+// the lock is never held while reading the underlying memory. Pages within
+// a set are replaced using the CLOCK algorithm. The memory for a page is
+// only allocated the first time its way is used.
 class MemoryCache : public MemoryCacheBase {
  public:
-  MemoryCache(Memory* memory) : MemoryCacheBase(memory) {}
+  constexpr static size_t kCacheWays = 4;
+  constexpr static size_t kDefaultMaxCachedBytes = 4 * 1024 * 1024;
+
+  // The number of sets is rounded up to a power of two, so the real
+  // capacity might be larger than max_cached_bytes. GetStats only counts
+  // anything when collect_stats is set.
+  MemoryCache(Memory* memory, size_t max_cached_bytes = kDefaultMaxCachedBytes,
+              bool collect_stats = false);
   virtual ~MemoryCache() = default;
 
+  // A read that is no larger than a single page can only span two
+  // cached pages, so it can be served from the cache.
+  size_t Read(uint64_t addr, void* dst, size_t size) override {
+    if (size > kCacheSize) {
+      return impl_->Read(addr, dst, size);
+    }
+    return CachedRead(addr, dst, size);
+  }
+
   size_t CachedRead(uint64_t addr, void* dst, size_t size) override;
 
   void Clear() override;
 
+  MemoryCacheStats GetStats() override;
+
+  size_t MaxCachedPages() { return num_sets_ * kCacheWays; }
+
  protected:
-  CacheDataType cache_;
+  struct alignas(64) CacheSet {
+    std::mutex lock;
+    uint64_t pages[kCacheWays] = {};
+    std::unique_ptr<uint8_t[]> data[kCacheWays];
+    // One bit per way.
+    uint8_t valid = 0;
+    uint8_t referenced = 0;
+    uint8_t hand = 0;
+    MemoryCacheStats stats;
+  };
+
+  size_t SetIndex(uint64_t addr_page) {
+    return (addr_page ^ (addr_page >> set_bits_)) & (num_sets_ - 1);
+  }
+
+  // Returns the way to replace in a set that misses. Must be called with
+  // the lock of the set held.
+  size_t PickVictim(CacheSet* set);
 
-  std::mutex cache_lock_;
+  size_t ReadFromPage(uint64_t addr_page, size_t page_offset, void* dst, size_t size);
+
+  // Adds a page, unless another thread added it first.
+  void InsertPage(uint64_t addr_page, const uint8_t* data, bool count_miss);
+
+  bool CopyIfCached(uint64_t addr_page, size_t page_offset, void* dst, size_t size);
+
+  bool ReadIfCached(uint64_t addr, void* dst, size_t size) override;
+
+  void AddPage(uint64_t addr_page, const uint8_t* data) override;
+
+  bool collect_stats_;
+  size_t set_bits_;
+  size_t num_sets_;
+  std::unique_ptr<CacheSet[]> sets_;
 };
 
+// Every thread gets its own cache, limited to max_cached_bytes, and
+// replaces pages in least recently used order.
 class MemoryThreadCache : public MemoryCacheBase {
  public:
-  MemoryThreadCache(Memory* memory);
+  constexpr static size_t kDefaultMaxCachedBytes = 1024 * 1024;
+
+  MemoryThreadCache(Memory* memory, size_t max_cached_bytes = kDefaultMaxCachedBytes);
   virtual ~MemoryThreadCache();
 
   size_t CachedRead(uint64_t addr, void* dst, size_t size) override;
 
+  // Only clears the cache of the calling thread.
   void Clear() override;
 
+  // Invalidates the caches of all threads. Each thread discards its cached
+  // data the next time it reads from this object.
+  void ClearAllThreads() { epoch_.fetch_add(1, std::memory_order_release); }
+
+  size_t MaxCachedPages() { return max_pages_; }
+
  protected:
+  struct CachedPage {
+    uint64_t addr_page;
+    uint8_t data[kCacheSize];
+  };
+
+  struct ThreadCache {
+    uint64_t epoch;
+    // The most recently used page is at the front.
+    std::list<CachedPage> pages;
+    std::unordered_map<uint64_t, std::list<CachedPage>::iterator> index;
+  };
+
+  // Returns the cache of the calling thread, or nullptr if there is no
+  // thread local storage.
+  ThreadCache* GetThreadCache();
+
+  // Makes room for a new page at the front of the cache.
+  std::list<CachedPage>::iterator NewPage(ThreadCache* cache);
+
+  uint8_t* GetPage(ThreadCache* cache, uint64_t addr_page);
+
+  bool ReadIfCached(uint64_t addr, void* dst, size_t size) override;
+
+  void AddPage(uint64_t addr_page, const uint8_t* data) override;
+
+  size_t max_pages_;
+  std::atomic_uint64_t epoch_ = 0;
   std::optional<pthread_key_t> thread_cache_;
 };
 
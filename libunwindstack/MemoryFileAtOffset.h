@@ -18,10 +18,18 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <string>
+#include <string_view>
+
 #include <unwindstack/Memory.h>
 
 namespace unwindstack {
 
+struct FileMapping;
+
+// The file data is mapped through a process wide registry, so objects
+// that need the same part of the same file share a single mapping.
 class MemoryFileAtOffset : public Memory {
  public:
   MemoryFileAtOffset() = default;
@@ -33,6 +41,14 @@ class MemoryFileAtOffset : public Memory {
 
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
+  bool ReadString(uint64_t addr, std::string* dst, size_t max_read) override;
+
+  bool ReadStringView(uint64_t addr, std::string_view* dst, size_t max_read,
+                      std::string* storage) override;
+
+  // Uses madvise on the pages covering the range.
+  bool Prefetch(uint64_t addr, uint64_t size, PrefetchMode mode) override;
+
   size_t Size() { return size_; }
 
   void Clear() override;
@@ -41,6 +57,7 @@ class MemoryFileAtOffset : public Memory {
   size_t size_ = 0;
   size_t offset_ = 0;
   uint8_t* data_ = nullptr;
+  std::shared_ptr<FileMapping> mapping_;
 };
 
 }  // namespace unwindstack
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include <unwindstack/Memory.h>
+
+namespace unwindstack {
+
+// A flat array of non-overlapping address intervals, sorted by address,
+// each one read through its own Memory object. Lookups first check the
+// interval that satisfied the previous lookup, and then fall back to a
+// branch free binary search. The Memory objects are not owned.
+class MemoryIntervals {
+ public:
+  struct Interval {
+    uint64_t start;
+    uint64_t end;
+    Memory* memory;
+  };
+
+  MemoryIntervals() = default;
+  ~MemoryIntervals() = default;
+
+  // Adds [start, end). Returns false if the interval is empty or
+  // overlaps an interval that was already added.
+  bool Insert(uint64_t start, uint64_t end, Memory* memory);
+
+  // Adds only the parts of [start, end) that no existing interval covers,
+  // so that the intervals added first take precedence. Returns false if
+  // nothing was added.
+  bool InsertUncovered(uint64_t start, uint64_t end, Memory* memory);
+
+  // Reads through the memory of the interval containing addr. If that
+  // memory stops short, the read continues through the interval that
+  // contains the address where it stopped, if there is one.
+  size_t Read(uint64_t addr, void* dst, size_t size);
+
+  const Interval* Find(uint64_t addr) {
+    size_t index = FindIndex(addr);
+    return index == kNotFound ? nullptr : &intervals_[index];
+  }
+
+  size_t Size() const { return intervals_.size(); }
+
+ private:
+  static constexpr size_t kNotFound = static_cast<size_t>(-1);
+
+  // Returns the index of the first interval that ends after addr.
+  size_t UpperBound(uint64_t addr) const;
+
+  size_t FindIndex(uint64_t addr);
+
+  std::vector<Interval> intervals_;
+  std::atomic_size_t last_index_ = 0;
+};
+
+}  // namespace unwindstack
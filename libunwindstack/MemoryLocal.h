@@ -28,7 +28,13 @@ class MemoryLocal : public Memory {
   virtual ~MemoryLocal() = default;
 
   size_t Read(uint64_t addr, void* dst, size_t size) override;
+  bool ReadMany(ReadRequest* requests, size_t num_requests) override;
   long ReadTag(uint64_t addr) override;
+
+  // Returns true if all of [addr, addr + size) is in the calling thread's
+  // stack, at or above the current frame. Such reads are done directly,
+  // everything else goes through process_vm_readv.
+  static bool CanReadDirectly(uint64_t addr, size_t size);
 };
 
 }  // namespace unwindstack
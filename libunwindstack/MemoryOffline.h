@@ -24,6 +24,7 @@
 
 #include <unwindstack/Memory.h>
 
+#include "MemoryIntervals.h"
 #include "MemoryRange.h"
 
 namespace unwindstack {
@@ -39,6 +40,9 @@ class MemoryOffline : public Memory {
 
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
+  // Returns the range of addresses covered, false if not initialized.
+  bool GetRange(uint64_t* start, uint64_t* end);
+
  private:
   std::unique_ptr<MemoryRange> memory_;
 };
@@ -48,12 +52,14 @@ class MemoryOfflineParts : public Memory {
   MemoryOfflineParts() = default;
   virtual ~MemoryOfflineParts();
 
-  void Add(MemoryOffline* memory) { memories_.push_back(memory); }
+  // Takes ownership of memory.
+  void Add(MemoryOffline* memory);
 
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
  private:
   std::vector<MemoryOffline*> memories_;
+  MemoryIntervals intervals_;
 };
 
 }  // namespace unwindstack
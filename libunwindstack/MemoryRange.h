@@ -18,12 +18,14 @@
 
 #include <stdint.h>
 
-#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <unwindstack/Memory.h>
 
+#include "MemoryIntervals.h"
+
 namespace unwindstack {
 
 // MemoryRange maps one address range onto another.
@@ -52,12 +54,16 @@ class MemoryRanges : public Memory {
   MemoryRanges() = default;
   virtual ~MemoryRanges() = default;
 
+  // Takes ownership of memory. Only the part of its range that no earlier
+  // range covers is read through it. Returns false, and deletes memory,
+  // if an earlier range covers all of it.
   bool Insert(MemoryRange* memory);
 
   size_t Read(uint64_t addr, void* dst, size_t size) override;
 
  private:
-  std::map<uint64_t, std::unique_ptr<MemoryRange>> maps_;
+  std::vector<std::unique_ptr<MemoryRange>> memories_;
+  MemoryIntervals intervals_;
 };
 
 }  // namespace unwindstack
@@ -20,6 +20,7 @@
 #include <sys/types.h>
 
 #include <atomic>
+#include <chrono>
 
 #include <unwindstack/Memory.h>
 
@@ -27,17 +28,69 @@ namespace unwindstack {
 
 class MemoryRemote : public Memory {
  public:
-  MemoryRemote(pid_t pid) : pid_(pid), read_redirect_func_(0) {}
-  virtual ~MemoryRemote() = default;
+  // The ways of reading the memory of another process, in the order that
+  // they are tried when picking one.
+  enum Backend : uint8_t {
+    BACKEND_NONE = 0,
+    BACKEND_PROCESS_VM_READV,  // One process_vm_readv per read, batches ReadMany.
+    BACKEND_PROC_MEM,          // pread of /proc/<pid>/mem, for when the above is blocked.
+    BACKEND_PTRACE,            // One PTRACE_PEEKTEXT per word.
+    BACKEND_MAX = BACKEND_PTRACE,
+  };
+
+  struct BackendStats {
+    uint64_t reads = 0;
+    uint64_t bytes = 0;
+    // A batched ReadMany is one read, but can still need several calls.
+    uint64_t syscalls = 0;
+    uint64_t nanoseconds = 0;
+
+    // Effective throughput of the backend, zero if it has not been used.
+    double BytesPerSecond() const {
+      return nanoseconds == 0 ? 0.0 : static_cast<double>(bytes) * 1e9 / nanoseconds;
+    }
+  };
+
+  // The stats cost a clock read per read, so they are only kept when
+  // collect_stats is set.
+  MemoryRemote(pid_t pid, bool collect_stats = false)
+      : pid_(pid), collect_stats_(collect_stats), backend_(BACKEND_NONE) {}
+  virtual ~MemoryRemote();
 
   size_t Read(uint64_t addr, void* dst, size_t size) override;
+  bool ReadMany(ReadRequest* requests, size_t num_requests) override;
   long ReadTag(uint64_t addr) override;
 
   pid_t pid() { return pid_; }
 
+  // The backend picked by the first successful read, or BACKEND_NONE.
+  Backend backend() { return backend_.load(); }
+
+  // Skip the automatic selection and always use the given backend.
+  void SetBackend(Backend backend) { backend_ = backend; }
+
+  // Returns all zeroes unless the object was created with collect_stats.
+  BackendStats GetStats(Backend backend);
+
  private:
+  size_t ReadWithBackend(Backend backend, uint64_t addr, void* dst, size_t size);
+  size_t ProcMemRead(uint64_t addr, void* dst, size_t size, uint64_t* syscalls);
+  int GetProcMemFd();
+  void AddStats(Backend backend, uint64_t bytes, uint64_t syscalls,
+                std::chrono::nanoseconds elapsed);
+
+  struct AtomicBackendStats {
+    std::atomic_uint64_t reads = 0;
+    std::atomic_uint64_t bytes = 0;
+    std::atomic_uint64_t syscalls = 0;
+    std::atomic_uint64_t nanoseconds = 0;
+  };
+
   pid_t pid_;
-  std::atomic_uintptr_t read_redirect_func_;
+  bool collect_stats_;
+  std::atomic<Backend> backend_;
+  std::atomic_int proc_mem_fd_ = -1;
+  AtomicBackendStats stats_[BACKEND_MAX + 1];
 };
 
 }  // namespace unwindstack
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+#include <unwindstack/Memory.h>
+
+namespace unwindstack {
+
+class Maps;
+
+// Holds a copy of the top of a thread's stack, taken with a single read
+// before unwinding, in front of the process memory. Reads that fall in
+// the copy do not touch the process memory at all, everything else is
+// passed through.
+class MemoryStackSnapshot : public Memory {
+ public:
+  explicit MemoryStackSnapshot(const std::shared_ptr<Memory>& process_memory)
+      : process_memory_(process_memory) {}
+  virtual ~MemoryStackSnapshot() = default;
+
+  // Returns a snapshot of up to size bytes of the stack starting at sp,
+  // bounded by the map containing sp, or nullptr if there is no such map
+  // or it cannot be read.
+  static std::shared_ptr<MemoryStackSnapshot> Create(const std::shared_ptr<Memory>& process_memory,
+                                                     Maps* maps, uint64_t sp, size_t size);
+
+  // Copy up to size bytes of the stack starting at sp, never going past
+  // stack_end. Returns false if nothing could be read.
+  bool Snapshot(uint64_t sp, uint64_t stack_end, size_t size);
+
+  // Replaces the snapshot with a copy of size bytes of the stack starting
+  // at sp that someone else read, such as the kernel for a perf sample.
+  // The buffer is reused when it is big enough.
+  void SetStack(uint64_t sp, const void* data, size_t size);
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+
+  bool ReadMany(ReadRequest* requests, size_t num_requests) override;
+
+  void Clear() override { process_memory_->Clear(); }
+
+  // Number of bytes above sp, up to the end of the stack, that have been
+  // read since the snapshot was taken. Used to size the next snapshot.
+  size_t StackBytesUsed() const { return max_read_end_ - start_; }
+
+  uint64_t start() const { return start_; }
+  uint64_t end() const { return end_; }
+
+  // Returns the size to use for the next snapshot of a thread, given the
+  // size of the last one and how much of the stack the last unwind used.
+  // Grows right away to cover the stack used, but only shrinks by half
+  // each time so that a single short unwind does not undo the history.
+  static size_t NextSize(size_t last_size, size_t bytes_used);
+
+  static constexpr size_t kInitialSize = 32 * 1024;
+  static constexpr size_t kMinSize = 8 * 1024;
+  static constexpr size_t kMaxSize = 512 * 1024;
+
+ private:
+  std::shared_ptr<Memory> process_memory_;
+  std::unique_ptr<uint8_t[]> data_;
+  size_t capacity_ = 0;
+  uint64_t start_ = 0;
+  uint64_t end_ = 0;
+  uint64_t stack_end_ = 0;
+  uint64_t max_read_end_ = 0;
+};
+
+}  // namespace unwindstack
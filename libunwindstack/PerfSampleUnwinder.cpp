@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/MachineArm.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineRiscv64.h>
+#include <unwindstack/MachineX86.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/PerfSampleUnwinder.h>
+#include <unwindstack/RegsArm.h>
+#include <unwindstack/RegsArm64.h>
+#include <unwindstack/RegsRiscv64.h>
+#include <unwindstack/RegsX86.h>
+#include <unwindstack/RegsX86_64.h>
+
+#include "MemoryOfflineBuffer.h"
+#include "MemoryStackSnapshot.h"
+
+namespace unwindstack {
+
+// The layouts of the records that are used, after the perf_event_header.
+struct PerfMmap2Record {
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t addr;
+  uint64_t len;
+  uint64_t pgoff;
+  // Either the device and inode, or the build id of the file.
+  uint8_t file_id[24];
+  uint32_t prot;
+  uint32_t flags;
+  // Followed by the nul terminated file name.
+};
+
+struct PerfTaskRecord {
+  uint32_t pid;
+  uint32_t ppid;
+  uint32_t tid;
+  uint32_t ptid;
+  uint64_t time;
+};
+
+struct PerfCommRecord {
+  uint32_t pid;
+  uint32_t tid;
+  // Followed by the nul terminated command name.
+};
+
+struct PerfLostRecord {
+  uint64_t id;
+  uint64_t lost;
+};
+
+static constexpr uint8_t kNoReg = 0xff;
+
+// The register of the arch for each perf register number.
+static constexpr uint8_t kX86_64Regs[] = {
+    X86_64_REG_RAX, X86_64_REG_RBX, X86_64_REG_RCX, X86_64_REG_RDX, X86_64_REG_RSI,
+    X86_64_REG_RDI, X86_64_REG_RBP, X86_64_REG_RSP, X86_64_REG_RIP, kNoReg,
+    kNoReg,         kNoReg,         kNoReg,         kNoReg,         kNoReg,
+    kNoReg,         X86_64_REG_R8,  X86_64_REG_R9,  X86_64_REG_R10, X86_64_REG_R11,
+    X86_64_REG_R12, X86_64_REG_R13, X86_64_REG_R14, X86_64_REG_R15,
+};
+
+static constexpr uint8_t kX86Regs[] = {
+    X86_REG_EAX, X86_REG_EBX, X86_REG_ECX, X86_REG_EDX, X86_REG_ESI,
+    X86_REG_EDI, X86_REG_EBP, X86_REG_ESP, X86_REG_EIP,
+};
+
+// The flags, segment and extended registers are not needed to unwind.
+static constexpr uint64_t kX86_64RegsMask = 0xff01ff;
+static constexpr uint64_t kX86RegsMask = 0x1ff;
+
+// On an arm64 kernel, the registers of 32 bit processes are in the same
+// slots as on an arm kernel.
+static constexpr uint64_t kArmRegsMask = (1ULL << ARM_REG_LAST) - 1;
+static constexpr uint64_t kArm64RegsMask = (1ULL << (ARM64_REG_PC + 1)) - 1;
+// The perf register numbers of riscv64 start with the pc, like the arch.
+static constexpr uint64_t kRiscv64RegsMask = (1ULL << 32) - 1;
+
+static Regs* CreateRegs(ArchEnum arch) {
+  switch (arch) {
+    case ARCH_ARM:
+      return new RegsArm;
+    case ARCH_ARM64:
+      return new RegsArm64;
+    case ARCH_RISCV64:
+      return new RegsRiscv64;
+    case ARCH_X86:
+      return new RegsX86;
+    case ARCH_X86_64:
+      return new RegsX86_64;
+    default:
+      return nullptr;
+  }
+}
+
+static ArchEnum GetArch32(ArchEnum arch) {
+  switch (arch) {
+    case ARCH_ARM64:
+      return ARCH_ARM;
+    case ARCH_X86_64:
+      return ARCH_X86;
+    default:
+      return ARCH_UNKNOWN;
+  }
+}
+
+template <typename AddressType>
+static void FillRegs(Regs* regs, uint64_t mask, const uint64_t* values, const uint8_t* reg_map,
+                     size_t reg_map_size) {
+  AddressType* data = reinterpret_cast<AddressType*>(regs->RawData());
+  memset(data, 0, regs->total_regs() * sizeof(AddressType));
+  regs->ResetPseudoRegisters();
+  regs->set_dex_pc(0);
+
+  for (size_t perf_reg = 0; mask != 0; perf_reg++, mask >>= 1) {
+    if ((mask & 1) == 0) {
+      continue;
+    }
+    uint64_t value = *values++;
+    size_t reg = perf_reg;
+    if (reg_map != nullptr) {
+      reg = perf_reg < reg_map_size ? reg_map[perf_reg] : kNoReg;
+    }
+    if (reg < regs->total_regs()) {
+      data[reg] = static_cast<AddressType>(value);
+    }
+  }
+}
+
+PerfSampleUnwinder::PerfSampleUnwinder(ArchEnum arch, CallingContextTrie* trie, size_t max_frames)
+    : arch_(arch), trie_(trie), max_frames_(max_frames) {
+  switch (arch) {
+    case ARCH_ARM:
+      regs_mask_ = kArmRegsMask;
+      break;
+    case ARCH_ARM64:
+      regs_mask_ = kArm64RegsMask;
+      break;
+    case ARCH_RISCV64:
+      regs_mask_ = kRiscv64RegsMask;
+      break;
+    case ARCH_X86:
+      regs_mask_ = kX86RegsMask;
+      break;
+    case ARCH_X86_64:
+      regs_mask_ = kX86_64RegsMask;
+      break;
+    default:
+      return;
+  }
+  num_regs_ = __builtin_popcountll(regs_mask_);
+  regs_.reset(CreateRegs(arch));
+  regs32_.reset(CreateRegs(GetArch32(arch)));
+}
+
+PerfSampleUnwinder::~PerfSampleUnwinder() = default;
+
+bool PerfSampleUnwinder::InitAttr(perf_event_attr* attr, uint32_t stack_size) const {
+  if (regs_mask_ == 0) {
+    return false;
+  }
+  attr->sample_type =
+      PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_REGS_USER | PERF_SAMPLE_STACK_USER;
+  // Add the pid, tid and time to the end of all of the other records, so
+  // the records of several ring buffers can be put back in order.
+  attr->sample_id_all = 1;
+  attr->sample_regs_user = regs_mask_;
+  // The kernel only accepts a multiple of 8.
+  attr->sample_stack_user = stack_size & ~7U;
+  // Report all of the maps, an executable map can need the read-only map
+  // in front of it to find its elf, like for a library in an apk.
+  attr->mmap = 1;
+  attr->mmap2 = 1;
+  attr->mmap_data = 1;
+  attr->comm = 1;
+  attr->comm_exec = 1;
+  attr->task = 1;
+  return true;
+}
+
+bool PerfSampleUnwinder::GetRecordTime(const void* record, size_t size, uint64_t* time) {
+  const perf_event_header* header = reinterpret_cast<const perf_event_header*>(record);
+  // Every record has at least the pid, tid and time.
+  if (size < sizeof(*header) || header->size > size ||
+      header->size < sizeof(*header) + 2 * sizeof(uint64_t)) {
+    return false;
+  }
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(record);
+  if (header->type == PERF_RECORD_SAMPLE) {
+    memcpy(time, data + sizeof(*header) + sizeof(uint64_t), sizeof(*time));
+  } else {
+    memcpy(time, data + header->size - sizeof(uint64_t), sizeof(*time));
+  }
+  return true;
+}
+
+bool PerfSampleUnwinder::ProcessRecord(const void* record, size_t size) {
+  const perf_event_header* header = reinterpret_cast<const perf_event_header*>(record);
+  if (size < sizeof(*header) || header->size < sizeof(*header) || header->size > size) {
+    stats_.malformed_records++;
+    return false;
+  }
+
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(record) + sizeof(*header);
+  size = header->size - sizeof(*header);
+  bool valid = true;
+  switch (header->type) {
+    case PERF_RECORD_SAMPLE:
+      valid = ProcessSample(data, size);
+      break;
+    case PERF_RECORD_MMAP2:
+      valid = ProcessMmap2(data, size);
+      break;
+    case PERF_RECORD_FORK:
+      valid = ProcessFork(data, size);
+      break;
+    case PERF_RECORD_EXIT:
+      valid = ProcessExit(data, size);
+      break;
+    case PERF_RECORD_COMM:
+      if (size < sizeof(PerfCommRecord)) {
+        valid = false;
+      } else if (header->misc & PERF_RECORD_MISC_COMM_EXEC) {
+        // The process has a new address space, the mmap records of the new
+        // program follow.
+        const PerfCommRecord* comm = reinterpret_cast<const PerfCommRecord*>(data);
+        processes_.erase(comm->pid);
+      }
+      break;
+    case PERF_RECORD_LOST:
+      if (size < sizeof(PerfLostRecord)) {
+        valid = false;
+      } else {
+        stats_.lost_samples += reinterpret_cast<const PerfLostRecord*>(data)->lost;
+      }
+      break;
+    default:
+      break;
+  }
+  if (!valid) {
+    stats_.malformed_records++;
+  }
+  return valid;
+}
+
+PerfSampleUnwinder::Process* PerfSampleUnwinder::GetProcess(pid_t pid) {
+  auto entry = processes_.find(pid);
+  if (entry != processes_.end()) {
+    return &entry->second;
+  }
+  // A process that existed before the events were enabled has no mmap
+  // records for the maps it already had.
+  return CreateProcess(pid, read_processes_);
+}
+
+PerfSampleUnwinder::Process* PerfSampleUnwinder::CreateProcess(pid_t pid, bool read_maps) {
+  Process& process = processes_[pid];
+  process.maps.reset(new IncrementalMaps(pid));
+  if (read_maps) {
+    process.maps->Parse();
+  }
+  std::shared_ptr<Memory> process_memory;
+  if (read_processes_) {
+    process_memory = Memory::CreateProcessMemoryCached(pid);
+  } else {
+    process_memory.reset(new MemoryOfflineBuffer(nullptr, 0, 0));
+  }
+  process.stack_memory.reset(new MemoryStackSnapshot(process_memory));
+  process.unwinder.reset(new Unwinder(max_frames_, process.maps.get(), process_memory));
+  process.unwinder->SetStepMemory(process.stack_memory);
+  // The trie symbolizes each frame once, when it is dumped.
+  process.unwinder->SetResolveNames(false);
+  return &process;
+}
+
+bool PerfSampleUnwinder::ProcessMmap2(const uint8_t* data, size_t size) {
+  if (size <= sizeof(PerfMmap2Record)) {
+    return false;
+  }
+  const PerfMmap2Record* mmap = reinterpret_cast<const PerfMmap2Record*>(data);
+  const char* name = reinterpret_cast<const char*>(data + sizeof(PerfMmap2Record));
+  size_t max_name_size = size - sizeof(PerfMmap2Record);
+  size_t name_size = strnlen(name, max_name_size);
+  if (name_size == max_name_size) {
+    return false;
+  }
+  Process* process = GetProcess(mmap->pid);
+  process->maps->Map(mmap->addr, mmap->addr + mmap->len, mmap->pgoff, mmap->prot,
+                     std::string(name, name_size));
+  stats_.mmaps++;
+  return true;
+}
+
+bool PerfSampleUnwinder::ProcessSample(const uint8_t* data, size_t size) {
+  const uint8_t* end = data + size;
+  uint32_t ids[2];
+  uint64_t time;
+  uint64_t abi;
+  if (size < sizeof(ids) + sizeof(time) + sizeof(abi)) {
+    return false;
+  }
+  memcpy(ids, data, sizeof(ids));
+  memcpy(&abi, data + sizeof(ids) + sizeof(time), sizeof(abi));
+  data += sizeof(ids) + sizeof(time) + sizeof(abi);
+
+  const uint64_t* values = nullptr;
+  if (abi != PERF_SAMPLE_REGS_ABI_NONE) {
+    if (static_cast<size_t>(end - data) < num_regs_ * sizeof(uint64_t)) {
+      return false;
+    }
+    values = reinterpret_cast<const uint64_t*>(data);
+    data += num_regs_ * sizeof(uint64_t);
+  }
+
+  uint64_t stack_size;
+  if (static_cast<size_t>(end - data) < sizeof(stack_size)) {
+    return false;
+  }
+  memcpy(&stack_size, data, sizeof(stack_size));
+  data += sizeof(stack_size);
+  const uint8_t* stack = data;
+  uint64_t dyn_size = 0;
+  if (stack_size != 0) {
+    size_t left = end - data;
+    if (left < sizeof(dyn_size) || stack_size > left - sizeof(dyn_size)) {
+      return false;
+    }
+    memcpy(&dyn_size, data + stack_size, sizeof(dyn_size));
+    // The kernel copies less than requested when the stack is smaller.
+    dyn_size = std::min(dyn_size, stack_size);
+  }
+
+  stats_.samples++;
+  Regs* regs = values != nullptr ? GetRegs(abi, values) : nullptr;
+  if (regs == nullptr) {
+    stats_.samples_without_regs++;
+    return true;
+  }
+
+  Process* process = GetProcess(ids[0]);
+  process->stack_memory->SetStack(regs->sp(), stack, dyn_size);
+  Unwinder* unwinder = process->unwinder.get();
+  unwinder->SetRegs(regs);
+  unwinder->Unwind();
+  pcs_.clear();
+  for (const auto& frame : unwinder->frames()) {
+    pcs_.push_back(frame.pc);
+  }
+  trie_->AddSample(process->maps.get(), pcs_.data(), pcs_.size());
+  return true;
+}
+
+Regs* PerfSampleUnwinder::GetRegs(uint64_t abi, const uint64_t* values) {
+  ArchEnum arch = arch_;
+  Regs* regs = regs_.get();
+  if (abi == PERF_SAMPLE_REGS_ABI_32 && !ArchIs32Bit(arch_)) {
+    arch = GetArch32(arch_);
+    regs = regs32_.get();
+  } else if (abi != (ArchIs32Bit(arch_) ? PERF_SAMPLE_REGS_ABI_32 : PERF_SAMPLE_REGS_ABI_64)) {
+    return nullptr;
+  }
+  if (regs == nullptr) {
+    return nullptr;
+  }
+
+  switch (arch) {
+    case ARCH_ARM:
+      FillRegs<uint32_t>(regs, regs_mask_, values, nullptr, 0);
+      break;
+    case ARCH_ARM64:
+    case ARCH_RISCV64:
+      FillRegs<uint64_t>(regs, regs_mask_, values, nullptr, 0);
+      break;
+    case ARCH_X86:
+      FillRegs<uint32_t>(regs, regs_mask_, values, kX86Regs, sizeof(kX86Regs));
+      break;
+    case ARCH_X86_64:
+      FillRegs<uint64_t>(regs, regs_mask_, values, kX86_64Regs, sizeof(kX86_64Regs));
+      break;
+    default:
+      return nullptr;
+  }
+  return regs;
+}
+
+bool PerfSampleUnwinder::ProcessFork(const uint8_t* data, size_t size) {
+  if (size < sizeof(PerfTaskRecord)) {
+    return false;
+  }
+  const PerfTaskRecord* task = reinterpret_cast<const PerfTaskRecord*>(data);
+  if (task->pid == task->ppid) {
+    // A new thread of an existing process.
+    return true;
+  }
+
+  processes_.erase(task->pid);
+  auto parent = processes_.find(task->ppid);
+  if (parent == processes_.end()) {
+    return true;
+  }
+  // The new process starts with a copy of the maps of its parent. The map
+  // objects are not shared, since each process updates its own. Creating
+  // the process can rehash processes_, which invalidates parent, but not
+  // the maps it points to.
+  IncrementalMaps* parent_maps = parent->second.maps.get();
+  Process* process = CreateProcess(task->pid, false);
+  for (const auto& map_info : *parent_maps) {
+    process->maps->Add(map_info->start(), map_info->end(), map_info->offset(), map_info->flags(),
+                       map_info->name());
+  }
+  process->maps->Sort();
+  return true;
+}
+
+bool PerfSampleUnwinder::ProcessExit(const uint8_t* data, size_t size) {
+  if (size < sizeof(PerfTaskRecord)) {
+    return false;
+  }
+  const PerfTaskRecord* task = reinterpret_cast<const PerfTaskRecord*>(data);
+  if (task->pid == task->tid) {
+    processes_.erase(task->pid);
+  }
+  return true;
+}
+
+}  // namespace unwindstack
@@ -139,18 +139,20 @@ bool RegsMips64::StepIfSignalHandler(uint64_t elf_offset, Elf* elf, Memory* proc
   // vdso_rt_sigreturn => read rt_sigframe
   // offset = siginfo offset + sizeof(siginfo) + uc_mcontext offset
   // read 64 bit sc_regs[32] from stack into 64 bit regs_
-  uint64_t sp = regs_[MIPS64_REG_SP];
-  if (!process_memory->Read(sp + 24 + 128 + 40, regs_.data(),
-                            sizeof(uint64_t) * (MIPS64_REG_LAST - 1))) {
-    return false;
-  }
-
   // offset = siginfo offset + sizeof(siginfo) + uc_mcontext offset + sc_pc offset
   // read 64 bit sc_pc from stack into 64 bit regs_[MIPS64_REG_PC]
-  if (!process_memory->Read(sp + 24 + 128 + 40 + 576, &regs_[MIPS64_REG_PC], sizeof(uint64_t))) {
-    return false;
-  }
-  return true;
+  uint64_t sp = regs_[MIPS64_REG_SP];
+  Memory::ReadRequest reads[] = {
+      {.addr = sp + 24 + 128 + 40,
+       .dst = regs_.data(),
+       .size = sizeof(uint64_t) * (MIPS64_REG_LAST - 1),
+       .success = false},
+      {.addr = sp + 24 + 128 + 40 + 576,
+       .dst = &regs_[MIPS64_REG_PC],
+       .size = sizeof(uint64_t),
+       .success = false},
+  };
+  return process_memory->ReadMany(reads, sizeof(reads) / sizeof(reads[0]));
 }
 
 Regs* RegsMips64::Clone() {
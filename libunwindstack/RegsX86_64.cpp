@@ -51,6 +51,15 @@ void RegsX86_64::set_sp(uint64_t sp) {
   regs_[X86_64_REG_SP] = sp;
 }
 
+bool RegsX86_64::GetFramePointer(uint64_t* fp) {
+  *fp = regs_[X86_64_REG_RBP];
+  return true;
+}
+
+void RegsX86_64::SetFramePointer(uint64_t fp) {
+  regs_[X86_64_REG_RBP] = fp;
+}
+
 bool RegsX86_64::SetPcFromReturnAddress(Memory* process_memory) {
   // Attempt to get the return address from the top of the stack.
   uint64_t new_pc;
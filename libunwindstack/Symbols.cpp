@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <unwindstack/Memory.h>
@@ -47,6 +48,11 @@ Symbols::Symbols(uint64_t offset, uint64_t size, uint64_t entry_size, uint64_t s
   }
 }
 
+void Symbols::Prefetch(Memory* elf_memory, Memory::PrefetchMode mode) {
+  elf_memory->Prefetch(offset_, count_ * entry_size_, mode);
+  elf_memory->Prefetch(str_offset_, str_end_ - str_offset_, mode);
+}
+
 template <typename SymType>
 static bool IsFunc(const SymType* entry) {
   return entry->st_shndx != SHN_UNDEF && ELF32_ST_TYPE(entry->st_info) == STT_FUNC;
@@ -69,13 +75,13 @@ Symbols::Info* Symbols::BinarySearch(uint64_t addr, Memory* elf_memory, uint64_t
       return &it->second;
     }
   }
-  uint32_t count = RemapIndices ? remap_->size() : count_;
+  uint32_t count = RemapIndices ? remap_size_ : count_;
   uint32_t last = (it != symbols_.end()) ? it->second.index : count;
   uint32_t first = (it != symbols_.begin()) ? std::prev(it)->second.index + 1 : 0;
 
   while (first < last) {
     uint32_t current = first + (last - first) / 2;
-    uint32_t symbol_index = RemapIndices ? remap_.value()[current] : current;
+    uint32_t symbol_index = RemapIndices ? remap_[current] : current;
     uint64_t offset = symbol_index * entry_size_;
     if (__builtin_add_overflow(offset, offset_, &offset)) {
       // The elf data might be malformed.
@@ -106,8 +112,8 @@ template <typename SymType>
 void Symbols::BuildRemapTable(Memory* elf_memory) {
   std::vector<uint64_t> addrs;  // Addresses of all symbols (addrs[i] == symbols[i].st_value).
   addrs.reserve(count_);
-  remap_.emplace();  // Construct the optional remap table.
-  remap_->reserve(count_);
+  std::vector<uint32_t> remap;
+  remap.reserve(count_);
   for (size_t symbol_idx = 0; symbol_idx < count_;) {
     // Read symbols from memory.  We intentionally bypass the cache to save memory.
     // Do the reads in batches so that we minimize the number of memory read calls.
@@ -132,24 +138,46 @@ void Symbols::BuildRemapTable(Memory* elf_memory) {
       // NB: It is important to filter our zero-sized symbols since otherwise we can get
       // duplicate end addresses in the table (e.g. if there is custom "end" symbol marker).
       if (IsFunc(&sym) && sym.st_size != 0) {
-        remap_->push_back(symbol_idx);  // Indices of function symbols only.
+        remap.push_back(symbol_idx);  // Indices of function symbols only.
       }
     }
   }
   // Sort by address to make the remap list binary searchable (stable due to the a<b tie break).
   auto comp = [&addrs](auto a, auto b) { return std::tie(addrs[a], a) < std::tie(addrs[b], b); };
-  std::sort(remap_->begin(), remap_->end(), comp);
+  std::sort(remap.begin(), remap.end(), comp);
   // Remove duplicate entries (methods de-duplicated by the linker).
   auto pred = [&addrs](auto a, auto b) { return addrs[a] == addrs[b]; };
-  remap_->erase(std::unique(remap_->begin(), remap_->end(), pred), remap_->end());
-  remap_->shrink_to_fit();
+  remap.erase(std::unique(remap.begin(), remap.end(), pred), remap.end());
+  remap.shrink_to_fit();
+  remap_storage_ = std::move(remap);
+  remap_ = remap_storage_.data();
+  remap_size_ = remap_storage_.size();
+  has_remap_ = true;
+}
+
+template <typename SymType>
+void Symbols::GetRemapTable(Memory* elf_memory, const uint32_t** table, size_t* size) {
+  if (!has_remap_) {
+    BuildRemapTable<SymType>(elf_memory);
+    symbols_.clear();  // Remove cached symbols since the access pattern will be different.
+  }
+  *table = remap_;
+  *size = remap_size_;
+}
+
+void Symbols::SetRemapTable(const uint32_t* table, size_t size) {
+  symbols_.clear();
+  remap_storage_ = std::vector<uint32_t>();
+  remap_ = table;
+  remap_size_ = size;
+  has_remap_ = true;
 }
 
 template <typename SymType>
 bool Symbols::GetName(uint64_t addr, Memory* elf_memory, SharedString* name,
                       uint64_t* func_offset) {
   Info* info;
-  if (!remap_.has_value()) {
+  if (!has_remap_) {
     // Assume the symbol table is sorted. If it is not, this will gracefully fail.
     info = BinarySearch<SymType, false>(addr, elf_memory, func_offset);
     if (info == nullptr) {
@@ -168,7 +196,7 @@ bool Symbols::GetName(uint64_t addr, Memory* elf_memory, SharedString* name,
   // Read and cache the symbol name.
   if (info->name.is_null()) {
     SymType sym;
-    uint32_t symbol_index = remap_.has_value() ? remap_.value()[info->index] : info->index;
+    uint32_t symbol_index = has_remap_ ? remap_[info->index] : info->index;
     uint64_t offset = symbol_index * entry_size_;
     if (__builtin_add_overflow(offset, offset_, &offset)) {
       // The elf data might be malformed.
@@ -177,15 +205,21 @@ bool Symbols::GetName(uint64_t addr, Memory* elf_memory, SharedString* name,
     if (!elf_memory->ReadFully(offset, &sym, sizeof(sym))) {
       return false;
     }
-    std::string symbol_name;
     uint64_t str;
     if (__builtin_add_overflow(str_offset_, sym.st_name, &str) || str >= str_end_) {
       return false;
     }
-    if (!IsFunc(&sym) || !elf_memory->ReadString(str, &symbol_name, str_end_ - str)) {
+    std::string storage;
+    std::string_view symbol_name;
+    if (!IsFunc(&sym) ||
+        !elf_memory->ReadStringView(str, &symbol_name, str_end_ - str, &storage)) {
       return false;
     }
-    info->name = SharedString(std::move(symbol_name));
+    if (symbol_name.data() == storage.data()) {
+      info->name = SharedString(std::move(storage));
+    } else {
+      info->name = SharedString(std::string(symbol_name));
+    }
   }
   *name = info->name;
   return true;
@@ -223,8 +257,10 @@ bool Symbols::GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* m
         return false;
       }
       if (str_offset < str_end_) {
-        std::string symbol;
-        if (elf_memory->ReadString(str_offset, &symbol, str_end_ - str_offset) && symbol == name) {
+        std::string storage;
+        std::string_view symbol;
+        if (elf_memory->ReadStringView(str_offset, &symbol, str_end_ - str_offset, &storage) &&
+            symbol == name) {
           global_variables_.emplace(name, entry.st_value);
           *memory_address = entry.st_value;
           return true;
@@ -242,4 +278,7 @@ template bool Symbols::GetName<Elf64_Sym>(uint64_t, Memory*, SharedString*, uint
 
 template bool Symbols::GetGlobal<Elf32_Sym>(Memory*, const std::string&, uint64_t*);
 template bool Symbols::GetGlobal<Elf64_Sym>(Memory*, const std::string&, uint64_t*);
+
+template void Symbols::GetRemapTable<Elf32_Sym>(Memory*, const uint32_t**, size_t*);
+template void Symbols::GetRemapTable<Elf64_Sym>(Memory*, const uint32_t**, size_t*);
 }  // namespace unwindstack
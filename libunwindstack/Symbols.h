@@ -22,14 +22,13 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include <unwindstack/Memory.h>
 #include <unwindstack/SharedString.h>
 
 namespace unwindstack {
 
-// Forward declaration.
-class Memory;
-
 class Symbols {
   struct Info {
     uint32_t size;   // Symbol size in bytes.
@@ -48,9 +47,31 @@ class Symbols {
   template <typename SymType>
   bool GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* memory_address);
 
+  // Prefetch the symbol table and its string table.
+  void Prefetch(Memory* elf_memory, Memory::PrefetchMode mode);
+
+  uint64_t offset() const { return offset_; }
+  uint64_t count() const { return count_; }
+
+  // Returns the indices of the function symbols sorted by address, building
+  // them first if necessary.
+  template <typename SymType>
+  void GetRemapTable(Memory* elf_memory, const uint32_t** table, size_t* size);
+
+  // Uses a table returned by GetRemapTable for an identical symbol table,
+  // such as one loaded from a cache file. The table is not copied, it must
+  // stay valid for the life of this object.
+  void SetRemapTable(const uint32_t* table, size_t size);
+
   void ClearCache() {
     symbols_.clear();
-    remap_.reset();
+    // A table passed to SetRemapTable does not use any heap memory, keep it.
+    if (remap_ == remap_storage_.data()) {
+      remap_storage_ = std::vector<uint32_t>();
+      remap_ = nullptr;
+      remap_size_ = 0;
+      has_remap_ = false;
+    }
   }
 
  private:
@@ -67,7 +88,13 @@ class Symbols {
   uint64_t str_end_;
 
   std::map<uint64_t, Info> symbols_;  // Cache of read symbols (keyed by function *end* address).
-  std::optional<std::vector<uint32_t>> remap_;  // Indices of function symbols sorted by address.
+
+  // Indices of function symbols sorted by address. Points either at
+  // remap_storage_ or at a table passed to SetRemapTable.
+  bool has_remap_ = false;
+  const uint32_t* remap_ = nullptr;
+  size_t remap_size_ = 0;
+  std::vector<uint32_t> remap_storage_;
 
   // Cache of global data (non-function) symbols.
   std::unordered_map<std::string, std::optional<uint64_t>> global_variables_;
@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/ptrace.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <procinfo/process.h>
+
+#include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/UnwindService.h>
+
+namespace unwindstack {
+
+// The longest wait for a thread to stop after attaching to it.
+static constexpr std::chrono::seconds kMaxStopWait(10);
+
+static bool AttachThread(pid_t tid, std::chrono::steady_clock::time_point deadline) {
+  if (ptrace(PTRACE_ATTACH, tid, 0, 0) == -1) {
+    return false;
+  }
+
+  deadline = std::min(deadline, std::chrono::steady_clock::now() + kMaxStopWait);
+  siginfo_t si;
+  // The thread usually stops right away, so start with short waits.
+  useconds_t wait_us = 20;
+  while (true) {
+    if (ptrace(PTRACE_GETSIGINFO, tid, 0, &si) == 0) {
+      return true;
+    }
+    if (errno == EINVAL) {
+      // The thread is in group-stop state, try and kick it out of that
+      // state. If that fails, pretend it worked and see if the unwind does.
+      if (ptrace(PTRACE_LISTEN, tid, 0, 0) == -1) {
+        return true;
+      }
+    } else if (errno != ESRCH) {
+      break;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
+    usleep(wait_us);
+    wait_us = std::min<useconds_t>(wait_us * 2, 1000);
+  }
+  ptrace(PTRACE_DETACH, tid, 0, 0);
+  return false;
+}
+
+// Returns zero if the process is gone.
+static uint64_t GetStartTime(pid_t pid) {
+  android::procinfo::ProcessInfo info;
+  if (!android::procinfo::GetProcessInfo(pid, &info)) {
+    return 0;
+  }
+  return info.starttime;
+}
+
+// Whether the unwind found an address that is not in the maps. The pc of
+// the first frame comes straight from the registers, so it is always in a
+// map unless the maps are out of date. Later frames can be found using the
+// return address on the stack even if it is not, so the error of the
+// whole unwind does not always show it.
+static bool MissingMap(const UnwindServiceResult& result) {
+  return result.error.code == ERROR_INVALID_MAP ||
+         (!result.frames.empty() && result.frames[0].map_info == nullptr);
+}
+
+UnwindService::UnwindService(size_t num_threads, size_t max_queued_requests)
+    : max_queued_requests_(max_queued_requests) {
+  for (size_t i = 0; i < std::max<size_t>(num_threads, 1); i++) {
+    threads_.emplace_back(&UnwindService::Worker, this);
+  }
+}
+
+UnwindService::~UnwindService() {
+  std::deque<QueuedRequest> queue;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+    queue.swap(queue_);
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+
+  for (auto& queued : queue) {
+    UnwindServiceResult result;
+    result.status = UNWIND_SERVICE_CANCELLED;
+    Finish(queued, result);
+  }
+}
+
+uint64_t UnwindService::Submit(const UnwindServiceRequest& request, Callback callback) {
+  uint64_t id;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (stopping_ || queue_.size() >= max_queued_requests_) {
+      stats_.rejected++;
+      return 0;
+    }
+    id = next_id_++;
+    queue_.push_back(QueuedRequest{.id = id,
+                                   .request = request,
+                                   .callback = std::move(callback),
+                                   .submit_time = std::chrono::steady_clock::now()});
+  }
+  cond_.notify_one();
+  return id;
+}
+
+std::future<UnwindServiceResult> UnwindService::Submit(const UnwindServiceRequest& request) {
+  auto promise = std::make_shared<std::promise<UnwindServiceResult>>();
+  std::future<UnwindServiceResult> future = promise->get_future();
+  uint64_t id = Submit(request, [promise](UnwindServiceResult& result) {
+    promise->set_value(std::move(result));
+  });
+  if (id == 0) {
+    UnwindServiceResult result;
+    result.pid = request.pid;
+    result.tid = request.tid != 0 ? request.tid : request.pid;
+    result.status = UNWIND_SERVICE_REJECTED;
+    promise->set_value(std::move(result));
+  }
+  return future;
+}
+
+bool UnwindService::Cancel(uint64_t id) {
+  QueuedRequest queued;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = std::find_if(queue_.begin(), queue_.end(),
+                           [id](const QueuedRequest& entry) { return entry.id == id; });
+    if (it == queue_.end()) {
+      return false;
+    }
+    queued = std::move(*it);
+    queue_.erase(it);
+  }
+
+  UnwindServiceResult result;
+  result.status = UNWIND_SERVICE_CANCELLED;
+  Finish(queued, result);
+  return true;
+}
+
+void UnwindService::ClearProcess(pid_t pid) {
+  std::lock_guard<std::mutex> guard(unwinders_lock_);
+  unwinders_.erase(pid);
+}
+
+size_t UnwindService::NumQueued() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return queue_.size();
+}
+
+UnwindServiceStats UnwindService::GetStats() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return stats_;
+}
+
+std::shared_ptr<AndroidUnwinder> UnwindService::GetUnwinder(pid_t pid, pid_t tid, bool* cached,
+                                                            ErrorCode* error_code) {
+  // This process cannot be replaced while it runs.
+  uint64_t start_time = pid == getpid() ? 0 : GetStartTime(pid);
+  std::lock_guard<std::mutex> guard(unwinders_lock_);
+  auto entry = unwinders_.find(pid);
+  if (entry != unwinders_.end()) {
+    if (entry->second.start_time == start_time) {
+      *cached = true;
+      return entry->second.unwinder;
+    }
+    // The pid was reused by a new process.
+    unwinders_.erase(entry);
+  }
+  *cached = false;
+
+  std::shared_ptr<AndroidUnwinder> unwinder;
+  if (pid == getpid()) {
+    unwinder.reset(new AndroidLocalUnwinder);
+  } else {
+    // Only the attached thread can be used to get the arch, the main
+    // thread of the process might not be attached.
+    ArchEnum arch = Regs::RemoteGetArch(tid, error_code);
+    if (arch == ARCH_UNKNOWN) {
+      return nullptr;
+    }
+    // Every worker keeps its own cache, so that the unwinds of different
+    // threads do not clear each other's cache.
+    std::shared_ptr<Memory> process_memory = Memory::CreateProcessMemoryThreadCached(pid);
+    unwinder.reset(new AndroidRemoteUnwinder(pid, arch, process_memory));
+  }
+  if (unwinders_.size() >= kMaxProcesses) {
+    // Processes come and go, so start over rather than grow forever.
+    unwinders_.clear();
+  }
+  unwinders_.emplace(pid, CachedUnwinder{.start_time = start_time, .unwinder = unwinder});
+  return unwinder;
+}
+
+void UnwindService::DropUnwinder(pid_t pid, const std::shared_ptr<AndroidUnwinder>& unwinder) {
+  std::lock_guard<std::mutex> guard(unwinders_lock_);
+  auto entry = unwinders_.find(pid);
+  // Another worker might have replaced it already.
+  if (entry != unwinders_.end() && entry->second.unwinder == unwinder) {
+    unwinders_.erase(entry);
+  }
+}
+
+void UnwindService::Run(QueuedRequest& queued, UnwindServiceResult* result) {
+  const UnwindServiceRequest& request = queued.request;
+  auto start_time = std::chrono::steady_clock::now();
+  result->queue_time = start_time - queued.submit_time;
+  if (start_time >= request.deadline) {
+    result->status = UNWIND_SERVICE_DEADLINE_EXCEEDED;
+    return;
+  }
+
+  bool remote = request.pid != getpid();
+  if (remote && !AttachThread(result->tid, request.deadline)) {
+    result->status = UNWIND_SERVICE_ATTACH_FAILED;
+    result->unwind_time = std::chrono::steady_clock::now() - start_time;
+    return;
+  }
+
+  std::optional<size_t> max_frames;
+  if (request.max_frames != 0) {
+    max_frames = request.max_frames;
+  }
+  auto unwind = [&](AndroidUnwinder* unwinder) {
+    AndroidUnwinderData data(max_frames, request.show_all_frames);
+    bool unwound = unwinder->Unwind(result->tid, data);
+    result->frames = std::move(data.frames);
+    result->error = data.error;
+    return unwound;
+  };
+
+  bool cached;
+  std::shared_ptr<AndroidUnwinder> unwinder =
+      GetUnwinder(request.pid, result->tid, &cached, &result->error.code);
+  bool unwound = unwinder != nullptr && unwind(unwinder.get());
+  if (remote && cached && MissingMap(*result)) {
+    // The maps were read for an earlier request, and the process might
+    // have mapped something since. Read them again and retry once.
+    DropUnwinder(request.pid, unwinder);
+    unwinder = GetUnwinder(request.pid, result->tid, &cached, &result->error.code);
+    unwound = unwinder != nullptr && unwind(unwinder.get());
+  }
+  if (!unwound) {
+    result->status = UNWIND_SERVICE_UNWIND_FAILED;
+  }
+
+  if (remote) {
+    ptrace(PTRACE_DETACH, result->tid, 0, 0);
+  }
+  result->unwind_time = std::chrono::steady_clock::now() - start_time;
+}
+
+void UnwindService::Finish(QueuedRequest& queued, UnwindServiceResult& result) {
+  result.id = queued.id;
+  result.pid = queued.request.pid;
+  result.tid = queued.request.tid != 0 ? queued.request.tid : queued.request.pid;
+  std::chrono::nanoseconds latency = std::chrono::steady_clock::now() - queued.submit_time;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    switch (result.status) {
+      case UNWIND_SERVICE_OK:
+        stats_.completed++;
+        break;
+      case UNWIND_SERVICE_UNWIND_FAILED:
+      case UNWIND_SERVICE_ATTACH_FAILED:
+        stats_.failed++;
+        break;
+      case UNWIND_SERVICE_REJECTED:
+        stats_.rejected++;
+        break;
+      case UNWIND_SERVICE_CANCELLED:
+        stats_.cancelled++;
+        break;
+      case UNWIND_SERVICE_DEADLINE_EXCEEDED:
+        stats_.deadline_exceeded++;
+        break;
+    }
+    stats_.total_queue_time += result.queue_time;
+    stats_.total_unwind_time += result.unwind_time;
+    stats_.max_latency = std::max(stats_.max_latency, latency);
+  }
+  queued.callback(result);
+}
+
+void UnwindService::Worker() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    // Take the oldest request for a thread that is not being unwound.
+    auto next = queue_.end();
+    cond_.wait(lock, [this, &next]() {
+      if (stopping_) {
+        return true;
+      }
+      next = std::find_if(queue_.begin(), queue_.end(), [this](const QueuedRequest& entry) {
+        pid_t tid = entry.request.tid != 0 ? entry.request.tid : entry.request.pid;
+        return busy_tids_.count(tid) == 0;
+      });
+      return next != queue_.end();
+    });
+    if (stopping_) {
+      return;
+    }
+    QueuedRequest queued = std::move(*next);
+    queue_.erase(next);
+    pid_t tid = queued.request.tid != 0 ? queued.request.tid : queued.request.pid;
+    busy_tids_.insert(tid);
+    lock.unlock();
+
+    UnwindServiceResult result;
+    result.tid = tid;
+    Run(queued, &result);
+    Finish(queued, result);
+
+    lock.lock();
+    busy_tids_.erase(tid);
+    // Requests for the same thread might be waiting.
+    cond_.notify_all();
+  }
+}
+
+}  // namespace unwindstack
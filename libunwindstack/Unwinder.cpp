@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -33,13 +34,17 @@
 #include <unwindstack/Demangle.h>
 #include <unwindstack/DexFiles.h>
 #include <unwindstack/Elf.h>
+#include <unwindstack/Epoch.h>
 #include <unwindstack/JitDebug.h>
+#include <unwindstack/MachineX86.h>
+#include <unwindstack/MachineX86_64.h>
 #include <unwindstack/MapInfo.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 #include <unwindstack/Unwinder.h>
 
 #include "Check.h"
+#include "MemoryStackSnapshot.h"
 
 namespace unwindstack {
 
@@ -129,17 +134,62 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
   // Clear any cached data from previous unwinds.
   process_memory_->Clear();
 
-  if (maps_->Find(regs_->pc()) == nullptr) {
+  Memory* step_memory = step_memory_ != nullptr ? step_memory_.get() : process_memory_.get();
+
+  // A memo frame is only known to be the same if its return address is,
+  // which is only at a known place on x86 and x86_64.
+  bool use_memo = stack_memo_ != nullptr && (arch_ == ARCH_X86 || arch_ == ARCH_X86_64);
+  if (stack_memo_ != nullptr && !use_memo) {
+    stack_memo_->Clear();
+    stack_memo_->reused_frames_ = 0;
+  }
+
+  // Keeps every map found during the unwind alive without touching its
+  // reference count, even if another thread updates the maps.
+  EpochReadSection epoch_section;
+  uint64_t maps_generation = use_memo ? maps_->Generation() : 0;
+
+  if (maps_->FindMapInfo(regs_->pc()) == nullptr) {
     regs_->fallback_pc();
   }
 
   bool return_address_attempt = false;
   bool adjust_pc = false;
+  // Set when the pc is a return address that a normal step produced.
+  bool caller_frame = false;
+  // When there is a memo, holds an entry for every frame.
+  std::vector<StackMemo::Entry> memo_entries;
+  bool spliced = false;
+  // The map of the last frame.
+  std::shared_ptr<MapInfo> frame_map;
+  bool frame_pointer_unwind = frame_pointer_unwind_ && arch_ == ARCH_X86_64;
+  // The steps of each library in this unwind, only added to the stats
+  // once the unwind is done.
+  struct StepCounts {
+    Elf* elf;
+    MapInfo* map_info;
+    uint64_t steps;
+    uint64_t frame_pointer_steps;
+  };
+  std::vector<StepCounts> step_counts;
+  size_t counts_index = 0;
   for (; frames_.size() < max_frames_;) {
     uint64_t cur_pc = regs_->pc();
     uint64_t cur_sp = regs_->sp();
 
-    std::shared_ptr<MapInfo> map_info = maps_->Find(regs_->pc());
+    if (use_memo && caller_frame && regs_->dex_pc() == 0 &&
+        SpliceStackMemo(step_memory, &memo_entries)) {
+      spliced = true;
+      break;
+    }
+
+    // The frames keep a reference to their map, the lookup that takes one
+    // is only done when the pc moves to another map.
+    if (frame_map == nullptr || regs_->pc() < frame_map->start() ||
+        regs_->pc() >= frame_map->end()) {
+      frame_map = maps_->Find(regs_->pc());
+    }
+    MapInfo* map_info = frame_map.get();
     uint64_t pc_adjustment = 0;
     uint64_t step_pc;
     uint64_t rel_pc;
@@ -164,7 +214,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
       }
       elf = map_info->GetElf(process_memory_, arch_);
       step_pc = regs_->pc();
-      rel_pc = elf->GetRelPc(step_pc, map_info.get());
+      rel_pc = elf->GetRelPc(step_pc, map_info);
       // Everyone except elf data in gdb jit debug maps uses the relative pc.
       if (!(map_info->flags() & MAPS_FLAGS_JIT_SYMFILE_MAP)) {
         step_pc = rel_pc;
@@ -190,12 +240,17 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
     }
 
     FrameData* frame = nullptr;
+    bool added_dex_frame = false;
     if (!ignore_frame) {
       if (regs_->dex_pc() != 0) {
         // Add a frame to represent the dex file.
         FillInDexFrame();
         // Clear the dex pc so that we don't repeat this frame later.
         regs_->set_dex_pc(0);
+        added_dex_frame = true;
+        if (use_memo) {
+          memo_entries.emplace_back();
+        }
 
         // Make sure there is enough room for the real frame.
         if (frames_.size() == max_frames_) {
@@ -204,7 +259,13 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
         }
       }
 
-      frame = FillInFrame(map_info, elf, rel_pc, pc_adjustment);
+      frame = FillInFrame(frame_map, elf, rel_pc, pc_adjustment);
+      if (use_memo) {
+        StackMemo::Entry& entry = memo_entries.emplace_back();
+        entry.pc = cur_pc;
+        entry.sp = cur_sp;
+        GetCalleeSavedRegs(regs_, entry.callee_saved);
+      }
 
       // Once a frame is added, stop skipping frames.
       initial_map_names_to_skip = nullptr;
@@ -214,6 +275,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
     bool stepped = false;
     bool in_device_map = false;
     bool finished = false;
+    bool is_signal_frame = false;
     if (map_info != nullptr) {
       if (map_info->flags() & MAPS_FLAGS_DEVICE_MAP) {
         // Do not stop here, fall through in case we are
@@ -221,21 +283,43 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
         // some of the speculative frames.
         in_device_map = true;
       } else {
-        auto sp_info = maps_->Find(regs_->sp());
+        MapInfo* sp_info = maps_->FindMapInfo(regs_->sp());
         if (sp_info != nullptr && sp_info->flags() & MAPS_FLAGS_DEVICE_MAP) {
           // Do not stop here, fall through in case we are
           // in the speculative unwind path and need to remove
           // some of the speculative frames.
           in_device_map = true;
         } else {
-          bool is_signal_frame = false;
-          if (elf->StepIfSignalHandler(rel_pc, regs_, process_memory_.get())) {
+          bool use_frame_pointer = frame_pointer_unwind && caller_frame && elf->valid();
+          bool frame_pointer_step = false;
+          if (use_frame_pointer && elf->frame_pointer_state() == Elf::FRAME_POINTER_SAFE) {
+            frame_pointer_step = StepFramePointer(regs_, step_memory);
+          }
+          std::unique_ptr<Regs> check_regs;
+          if (use_frame_pointer && !frame_pointer_step &&
+              elf->frame_pointer_state() == Elf::FRAME_POINTER_UNKNOWN) {
+            // Keep the registers so the frame pointer step can be
+            // compared against the step using the unwind information.
+            check_regs.reset(regs_->Clone());
+          }
+          if (frame_pointer_step) {
+            stepped = true;
+          } else if (elf->StepIfSignalHandler(rel_pc, regs_, step_memory)) {
             stepped = true;
             is_signal_frame = true;
-          } else if (elf->Step(step_pc, regs_, process_memory_.get(), &finished,
+          } else if (elf->Step(step_pc, regs_, step_memory, &finished,
                                &is_signal_frame)) {
             stepped = true;
           }
+          if (check_regs != nullptr && stepped && !is_signal_frame && !finished) {
+            uint64_t check_fp;
+            uint64_t fp;
+            bool matched = StepFramePointer(check_regs.get(), step_memory) &&
+                           check_regs->GetFramePointer(&check_fp) &&
+                           regs_->GetFramePointer(&fp) && check_fp == fp &&
+                           check_regs->pc() == regs_->pc() && check_regs->sp() == regs_->sp();
+            elf->AddFramePointerCheck(matched);
+          }
           if (is_signal_frame && frame != nullptr) {
             // Need to adjust the relative pc because the signal handler
             // pc should not be adjusted.
@@ -243,7 +327,25 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
             frame->pc += pc_adjustment;
             step_pc = rel_pc;
           }
-          elf->GetLastError(&last_error_);
+          if (!frame_pointer_step) {
+            elf->GetLastError(&last_error_);
+          }
+          if (frame_pointer_unwind_ && stepped) {
+            if (counts_index == step_counts.size() || step_counts[counts_index].elf != elf) {
+              counts_index = std::find_if(step_counts.begin(), step_counts.end(),
+                                          [elf](const StepCounts& counts) {
+                                            return counts.elf == elf;
+                                          }) -
+                             step_counts.begin();
+              if (counts_index == step_counts.size()) {
+                step_counts.push_back(StepCounts{.elf = elf, .map_info = map_info});
+              }
+            }
+            step_counts[counts_index].steps++;
+            if (frame_pointer_step) {
+              step_counts[counts_index].frame_pointer_steps++;
+            }
+          }
         }
       }
     }
@@ -260,15 +362,26 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
       break;
     }
 
+    // A frame that follows a dex frame cannot be reused, since the dex
+    // frame would be lost.
+    if (use_memo && frame != nullptr && !added_dex_frame && caller_frame &&
+        stepped && !is_signal_frame) {
+      RecordStackMemoStep(step_memory, &memo_entries.back());
+    }
+
     if (!stepped) {
       if (return_address_attempt) {
         // Only remove the speculative frame if there are more than two frames
         // or the pc in the first frame is in a valid map.
         // This allows for a case where the code jumps into the middle of
         // nowhere, but there is no other unwind information after that.
-        if (frames_.size() > 2 || (frames_.size() > 0 && maps_->Find(frames_[0].pc) != nullptr)) {
+        if (frames_.size() > 2 ||
+            (frames_.size() > 0 && maps_->FindMapInfo(frames_[0].pc) != nullptr)) {
           // Remove the speculative frame.
           frames_.pop_back();
+          if (use_memo) {
+            memo_entries.pop_back();
+          }
         }
         break;
       } else if (in_device_map) {
@@ -277,7 +390,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
         break;
       } else {
         // Steping didn't work, try this secondary method.
-        if (!regs_->SetPcFromReturnAddress(process_memory_.get())) {
+        if (!regs_->SetPcFromReturnAddress(step_memory)) {
           break;
         }
         return_address_attempt = true;
@@ -288,6 +401,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
         last_error_.code = ERROR_MAX_FRAMES_EXCEEDED;
       }
     }
+    caller_frame = stepped && !is_signal_frame;
 
     // If the pc and sp didn't change, then consider everything stopped.
     if (cur_pc == regs_->pc() && cur_sp == regs_->sp()) {
@@ -295,6 +409,161 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
       break;
     }
   }
+
+  // The maps are only guaranteed to be alive until the read section ends.
+  for (const StepCounts& counts : step_counts) {
+    FramePointerStats& stats = frame_pointer_stats_[counts.map_info->name()];
+    if (stats.library.empty()) {
+      stats.library = counts.map_info->name();
+    }
+    stats.steps += counts.steps;
+    stats.frame_pointer_steps += counts.frame_pointer_steps;
+  }
+
+  if (use_memo) {
+    for (size_t i = 0; i < frames_.size(); i++) {
+      memo_entries[i].frame = frames_[i];
+    }
+    stack_memo_->entries_ = std::move(memo_entries);
+    stack_memo_->last_error_ = last_error_;
+    stack_memo_->maps_ = maps_;
+    stack_memo_->maps_generation_ = maps_generation;
+    if (!spliced) {
+      stack_memo_->reused_frames_ = 0;
+    }
+  }
+}
+
+void Unwinder::GetCalleeSavedRegs(Regs* regs, uint64_t* values) {
+  static constexpr uint16_t kX86Regs[] = {X86_REG_EBX, X86_REG_EBP, X86_REG_ESI, X86_REG_EDI};
+  static constexpr uint16_t kX86_64Regs[] = {X86_64_REG_RBX, X86_64_REG_RBP, X86_64_REG_R12,
+                                             X86_64_REG_R13, X86_64_REG_R14, X86_64_REG_R15};
+  static_assert(sizeof(kX86_64Regs) / sizeof(uint16_t) == StackMemo::kMaxCalleeSavedRegs);
+  memset(values, 0, StackMemo::kMaxCalleeSavedRegs * sizeof(uint64_t));
+  void* raw_data = regs->RawData();
+  if (raw_data == nullptr) {
+    return;
+  }
+  if (regs->Arch() == ARCH_X86) {
+    for (size_t i = 0; i < sizeof(kX86Regs) / sizeof(uint16_t); i++) {
+      values[i] = reinterpret_cast<uint32_t*>(raw_data)[kX86Regs[i]];
+    }
+  } else if (regs->Arch() == ARCH_X86_64) {
+    for (size_t i = 0; i < sizeof(kX86_64Regs) / sizeof(uint16_t); i++) {
+      values[i] = reinterpret_cast<uint64_t*>(raw_data)[kX86_64Regs[i]];
+    }
+  }
+}
+
+void Unwinder::RecordStackMemoStep(Memory* memory, StackMemo::Entry* entry) {
+  entry->cfa = regs_->sp();
+  size_t slot_size = regs_->Is32Bit() ? 2 * sizeof(uint32_t) : 2 * sizeof(uint64_t);
+  entry->valid = entry->cfa >= slot_size &&
+                 memory->ReadFully(entry->cfa - slot_size, entry->slot, slot_size);
+}
+
+bool Unwinder::SpliceStackMemo(Memory* memory, std::vector<StackMemo::Entry>* entries) {
+  const std::vector<StackMemo::Entry>& memo = stack_memo_->entries_;
+  uint64_t pc = regs_->pc();
+  uint64_t sp = regs_->sp();
+  uint64_t callee_saved[StackMemo::kMaxCalleeSavedRegs];
+  GetCalleeSavedRegs(regs_, callee_saved);
+  size_t slot_size = regs_->Is32Bit() ? 2 * sizeof(uint32_t) : 2 * sizeof(uint64_t);
+
+  for (auto it = memo.begin(); it != memo.end(); ++it) {
+    if (!it->valid || it->sp != sp || it->pc != pc ||
+        memcmp(it->callee_saved, callee_saved, sizeof(callee_saved)) != 0) {
+      continue;
+    }
+    // Check that the return address and the saved frame pointer of this
+    // frame are also unchanged. That only shows that the step to the
+    // caller gives the same registers. The frames further out are not
+    // checked, so if the stack above the slot was rewritten with other
+    // frames while these words happen to match, the copied frames are
+    // wrong. That takes a thread that returned past this frame and called
+    // back down to the same pc and sp, with the same callee saved
+    // registers.
+    uint8_t slot[sizeof(it->slot)];
+    if (!memory->ReadFully(it->cfa - slot_size, slot, slot_size) ||
+        memcmp(slot, it->slot, slot_size) != 0) {
+      continue;
+    }
+    // Do not reuse frames from maps that have since been removed. The
+    // frames hold their maps, so they only need to be looked up again if
+    // the maps changed.
+    if (stack_memo_->maps_ != maps_ || stack_memo_->maps_generation_ != maps_->Generation()) {
+      bool maps_changed = std::any_of(it, memo.end(), [this](const StackMemo::Entry& entry) {
+        return entry.frame.map_info != nullptr &&
+               maps_->FindMapInfo(entry.frame.pc) != entry.frame.map_info.get();
+      });
+      if (maps_changed) {
+        return false;
+      }
+    }
+
+    size_t num_frames = frames_.size();
+    for (; it != memo.end(); ++it) {
+      if (frames_.size() == max_frames_) {
+        break;
+      }
+      FrameData& frame = frames_.emplace_back(it->frame);
+      frame.num = frames_.size() - 1;
+      entries->push_back(*it);
+    }
+    last_error_ = stack_memo_->last_error_;
+    if (it != memo.end()) {
+      last_error_.code = ERROR_MAX_FRAMES_EXCEEDED;
+    }
+    stack_memo_->reused_frames_ = frames_.size() - num_frames;
+    return true;
+  }
+  return false;
+}
+
+bool Unwinder::StepFramePointer(Regs* regs, Memory* memory) {
+  uint64_t fp;
+  if (!regs->GetFramePointer(&fp) || fp < regs->sp() || (fp & 7) != 0) {
+    return false;
+  }
+  // The frame record has to be in the same map as the stack.
+  MapInfo* stack_map_info = maps_->FindMapInfo(regs->sp());
+  uint64_t record_end;
+  if (stack_map_info == nullptr || __builtin_add_overflow(fp, 2 * sizeof(uint64_t), &record_end) ||
+      record_end > stack_map_info->end()) {
+    return false;
+  }
+
+  uint64_t record[2];
+  if (!memory->ReadFully(fp, record, sizeof(record))) {
+    return false;
+  }
+  // The chain only moves up the stack, a zero frame pointer ends it.
+  uint64_t next_fp = record[0];
+  if (next_fp != 0 && next_fp <= fp) {
+    return false;
+  }
+  uint64_t return_address = record[1];
+  MapInfo* map_info = maps_->FindMapInfo(return_address);
+  if (map_info == nullptr || !(map_info->flags() & PROT_EXEC)) {
+    return false;
+  }
+
+  regs->set_pc(return_address);
+  regs->set_sp(record_end);
+  regs->SetFramePointer(next_fp);
+  return true;
+}
+
+std::vector<FramePointerStats> Unwinder::GetFramePointerStats() const {
+  std::vector<FramePointerStats> stats;
+  for (const auto& entry : frame_pointer_stats_) {
+    stats.push_back(entry.second);
+  }
+  std::sort(stats.begin(), stats.end(),
+            [](const FramePointerStats& a, const FramePointerStats& b) {
+              return a.library < b.library;
+            });
+  return stats;
 }
 
 std::string Unwinder::FormatFrame(const FrameData& frame) const {
@@ -406,7 +675,23 @@ void UnwinderFromPid::Unwind(const std::vector<std::string>* initial_map_names_t
   if (!Init()) {
     return;
   }
+  if (!stack_prefetch_ || regs_ == nullptr) {
+    Unwinder::Unwind(initial_map_names_to_skip, map_suffixes_to_ignore);
+    return;
+  }
+
+  if (stack_prefetch_size_ == 0) {
+    stack_prefetch_size_ = MemoryStackSnapshot::kInitialSize;
+  }
+  std::shared_ptr<MemoryStackSnapshot> snapshot =
+      MemoryStackSnapshot::Create(process_memory_, maps_, regs_->sp(), stack_prefetch_size_);
+  SetStepMemory(snapshot);
   Unwinder::Unwind(initial_map_names_to_skip, map_suffixes_to_ignore);
+  SetStepMemory(nullptr);
+  if (snapshot != nullptr) {
+    stack_prefetch_size_ =
+        MemoryStackSnapshot::NextSize(stack_prefetch_size_, snapshot->StackBytesUsed());
+  }
 }
 
 FrameData Unwinder::BuildFrameFromPcOnly(uint64_t pc, ArchEnum arch, Maps* maps,
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Unwinder.h>
+
+static constexpr size_t kNumUniqueStacks = 256;
+static constexpr size_t kStackDepth = 32;
+
+// Creates stacks that share their outer frames, the way the stacks of a
+// real process share main and the thread entry functions.
+static std::vector<std::vector<unwindstack::FrameData>> CreateStacks() {
+  std::vector<std::shared_ptr<unwindstack::MapInfo>> maps;
+  for (size_t i = 0; i < 8; i++) {
+    maps.push_back(unwindstack::MapInfo::Create(i * 0x100000, (i + 1) * 0x100000, 0,
+                                                PROT_READ | PROT_EXEC,
+                                                "/system/lib64/lib" + std::to_string(i) + ".so"));
+  }
+
+  std::vector<std::vector<unwindstack::FrameData>> stacks(kNumUniqueStacks);
+  uint64_t seed = 0x12345678;
+  for (size_t i = 0; i < kNumUniqueStacks; i++) {
+    for (size_t depth = 0; depth < kStackDepth; depth++) {
+      unwindstack::FrameData frame{};
+      frame.num = depth;
+      // The outer half of every stack is the same.
+      if (depth < kStackDepth / 2) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        frame.map_info = maps[(seed >> 33) % maps.size()];
+        frame.rel_pc = (seed >> 40) % 0x100000;
+      } else {
+        frame.map_info = maps[0];
+        frame.rel_pc = depth * 0x40;
+      }
+      frame.pc = frame.map_info->start() + frame.rel_pc;
+      stacks[i].push_back(frame);
+    }
+  }
+  return stacks;
+}
+
+// Adds samples drawn from a fixed set of stacks, and reports the memory
+// used per sample, which drops as samples repeat stacks.
+static void BM_calling_context_trie_add_sample(benchmark::State& state) {
+  static std::vector<std::vector<unwindstack::FrameData>>* stacks;
+  static unwindstack::CallingContextTrie* trie;
+  if (state.thread_index() == 0) {
+    stacks = new std::vector<std::vector<unwindstack::FrameData>>(CreateStacks());
+    trie = new unwindstack::CallingContextTrie;
+  }
+
+  size_t index = state.thread_index();
+  for (auto _ : state) {
+    trie->AddSample((*stacks)[index++ % stacks->size()]);
+  }
+
+  if (state.thread_index() == 0) {
+    uint64_t num_samples = trie->NumSamples();
+    state.counters["NODES"] = trie->NumNodes();
+    state.counters["BYTES_PER_SAMPLE"] = trie->MemoryUsage() / static_cast<double>(num_samples);
+    state.counters["FRAME_BYTES_PER_SAMPLE"] = kStackDepth * sizeof(unwindstack::FrameData);
+    delete trie;
+    delete stacks;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_calling_context_trie_add_sample)->ThreadRange(1, 4)->UseRealTime();
+
+// Dumps a trie whose nodes all have names already.
+static void BM_calling_context_trie_dump_folded(benchmark::State& state) {
+  std::vector<std::vector<unwindstack::FrameData>> stacks = CreateStacks();
+  unwindstack::CallingContextTrie trie;
+  for (auto& stack : stacks) {
+    for (auto& frame : stack) {
+      frame.function_name = "function_" + std::to_string(frame.rel_pc);
+    }
+    trie.AddSample(stack);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(trie.DumpFolded());
+  }
+}
+BENCHMARK(BM_calling_context_trie_dump_folded);
@@ -15,18 +15,34 @@
  */
 
 #include <err.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
 #include <benchmark/benchmark.h>
 
+#include <unwindstack/DwarfSection.h>
 #include <unwindstack/Elf.h>
+#include <unwindstack/ElfInterface.h>
+#include <unwindstack/MachineArm.h>
+#include <unwindstack/MapInfo.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 #include <unwindstack/Regs.h>
+#include <unwindstack/RegsArm.h>
+#include <unwindstack/RegsArm64.h>
 
+#include "DwarfEhFrame.h"
+#include "ElfInterfaceArm.h"
 #include "Utils.h"
 
 static void BenchmarkElfCreate(benchmark::State& state, const std::string& elf_file) {
@@ -83,6 +99,322 @@ void BM_elf_create_large_eh_frame(benchmark::State& state) {
 }
 BENCHMARK(BM_elf_create_large_eh_frame);
 
+// Counts the bytes read through it, which is the part of the file that a
+// stage of the elf initialization touches.
+class MemoryCountReads : public unwindstack::Memory {
+ public:
+  MemoryCountReads(unwindstack::Memory* memory) : memory_(memory) {}
+  virtual ~MemoryCountReads() = default;
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override {
+    size_t bytes = memory_->Read(addr, dst, size);
+    bytes_read_ += bytes;
+    return bytes;
+  }
+
+  uint64_t bytes_read() { return bytes_read_; }
+
+ private:
+  std::unique_ptr<unwindstack::Memory> memory_;
+  uint64_t bytes_read_ = 0;
+};
+
+enum ElfInitStage {
+  // The elf and program headers, enough for the load bias and build id.
+  ELF_STAGE_IDENTITY,
+  // The section headers.
+  ELF_STAGE_SECTIONS,
+  // The eh_frame and debug_frame.
+  ELF_STAGE_UNWIND,
+  // The .gnu_debugdata and the first symbol lookup.
+  ELF_STAGE_SYMBOLS,
+};
+
+static void RunElfInitStage(unwindstack::Elf* elf, ElfInitStage stage) {
+  switch (stage) {
+    case ELF_STAGE_IDENTITY:
+      if (!elf->Init() || !elf->valid()) {
+        errx(1, "Internal Error: Cannot open elf");
+      }
+      benchmark::DoNotOptimize(elf->GetBuildID());
+      break;
+    case ELF_STAGE_SECTIONS:
+      elf->interface()->ReadSectionsIfNeeded();
+      break;
+    case ELF_STAGE_UNWIND:
+      elf->interface()->InitHeadersIfNeeded();
+      break;
+    case ELF_STAGE_SYMBOLS: {
+      unwindstack::SharedString name;
+      uint64_t func_offset;
+      benchmark::DoNotOptimize(elf->GetFunctionName(0, &name, &func_offset));
+      benchmark::DoNotOptimize(elf->gnu_debugdata_interface());
+      break;
+    }
+  }
+}
+
+// Times one stage of the elf initialization, after running the stages
+// before it untimed, and reports the bytes of the file it reads.
+static void BenchmarkElfInitStage(benchmark::State& state, const std::string& elf_file,
+                                  ElfInitStage stage) {
+  uint64_t bytes_read = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    MemoryCountReads* memory =
+        new MemoryCountReads(unwindstack::Memory::CreateFileMemory(elf_file, 0).release());
+    unwindstack::Elf elf(memory);
+    for (int i = ELF_STAGE_IDENTITY; i < stage; i++) {
+      RunElfInitStage(&elf, static_cast<ElfInitStage>(i));
+    }
+    uint64_t bytes_before = memory->bytes_read();
+    state.ResumeTiming();
+
+    RunElfInitStage(&elf, stage);
+
+    state.PauseTiming();
+    bytes_read += memory->bytes_read() - bytes_before;
+    state.ResumeTiming();
+  }
+  state.counters["BYTES_READ"] = bytes_read / static_cast<double>(state.iterations());
+}
+
+void BM_elf_init_stage_identity(benchmark::State& state) {
+  BenchmarkElfInitStage(state, GetLargeCompressedFrameElfFile(), ELF_STAGE_IDENTITY);
+}
+BENCHMARK(BM_elf_init_stage_identity);
+
+void BM_elf_init_stage_sections(benchmark::State& state) {
+  BenchmarkElfInitStage(state, GetLargeCompressedFrameElfFile(), ELF_STAGE_SECTIONS);
+}
+BENCHMARK(BM_elf_init_stage_sections);
+
+void BM_elf_init_stage_unwind(benchmark::State& state) {
+  BenchmarkElfInitStage(state, GetLargeCompressedFrameElfFile(), ELF_STAGE_UNWIND);
+}
+BENCHMARK(BM_elf_init_stage_unwind);
+
+void BM_elf_init_stage_symbols(benchmark::State& state) {
+  BenchmarkElfInitStage(state, GetLargeCompressedFrameElfFile(), ELF_STAGE_SYMBOLS);
+}
+BENCHMARK(BM_elf_init_stage_symbols);
+
+// Drops the file from the page cache before every iteration, then creates
+// the elf and looks up a spread of pcs, the way the first unwind through a
+// library that has not been used in a while does. Dropping the whole page
+// cache needs root, evicting only this file is enough and works anywhere.
+static void BenchmarkElfColdCache(benchmark::State& state, const std::string& elf_file,
+                                  unwindstack::Memory::PrefetchMode mode) {
+  android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(elf_file.c_str(), O_RDONLY | O_CLOEXEC)));
+  if (fd == -1) {
+    errx(1, "Internal Error: Cannot open elf: %s", elf_file.c_str());
+  }
+
+  unwindstack::Memory::PrefetchMode old_mode = unwindstack::Elf::SectionPrefetch();
+  unwindstack::Elf::SetSectionPrefetch(mode);
+  constexpr size_t kNumLookups = 16;
+  for (auto _ : state) {
+    state.PauseTiming();
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    auto file_memory = unwindstack::Memory::CreateFileMemory(elf_file, 0);
+    state.ResumeTiming();
+
+    unwindstack::Elf elf(file_memory.release());
+    if (!elf.Init() || !elf.valid()) {
+      errx(1, "Internal Error: Cannot open elf: %s", elf_file.c_str());
+    }
+
+    uint64_t text_addr;
+    uint64_t text_size;
+    if (!elf.GetTextRange(&text_addr, &text_size)) {
+      errx(1, "Internal Error: No text range in elf: %s", elf_file.c_str());
+    }
+    unwindstack::DwarfSection* eh_frame = elf.interface()->eh_frame();
+    for (size_t i = 0; i < kNumLookups; i++) {
+      uint64_t pc = text_addr + text_size / kNumLookups * i;
+      unwindstack::SharedString name;
+      uint64_t func_offset;
+      benchmark::DoNotOptimize(elf.GetFunctionName(pc, &name, &func_offset));
+      if (eh_frame != nullptr) {
+        benchmark::DoNotOptimize(eh_frame->GetFdeFromPc(pc));
+      }
+    }
+  }
+  unwindstack::Elf::SetSectionPrefetch(old_mode);
+}
+
+void BM_elf_cold_cache(benchmark::State& state) {
+  BenchmarkElfColdCache(state, GetElfFile(), unwindstack::Memory::PREFETCH_NONE);
+}
+BENCHMARK(BM_elf_cold_cache);
+
+void BM_elf_cold_cache_prefetch_async(benchmark::State& state) {
+  BenchmarkElfColdCache(state, GetElfFile(), unwindstack::Memory::PREFETCH_ASYNC);
+}
+BENCHMARK(BM_elf_cold_cache_prefetch_async);
+
+void BM_elf_cold_cache_prefetch_populate(benchmark::State& state) {
+  BenchmarkElfColdCache(state, GetElfFile(), unwindstack::Memory::PREFETCH_POPULATE);
+}
+BENCHMARK(BM_elf_cold_cache_prefetch_populate);
+
+// Steps from the start of a spread of functions, using either the full
+// dwarf evaluation or the compact table built from it.
+static void BenchmarkDwarfStep(benchmark::State& state, bool compact) {
+  std::string elf_file = GetLargeEhFrameElfFile();
+  unwindstack::Elf elf(unwindstack::Memory::CreateFileMemory(elf_file, 0).release());
+  if (!elf.Init() || !elf.valid() || elf.arch() != unwindstack::ARCH_ARM64) {
+    errx(1, "Internal Error: Cannot open arm64 elf: %s", elf_file.c_str());
+  }
+  unwindstack::DwarfSection* eh_frame = elf.interface()->eh_frame();
+  if (eh_frame == nullptr) {
+    errx(1, "Internal Error: No eh_frame in elf: %s", elf_file.c_str());
+  }
+  if (compact && !eh_frame->BuildCompactTable(elf.arch())) {
+    errx(1, "Internal Error: Cannot build compact table for elf: %s", elf_file.c_str());
+  }
+
+  std::vector<const unwindstack::DwarfFde*> fdes;
+  eh_frame->GetFdes(&fdes);
+  constexpr size_t kNumPcs = 1024;
+  std::vector<uint64_t> pcs;
+  for (size_t i = 0; i < fdes.size(); i += std::max<size_t>(1, fdes.size() / kNumPcs)) {
+    pcs.push_back(fdes[i]->pc_start);
+  }
+
+  std::vector<uint8_t> stack(0x2000, 0x40);
+  std::shared_ptr<unwindstack::Memory> stack_memory =
+      unwindstack::Memory::CreateOfflineMemory(stack.data(), 0x10000, 0x10000 + stack.size());
+  unwindstack::RegsArm64 regs;
+  for (auto _ : state) {
+    for (uint64_t pc : pcs) {
+      regs.set_sp(0x11000);
+      regs[unwindstack::ARM64_REG_R29] = 0x11000;
+      bool finished;
+      bool is_signal_frame;
+      benchmark::DoNotOptimize(
+          eh_frame->Step(pc, &regs, stack_memory.get(), &finished, &is_signal_frame));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+
+void BM_dwarf_step(benchmark::State& state) {
+  BenchmarkDwarfStep(state, false);
+}
+BENCHMARK(BM_dwarf_step);
+
+void BM_dwarf_step_compact_table(benchmark::State& state) {
+  BenchmarkDwarfStep(state, true);
+}
+BENCHMARK(BM_dwarf_step_compact_table);
+
+// Builds the fde index of a large eh_frame, without using its eh_frame_hdr,
+// on the number of threads given by the argument.
+static void BM_dwarf_build_fde_index(benchmark::State& state) {
+  std::string elf_file = GetLargeEhFrameElfFile();
+  unwindstack::Elf elf(unwindstack::Memory::CreateFileMemory(elf_file, 0).release());
+  if (!elf.Init() || !elf.valid()) {
+    errx(1, "Internal Error: Cannot open elf: %s", elf_file.c_str());
+  }
+  unwindstack::ElfInterface* interface = elf.interface();
+  if (interface->eh_frame_size() == 0) {
+    errx(1, "Internal Error: No eh_frame in elf: %s", elf_file.c_str());
+  }
+
+  unwindstack::DwarfSection::SetIndexThreads(state.range(0));
+  size_t num_entries = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    unwindstack::DwarfEhFrame<uint64_t> eh_frame(elf.memory());
+    if (!eh_frame.Init(interface->eh_frame_offset(), interface->eh_frame_size(),
+                       interface->eh_frame_section_bias())) {
+      errx(1, "Internal Error: Cannot init eh_frame in elf: %s", elf_file.c_str());
+    }
+    state.ResumeTiming();
+
+    const unwindstack::DwarfSection::FdeIndexEntry* index;
+    if (!eh_frame.GetFdeIndex(&index, &num_entries) || num_entries == 0) {
+      errx(1, "Internal Error: Cannot build fde index for elf: %s", elf_file.c_str());
+    }
+  }
+  unwindstack::DwarfSection::SetIndexThreads(1);
+  state.counters["ENTRIES"] = num_entries;
+}
+BENCHMARK(BM_dwarf_build_fde_index)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// Converts a spread of absolute pcs, some of which are outside of any
+// executable segment, and checks each of them, the way every frame of an
+// unwind does.
+static void BM_elf_get_rel_pc_is_valid_pc(benchmark::State& state) {
+  std::string elf_file = GetLargeEhFrameElfFile();
+  unwindstack::Elf elf(unwindstack::Memory::CreateFileMemory(elf_file, 0).release());
+  if (!elf.Init() || !elf.valid()) {
+    errx(1, "Internal Error: Cannot open elf: %s", elf_file.c_str());
+  }
+  const std::vector<unwindstack::LoadInfo>& pt_loads = elf.interface()->pt_loads();
+  if (pt_loads.empty()) {
+    errx(1, "Internal Error: No executable PT_LOAD in elf: %s", elf_file.c_str());
+  }
+
+  constexpr uint64_t kMapStart = 0x70000000;
+  auto map_info = unwindstack::MapInfo::Create(kMapStart, kMapStart + 0x10000000, 0,
+                                               PROT_READ | PROT_EXEC, elf_file);
+  constexpr size_t kNumPcs = 1024;
+  uint64_t last_end = pt_loads.back().table_offset + pt_loads.back().table_size;
+  std::vector<uint64_t> pcs;
+  for (size_t i = 0; i < kNumPcs; i++) {
+    pcs.push_back(kMapStart - elf.GetLoadBias() + last_end / kNumPcs * i + i % 2 * 0x10);
+  }
+
+  for (auto _ : state) {
+    for (uint64_t pc : pcs) {
+      uint64_t rel_pc = elf.GetRelPc(pc, map_info.get());
+      benchmark::DoNotOptimize(elf.IsValidPc(rel_pc));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+BENCHMARK(BM_elf_get_rel_pc_is_valid_pc);
+
+// Steps from a spread of functions using only the arm exidx data.
+static void BM_exidx_step(benchmark::State& state) {
+  std::string elf_file = GetElfFile();
+  unwindstack::Elf elf(unwindstack::Memory::CreateFileMemory(elf_file, 0).release());
+  if (!elf.Init() || !elf.valid() || elf.arch() != unwindstack::ARCH_ARM) {
+    errx(1, "Internal Error: Cannot open arm elf: %s", elf_file.c_str());
+  }
+  unwindstack::ElfInterfaceArm* interface =
+      reinterpret_cast<unwindstack::ElfInterfaceArm*>(elf.interface());
+
+  constexpr size_t kNumPcs = 1024;
+  std::vector<uint64_t> pcs;
+  size_t skip = std::max<size_t>(1, interface->total_entries() / kNumPcs);
+  size_t index = 0;
+  for (uint32_t pc : *interface) {
+    if (index++ % skip == 0) {
+      pcs.push_back(pc + elf.GetLoadBias());
+    }
+  }
+
+  std::vector<uint8_t> stack(0x2000, 0x40);
+  std::shared_ptr<unwindstack::Memory> stack_memory =
+      unwindstack::Memory::CreateOfflineMemory(stack.data(), 0x10000, 0x10000 + stack.size());
+  unwindstack::RegsArm regs;
+  for (auto _ : state) {
+    for (uint64_t pc : pcs) {
+      regs.set_sp(0x11000);
+      regs[unwindstack::ARM_REG_SP] = 0x11000;
+      regs[unwindstack::ARM_REG_R7] = 0x11000;
+      regs[unwindstack::ARM_REG_R11] = 0x11000;
+      bool finished;
+      benchmark::DoNotOptimize(interface->StepExidx(pc, &regs, stack_memory.get(), &finished));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+BENCHMARK(BM_exidx_step);
+
 static void InitializeBuildId(benchmark::State& state, unwindstack::Maps& maps,
                               unwindstack::MapInfo** build_id_map_info) {
   if (!maps.Parse()) {
@@ -15,15 +15,20 @@
  */
 
 #include <err.h>
+#include <inttypes.h>
 #include <stdint.h>
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
 
 #include <benchmark/benchmark.h>
 
+#include <unwindstack/Epoch.h>
+#include <unwindstack/MapInfo.h>
 #include <unwindstack/Maps.h>
 
 class BenchmarkLocalUpdatableMaps : public unwindstack::LocalUpdatableMaps {
@@ -158,3 +163,102 @@ void BM_local_updatable_maps_reparse_few_less_large(benchmark::State& state) {
   ReparseBenchmark(state, maps1.path, kNumLargeMaps, maps2.path, kNumLargeMaps - 4);
 }
 BENCHMARK(BM_local_updatable_maps_reparse_few_less_large);
+
+static void FindBenchmark(benchmark::State& state, size_t num_maps, size_t num_pcs,
+                          bool consecutive) {
+  TemporaryFile maps_file;
+  CreateMap(maps_file.path, num_maps);
+  BenchmarkLocalUpdatableMaps maps;
+  maps.BenchmarkSetMapsFile(maps_file.path);
+  if (!maps.Parse()) {
+    errx(1, "Internal Error: parse of maps failed.");
+  }
+
+  // Consecutive lookups emulate an unwind, where each frame looks up a pc
+  // in a code map and an sp in the stack map, and neighbouring frames tend
+  // to be in the same code map.
+  std::vector<uint64_t> pcs;
+  uint64_t seed = 0x12345678;
+  for (size_t i = 0; i < num_pcs; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    if (consecutive) {
+      pcs.push_back(((i / 8) % num_maps) * 1000 + (seed >> 54));
+      pcs.push_back((num_maps - 1) * 1000 + 500);
+    } else {
+      pcs.push_back((seed >> 16) % (num_maps * 1000));
+    }
+  }
+
+  for (auto _ : state) {
+    for (uint64_t pc : pcs) {
+      if (maps.Find(pc) == nullptr) {
+        errx(1, "Internal Error: unable to find map for pc 0x%" PRIx64, pc);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * pcs.size());
+}
+
+void BM_maps_find_random_small(benchmark::State& state) {
+  FindBenchmark(state, kNumSmallMaps, 1024, false);
+}
+BENCHMARK(BM_maps_find_random_small);
+
+void BM_maps_find_random_large(benchmark::State& state) {
+  FindBenchmark(state, kNumLargeMaps, 1024, false);
+}
+BENCHMARK(BM_maps_find_random_large);
+
+void BM_maps_find_unwind_like_small(benchmark::State& state) {
+  FindBenchmark(state, kNumSmallMaps, 1024, true);
+}
+BENCHMARK(BM_maps_find_unwind_like_small);
+
+void BM_maps_find_unwind_like_large(benchmark::State& state) {
+  FindBenchmark(state, kNumLargeMaps, 1024, true);
+}
+BENCHMARK(BM_maps_find_unwind_like_large);
+
+// Every thread looks up pcs in the same map, as threads unwinding through
+// a popular library do. Either each lookup takes a reference to the map,
+// or the lookups use pointers inside a single epoch read section, the way
+// an unwind does.
+static void SharedFindBenchmark(benchmark::State& state, bool take_reference) {
+  static BenchmarkLocalUpdatableMaps* maps = [] {
+    TemporaryFile maps_file;
+    CreateMap(maps_file.path, kNumSmallMaps);
+    auto maps = new BenchmarkLocalUpdatableMaps;
+    maps->BenchmarkSetMapsFile(maps_file.path);
+    if (!maps->Parse()) {
+      errx(1, "Internal Error: parse of maps failed.");
+    }
+    return maps;
+  }();
+
+  constexpr size_t kNumFrames = 64;
+  for (auto _ : state) {
+    if (take_reference) {
+      for (size_t i = 0; i < kNumFrames; i++) {
+        std::shared_ptr<unwindstack::MapInfo> map_info = maps->Find(1000 + i);
+        benchmark::DoNotOptimize(map_info);
+      }
+    } else {
+      unwindstack::EpochReadSection read_section;
+      for (size_t i = 0; i < kNumFrames; i++) {
+        unwindstack::MapInfo* map_info = maps->FindMapInfo(1000 + i);
+        benchmark::DoNotOptimize(map_info);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kNumFrames);
+}
+
+void BM_maps_find_shared(benchmark::State& state) {
+  SharedFindBenchmark(state, true);
+}
+BENCHMARK(BM_maps_find_shared)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_maps_find_map_info_shared(benchmark::State& state) {
+  SharedFindBenchmark(state, false);
+}
+BENCHMARK(BM_maps_find_map_info_shared)->ThreadRange(1, 8)->UseRealTime();
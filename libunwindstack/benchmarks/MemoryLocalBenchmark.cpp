@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <unwindstack/Memory.h>
+
+#include "MemoryLocalUnsafe.h"
+
+// The reads an unwind makes, one word at a time from the stack.
+static constexpr size_t kNumWords = 64;
+
+static void ReadWords(benchmark::State& state, unwindstack::Memory* memory, uint64_t addr) {
+  uint64_t value;
+  for (auto _ : state) {
+    for (size_t i = 0; i < kNumWords; i++) {
+      if (!memory->ReadFully(addr + i * sizeof(uint64_t), &value, sizeof(value))) {
+        state.SkipWithError("Failed to read memory.");
+        return;
+      }
+      benchmark::DoNotOptimize(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kNumWords);
+}
+
+// Reads from the stack of the calling thread, which are done directly.
+static void BM_memory_local_read_stack(benchmark::State& state) {
+  std::shared_ptr<unwindstack::Memory> memory = unwindstack::Memory::CreateProcessMemory(getpid());
+  uint64_t words[kNumWords] = {};
+  ReadWords(state, memory.get(), reinterpret_cast<uintptr_t>(words));
+}
+BENCHMARK(BM_memory_local_read_stack);
+
+// Reads from anywhere else, which still go through process_vm_readv, the
+// way all local reads used to.
+static void BM_memory_local_read_heap(benchmark::State& state) {
+  std::shared_ptr<unwindstack::Memory> memory = unwindstack::Memory::CreateProcessMemory(getpid());
+  std::vector<uint64_t> words(kNumWords);
+  ReadWords(state, memory.get(), reinterpret_cast<uintptr_t>(words.data()));
+}
+BENCHMARK(BM_memory_local_read_heap);
+
+// The same reads as BM_memory_local_read_stack with no checks, the lower
+// bound for the direct reads.
+static void BM_memory_local_read_stack_unsafe(benchmark::State& state) {
+  unwindstack::MemoryLocalUnsafe memory;
+  uint64_t words[kNumWords] = {};
+  ReadWords(state, &memory, reinterpret_cast<uintptr_t>(words));
+}
+BENCHMARK(BM_memory_local_read_stack_unsafe);
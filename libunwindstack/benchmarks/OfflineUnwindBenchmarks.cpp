@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
@@ -22,11 +23,15 @@
 #include <unordered_map>
 #include <vector>
 
+#include <android-base/file.h>
 #include <benchmark/benchmark.h>
 
 #include <unwindstack/Arch.h>
+#include <unwindstack/BatchUnwinder.h>
+#include <unwindstack/Maps.h>
 #include <unwindstack/Unwinder.h>
 
+#include "MemoryOffline.h"
 #include "Utils.h"
 #include "utils/OfflineUnwindUtils.h"
 
@@ -278,5 +283,136 @@ BENCHMARK_REGISTER_F(OfflineUnwindBenchmark, BM_offline_profiler_like_single_thr
     ->ArgNames({"is_steady_state_case", "resolve_names"})
     ->Ranges({{false, true}, {false, true}});
 
+// Unwinds the profiler like samples of several processes with a
+// BatchUnwinder, and reports the samples unwound per second for each
+// number of threads.
+static void BM_offline_batch_profiler_like(benchmark::State& state) {
+  constexpr size_t kSamplesPerProcess = 64;
+  std::vector<UnwindSampleInfo> sample_infos{
+      {.offline_files_dir = "bluetooth_arm64/pc_1/", .arch = ARCH_ARM64},
+      {.offline_files_dir = "photos_reset_arm64/", .arch = ARCH_ARM64},
+      {.offline_files_dir = "youtube_compiled_arm64/", .arch = ARCH_ARM64},
+      {.offline_files_dir = "yt_music_arm64/", .arch = ARCH_ARM64},
+      {.offline_files_dir = "maps_compiled_arm64/28656_oat_odex_jar/", .arch = ARCH_ARM64}};
+  OfflineUnwindUtils offline_utils;
+  std::string error_msg;
+  if (!offline_utils.Init(sample_infos, &error_msg)) {
+    state.SkipWithError(error_msg.c_str());
+    return;
+  }
+
+  // The samples are unwound from every directory at once, so all of the
+  // map names have to be full paths.
+  for (const auto& sample_info : sample_infos) {
+    const std::string& sample_name = sample_info.offline_files_dir;
+    if (!offline_utils.ChangeToSampleDirectory(&error_msg, sample_name)) {
+      state.SkipWithError(error_msg.c_str());
+      return;
+    }
+    for (auto& map_info : *offline_utils.GetMaps(sample_name)) {
+      auto& name = map_info->name();
+      if (!name.empty()) {
+        std::filesystem::path path;
+        if (std::filesystem::is_symlink(name.c_str())) {
+          path = std::filesystem::read_symlink(name.c_str());
+        } else {
+          path = std::filesystem::current_path() / name.c_str();
+        }
+        name = path.lexically_normal().c_str();
+      }
+    }
+  }
+
+  BatchUnwinder batch(state.range(0));
+  for (size_t i = 0; i < sample_infos.size(); i++) {
+    // The maps are owned by offline_utils.
+    Maps* maps = offline_utils.GetMaps(sample_infos[i].offline_files_dir);
+    batch.AddMaps(i, 0, std::shared_ptr<Maps>(maps, [](Maps*) {}));
+  }
+  auto add_samples = [&]() {
+    uint64_t id = 0;
+    for (size_t i = 0; i < sample_infos.size(); i++) {
+      const std::string& sample_name = sample_infos[i].offline_files_dir;
+      for (size_t j = 0; j < kSamplesPerProcess; j++) {
+        BatchUnwindSample sample;
+        sample.id = id++;
+        sample.pid = i;
+        sample.regs.reset(offline_utils.GetRegs(sample_name)->Clone());
+        sample.process_memory = offline_utils.GetProcessMemory(sample_name);
+        batch.AddSample(std::move(sample));
+      }
+    }
+  };
+
+  std::atomic<size_t> num_frames = 0;
+  auto callback = [&num_frames](BatchUnwindResult& result) {
+    num_frames += result.frames.size();
+  };
+  // Create the Elf objects before measuring.
+  add_samples();
+  batch.Run(callback);
+
+  size_t num_samples = 0;
+  size_t num_stolen_tasks = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    add_samples();
+    num_samples += batch.NumSamples();
+    state.ResumeTiming();
+    batch.Run(callback);
+    num_stolen_tasks += batch.NumStolenTasks();
+  }
+  offline_utils.ReturnToCurrentWorkingDirectory();
+  state.SetItemsProcessed(num_samples);
+  state.counters["STOLEN_TASKS"] =
+      benchmark::Counter(num_stolen_tasks, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_offline_batch_profiler_like)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// Reads from stack memory made of many parts, like a snapshot captured with
+// unwind_for_offline. Every other part is adjacent to the previous one, so
+// some of the reads span two parts.
+static void BM_offline_memory_parts_read(benchmark::State& state) {
+  constexpr size_t kPartSize = 4096;
+  TemporaryFile tf;
+  std::vector<uint8_t> buffer(kPartSize, 0x12);
+  if (!android::base::WriteFully(tf.fd, buffer.data(), buffer.size())) {
+    state.SkipWithError("Failed to write the part data.");
+    return;
+  }
+
+  size_t num_parts = state.range(0);
+  MemoryOfflineParts parts;
+  std::vector<uint64_t> addrs;
+  uint64_t start = 0x10000000;
+  for (size_t i = 0; i < num_parts; i++) {
+    auto part = new MemoryOffline;
+    if (!part->Init(tf.path, 0, start, kPartSize)) {
+      delete part;
+      state.SkipWithError("Failed to init a part.");
+      return;
+    }
+    parts.Add(part);
+    addrs.push_back(start + 0x100);
+    addrs.push_back(start + kPartSize - 4);
+    start += (i % 2) ? 3 * kPartSize : kPartSize;
+  }
+
+  // Visit the parts out of order.
+  std::vector<uint64_t> order;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    order.push_back(addrs[(i * 7919) % addrs.size()]);
+  }
+
+  for (auto _ : state) {
+    for (uint64_t addr : order) {
+      uint64_t value;
+      benchmark::DoNotOptimize(parts.Read(addr, &value, sizeof(value)));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * order.size());
+}
+BENCHMARK(BM_offline_memory_parts_read)->Arg(16)->Arg(256)->Arg(1024);
+
 }  // namespace
 }  // namespace unwindstack
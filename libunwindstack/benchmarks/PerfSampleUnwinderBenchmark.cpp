@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/PerfSampleUnwinder.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsGetLocal.h>
+
+// The perf register numbers of the registers of x86_64.
+static constexpr uint8_t kX86_64PerfRegs[] = {
+    unwindstack::X86_64_REG_RAX, unwindstack::X86_64_REG_RBX, unwindstack::X86_64_REG_RCX,
+    unwindstack::X86_64_REG_RDX, unwindstack::X86_64_REG_RSI, unwindstack::X86_64_REG_RDI,
+    unwindstack::X86_64_REG_RBP, unwindstack::X86_64_REG_RSP, unwindstack::X86_64_REG_RIP,
+    0xff,                        0xff,                        0xff,
+    0xff,                        0xff,                        0xff,
+    0xff,                        unwindstack::X86_64_REG_R8,  unwindstack::X86_64_REG_R9,
+    unwindstack::X86_64_REG_R10, unwindstack::X86_64_REG_R11, unwindstack::X86_64_REG_R12,
+    unwindstack::X86_64_REG_R13, unwindstack::X86_64_REG_R14, unwindstack::X86_64_REG_R15,
+};
+
+template <typename T>
+static void Append(std::vector<uint8_t>* record, const T& value) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  record->insert(record->end(), bytes, bytes + sizeof(value));
+}
+
+// Creates a sample of the current thread, like the kernel would for a
+// sample taken right here.
+static __attribute__((__noinline__)) std::vector<uint8_t> CreateSample(uint64_t regs_mask,
+                                                                        size_t stack_size) {
+  std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::CreateFromLocal());
+  unwindstack::RegsGetLocal(regs.get());
+
+  std::vector<uint8_t> stack(stack_size);
+  size_t bytes = unwindstack::Memory::CreateProcessMemory(getpid())->Read(regs->sp(), stack.data(),
+                                                                          stack_size);
+
+  std::vector<uint8_t> record(sizeof(perf_event_header));
+  Append(&record, uint32_t(getpid()));
+  Append(&record, uint32_t(gettid()));
+  Append(&record, uint64_t(0));
+  Append(&record, uint64_t(PERF_SAMPLE_REGS_ABI_64));
+  const uint64_t* values = reinterpret_cast<const uint64_t*>(regs->RawData());
+  for (size_t perf_reg = 0; perf_reg < 64; perf_reg++) {
+    if ((regs_mask & (1ULL << perf_reg)) == 0) {
+      continue;
+    }
+    size_t reg = perf_reg;
+    if (regs->Arch() == unwindstack::ARCH_X86_64) {
+      reg = perf_reg < sizeof(kX86_64PerfRegs) ? kX86_64PerfRegs[perf_reg] : 0xff;
+    }
+    Append(&record, reg < regs->total_regs() ? values[reg] : uint64_t(0));
+  }
+  Append(&record, uint64_t(stack_size));
+  record.insert(record.end(), stack.begin(), stack.end());
+  Append(&record, uint64_t(bytes));
+
+  perf_event_header header{.type = PERF_RECORD_SAMPLE, .misc = 0, .size = 0};
+  header.size = record.size();
+  memcpy(record.data(), &header, sizeof(header));
+  return record;
+}
+
+static __attribute__((__noinline__)) std::vector<uint8_t> CreateDeepSample(
+    size_t depth, uint64_t regs_mask, size_t stack_size) {
+  if (depth == 0) {
+    return CreateSample(regs_mask, stack_size);
+  }
+  std::vector<uint8_t> sample = CreateDeepSample(depth - 1, regs_mask, stack_size);
+  benchmark::DoNotOptimize(sample.data());
+  return sample;
+}
+
+// Unwinds a sample of this process over and over, and reports the samples
+// unwound per second. The sample copies state.range(0) bytes of the stack.
+static void BM_perf_sample_unwind(benchmark::State& state) {
+  unwindstack::ArchEnum arch = unwindstack::Regs::CurrentArch();
+  if (arch != unwindstack::ARCH_ARM64 && arch != unwindstack::ARCH_X86_64) {
+    state.SkipWithError("Only supported on arm64 and x86_64.");
+    return;
+  }
+
+  unwindstack::CallingContextTrie trie;
+  unwindstack::PerfSampleUnwinder unwinder(arch, &trie);
+  unwinder.SetReadProcesses(true);
+  perf_event_attr attr = {};
+  unwinder.InitAttr(&attr, state.range(0));
+  std::vector<uint8_t> sample = CreateDeepSample(16, attr.sample_regs_user, attr.sample_stack_user);
+  // Read the maps and the elf files before measuring.
+  unwinder.ProcessRecord(sample.data(), sample.size());
+
+  for (auto _ : state) {
+    unwinder.ProcessRecord(sample.data(), sample.size());
+  }
+  state.counters["FRAMES"] = trie.NumNodes();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_perf_sample_unwind)->Arg(8192)->Arg(32768)->Arg(60000);
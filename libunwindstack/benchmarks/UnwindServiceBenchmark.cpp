@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <unwindstack/UnwindService.h>
+
+static constexpr size_t kNumRemoteThreads = 8;
+static constexpr size_t kRequestsPerIteration = 64;
+
+// Starts a process with kNumRemoteThreads threads besides the main thread,
+// and returns the ids of all of its threads.
+static pid_t StartRemoteThreads(std::vector<pid_t>* tids) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    for (size_t i = 0; i < kNumRemoteThreads; i++) {
+      std::thread([] {
+        while (true) {
+          usleep(1000);
+        }
+      }).detach();
+    }
+    while (true) {
+      usleep(1000);
+    }
+  }
+  if (pid == -1) {
+    return -1;
+  }
+
+  std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+  for (size_t i = 0; i < 1000 && tids->size() != kNumRemoteThreads + 1; i++) {
+    usleep(1000);
+    tids->clear();
+    DIR* dir = opendir(task_dir.c_str());
+    if (dir == nullptr) {
+      continue;
+    }
+    dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      if (entry->d_name[0] != '.') {
+        tids->push_back(atoi(entry->d_name));
+      }
+    }
+    closedir(dir);
+  }
+  return pid;
+}
+
+// Unwinds the threads of another process with the given number of workers,
+// and reports the requests completed per second.
+static void BM_unwind_service_remote_requests(benchmark::State& state) {
+  std::vector<pid_t> tids;
+  pid_t pid = StartRemoteThreads(&tids);
+  if (pid == -1 || tids.size() != kNumRemoteThreads + 1) {
+    if (pid != -1) {
+      kill(pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+    }
+    state.SkipWithError("Failed to start the remote threads.");
+    return;
+  }
+
+  unwindstack::UnwindService service(state.range(0), kRequestsPerIteration);
+  // Create the shared data of the process before measuring.
+  service.Submit(unwindstack::UnwindServiceRequest{.pid = pid}).wait();
+
+  size_t num_failed = 0;
+  for (auto _ : state) {
+    std::vector<std::future<unwindstack::UnwindServiceResult>> futures;
+    for (size_t i = 0; i < kRequestsPerIteration; i++) {
+      unwindstack::UnwindServiceRequest request{.pid = pid, .tid = tids[i % tids.size()]};
+      futures.emplace_back(service.Submit(request));
+    }
+    for (auto& future : futures) {
+      if (future.get().status != unwindstack::UNWIND_SERVICE_OK) {
+        num_failed++;
+      }
+    }
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+
+  if (num_failed != 0) {
+    state.SkipWithError("Some unwinds failed.");
+    return;
+  }
+  unwindstack::UnwindServiceStats stats = service.GetStats();
+  uint64_t num_requests = stats.completed;
+  state.counters["AVG_QUEUE_US"] =
+      std::chrono::duration<double, std::micro>(stats.total_queue_time).count() / num_requests;
+  state.counters["AVG_UNWIND_US"] =
+      std::chrono::duration<double, std::micro>(stats.total_unwind_time).count() / num_requests;
+  state.counters["MAX_LATENCY_US"] =
+      std::chrono::duration<double, std::micro>(stats.max_latency).count();
+  state.SetItemsProcessed(state.iterations() * kRequestsPerIteration);
+}
+BENCHMARK(BM_unwind_service_remote_requests)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
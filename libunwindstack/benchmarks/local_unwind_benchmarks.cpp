@@ -36,6 +36,7 @@ struct UnwindData {
   std::shared_ptr<unwindstack::Memory>& process_memory;
   unwindstack::Maps* maps;
   bool resolve_names;
+  bool frame_pointer_unwind = false;
 };
 
 size_t LocalCall5(size_t (*func)(void*), void* data) {
@@ -72,6 +73,7 @@ static size_t Unwind(void* data_ptr) {
   unwindstack::RegsGetLocal(regs.get());
   unwindstack::Unwinder unwinder(kMaxFrames, data->maps, regs.get(), data->process_memory);
   unwinder.SetResolveNames(data->resolve_names);
+  unwinder.SetFramePointerUnwind(data->frame_pointer_unwind);
   unwinder.Unwind();
   return unwinder.NumFrames();
 }
@@ -208,6 +210,21 @@ static void BM_local_unwind_cached_process_memory_no_func_names(benchmark::State
 }
 BENCHMARK(BM_local_unwind_cached_process_memory_no_func_names);
 
+static void BM_local_unwind_cached_process_memory_frame_pointers(benchmark::State& state) {
+  auto process_memory = unwindstack::Memory::CreateProcessMemoryCached(getpid());
+  unwindstack::LocalMaps maps;
+  if (!maps.Parse()) {
+    state.SkipWithError("Failed to parse local maps.");
+  }
+
+  UnwindData data = {.process_memory = process_memory,
+                     .maps = &maps,
+                     .resolve_names = false,
+                     .frame_pointer_unwind = true};
+  Run(state, Unwind, &data);
+}
+BENCHMARK(BM_local_unwind_cached_process_memory_frame_pointers);
+
 static void BM_local_unwind_local_updatable_maps_uncached_no_func_names(benchmark::State& state) {
   auto process_memory = unwindstack::Memory::CreateProcessMemory(getpid());
   unwindstack::LocalUpdatableMaps maps;
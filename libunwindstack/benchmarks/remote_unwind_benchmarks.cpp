@@ -30,6 +30,7 @@
 #include <unwindstack/Regs.h>
 #include <unwindstack/Unwinder.h>
 
+#include "MemoryCache.h"
 #include "MemoryRemote.h"
 #include "PidUtils.h"
 #include "tests/TestUtils.h"
@@ -100,17 +101,23 @@ static void RemoteUnwind(benchmark::State& state, bool cached) {
   }
   unwindstack::TestScopedPidReaper reap(pid);
 
+  // Same as the memory created by CreateProcessMemory and
+  // CreateProcessMemoryCached, but keeps the remote memory around to get
+  // its stats.
+  auto remote_memory = new unwindstack::MemoryRemote(pid, true);
+  remote_memory->SetBackend(unwindstack::MemoryRemote::BACKEND_PROCESS_VM_READV);
   std::shared_ptr<unwindstack::Memory> process_memory;
   if (cached) {
-    process_memory = unwindstack::Memory::CreateProcessMemoryCached(pid);
+    process_memory.reset(new unwindstack::MemoryCache(remote_memory));
   } else {
-    process_memory = unwindstack::Memory::CreateProcessMemory(pid);
+    process_memory.reset(remote_memory);
   }
   unwindstack::RemoteMaps maps(pid);
   if (!maps.Parse()) {
     state.SkipWithError("Failed to parse maps.");
   }
 
+  uint64_t total_frames = 0;
   for (auto _ : state) {
     std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::RemoteGet(pid));
     unwindstack::Unwinder unwinder(32, &maps, regs.get(), process_memory);
@@ -118,6 +125,12 @@ static void RemoteUnwind(benchmark::State& state, bool cached) {
     if (unwinder.NumFrames() < 5) {
       state.SkipWithError("Failed to unwind properly.");
     }
+    total_frames += unwinder.NumFrames();
+  }
+  if (total_frames != 0) {
+    uint64_t syscalls =
+        remote_memory->GetStats(unwindstack::MemoryRemote::BACKEND_PROCESS_VM_READV).syscalls;
+    state.counters["process_vm_readv_per_frame"] = static_cast<double>(syscalls) / total_frames;
   }
 
   ptrace(PTRACE_DETACH, pid, 0, 0);
@@ -133,7 +146,55 @@ static void BM_remote_unwind_cached(benchmark::State& state) {
 }
 BENCHMARK(BM_remote_unwind_cached);
 
-static void RemoteAndroidUnwind(benchmark::State& state, bool cached) {
+static void RemoteUnwindWithBackend(benchmark::State& state,
+                                    unwindstack::MemoryRemote::Backend backend) {
+  pid_t pid = StartRemoteRun();
+  if (pid == -1) {
+    state.SkipWithError("Failed to start remote process.");
+  }
+  unwindstack::TestScopedPidReaper reap(pid);
+
+  // The cache turns most reads into page sized reads, which is how the
+  // backends are normally used.
+  auto remote_memory = new unwindstack::MemoryRemote(pid, true);
+  remote_memory->SetBackend(backend);
+  std::shared_ptr<unwindstack::Memory> process_memory(new unwindstack::MemoryCache(remote_memory));
+  unwindstack::RemoteMaps maps(pid);
+  if (!maps.Parse()) {
+    state.SkipWithError("Failed to parse maps.");
+  }
+
+  for (auto _ : state) {
+    std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::RemoteGet(pid));
+    unwindstack::Unwinder unwinder(32, &maps, regs.get(), process_memory);
+    unwinder.Unwind();
+    if (unwinder.NumFrames() < 5) {
+      state.SkipWithError("Failed to unwind properly.");
+    }
+  }
+  state.counters["backend_bytes_per_second"] =
+      remote_memory->GetStats(backend).BytesPerSecond();
+
+  ptrace(PTRACE_DETACH, pid, 0, 0);
+}
+
+static void BM_remote_unwind_process_vm_readv(benchmark::State& state) {
+  RemoteUnwindWithBackend(state, unwindstack::MemoryRemote::BACKEND_PROCESS_VM_READV);
+}
+BENCHMARK(BM_remote_unwind_process_vm_readv);
+
+static void BM_remote_unwind_proc_mem(benchmark::State& state) {
+  RemoteUnwindWithBackend(state, unwindstack::MemoryRemote::BACKEND_PROC_MEM);
+}
+BENCHMARK(BM_remote_unwind_proc_mem);
+
+static void BM_remote_unwind_ptrace(benchmark::State& state) {
+  RemoteUnwindWithBackend(state, unwindstack::MemoryRemote::BACKEND_PTRACE);
+}
+BENCHMARK(BM_remote_unwind_ptrace);
+
+static void RemoteAndroidUnwind(benchmark::State& state, bool cached,
+                                bool stack_prefetch = false) {
   pid_t pid = StartRemoteRun();
   if (pid == -1) {
     state.SkipWithError("Failed to start remote process.");
@@ -147,6 +208,7 @@ static void RemoteAndroidUnwind(benchmark::State& state, bool cached) {
     process_memory = unwindstack::Memory::CreateProcessMemory(pid);
   }
   unwindstack::AndroidRemoteUnwinder unwinder(pid, process_memory);
+  unwinder.SetStackPrefetch(stack_prefetch);
   unwindstack::ErrorData error;
   if (!unwinder.Initialize(error)) {
     state.SkipWithError("Failed to initialize unwinder.");
@@ -171,3 +233,8 @@ static void BM_remote_android_unwind_cached(benchmark::State& state) {
   RemoteAndroidUnwind(state, true);
 }
 BENCHMARK(BM_remote_android_unwind_cached);
+
+static void BM_remote_android_unwind_cached_stack_prefetch(benchmark::State& state) {
+  RemoteAndroidUnwind(state, true, true);
+}
+BENCHMARK(BM_remote_android_unwind_cached_stack_prefetch);
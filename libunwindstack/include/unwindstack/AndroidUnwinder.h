@@ -24,6 +24,7 @@
 #include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -43,13 +44,15 @@ struct AndroidUnwinderData {
   AndroidUnwinderData() = default;
   explicit AndroidUnwinderData(const size_t max_frames) : max_frames(max_frames) {}
   explicit AndroidUnwinderData(const bool show_all_frames) : show_all_frames(show_all_frames) {}
+  AndroidUnwinderData(const std::optional<size_t> max_frames, const bool show_all_frames)
+      : max_frames(max_frames), show_all_frames(show_all_frames) {}
 
   void DemangleFunctionNames();
 
   std::string GetErrorString();
 
   std::vector<FrameData> frames;
-  ErrorData error;
+  ErrorData error = {.code = ERROR_NONE, .address = 0};
   std::optional<std::unique_ptr<Regs>> saved_initial_regs;
   const std::optional<size_t> max_frames;
   const bool show_all_frames = false;
@@ -61,6 +64,8 @@ class AndroidUnwinder {
   AndroidUnwinder(pid_t pid, std::shared_ptr<Memory>& memory)
       : pid_(pid), process_memory_(memory) {}
   AndroidUnwinder(pid_t pid, ArchEnum arch) : pid_(pid), arch_(arch) {}
+  AndroidUnwinder(pid_t pid, ArchEnum arch, std::shared_ptr<Memory>& memory)
+      : pid_(pid), arch_(arch), process_memory_(memory) {}
   AndroidUnwinder(pid_t pid, const std::vector<std::string> initial_map_names_to_skip)
       : pid_(pid), initial_map_names_to_skip_(std::move(initial_map_names_to_skip)) {}
   AndroidUnwinder(pid_t pid, const std::vector<std::string> initial_map_names_to_skip,
@@ -94,6 +99,11 @@ class AndroidUnwinder {
 
   virtual bool InternalUnwind(std::optional<pid_t> tid, AndroidUnwinderData& data) = 0;
 
+  // Unwind using step_memory for the reads done while stepping, see
+  // Unwinder::SetStepMemory.
+  bool UnwindWithStepMemory(Regs* initial_regs, std::shared_ptr<Memory> step_memory,
+                            AndroidUnwinderData& data);
+
   pid_t pid_;
 
   size_t max_frames_ = kMaxNumFrames;
@@ -146,6 +156,8 @@ class AndroidRemoteUnwinder : public AndroidUnwinder {
   AndroidRemoteUnwinder(pid_t pid, std::shared_ptr<Memory>& process_memory)
       : AndroidUnwinder(pid, process_memory) {}
   AndroidRemoteUnwinder(pid_t pid, ArchEnum arch) : AndroidUnwinder(pid, arch) {}
+  AndroidRemoteUnwinder(pid_t pid, ArchEnum arch, std::shared_ptr<Memory>& process_memory)
+      : AndroidUnwinder(pid, arch, process_memory) {}
   AndroidRemoteUnwinder(pid_t pid, const std::vector<std::string> initial_map_names_to_skip)
       : AndroidUnwinder(pid, initial_map_names_to_skip) {}
   AndroidRemoteUnwinder(pid_t pid, const std::vector<std::string> initial_map_names_to_skip,
@@ -153,10 +165,26 @@ class AndroidRemoteUnwinder : public AndroidUnwinder {
       : AndroidUnwinder(pid, initial_map_names_to_skip, map_suffixes_to_ignore) {}
   virtual ~AndroidRemoteUnwinder() = default;
 
+  // When enabled, the top of the stack of the thread is read in a single
+  // read before unwinding, and the stack reads done by the unwind are
+  // served from that copy. The amount read adapts to the depth of the
+  // previous unwinds of the same thread.
+  void SetStackPrefetch(bool enable) { stack_prefetch_ = enable; }
+
  protected:
   bool InternalInitialize(ErrorData& error) override;
 
   bool InternalUnwind(std::optional<pid_t> tid, AndroidUnwinderData& data) override;
+
+  size_t GetStackPrefetchSize(pid_t tid);
+  void SetStackPrefetchSize(pid_t tid, size_t size);
+
+  bool stack_prefetch_ = false;
+  std::mutex stack_prefetch_lock_;
+  std::unordered_map<pid_t, size_t> stack_prefetch_sizes_;
+
+  // Limit on the number of threads with a remembered prefetch size.
+  static constexpr size_t kMaxStackPrefetchThreads = 1024;
 };
 
 }  // namespace unwindstack
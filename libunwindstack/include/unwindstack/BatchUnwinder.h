@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <unwindstack/Error.h>
+#include <unwindstack/Unwinder.h>
+
+namespace unwindstack {
+
+// Forward declarations.
+class Maps;
+class Memory;
+class Regs;
+
+struct BatchUnwindSample {
+  // Passed back in the result, to match it with the sample.
+  uint64_t id = 0;
+  pid_t pid = 0;
+  // Changes every time the maps of the process change.
+  uint64_t maps_generation = 0;
+  std::unique_ptr<Regs> regs;
+  // Usually only the stack captured with the sample, the elf files are
+  // read from the paths in the maps.
+  std::shared_ptr<Memory> process_memory;
+};
+
+struct BatchUnwindResult {
+  uint64_t id = 0;
+  pid_t pid = 0;
+  std::vector<FrameData> frames;
+  ErrorData error;
+};
+
+// Unwinds a large number of recorded samples on a pool of threads.
+//
+// Samples are grouped by process and maps generation, and all of the
+// samples in a group share one Maps object, and so the Elf objects and
+// caches of its maps. To also share Elf objects between processes and
+// generations, enable Elf::SetCachingEnabled before running.
+//
+// The samples of a group are split into tasks that start out on the same
+// thread, and a thread that runs out of tasks steals them from the others.
+class BatchUnwinder {
+ public:
+  // Called from the pool threads, for different samples at the same time,
+  // and in no particular order.
+  using Callback = std::function<void(BatchUnwindResult& result)>;
+
+  // The calling thread is one of the num_threads threads.
+  BatchUnwinder(size_t num_threads, size_t max_frames = 512);
+
+  // Sets the maps used by the samples of pid with maps_generation. The
+  // maps must not change while the samples are unwound.
+  void AddMaps(pid_t pid, uint64_t maps_generation, std::shared_ptr<Maps> maps);
+
+  // Samples of a process and generation that have no maps get a single
+  // frame with no map.
+  void AddSample(BatchUnwindSample&& sample);
+
+  void SetResolveNames(bool resolve) { resolve_names_ = resolve; }
+
+  // Unwinds all of the samples added since the last run, and then removes
+  // them. The maps are kept for later runs.
+  void Run(const Callback& callback);
+
+  size_t NumSamples() const { return num_samples_; }
+
+  size_t num_threads() const { return num_threads_; }
+
+  // The number of tasks of the last run that were stolen from another
+  // thread.
+  size_t NumStolenTasks() const { return num_stolen_tasks_; }
+
+  // The number of consecutive samples of a group that make up a task.
+  static constexpr size_t kSamplesPerTask = 16;
+
+ private:
+  struct Group {
+    std::shared_ptr<Maps> maps;
+    std::vector<BatchUnwindSample> samples;
+  };
+
+  struct Task {
+    Group* group;
+    BatchUnwindSample* begin;
+    BatchUnwindSample* end;
+  };
+
+  class TaskQueue;
+
+  void Unwind(Group* group, BatchUnwindSample* sample, const Callback& callback);
+
+  size_t num_threads_;
+  size_t max_frames_;
+  bool resolve_names_ = true;
+
+  std::map<std::pair<pid_t, uint64_t>, Group> groups_;
+  size_t num_samples_ = 0;
+  size_t num_stolen_tasks_ = 0;
+};
+
+}  // namespace unwindstack
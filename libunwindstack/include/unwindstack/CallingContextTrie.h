@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unwindstack/SharedString.h>
+#include <unwindstack/Unwinder.h>
+
+namespace unwindstack {
+
+// Forward declarations.
+class MapInfo;
+class Maps;
+
+// Aggregates sampled stacks into a calling context trie, where every node
+// is a frame keyed by its map and relative pc, and its parent is the frame
+// that called it. Memory grows with the number of unique stacks, not with
+// the number of samples, and each node is symbolized at most once, when
+// the trie is dumped.
+//
+// Samples can be added from multiple threads at the same time, and the
+// trie can be dumped while samples are being added.
+class CallingContextTrie {
+ public:
+  // The number of buckets is rounded up to a power of two, it should be
+  // around the number of unique frames expected. The buckets are doubled
+  // whenever there are more nodes than buckets.
+  CallingContextTrie(size_t num_buckets = 1 << 14);
+  ~CallingContextTrie();
+
+  CallingContextTrie(const CallingContextTrie&) = delete;
+  CallingContextTrie& operator=(const CallingContextTrie&) = delete;
+
+  // Adds a sample of the frames produced by an unwind, the innermost frame
+  // first. If a frame already has a function name, it is used instead of
+  // symbolizing the frame later.
+  void AddSample(const std::vector<FrameData>& frames, uint64_t count = 1);
+
+  // Adds a sample of the pcs of the frames produced by an unwind, the
+  // innermost frame first, without building the frames. Each pc is looked
+  // up in maps, and the frame is keyed the same way as a frame with that
+  // pc would be.
+  void AddSample(Maps* maps, const uint64_t* pcs, size_t num_pcs, uint64_t count = 1);
+
+  // Returns the stacks in the folded format used by flame graph tools,
+  // one line per stack, with the outermost frame first:
+  //   main;foo;bar 12
+  // The ';' and ' ' characters in a frame name are replaced with '_',
+  // since they separate the frames and the count.
+  std::string DumpFolded();
+
+  size_t NumNodes() const { return num_nodes_.load(std::memory_order_relaxed); }
+
+  uint64_t NumSamples() const;
+
+  // Returns the number of bytes used by the nodes and buckets, not
+  // including the function names.
+  size_t MemoryUsage() const;
+
+ private:
+  struct Node {
+    Node* parent;
+    MapInfo* map_info;
+    // The relative pc, or the absolute pc if there is no map.
+    uint64_t pc;
+    // The samples in which this is the innermost frame.
+    std::atomic<uint64_t> count = 0;
+    Node* next = nullptr;
+
+    std::once_flag symbolize_once;
+    bool has_name = false;
+    SharedString function_name;
+    uint64_t function_offset = 0;
+  };
+
+  // The name of frame is used for the node if it is set, and frame can be
+  // nullptr.
+  Node* FindOrAddChild(Node* parent, const std::shared_ptr<MapInfo>& map_info, uint64_t pc,
+                       const FrameData* frame);
+
+  // Grows the buckets if there are more nodes than buckets.
+  void MaybeRehash();
+
+  template <typename Callback>
+  void ForEachNode(Callback callback) const;
+
+  static void Symbolize(Node* node);
+
+  static std::string GetFrameName(Node* node);
+
+  // Held for reading while nodes are added or read, and for writing while
+  // the buckets are replaced.
+  mutable pthread_rwlock_t buckets_rwlock_;
+  size_t num_buckets_;
+  std::unique_ptr<std::atomic<Node*>[]> buckets_;
+  std::atomic<size_t> num_nodes_ = 0;
+
+  // Keeps every map used by a node alive, and so its identity unique.
+  std::mutex maps_lock_;
+  std::unordered_map<MapInfo*, std::shared_ptr<MapInfo>> maps_;
+};
+
+}  // namespace unwindstack
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <unwindstack/DwarfLocation.h>
+#include <unwindstack/DwarfStructs.h>
+
+namespace unwindstack {
+
+// Forward declarations.
+enum ArchEnum : uint8_t;
+class DwarfSection;
+class Memory;
+class Regs;
+
+// A compact form of the call frame information, in the spirit of the
+// kernel's ORC tables. Every row only says how to compute the cfa from the
+// stack pointer or the frame pointer, and where the return address, the
+// frame pointer and any other saved registers are relative to the cfa.
+// Finding the row for a pc is a single binary search over a sorted array
+// of 32 bit pc offsets.
+//
+// The other saved registers are kept in a separate table of the distinct
+// sets, since most functions save the same few registers in the same
+// places. Rows that need anything more, such as expressions or signal
+// frames, are left out so that the full dwarf evaluation is used for those
+// pcs. A compact step restores the same registers as the full evaluation.
+//
+// Only arm64 and x86_64 are supported.
+class DwarfCompactTable {
+ public:
+  enum CfaRegister : uint8_t {
+    CFA_NONE = 0,
+    CFA_SP,
+    CFA_FP,
+  };
+
+  enum EntryFlags : uint8_t {
+    // The return address is saved at cfa + ra_offset.
+    RA_SAVED = 0x1,
+    // The return address is undefined, there is no caller.
+    RA_UNDEFINED = 0x2,
+    // The frame pointer is saved at cfa + fp_offset.
+    FP_SAVED = 0x4,
+  };
+
+  // The number of bits in Entry::saved_regs.
+  static constexpr size_t kSavedRegsBits = 11;
+  static constexpr size_t kMaxSavedRegSets = 1 << kSavedRegsBits;
+
+  // Packed into 8 bytes, which with the 4 byte pc offset makes a row
+  // 12 bytes.
+  struct Entry {
+    Entry() : saved_regs(0), cfa_reg(CFA_NONE), flags(0) {}
+
+    int16_t cfa_offset = 0;
+    int16_t ra_offset = 0;
+    int16_t fp_offset = 0;
+    // Index of the other saved registers, zero is the empty set.
+    uint16_t saved_regs : kSavedRegsBits;
+    // A CfaRegister.
+    uint16_t cfa_reg : 2;
+    // The EntryFlags.
+    uint16_t flags : 3;
+
+    bool operator==(const Entry& rhs) const {
+      return cfa_offset == rhs.cfa_offset && ra_offset == rhs.ra_offset &&
+             fp_offset == rhs.fp_offset && saved_regs == rhs.saved_regs &&
+             cfa_reg == rhs.cfa_reg && flags == rhs.flags;
+    }
+  };
+
+  static_assert(sizeof(Entry) == 8);
+
+  // A row with more saved registers is left to the full evaluation. This
+  // is enough for all of the callee saved registers on both arches.
+  static constexpr size_t kMaxSavedRegs = 12;
+
+  // The registers, other than the frame pointer and the return address,
+  // that are saved at an offset from the cfa. Bit n of mask is register
+  // n, the offsets are in register order.
+  struct SavedRegs {
+    uint64_t mask = 0;
+    int16_t offsets[kMaxSavedRegs] = {};
+
+    bool operator<(const SavedRegs& rhs) const {
+      if (mask != rhs.mask) {
+        return mask < rhs.mask;
+      }
+      return std::lexicographical_compare(offsets, offsets + kMaxSavedRegs, rhs.offsets,
+                                          rhs.offsets + kMaxSavedRegs);
+    }
+  };
+
+  struct Stats {
+    uint64_t fdes = 0;
+    uint64_t rows = 0;
+    uint64_t compact_rows = 0;
+    // Size of the code covered by the fdes, and by the compact rows.
+    uint64_t bytes = 0;
+    uint64_t compact_bytes = 0;
+  };
+
+  explicit DwarfCompactTable(ArchEnum arch);
+
+  static bool IsArchSupported(ArchEnum arch);
+
+  // Converts one row of locations, returns false if the row cannot be
+  // represented by an entry. The saved registers of the row are added to
+  // the table if this set has not been seen yet.
+  bool ConvertRow(const DwarfCie* cie, const DwarfLocations& loc_regs, Entry* entry);
+
+  // Adds every row of the fde. The rows are only visible to Find after
+  // the next call to Finalize. Returns false if the cfa information of
+  // the fde could not be processed, any rows before the error are kept.
+  bool AddFde(DwarfSection* section, const DwarfFde* fde);
+
+  // Adds a row for [pc_start, pc_end). Rows can be added in any order, a
+  // row that overlaps one that is already present is clipped.
+  void AddRow(uint64_t pc_start, uint64_t pc_end, const Entry& entry);
+
+  // Merges the rows added since the last call into the table.
+  void Finalize();
+
+  // Returns the entry for pc, or nullptr if there is no compact row for it.
+  const Entry* Find(uint64_t pc) const;
+
+  // Steps using the compact row for pc. Returns false without changing
+  // the registers if there is no compact row or a read fails, in that case
+  // the full dwarf information should be used instead.
+  bool Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished) const;
+
+  size_t NumRows() const { return pcs_.size(); }
+  size_t MemoryUsage() const {
+    return pcs_.size() * (sizeof(uint32_t) + sizeof(Entry)) +
+           saved_regs_.size() * sizeof(SavedRegs);
+  }
+
+  const SavedRegs& saved_regs(const Entry& entry) const { return saved_regs_[entry.saved_regs]; }
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  ArchEnum arch_;
+  uint16_t sp_reg_ = 0;
+  uint16_t fp_reg_ = 0;
+  uint16_t ra_reg_ = 0;
+  uint16_t total_regs_ = 0;
+
+  Stats stats_;
+
+  std::vector<std::tuple</*pc_start*/ uint64_t, /*pc_end*/ uint64_t, Entry>> pending_;
+
+  // Row i covers [base_pc_ + pcs_[i], base_pc_ + pcs_[i + 1]). The last
+  // row is always a CFA_NONE entry that ends the table.
+  uint64_t base_pc_ = 0;
+  std::vector<uint32_t> pcs_;
+  std::vector<Entry> entries_;
+
+  // The index of each set in saved_regs_, for adding rows.
+  std::map<SavedRegs, uint16_t> saved_regs_index_;
+  std::vector<SavedRegs> saved_regs_;
+};
+
+}  // namespace unwindstack
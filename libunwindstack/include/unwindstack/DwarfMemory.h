@@ -45,6 +45,8 @@ class DwarfMemory {
   template <typename AddressType>
   bool ReadEncodedValue(uint8_t encoding, uint64_t* value);
 
+  Memory* memory() { return memory_; }
+
   uint64_t cur_offset() { return cur_offset_; }
   void set_cur_offset(uint64_t cur_offset) { cur_offset_ = cur_offset; }
 
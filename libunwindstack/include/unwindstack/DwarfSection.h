@@ -18,10 +18,16 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include <unwindstack/DwarfCompactTable.h>
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfLocation.h>
 #include <unwindstack/DwarfMemory.h>
@@ -113,7 +119,57 @@ class DwarfSection {
 
   bool Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished, bool* is_signal_frame);
 
+  // Compiles the cfa information of every fde into a compact table that
+  // Step uses ahead of the full evaluation. Returns false if the arch is
+  // not supported by DwarfCompactTable.
+  bool BuildCompactTable(ArchEnum arch);
+
+  // Adds the rows of a single fde to the compact table, creating the
+  // table if necessary, so that hot functions can be compiled one at a
+  // time.
+  bool AddFdeToCompactTable(const DwarfFde* fde, ArchEnum arch);
+
+  const DwarfCompactTable* compact_table() const { return compact_table_.get(); }
+
+  // When enabled, Step compiles the fde of every pc that misses both the
+  // compact table and the row cache into the compact table, so that later
+  // steps through the same function use the compact row. Only has an
+  // effect on the arches that DwarfCompactTable supports. Defaults to
+  // disabled.
+  static void SetCompactTables(bool enable) { compact_tables_ = enable; }
+
+  static bool CompactTables() { return compact_tables_; }
+
+  struct FdeIndexEntry {
+    uint64_t pc_end;
+    uint64_t fde_offset;
+  };
+
+  // Returns the sorted index that GetFdeFromPc searches, building it first
+  // if necessary. Returns false if the section does not use such an index.
+  virtual bool GetFdeIndex(const FdeIndexEntry**, size_t*) { return false; }
+
+  // Uses an index returned by GetFdeIndex for an identical section, such
+  // as one loaded from a cache file. The index is not copied, it must stay
+  // valid for the life of this object.
+  virtual void SetFdeIndex(const FdeIndexEntry*, size_t) {}
+
+  // Gets the sorted, merged pc ranges that have an fde in this section,
+  // or a superset of them. Returns false if the ranges are not known, in
+  // which case any pc might have an fde.
+  virtual bool GetPcRanges(std::vector<std::pair<uint64_t, uint64_t>>*) { return false; }
+
+  // Sets the number of threads that can be used to build the fde index of
+  // a large section. The default of 1 builds the index on the calling
+  // thread only. The other threads come from a pool shared by all of the
+  // sections, which never has more threads than there are cpus.
+  static void SetIndexThreads(size_t num_threads) { index_threads_ = num_threads; }
+
+  static size_t IndexThreads() { return index_threads_; }
+
  protected:
+  bool AddFdeRowsToCompactTable(const DwarfFde* fde, ArchEnum arch);
+
   DwarfMemory memory_;
   DwarfErrorData last_error_{DWARF_ERROR_NONE, 0};
 
@@ -124,6 +180,13 @@ class DwarfSection {
   std::unordered_map<uint64_t, DwarfCie> cie_entries_;
   std::unordered_map<uint64_t, DwarfLocations> cie_loc_regs_;
   std::map<uint64_t, DwarfLocations> loc_regs_;  // Single row indexed by pc_end.
+
+  std::unique_ptr<DwarfCompactTable> compact_table_;
+  // The fdes already added to compact_table_ by Step.
+  std::unordered_set<const DwarfFde*> compact_fdes_;
+
+  static std::atomic<size_t> index_threads_;
+  static std::atomic_bool compact_tables_;
 };
 
 template <typename AddressType>
@@ -142,6 +205,12 @@ class DwarfSectionImpl : public DwarfSection {
 
   void GetFdes(std::vector<const DwarfFde*>* fdes) override;
 
+  bool GetFdeIndex(const FdeIndexEntry** index, size_t* size) override;
+
+  void SetFdeIndex(const FdeIndexEntry* index, size_t size) override;
+
+  bool GetPcRanges(std::vector<std::pair<uint64_t, uint64_t>>* ranges) override;
+
   bool EvalRegister(const DwarfLocation* loc, uint32_t reg, AddressType* reg_ptr, void* info);
 
   bool Eval(const DwarfCie* cie, Memory* regular_memory, const DwarfLocations& loc_regs, Regs* regs,
@@ -152,10 +221,23 @@ class DwarfSectionImpl : public DwarfSection {
 
   bool Log(uint8_t indent, uint64_t pc, const DwarfFde* fde, ArchEnum arch) override;
 
+  // Sections smaller than this are never split when building the fde index.
+  static constexpr uint64_t kMinIndexChunkSize = 0x10000;
+
  protected:
   using DwarfFdeMap =
       std::map</*end*/ uint64_t, std::pair</*start*/ uint64_t, /*offset*/ uint64_t>>;
 
+  struct FdeInfo {
+    uint64_t pc_start, pc_end, fde_offset;
+  };
+
+  enum ScanResult : uint8_t {
+    SCAN_DONE,     // Reached the end offset.
+    SCAN_STOPPED,  // An entry pointed backwards, the walk of the section is over.
+    SCAN_FAILED,   // The entry at offset could not be read.
+  };
+
   bool GetNextCieOrFde(/*inout*/ uint64_t& offset, /*out*/ std::optional<DwarfFde>& fde);
 
   bool FillInCieHeader(DwarfCie* cie);
@@ -173,13 +255,32 @@ class DwarfSectionImpl : public DwarfSection {
 
   void BuildFdeIndex();
 
+  // Adds the fdes of every entry from offset up to end to fdes, and leaves
+  // offset at the entry that ended the walk.
+  ScanResult ScanFdes(uint64_t* offset, uint64_t end, std::vector<FdeInfo>* fdes);
+
+  // Splits the section into chunks at entry boundaries and scans them on
+  // separate threads. Returns false, without adding any fdes, if the
+  // section cannot be split.
+  bool ScanFdesInParallel(size_t num_threads, std::vector<FdeInfo>* fdes);
+
+  // Creates an empty section of the same type that reads from memory, used
+  // to scan part of this section on another thread.
+  virtual std::unique_ptr<DwarfSectionImpl<AddressType>> CreateIndexWorker(Memory*) {
+    return nullptr;
+  }
+
   int64_t section_bias_ = 0;
   uint64_t entries_offset_ = 0;
   uint64_t entries_end_ = 0;
   uint64_t pc_offset_ = 0;
 
-  // Binary search table (similar to .eh_frame_hdr). Contains only FDE offsets to save memory.
-  std::vector<std::pair</*function end address*/ uint64_t, /*FDE offset*/ uint64_t>> fde_index_;
+  // Binary search table (similar to .eh_frame_hdr). Contains the FDE ranges and offsets rather
+  // than the full entries to save memory.
+  // Points either at fde_index_storage_ or at an index passed to SetFdeIndex.
+  const FdeIndexEntry* fde_index_ = nullptr;
+  size_t fde_index_size_ = 0;
+  std::vector<FdeIndexEntry> fde_index_storage_;
 };
 
 }  // namespace unwindstack
@@ -18,6 +18,7 @@
 
 #include <stddef.h>
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -40,6 +41,7 @@
 namespace unwindstack {
 
 // Forward declaration.
+class ElfCacheFile;
 class MapInfo;
 class Regs;
 
@@ -95,7 +97,24 @@ class Elf {
 
   ElfInterface* interface() { return interface_.get(); }
 
-  ElfInterface* gnu_debugdata_interface() { return gnu_debugdata_interface_.get(); }
+  // Decompresses the .gnu_debugdata if that has not been done yet.
+  ElfInterface* gnu_debugdata_interface();
+
+  // Whether frame pointer steps through this elf can be trusted. Starts out
+  // unknown, becomes safe once kFramePointerChecks frame pointer steps in a
+  // row have agreed with the unwind information, and unsafe as soon as one
+  // does not.
+  enum FramePointerState : uint8_t {
+    FRAME_POINTER_UNKNOWN,
+    FRAME_POINTER_SAFE,
+    FRAME_POINTER_UNSAFE,
+  };
+  static constexpr uint32_t kFramePointerChecks = 8;
+
+  FramePointerState frame_pointer_state() { return frame_pointer_state_; }
+
+  // Record whether a frame pointer step agreed with the unwind information.
+  void AddFramePointerCheck(bool matched);
 
   static bool IsValidElf(Memory* memory);
 
@@ -113,6 +132,26 @@ class Elf {
 
   static bool CachingEnabled() { return cache_enabled_; }
 
+  // Controls whether the unwind and symbol sections of an elf are
+  // prefetched when the elf is initialized. Only has an effect on elf
+  // files that are mapped from disk. Defaults to PREFETCH_NONE.
+  static void SetSectionPrefetch(Memory::PrefetchMode mode) { section_prefetch_ = mode; }
+
+  static Memory::PrefetchMode SectionPrefetch() { return section_prefetch_; }
+
+  // Sets a directory used to keep the lookup tables of elf files between
+  // processes. When set, Init loads the sorted fde indexes, the sorted
+  // symbol tables and the decompressed .gnu_debugdata of an elf with a
+  // build id from this directory, and writes them there if they are not
+  // present yet. An empty string, the default, disables the cache files.
+  // Like caching, this cannot be changed while unwinding.
+  static void SetCacheDirectory(const std::string& dir);
+
+  static std::string CacheDirectory();
+
+  // Whether the lookup tables came from a file in the cache directory.
+  bool loaded_from_cache_file() { return cache_file_ != nullptr; }
+
   static void CacheLock();
   static void CacheUnlock();
   static void CacheAdd(MapInfo* info);
@@ -121,6 +160,19 @@ class Elf {
   static std::string GetPrintableBuildID(std::string& build_id);
 
  protected:
+  void InitGnuDebugdataInterface();
+
+  // Same as gnu_debugdata_interface, lock_ must be held.
+  ElfInterface* GetGnuDebugdataInterface();
+
+  // Without PT_LOADs, IsValidPc looks up a fde, which updates the dwarf
+  // sections, so it is locked then.
+  bool InterfaceIsValidPc(ElfInterface* interface, uint64_t pc);
+
+  std::string GetCacheFilePath(std::string* build_id, uint64_t* fingerprint);
+  bool LoadCacheFile(const std::string& path, const std::string& build_id, uint64_t fingerprint);
+  bool WriteCacheFile(const std::string& path, const std::string& build_id, uint64_t fingerprint);
+
   bool valid_ = false;
   int64_t load_bias_ = 0;
   std::unique_ptr<ElfInterface> interface_;
@@ -133,11 +185,22 @@ class Elf {
 
   std::unique_ptr<Memory> gnu_debugdata_memory_;
   std::unique_ptr<ElfInterface> gnu_debugdata_interface_;
+  // Set once the .gnu_debugdata is set up, after that the interface of the
+  // section is read without lock_.
+  std::atomic_bool gnu_debugdata_initialized_ = true;
+
+  // The tables used by the interfaces point into this file.
+  std::shared_ptr<ElfCacheFile> cache_file_;
+
+  std::atomic<FramePointerState> frame_pointer_state_ = FRAME_POINTER_UNKNOWN;
+  std::atomic_uint32_t frame_pointer_matches_ = 0;
 
   static bool cache_enabled_;
   static std::unordered_map<std::string, std::unordered_map<uint64_t, std::shared_ptr<Elf>>>*
       cache_;
   static std::mutex* cache_lock_;
+  static std::atomic<Memory::PrefetchMode> section_prefetch_;
+  static std::string* cache_directory_;
 };
 
 }  // namespace unwindstack
@@ -19,18 +19,25 @@
 #include <elf.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <unwindstack/DwarfSection.h>
 #include <unwindstack/Error.h>
+#include <unwindstack/Memory.h>
 #include <unwindstack/SharedString.h>
 
 namespace unwindstack {
 
 // Forward declarations.
+class ElfCacheFile;
+class ElfCacheFileWriter;
 class Memory;
 class Regs;
 class Symbols;
@@ -72,10 +79,35 @@ class ElfInterface {
   ElfInterface(Memory* memory) : memory_(memory) {}
   virtual ~ElfInterface();
 
+  // Only reads the elf header and the program headers. The section headers
+  // are read the first time anything that comes from them is needed, and
+  // the unwind sections are set up by InitHeaders, which runs the first
+  // time they are needed if it has not been called.
   virtual bool Init(int64_t* load_bias) = 0;
 
   virtual void InitHeaders() = 0;
 
+  // Both of these can be called from several threads at once, each stage
+  // runs once under its own lock and is free to check after that.
+  void ReadSectionsIfNeeded() {
+    if (!sections_read_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> guard(sections_lock_);
+      if (!sections_read_.load(std::memory_order_relaxed)) {
+        ReadSections();
+        sections_read_.store(true, std::memory_order_release);
+      }
+    }
+  }
+
+  void InitHeadersIfNeeded() {
+    if (!headers_initialized_.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> guard(headers_lock_);
+      if (!headers_initialized_.load(std::memory_order_relaxed)) {
+        InitHeaders();
+      }
+    }
+  }
+
   virtual std::string GetSoname() = 0;
 
   virtual bool GetFunctionName(uint64_t addr, SharedString* name, uint64_t* offset) = 0;
@@ -91,36 +123,136 @@ class ElfInterface {
 
   bool GetTextRange(uint64_t* addr, uint64_t* size);
 
+  // Prefetch the parts of the elf that unwinding and symbolization read:
+  // the eh_frame_hdr search table (or the whole eh_frame if there is no
+  // table), the debug_frame and the symbol and string tables.
+  void Prefetch(Memory::PrefetchMode mode);
+
   std::unique_ptr<Memory> CreateGnuDebugdataMemory();
 
+  // Returns a hash of the section layout, to tell apart elf files that
+  // share a build id, such as a stripped and an unstripped library.
+  uint64_t GetCacheFingerprint();
+
+  // Builds the lookup tables that are otherwise created lazily, the fde
+  // index of each dwarf section and the sorted symbol tables, and adds
+  // them to writer.
+  virtual void AddCacheTables(ElfCacheFileWriter* writer, uint32_t interface_id);
+
+  // Uses the tables that AddCacheTables added to a cache file. The file
+  // must outlive this object.
+  virtual void UseCacheTables(const ElfCacheFile& file, uint32_t interface_id);
+
   Memory* memory() { return memory_; }
 
-  const std::unordered_map<uint64_t, LoadInfo>& pt_loads() { return pt_loads_; }
+  // The executable PT_LOAD segments, sorted by virtual address.
+  const std::vector<LoadInfo>& pt_loads() { return pt_loads_; }
 
-  void SetGnuDebugdataInterface(ElfInterface* interface) { gnu_debugdata_interface_ = interface; }
+  void SetGnuDebugdataInterface(ElfInterface* interface) {
+    gnu_debugdata_interface_ = interface;
+    coverage_built_ = false;
+  }
+
+  // Called by Step to create the gnu_debugdata interface the first time
+  // that no other section can unwind a pc, so that the section is only
+  // decompressed when it is needed.
+  void SetGnuDebugdataLoader(std::function<void()> loader) {
+    gnu_debugdata_loader_ = std::move(loader);
+  }
+
+  enum CoverageSection : uint8_t {
+    COVERAGE_DEBUG_FRAME = 0x1,
+    COVERAGE_EH_FRAME = 0x2,
+    COVERAGE_GNU_DEBUGDATA = 0x4,
+    COVERAGE_ALL = 0x7,
+  };
+
+  // Returns the CoverageSection bits of the sections that might have unwind
+  // information for pc. The table behind this is built on the first call.
+  uint8_t GetCoverage(uint64_t pc);
 
   uint64_t dynamic_offset() { return dynamic_offset_; }
   uint64_t dynamic_vaddr_start() { return dynamic_vaddr_start_; }
   uint64_t dynamic_vaddr_end() { return dynamic_vaddr_end_; }
-  uint64_t data_offset() { return data_offset_; }
-  uint64_t data_vaddr_start() { return data_vaddr_start_; }
-  uint64_t data_vaddr_end() { return data_vaddr_end_; }
-  uint64_t eh_frame_hdr_offset() { return eh_frame_hdr_offset_; }
-  int64_t eh_frame_hdr_section_bias() { return eh_frame_hdr_section_bias_; }
-  uint64_t eh_frame_hdr_size() { return eh_frame_hdr_size_; }
-  uint64_t eh_frame_offset() { return eh_frame_offset_; }
-  int64_t eh_frame_section_bias() { return eh_frame_section_bias_; }
-  uint64_t eh_frame_size() { return eh_frame_size_; }
-  uint64_t debug_frame_offset() { return debug_frame_offset_; }
-  int64_t debug_frame_section_bias() { return debug_frame_section_bias_; }
-  uint64_t debug_frame_size() { return debug_frame_size_; }
-  uint64_t gnu_debugdata_offset() { return gnu_debugdata_offset_; }
-  uint64_t gnu_debugdata_size() { return gnu_debugdata_size_; }
-  uint64_t gnu_build_id_offset() { return gnu_build_id_offset_; }
-  uint64_t gnu_build_id_size() { return gnu_build_id_size_; }
-
-  DwarfSection* eh_frame() { return eh_frame_.get(); }
-  DwarfSection* debug_frame() { return debug_frame_.get(); }
+
+  // All of the values below, other than the dynamic ones, come from the
+  // section headers.
+  uint64_t data_offset() {
+    ReadSectionsIfNeeded();
+    return data_offset_;
+  }
+  uint64_t data_vaddr_start() {
+    ReadSectionsIfNeeded();
+    return data_vaddr_start_;
+  }
+  uint64_t data_vaddr_end() {
+    ReadSectionsIfNeeded();
+    return data_vaddr_end_;
+  }
+  uint64_t eh_frame_hdr_offset() {
+    ReadSectionsIfNeeded();
+    return eh_frame_hdr_offset_;
+  }
+  int64_t eh_frame_hdr_section_bias() {
+    ReadSectionsIfNeeded();
+    return eh_frame_hdr_section_bias_;
+  }
+  uint64_t eh_frame_hdr_size() {
+    ReadSectionsIfNeeded();
+    return eh_frame_hdr_size_;
+  }
+  uint64_t eh_frame_offset() {
+    ReadSectionsIfNeeded();
+    return eh_frame_offset_;
+  }
+  int64_t eh_frame_section_bias() {
+    ReadSectionsIfNeeded();
+    return eh_frame_section_bias_;
+  }
+  uint64_t eh_frame_size() {
+    ReadSectionsIfNeeded();
+    return eh_frame_size_;
+  }
+  uint64_t debug_frame_offset() {
+    ReadSectionsIfNeeded();
+    return debug_frame_offset_;
+  }
+  int64_t debug_frame_section_bias() {
+    ReadSectionsIfNeeded();
+    return debug_frame_section_bias_;
+  }
+  uint64_t debug_frame_size() {
+    ReadSectionsIfNeeded();
+    return debug_frame_size_;
+  }
+  uint64_t gnu_debugdata_offset() {
+    ReadSectionsIfNeeded();
+    return gnu_debugdata_offset_;
+  }
+  uint64_t gnu_debugdata_size() {
+    ReadSectionsIfNeeded();
+    return gnu_debugdata_size_;
+  }
+  uint64_t gnu_build_id_offset() {
+    ReadSectionsIfNeeded();
+    return gnu_build_id_offset_;
+  }
+  uint64_t gnu_build_id_size() {
+    ReadSectionsIfNeeded();
+    return gnu_build_id_size_;
+  }
+
+  DwarfSection* eh_frame() {
+    InitHeadersIfNeeded();
+    return eh_frame_.get();
+  }
+  DwarfSection* debug_frame() {
+    InitHeadersIfNeeded();
+    return debug_frame_.get();
+  }
+
+  bool sections_read() { return sections_read_; }
+  bool headers_initialized() { return headers_initialized_; }
 
   const ErrorData& last_error() { return last_error_; }
   ErrorCode LastErrorCode() { return last_error_.code; }
@@ -135,8 +267,34 @@ class ElfInterface {
  protected:
   virtual void HandleUnknownType(uint32_t, uint64_t, uint64_t) {}
 
+  virtual void ReadSections() {}
+
+  // Adds a PT_LOAD, replacing any earlier one at the same file offset.
+  // FinishPtLoads must be called once all of them have been added.
+  void AddPtLoad(const LoadInfo& load);
+  void FinishPtLoads();
+
+  // Gets the merged pc ranges of the debug_frame and eh_frame, returns
+  // false if they are not known.
+  bool GetDwarfPcRanges(std::vector<std::pair<uint64_t, uint64_t>>* ranges);
+  void BuildCoverage();
+
   Memory* memory_;
-  std::unordered_map<uint64_t, LoadInfo> pt_loads_;
+  std::vector<LoadInfo> pt_loads_;
+  // The address ranges of pt_loads_, sorted and merged so that IsValidPc
+  // is a single binary search even if the segments overlap.
+  std::vector<std::pair</*start*/ uint64_t, /*end*/ uint64_t>> pt_load_ranges_;
+
+  // Maps pc ranges to the sections that might have unwind information for
+  // them, so that Step does not search sections that cannot have the pc.
+  // Each entry covers the pcs from the end of the previous entry up to
+  // pc_end. Empty means any section might have any pc.
+  struct CoverageEntry {
+    uint64_t pc_end;
+    uint8_t sections;
+  };
+  std::vector<CoverageEntry> coverage_;
+  bool coverage_built_ = false;
 
   // Stored elf data.
   uint64_t dynamic_offset_ = 0;
@@ -168,6 +326,15 @@ class ElfInterface {
   uint64_t text_addr_ = 0;
   uint64_t text_size_ = 0;
 
+  // The PT_NOTE segments that can hold the build id, as offset and size.
+  std::vector<std::pair<uint64_t, uint64_t>> note_segments_;
+
+  // Set once the stage is done, InitHeaders sets headers_initialized_ last.
+  std::atomic_bool sections_read_ = false;
+  std::atomic_bool headers_initialized_ = false;
+  std::mutex sections_lock_;
+  std::mutex headers_lock_;
+
   uint8_t soname_type_ = SONAME_UNKNOWN;
   std::string soname_;
 
@@ -177,6 +344,7 @@ class ElfInterface {
   std::unique_ptr<DwarfSection> debug_frame_;
   // The Elf object owns the gnu_debugdata interface object.
   ElfInterface* gnu_debugdata_interface_ = nullptr;
+  std::function<void()> gnu_debugdata_loader_;
 
   std::vector<Symbols*> symbols_;
   std::vector<std::pair<uint64_t, uint64_t>> strtabs_;
@@ -208,6 +376,10 @@ class ElfInterfaceImpl : public ElfInterface {
 
   std::string GetBuildID() override { return ReadBuildID(); }
 
+  void AddCacheTables(ElfCacheFileWriter* writer, uint32_t interface_id) override;
+
+  void UseCacheTables(const ElfCacheFile& file, uint32_t interface_id) override;
+
   static void GetMaxSize(Memory* memory, uint64_t* size);
 
  protected:
@@ -215,9 +387,16 @@ class ElfInterfaceImpl : public ElfInterface {
 
   void ReadProgramHeaders(const EhdrType& ehdr, int64_t* load_bias);
 
+  void ReadSections() override { ReadSectionHeaders(ehdr_); }
+
   void ReadSectionHeaders(const EhdrType& ehdr);
 
   std::string ReadBuildID();
+
+  std::string ReadBuildIDFromNotes(uint64_t notes_offset, uint64_t notes_size);
+
+  // Kept from Init to read the section headers later.
+  EhdrType ehdr_ = {};
 };
 
 using ElfInterface32 = ElfInterfaceImpl<ElfTypes32>;
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+
+namespace unwindstack {
+
+// Epoch based reclamation of objects that are shared between threads.
+//
+// A thread that uses raw pointers to shared objects, such as the MapInfo
+// pointers returned by Maps::FindMapInfo, does so inside a read section.
+// A thread that removes a shared object retires it instead of dropping its
+// reference, and the object is only freed once every read section that was
+// active when it was retired has ended. Entering and leaving a read section
+// only writes to memory owned by the calling thread, unless the read section
+// started before a retired object that is still waiting to be released, in
+// which case ending it releases the ones no read section is using.
+class Epoch {
+ public:
+  // Starts a read section on the calling thread. Read sections can nest.
+  static void Enter();
+
+  // Ends the read section started by the matching Enter. Ending an
+  // outermost read section that started before a retired object was
+  // retired releases the retired objects that are no longer in use.
+  static void Exit();
+
+  // Keeps a reference to object until no read section can still be using it.
+  static void Retire(std::shared_ptr<void> object);
+
+  // Releases the retired objects that no read section can still be using.
+  static void Reclaim();
+
+  // Returns the number of retired objects that have not been released.
+  static size_t NumRetired();
+};
+
+class EpochReadSection {
+ public:
+  EpochReadSection() { Epoch::Enter(); }
+  ~EpochReadSection() { Epoch::Exit(); }
+
+  EpochReadSection(const EpochReadSection&) = delete;
+  EpochReadSection& operator=(const EpochReadSection&) = delete;
+};
+
+}  // namespace unwindstack
@@ -51,6 +51,16 @@ class Maps {
 
   virtual std::shared_ptr<MapInfo> Find(uint64_t pc);
 
+  // Finds the map containing pc without taking a reference to it. The
+  // pointer stays valid while the map is in this object. For maps that
+  // another thread can update, call this inside an EpochReadSection, the
+  // pointer then stays valid until the section ends.
+  virtual MapInfo* FindMapInfo(uint64_t pc);
+
+  // Changes whenever the maps change. As long as it does not, every map
+  // found earlier is still in this object.
+  virtual uint64_t Generation() { return generation_; }
+
   virtual bool Parse();
 
   virtual const std::string GetMapsFile() const { return ""; }
@@ -77,7 +87,30 @@ class Maps {
   }
 
  protected:
+  // Rebuild the packed search index used by Find. This must be called
+  // whenever maps_ is modified, and must not run concurrently with Find.
+  // If maps_ is not sorted, no index is built and Find falls back to
+  // a plain binary search over maps_.
+  void BuildSearchIndex();
+  void ClearSearchIndex();
+
   std::vector<std::shared_ptr<MapInfo>> maps_;
+
+ private:
+  size_t FindIndex(uint64_t pc);
+
+  // Unique, non-zero value after every change to maps_.
+  uint64_t generation_ = 0;
+  // Unique, non-zero value for every built search index. Used to validate
+  // the per-thread lookaside entry, zero means there is no valid index.
+  uint64_t search_generation_ = 0;
+  // The start and end of every map, in the same order as maps_.
+  std::vector<uint64_t> search_starts_;
+  std::vector<uint64_t> search_ends_;
+  // The start of every map in Eytzinger (breadth-first) order, 1-based.
+  // search_order_ maps each Eytzinger slot back to the index in maps_.
+  std::vector<uint64_t> search_keys_;
+  std::vector<uint32_t> search_order_;
 };
 
 class RemoteMaps : public Maps {
@@ -97,6 +130,18 @@ class LocalMaps : public RemoteMaps {
   virtual ~LocalMaps() = default;
 };
 
+// Maps that are kept up to date one mapping at a time, for example from
+// the mmap records of perf events, instead of parsing the maps file again.
+class IncrementalMaps : public RemoteMaps {
+ public:
+  IncrementalMaps(pid_t pid) : RemoteMaps(pid) {}
+  virtual ~IncrementalMaps() = default;
+
+  // Adds a new mapping. Like an mmap in the process, it replaces the parts
+  // of the existing maps that it overlaps.
+  void Map(uint64_t start, uint64_t end, uint64_t offset, uint64_t flags, const std::string& name);
+};
+
 class LocalUpdatableMaps : public Maps {
  public:
   LocalUpdatableMaps();
@@ -104,6 +149,10 @@ class LocalUpdatableMaps : public Maps {
 
   std::shared_ptr<MapInfo> Find(uint64_t pc) override;
 
+  MapInfo* FindMapInfo(uint64_t pc) override;
+
+  uint64_t Generation() override;
+
   bool Parse() override;
 
   const std::string GetMapsFile() const override;
@@ -22,6 +22,7 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
 
 namespace unwindstack {
 
@@ -29,12 +30,33 @@ class MemoryCacheBase;
 
 class Memory {
  public:
+  struct ReadRequest {
+    uint64_t addr;
+    void* dst;
+    size_t size;
+    // Set by ReadMany to indicate that all size bytes were read.
+    bool success;
+  };
+
+  enum PrefetchMode : uint8_t {
+    PREFETCH_NONE,
+    // Ask the kernel to start reading the range in the background.
+    PREFETCH_ASYNC,
+    // Fault the whole range in before returning.
+    PREFETCH_POPULATE,
+  };
+
   Memory() = default;
   virtual ~Memory() = default;
 
   static std::shared_ptr<Memory> CreateProcessMemory(pid_t pid);
   static std::shared_ptr<Memory> CreateProcessMemoryCached(pid_t pid);
+  // Limit the cache to roughly max_cached_bytes of process memory.
+  static std::shared_ptr<Memory> CreateProcessMemoryCached(pid_t pid, size_t max_cached_bytes);
   static std::shared_ptr<Memory> CreateProcessMemoryThreadCached(pid_t pid);
+  // Limit the cache of every thread to roughly max_cached_bytes of process memory.
+  static std::shared_ptr<Memory> CreateProcessMemoryThreadCached(pid_t pid,
+                                                                 size_t max_cached_bytes);
   static std::shared_ptr<Memory> CreateOfflineMemory(const uint8_t* data, uint64_t start,
                                                      uint64_t end);
   static std::unique_ptr<Memory> CreateFileMemory(const std::string& path, uint64_t offset,
@@ -44,6 +66,13 @@ class Memory {
 
   virtual bool ReadString(uint64_t addr, std::string* dst, size_t max_read);
 
+  // Same as ReadString, except that memory that is contiguous returns a
+  // view directly into its data and copies nothing. Other memory reads
+  // the string into storage and returns a view of that. The view is only
+  // valid as long as this object and storage are.
+  virtual bool ReadStringView(uint64_t addr, std::string_view* dst, size_t max_read,
+                              std::string* storage);
+
   virtual void Clear() {}
 
   // Get pointer to directly access the data for buffers that support it.
@@ -54,6 +83,17 @@ class Memory {
 
   bool ReadFully(uint64_t addr, void* dst, size_t size);
 
+  // Read a set of disjoint ranges, which allows implementations that need
+  // a system call per read to batch the requests together.
+  // Returns true if every request was read fully.
+  virtual bool ReadMany(ReadRequest* requests, size_t num_requests);
+
+  // Hint that the range will be read soon. Only memory backed by a file
+  // mapping acts on this, returns true if the hint was applied.
+  virtual bool Prefetch(uint64_t /*addr*/, uint64_t /*size*/, PrefetchMode /*mode*/) {
+    return false;
+  }
+
   inline bool Read32(uint64_t addr, uint32_t* dst) {
     return ReadFully(addr, dst, sizeof(uint32_t));
   }
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <unwindstack/Arch.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/Unwinder.h>
+
+// Forward declarations.
+struct perf_event_attr;
+
+namespace unwindstack {
+
+// Forward declarations.
+class CallingContextTrie;
+class Memory;
+class MemoryStackSnapshot;
+
+struct PerfSampleStats {
+  uint64_t samples = 0;
+  // Samples without usable user registers, like the samples of a kernel
+  // thread.
+  uint64_t samples_without_regs = 0;
+  // Samples that the kernel dropped because the ring buffer was full.
+  uint64_t lost_samples = 0;
+  uint64_t mmaps = 0;
+  uint64_t malformed_records = 0;
+};
+
+// Unwinds the samples of perf events that copy the user registers and the
+// top of the user stack of the sampled thread, and adds the frames to a
+// calling context trie.
+//
+// The maps of every process are kept up to date with the mmap records of
+// the events, and dropped when the process exits. Each sample is unwound
+// with registers built from the sampled values, reading the stack from the
+// copy in the sample. Frames of java code interpreted or compiled by ART
+// are not recognized, since that needs the memory of the process.
+class PerfSampleUnwinder {
+ public:
+  // arch is the arch of the sampled machine. On a 64 bit machine, samples
+  // of 32 bit processes are unwound as the matching 32 bit arch.
+  PerfSampleUnwinder(ArchEnum arch, CallingContextTrie* trie, size_t max_frames = 512);
+  ~PerfSampleUnwinder();
+
+  PerfSampleUnwinder(const PerfSampleUnwinder&) = delete;
+  PerfSampleUnwinder& operator=(const PerfSampleUnwinder&) = delete;
+
+  // Sets the sample type, the registers, stack_size and the record types
+  // of attr to what ProcessRecord expects. The caller picks the event,
+  // the sampling period and the target. Returns false if the arch is not
+  // supported.
+  bool InitAttr(perf_event_attr* attr, uint32_t stack_size) const;
+
+  // Processes one record from the ring buffer of an event set up by
+  // InitAttr, starting with its perf_event_header. Returns false if the
+  // record is malformed.
+  // The records of all of the events must be processed in the order of
+  // their times. The kernel writes the records of one ring buffer in order,
+  // but the records of different ring buffers, such as those of the
+  // events of each cpu, have to be merged by time.
+  bool ProcessRecord(const void* record, size_t size);
+
+  // Gets the time of a record from the ring buffer of an event set up by
+  // InitAttr. Returns false if the record is too small to have one.
+  static bool GetRecordTime(const void* record, size_t size, uint64_t* time);
+
+  // When set, processes seen for the first time are live processes on this
+  // machine: their maps are read from /proc, and memory outside of the
+  // copied stack, like the vdso, is read from the process. This must be
+  // set before any records are processed.
+  void SetReadProcesses(bool read_processes) { read_processes_ = read_processes; }
+
+  const PerfSampleStats& stats() const { return stats_; }
+
+  // Returns the number of processes with maps.
+  size_t NumProcesses() const { return processes_.size(); }
+
+ private:
+  struct Process {
+    std::unique_ptr<IncrementalMaps> maps;
+    std::shared_ptr<MemoryStackSnapshot> stack_memory;
+    std::unique_ptr<Unwinder> unwinder;
+  };
+
+  Process* GetProcess(pid_t pid);
+
+  Process* CreateProcess(pid_t pid, bool read_maps);
+
+  bool ProcessMmap2(const uint8_t* data, size_t size);
+
+  bool ProcessSample(const uint8_t* data, size_t size);
+
+  bool ProcessFork(const uint8_t* data, size_t size);
+
+  bool ProcessExit(const uint8_t* data, size_t size);
+
+  // Returns the registers of a sample, filled in from values, or nullptr
+  // if the abi is not known.
+  Regs* GetRegs(uint64_t abi, const uint64_t* values);
+
+  ArchEnum arch_;
+  CallingContextTrie* trie_;
+  size_t max_frames_;
+  bool read_processes_ = false;
+  // The registers requested by InitAttr, in the order of the perf
+  // register numbers of the arch.
+  uint64_t regs_mask_ = 0;
+  size_t num_regs_ = 0;
+
+  // Reused for every sample, one for each abi.
+  std::unique_ptr<Regs> regs_;
+  std::unique_ptr<Regs> regs32_;
+  // The pcs of the frames of a sample, reused for every sample.
+  std::vector<uint64_t> pcs_;
+
+  std::unordered_map<pid_t, Process> processes_;
+  PerfSampleStats stats_;
+};
+
+}  // namespace unwindstack
@@ -75,6 +75,12 @@ class Regs {
 
   virtual bool SetPcFromReturnAddress(Memory* process_memory) = 0;
 
+  // Support for walking a chain of frame records, where the frame pointer
+  // points at the caller's frame pointer followed by the return address.
+  // Returns false if the architecture does not keep such a chain.
+  virtual bool GetFramePointer(uint64_t*) { return false; }
+  virtual void SetFramePointer(uint64_t) {}
+
   virtual void IterateRegisters(std::function<void(const char*, uint64_t)>) = 0;
 
   uint16_t total_regs() { return total_regs_; }
@@ -38,6 +38,9 @@ class RegsX86_64 : public RegsImpl<uint64_t> {
 
   bool SetPcFromReturnAddress(Memory* process_memory) override;
 
+  bool GetFramePointer(uint64_t* fp) override;
+  void SetFramePointer(uint64_t fp) override;
+
   bool StepIfSignalHandler(uint64_t elf_offset, Elf* elf, Memory* process_memory) override;
 
   void SetFromUcontext(x86_64_ucontext_t* ucontext);
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <unwindstack/Error.h>
+#include <unwindstack/Unwinder.h>
+
+namespace unwindstack {
+
+// Forward declarations.
+class AndroidUnwinder;
+
+struct UnwindServiceRequest {
+  pid_t pid = 0;
+  // Zero means the main thread of pid.
+  pid_t tid = 0;
+  // Zero means the default of the unwinder.
+  size_t max_frames = 0;
+  bool show_all_frames = false;
+  // A request that has not started by the deadline is not unwound, and
+  // the deadline also limits the wait for the thread to stop.
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+enum UnwindServiceStatus : uint8_t {
+  UNWIND_SERVICE_OK = 0,
+  // The unwind ran, but did not produce any frames, see error.
+  UNWIND_SERVICE_UNWIND_FAILED,
+  // Could not attach to the thread, or it did not stop.
+  UNWIND_SERVICE_ATTACH_FAILED,
+  // The queue was full when the request was submitted.
+  UNWIND_SERVICE_REJECTED,
+  UNWIND_SERVICE_CANCELLED,
+  UNWIND_SERVICE_DEADLINE_EXCEEDED,
+};
+
+struct UnwindServiceResult {
+  uint64_t id = 0;
+  pid_t pid = 0;
+  pid_t tid = 0;
+  UnwindServiceStatus status = UNWIND_SERVICE_OK;
+  std::vector<FrameData> frames;
+  ErrorData error = {.code = ERROR_NONE, .address = 0};
+  // The time from the submit until a worker took the request.
+  std::chrono::nanoseconds queue_time{0};
+  // The time to attach, unwind and detach.
+  std::chrono::nanoseconds unwind_time{0};
+};
+
+struct UnwindServiceStats {
+  uint64_t completed = 0;
+  uint64_t failed = 0;
+  uint64_t rejected = 0;
+  uint64_t cancelled = 0;
+  uint64_t deadline_exceeded = 0;
+  std::chrono::nanoseconds total_queue_time{0};
+  std::chrono::nanoseconds total_unwind_time{0};
+  // The longest time from a submit to its result.
+  std::chrono::nanoseconds max_latency{0};
+};
+
+// Unwinds threads of this and other processes on a pool of worker threads.
+//
+// The Maps, memory and jit information of a process are created by the
+// first request for the process, and shared by all later requests for it.
+// They are identified by the pid and the start time of the process, so a
+// new process that reuses a pid does not get them. When an unwind of
+// another process runs into an address that is not in the shared maps,
+// the maps are read again and the unwind is retried once. Call ClearProcess
+// to drop them sooner when the maps of a process might have changed.
+//
+// Threads of other processes are attached with ptrace by the worker that
+// unwinds them, and detached afterwards, so they must not be traced by
+// anyone else. Threads of this process are unwound using a signal.
+class UnwindService {
+ public:
+  using Callback = std::function<void(UnwindServiceResult& result)>;
+
+  UnwindService(size_t num_threads, size_t max_queued_requests);
+  // Cancels the requests that have not started, and waits for the others.
+  ~UnwindService();
+
+  UnwindService(const UnwindService&) = delete;
+  UnwindService& operator=(const UnwindService&) = delete;
+
+  // Queues the request, and calls callback from a worker thread when it is
+  // done. Returns the id of the request, or zero without calling callback
+  // if the queue is full.
+  uint64_t Submit(const UnwindServiceRequest& request, Callback callback);
+
+  // If the queue is full, the result is ready right away, with the status
+  // UNWIND_SERVICE_REJECTED.
+  std::future<UnwindServiceResult> Submit(const UnwindServiceRequest& request);
+
+  // Removes a request that has not started yet from the queue, and calls
+  // its callback with the status UNWIND_SERVICE_CANCELLED. Returns false
+  // if the request already started or finished.
+  bool Cancel(uint64_t id);
+
+  // Drops the shared data of the process, the next request creates it
+  // again.
+  void ClearProcess(pid_t pid);
+
+  size_t NumQueued();
+
+  UnwindServiceStats GetStats();
+
+  // Limit on the number of processes with shared data.
+  static constexpr size_t kMaxProcesses = 64;
+
+ private:
+  struct QueuedRequest {
+    uint64_t id;
+    UnwindServiceRequest request;
+    Callback callback;
+    std::chrono::steady_clock::time_point submit_time;
+  };
+
+  void Worker();
+
+  void Run(QueuedRequest& queued, UnwindServiceResult* result);
+
+  void Finish(QueuedRequest& queued, UnwindServiceResult& result);
+
+  // Sets cached if the unwinder was created for an earlier request.
+  std::shared_ptr<AndroidUnwinder> GetUnwinder(pid_t pid, pid_t tid, bool* cached,
+                                               ErrorCode* error_code);
+
+  // Removes unwinder from the cache, unless it was replaced already.
+  void DropUnwinder(pid_t pid, const std::shared_ptr<AndroidUnwinder>& unwinder);
+
+  size_t max_queued_requests_;
+
+  std::mutex lock_;
+  std::condition_variable cond_;
+  std::deque<QueuedRequest> queue_;
+  // The threads being unwound, a thread can only be attached once.
+  std::unordered_set<pid_t> busy_tids_;
+  uint64_t next_id_ = 1;
+  bool stopping_ = false;
+  UnwindServiceStats stats_;
+
+  struct CachedUnwinder {
+    // The start time of the process, zero for this process.
+    uint64_t start_time;
+    std::shared_ptr<AndroidUnwinder> unwinder;
+  };
+
+  std::mutex unwinders_lock_;
+  std::unordered_map<pid_t, CachedUnwinder> unwinders_;
+
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace unwindstack
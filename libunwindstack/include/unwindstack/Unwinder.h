@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <unwindstack/Arch.h>
@@ -38,6 +39,18 @@ namespace unwindstack {
 class Elf;
 class ThreadEntry;
 
+struct FramePointerStats {
+  std::string library;
+  // Steps out of a frame in this library that used the frame pointer.
+  uint64_t frame_pointer_steps = 0;
+  // All of the steps out of a frame in this library.
+  uint64_t steps = 0;
+
+  double HitRatio() const {
+    return steps == 0 ? 0.0 : static_cast<double>(frame_pointer_steps) / steps;
+  }
+};
+
 struct FrameData {
   size_t num;
 
@@ -51,6 +64,51 @@ struct FrameData {
   std::shared_ptr<MapInfo> map_info;
 };
 
+// Remembers the frames of the previous unwind of a thread, so that the next
+// unwind of the same thread can reuse the outer frames that did not change.
+class StackMemo {
+ public:
+  void Clear() { entries_.clear(); }
+
+  size_t NumFrames() const { return entries_.size(); }
+
+  // Returns the number of frames that the last unwind reused.
+  size_t reused_frames() const { return reused_frames_; }
+
+ private:
+  friend class Unwinder;
+
+  // The most registers that a function has to preserve, on x86_64.
+  static constexpr size_t kMaxCalleeSavedRegs = 6;
+
+  struct Entry {
+    FrameData frame;
+    // The registers when the frame was reached. The unwind information of
+    // the callers can use any of the callee saved registers, which include
+    // the frame pointer.
+    uint64_t pc;
+    uint64_t sp;
+    uint64_t callee_saved[kMaxCalleeSavedRegs];
+    // The sp of the caller, and the two words below it. On x86 and x86_64
+    // the call pushed the return address right below the sp of the caller,
+    // and the word below that is the saved frame pointer if the frame has
+    // one.
+    uint64_t cfa;
+    uint8_t slot[16];
+    // Set if the frame was reached by a normal step, and its own step was
+    // recorded, so the unwind can continue from it.
+    bool valid;
+  };
+
+  std::vector<Entry> entries_;
+  ErrorData last_error_;
+  size_t reused_frames_ = 0;
+  // The maps, and their generation at the start of the unwind. While it
+  // does not change, the maps of the frames are known to be current.
+  Maps* maps_ = nullptr;
+  uint64_t maps_generation_ = 0;
+};
+
 class Unwinder {
  public:
   Unwinder(size_t max_frames, Maps* maps, Regs* regs, std::shared_ptr<Memory> process_memory)
@@ -96,12 +154,48 @@ class Unwinder {
   Maps* GetMaps() { return maps_; }
   std::shared_ptr<Memory>& GetProcessMemory() { return process_memory_; }
 
+  // Sets the memory used for the reads done while stepping from one frame
+  // to the next, which are nearly all stack reads. When not set, or set to
+  // nullptr, the process memory is used.
+  void SetStepMemory(std::shared_ptr<Memory> step_memory) { step_memory_ = step_memory; }
+
   // Disabling the resolving of names results in the function name being
   // set to an empty string and the function offset being set to zero.
   void SetResolveNames(bool resolve) { resolve_names_ = resolve; }
 
   void SetDisplayBuildID(bool display_build_id) { display_build_id_ = display_build_id; }
 
+  // When enabled, a frame whose pc is a return address is unwound by
+  // following the frame pointer, if the frame record passes validation and
+  // the elf has been found to be safe for frame pointer unwinding. While
+  // that is still unknown, both kinds of step are done and compared, and
+  // the unwind information is used. Anything else uses the unwind
+  // information. A frame pointer step only restores the pc, sp and frame
+  // pointer. The other callee saved registers keep the values they had
+  // before the step, so they are wrong in the caller if the function saved
+  // them, and a later step that computes the cfa from one of them fails.
+  // The unwind information of x86_64 code nearly always computes the cfa
+  // from the sp or the frame pointer.
+  // Only used on x86_64, where the sp of the caller is always just above
+  // the frame record.
+  void SetFramePointerUnwind(bool enable) { frame_pointer_unwind_ = enable; }
+
+  // Returns the per library counts of how the steps were done, collected
+  // over all of the unwinds done with frame pointer unwinding enabled.
+  std::vector<FramePointerStats> GetFramePointerStats() const;
+  void ClearFramePointerStats() { frame_pointer_stats_.clear(); }
+
+  // When set, each unwind records its frames in memo, and an unwind that
+  // reaches a frame with the same pc, sp, frame pointer and return address
+  // slot as a frame in memo copies the rest of the frames from memo instead
+  // of stepping through them. The registers are left at the frame where
+  // the copy started. The memo must only be used for unwinds of one thread
+  // that pass the same arguments to Unwind.
+  // Only used on x86 and x86_64, the only abis where the return address is
+  // always at a known place relative to the sp of the caller. Elsewhere,
+  // the memo is left empty.
+  void SetStackMemo(StackMemo* memo) { stack_memo_ = memo; }
+
   void SetDexFiles(DexFiles* dex_files);
 
   const ErrorData& LastError() { return last_error_; }
@@ -136,15 +230,38 @@ class Unwinder {
   FrameData* FillInFrame(std::shared_ptr<MapInfo>& map_info, Elf* elf, uint64_t rel_pc,
                          uint64_t pc_adjustment);
 
+  // Moves regs to the caller using the frame record the frame pointer
+  // points at, after checking that the record is on the stack, that the
+  // chain moves up the stack and that the return address is executable.
+  // Leaves regs untouched on failure.
+  bool StepFramePointer(Regs* regs, Memory* memory);
+
+  // Adds the frames from the memo, and its entries to entries, if the
+  // current registers match a frame in the memo.
+  bool SpliceStackMemo(Memory* memory, std::vector<StackMemo::Entry>* entries);
+
+  // Records the step from the frame of entry, whose caller is at the
+  // current registers.
+  void RecordStackMemoStep(Memory* memory, StackMemo::Entry* entry);
+
+  // Gets the registers that a function has to preserve for its caller.
+  static void GetCalleeSavedRegs(Regs* regs, uint64_t* values);
+
   size_t max_frames_;
   Maps* maps_ = nullptr;
   Regs* regs_;
   std::vector<FrameData> frames_;
   std::shared_ptr<Memory> process_memory_;
+  std::shared_ptr<Memory> step_memory_;
   JitDebug* jit_debug_ = nullptr;
   DexFiles* dex_files_ = nullptr;
   bool resolve_names_ = true;
   bool display_build_id_ = false;
+  bool frame_pointer_unwind_ = false;
+  // Keyed by the name of the library, since the Elf objects can be freed
+  // once their maps go away.
+  std::unordered_map<std::string, FramePointerStats> frame_pointer_stats_;
+  StackMemo* stack_memo_ = nullptr;
   ErrorData last_error_;
   uint64_t warnings_;
   ArchEnum arch_ = ARCH_UNKNOWN;
@@ -168,12 +285,19 @@ class UnwinderFromPid : public Unwinder {
   void Unwind(const std::vector<std::string>* initial_map_names_to_skip = nullptr,
               const std::vector<std::string>* map_suffixes_to_ignore = nullptr) override;
 
+  // When enabled, the top of the stack is read in a single read before
+  // unwinding, and the stack reads done by the unwind are served from
+  // that copy. The amount read adapts to the depth of previous unwinds.
+  void SetStackPrefetch(bool enable) { stack_prefetch_ = enable; }
+
  protected:
   pid_t pid_;
   std::unique_ptr<Maps> maps_ptr_;
   std::unique_ptr<JitDebug> jit_debug_ptr_;
   std::unique_ptr<DexFiles> dex_files_ptr_;
   bool initted_ = false;
+  bool stack_prefetch_ = false;
+  size_t stack_prefetch_size_ = 0;
 };
 
 class ThreadUnwinder : public UnwinderFromPid {
@@ -374,6 +374,30 @@ TEST(AndroidRemoteUnwinderTest, initialize_before) {
   ASSERT_TRUE(Detach(pid));
 }
 
+TEST(AndroidRemoteUnwinderTest, stack_prefetch) {
+  pid_t pid = ForkWaitForever();
+  ASSERT_NE(-1, pid);
+  TestScopedPidReaper reap(pid);
+
+  ASSERT_TRUE(Attach(pid));
+
+  AndroidRemoteUnwinder unwinder(pid);
+  AndroidUnwinderData expected_data;
+  ASSERT_TRUE(unwinder.Unwind(expected_data));
+
+  // The second unwind with prefetch enabled uses a size based on the first.
+  unwinder.SetStackPrefetch(true);
+  for (size_t i = 0; i < 2; i++) {
+    SCOPED_TRACE("Unwind " + std::to_string(i));
+    AndroidUnwinderData data;
+    ASSERT_TRUE(unwinder.Unwind(data));
+    ASSERT_EQ(GetBacktrace(unwinder, expected_data.frames), GetBacktrace(unwinder, data.frames));
+    EXPECT_EQ(expected_data.error.code, data.error.code);
+  }
+
+  ASSERT_TRUE(Detach(pid));
+}
+
 static bool Verify(pid_t pid, std::function<PidRunEnum(const FrameData& frame)> fn) {
   return RunWhenQuiesced(pid, false, [pid, &fn]() {
     AndroidRemoteUnwinder unwinder(pid);
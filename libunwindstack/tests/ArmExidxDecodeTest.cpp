@@ -16,7 +16,6 @@
 
 #include <stdint.h>
 
-#include <deque>
 #include <ios>
 #include <memory>
 #include <string>
@@ -77,7 +76,7 @@ class ArmExidxDecodeTest : public ::testing::TestWithParam<std::string> {
 
   std::unique_ptr<ArmExidx> exidx_;
   std::unique_ptr<RegsArm> regs_arm_;
-  std::deque<uint8_t>* data_;
+  ArmExidxData* data_;
 
   MemoryFake elf_memory_;
   MemoryFake process_memory_;
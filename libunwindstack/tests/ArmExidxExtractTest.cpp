@@ -16,7 +16,6 @@
 
 #include <stdint.h>
 
-#include <deque>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -45,7 +44,7 @@ class ArmExidxExtractTest : public ::testing::Test {
   }
 
   ArmExidx* exidx_ = nullptr;
-  std::deque<uint8_t>* data_;
+  ArmExidxData* data_;
   MemoryFake elf_memory_;
 };
 
@@ -280,6 +279,44 @@ TEST_F(ArmExidxExtractTest, read_failures) {
   EXPECT_EQ(0x510cU, exidx_->status_address());
 }
 
+TEST_F(ArmExidxExtractTest, entry_data_already_read) {
+  // The second word of the entry is not read from memory.
+  ASSERT_TRUE(exidx_->ExtractEntryData(0x4000, 0x80a8b0b0));
+  ASSERT_EQ(3U, data_->size());
+  ASSERT_EQ(0xa8, data_->at(0));
+  ASSERT_EQ(0xb0, data_->at(1));
+  ASSERT_EQ(0xb0, data_->at(2));
+
+  ASSERT_FALSE(exidx_->ExtractEntryData(0x4000, 1));
+  ASSERT_EQ(ARM_STATUS_NO_UNWIND, exidx_->status());
+  ASSERT_TRUE(data_->empty());
+
+  ASSERT_FALSE(exidx_->ExtractEntryData(0x4001, 0x80a8b0b0));
+  ASSERT_EQ(ARM_STATUS_INVALID_ALIGNMENT, exidx_->status());
+
+  // The extab data is still read relative to the entry.
+  elf_memory_.SetData32(0x5104, 0x8100f3b0);
+  ASSERT_TRUE(exidx_->ExtractEntryData(0x5000, 0x100));
+  ASSERT_EQ(2U, data_->size());
+  ASSERT_EQ(0xf3, data_->at(0));
+  ASSERT_EQ(0xb0, data_->at(1));
+}
+
+TEST_F(ArmExidxExtractTest, max_size_entry) {
+  elf_memory_.SetData32(0x5000, 0x100);
+  elf_memory_.SetData32(0x5004, 0x100);
+  elf_memory_.SetData32(0x5104, 0x1);
+  elf_memory_.SetData32(0x5108, 0x05a1a2a3);
+  for (size_t i = 0; i < 5; i++) {
+    elf_memory_.SetData32(0x510c + i * 4, 0xa4a5a6a7);
+  }
+  ASSERT_TRUE(exidx_->ExtractEntryData(0x5000));
+  ASSERT_EQ(24U, data_->size());
+  ASSERT_EQ(0xa1, data_->front());
+  ASSERT_EQ(0xa7, data_->at(22));
+  ASSERT_EQ(0xb0, data_->back());
+}
+
 TEST_F(ArmExidxExtractTest, malformed) {
   elf_memory_.SetData32(0x5000, 0x100);
   elf_memory_.SetData32(0x5004, 0x100);
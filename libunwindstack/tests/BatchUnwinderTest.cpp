@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/BatchUnwinder.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/RegsArm64.h>
+
+#include "utils/MemoryFake.h"
+#include "utils/OfflineUnwindUtils.h"
+
+namespace unwindstack {
+
+static BatchUnwindSample CreateSample(uint64_t id, pid_t pid, uint64_t generation, uint64_t pc) {
+  BatchUnwindSample sample;
+  sample.id = id;
+  sample.pid = pid;
+  sample.maps_generation = generation;
+  RegsArm64* regs = new RegsArm64;
+  regs->set_pc(pc);
+  regs->set_sp(0x10000);
+  // Keep the unwind from using the return address.
+  (*regs)[ARM64_REG_LR] = pc;
+  sample.regs.reset(regs);
+  sample.process_memory.reset(new MemoryFake);
+  return sample;
+}
+
+static std::shared_ptr<Maps> CreateMaps(const std::string& name) {
+  std::shared_ptr<Maps> maps(new Maps);
+  maps->Add(0x1000, 0x2000, 0, PROT_READ | PROT_EXEC, name);
+  return maps;
+}
+
+TEST(BatchUnwinderTest, groups_use_their_maps) {
+  BatchUnwinder batch(4);
+  batch.AddMaps(100, 1, CreateMaps("/fake/gen1.so"));
+  batch.AddMaps(100, 2, CreateMaps("/fake/gen2.so"));
+  batch.AddMaps(200, 1, CreateMaps("/fake/other.so"));
+
+  constexpr size_t kNumSamples = 300;
+  for (size_t i = 0; i < kNumSamples; i++) {
+    switch (i % 4) {
+      case 0:
+        batch.AddSample(CreateSample(i, 100, 1, 0x1000 + i));
+        break;
+      case 1:
+        batch.AddSample(CreateSample(i, 100, 2, 0x1000 + i));
+        break;
+      case 2:
+        batch.AddSample(CreateSample(i, 200, 1, 0x1000 + i));
+        break;
+      default:
+        // There are no maps for this generation.
+        batch.AddSample(CreateSample(i, 200, 2, 0x1000 + i));
+        break;
+    }
+  }
+  ASSERT_EQ(kNumSamples, batch.NumSamples());
+
+  std::mutex lock;
+  std::vector<size_t> seen(kNumSamples);
+  batch.Run([&](BatchUnwindResult& result) {
+    std::lock_guard<std::mutex> guard(lock);
+    ASSERT_LT(result.id, kNumSamples);
+    seen[result.id]++;
+    ASSERT_EQ(1U, result.frames.size()) << "Sample " << result.id;
+    const FrameData& frame = result.frames[0];
+    EXPECT_EQ(0x1000 + result.id, frame.pc);
+    switch (result.id % 4) {
+      case 0:
+        ASSERT_TRUE(frame.map_info != nullptr);
+        EXPECT_EQ(100, result.pid);
+        EXPECT_EQ("/fake/gen1.so", frame.map_info->name());
+        break;
+      case 1:
+        ASSERT_TRUE(frame.map_info != nullptr);
+        EXPECT_EQ(100, result.pid);
+        EXPECT_EQ("/fake/gen2.so", frame.map_info->name());
+        break;
+      case 2:
+        ASSERT_TRUE(frame.map_info != nullptr);
+        EXPECT_EQ(200, result.pid);
+        EXPECT_EQ("/fake/other.so", frame.map_info->name());
+        break;
+      default:
+        EXPECT_TRUE(frame.map_info == nullptr);
+        EXPECT_EQ(ERROR_INVALID_MAP, result.error.code);
+        break;
+    }
+  });
+  for (size_t i = 0; i < kNumSamples; i++) {
+    EXPECT_EQ(1U, seen[i]) << "Sample " << i;
+  }
+  EXPECT_EQ(0U, batch.NumSamples());
+
+  // The maps are kept for the next run.
+  batch.AddSample(CreateSample(0, 100, 2, 0x1800));
+  size_t num_results = 0;
+  batch.Run([&](BatchUnwindResult& result) {
+    num_results++;
+    ASSERT_EQ(1U, result.frames.size());
+    ASSERT_TRUE(result.frames[0].map_info != nullptr);
+    EXPECT_EQ("/fake/gen2.so", result.frames[0].map_info->name());
+  });
+  EXPECT_EQ(1U, num_results);
+}
+
+TEST(BatchUnwinderTest, offline_samples) {
+  OfflineUnwindUtils offline_utils;
+  std::string error_msg;
+  if (!offline_utils.Init({.offline_files_dir = "straddle_arm64/", .arch = ARCH_ARM64},
+                          &error_msg)) {
+    FAIL() << error_msg;
+  }
+  size_t expected_num_frames;
+  if (!offline_utils.GetExpectedNumFrames(&expected_num_frames, &error_msg)) FAIL() << error_msg;
+  // The map names are relative to the sample directory.
+  if (!offline_utils.ChangeToSampleDirectory(&error_msg)) FAIL() << error_msg;
+
+  BatchUnwinder batch(4);
+  // The maps are owned by offline_utils.
+  batch.AddMaps(1, 0, std::shared_ptr<Maps>(offline_utils.GetMaps(), [](Maps*) {}));
+  constexpr size_t kNumSamples = 200;
+  for (size_t i = 0; i < kNumSamples; i++) {
+    BatchUnwindSample sample;
+    sample.id = i;
+    sample.pid = 1;
+    sample.regs.reset(offline_utils.GetRegs()->Clone());
+    sample.process_memory = offline_utils.GetProcessMemory();
+    batch.AddSample(std::move(sample));
+  }
+
+  std::mutex lock;
+  std::vector<std::vector<FrameData>> frames(kNumSamples);
+  batch.Run([&](BatchUnwindResult& result) {
+    std::lock_guard<std::mutex> guard(lock);
+    frames[result.id] = std::move(result.frames);
+  });
+  offline_utils.ReturnToCurrentWorkingDirectory();
+
+  for (size_t i = 0; i < kNumSamples; i++) {
+    SCOPED_TRACE(i);
+    ASSERT_EQ(expected_num_frames, frames[i].size());
+    EXPECT_EQ(0x64d09d4fd8U, frames[i][0].pc);
+    EXPECT_EQ(0x7fe0d84040U, frames[i][0].sp);
+    for (size_t j = 0; j < expected_num_frames; j++) {
+      EXPECT_EQ(frames[0][j].pc, frames[i][j].pc);
+      EXPECT_EQ(frames[0][j].sp, frames[i][j].sp);
+      EXPECT_EQ(frames[0][j].function_name, frames[i][j].function_name);
+    }
+  }
+}
+
+}  // namespace unwindstack
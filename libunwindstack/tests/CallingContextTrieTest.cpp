@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Unwinder.h>
+
+#include "ElfFake.h"
+#include "utils/MemoryFake.h"
+
+namespace unwindstack {
+
+class CallingContextTrieTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ElfInterfaceFake::FakeClear();
+    libc_ = MapInfo::Create(0x1000, 0x8000, 0, PROT_READ | PROT_EXEC, "/system/lib64/libc.so");
+    libfoo_ = MapInfo::Create(0x10000, 0x12000, 0, PROT_READ | PROT_EXEC, "/data/libfoo.so");
+    anon_ = MapInfo::Create(0x20000, 0x21000, 0, PROT_READ | PROT_EXEC, "");
+  }
+
+  void TearDown() override { ElfInterfaceFake::FakeClear(); }
+
+  static FrameData Frame(std::shared_ptr<MapInfo> map_info, uint64_t rel_pc,
+                         const char* function_name = "") {
+    FrameData frame{};
+    frame.rel_pc = rel_pc;
+    frame.pc = rel_pc + (map_info != nullptr ? map_info->start() : 0);
+    frame.map_info = map_info;
+    frame.function_name = function_name;
+    return frame;
+  }
+
+  std::shared_ptr<MapInfo> libc_;
+  std::shared_ptr<MapInfo> libfoo_;
+  std::shared_ptr<MapInfo> anon_;
+};
+
+TEST_F(CallingContextTrieTest, empty) {
+  CallingContextTrie trie;
+  trie.AddSample({});
+  EXPECT_EQ(0U, trie.NumNodes());
+  EXPECT_EQ(0U, trie.NumSamples());
+  EXPECT_EQ("", trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, shared_prefix) {
+  CallingContextTrie trie;
+  std::vector<FrameData> stack1{Frame(libfoo_, 0x30, "bar"), Frame(libfoo_, 0x20, "foo"),
+                                Frame(libc_, 0x10, "main")};
+  std::vector<FrameData> stack2{Frame(libfoo_, 0x40, "baz"), Frame(libfoo_, 0x20, "foo"),
+                                Frame(libc_, 0x10, "main")};
+  trie.AddSample(stack1);
+  trie.AddSample(stack2);
+  trie.AddSample(stack1, 3);
+
+  EXPECT_EQ(4U, trie.NumNodes());
+  EXPECT_EQ(5U, trie.NumSamples());
+  EXPECT_EQ(
+      "main;foo;bar 4\n"
+      "main;foo;baz 1\n",
+      trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, same_pc_different_caller) {
+  CallingContextTrie trie;
+  trie.AddSample({Frame(libc_, 0x50, "memcpy"), Frame(libfoo_, 0x20, "foo")});
+  trie.AddSample({Frame(libc_, 0x50, "memcpy"), Frame(libfoo_, 0x30, "bar")});
+  trie.AddSample({Frame(libc_, 0x50, "memcpy")});
+
+  EXPECT_EQ(5U, trie.NumNodes());
+  EXPECT_EQ(
+      "bar;memcpy 1\n"
+      "foo;memcpy 1\n"
+      "memcpy 1\n",
+      trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, unknown_frames) {
+  CallingContextTrie trie;
+  trie.AddSample({Frame(nullptr, 0x1234), Frame(anon_, 0x40), Frame(libfoo_, 0x20)});
+  EXPECT_EQ("libfoo.so+0x20;<anonymous:20000>+0x40;0x1234 1\n", trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, names_with_separators) {
+  auto map_info = MapInfo::Create(0x30000, 0x31000, 0, PROT_READ | PROT_EXEC, "/data/my lib.so");
+  CallingContextTrie trie;
+  trie.AddSample({Frame(libfoo_, 0x30, "std::pair<int, int> foo(int;)"), Frame(map_info, 0x20)});
+  EXPECT_EQ("my_lib.so+0x20;std::pair<int,_int>_foo(int_) 1\n", trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, pcs) {
+  Maps maps;
+  maps.Add(0x1000, 0x8000, 0, PROT_READ | PROT_EXEC, "/system/lib64/libc.so");
+  maps.Add(0x10000, 0x12000, 0, PROT_READ | PROT_EXEC, "/data/libfoo.so");
+
+  CallingContextTrie trie;
+  std::vector<uint64_t> pcs{0x10030, 0x10020, 0x1010, 0x50000};
+  trie.AddSample(&maps, pcs.data(), pcs.size());
+  trie.AddSample(&maps, pcs.data(), pcs.size(), 2);
+  trie.AddSample(&maps, pcs.data(), 0);
+
+  EXPECT_EQ(4U, trie.NumNodes());
+  EXPECT_EQ(3U, trie.NumSamples());
+  EXPECT_EQ("0x50000;libc.so+0x10;libfoo.so+0x20;libfoo.so+0x30 3\n", trie.DumpFolded());
+
+  // The same frames built by an unwind end up in the same nodes.
+  auto libfoo = maps.Find(0x10000);
+  trie.AddSample({Frame(libfoo, 0x30), Frame(libfoo, 0x20), Frame(maps.Find(0x1000), 0x10),
+                  Frame(nullptr, 0x50000)});
+  EXPECT_EQ(4U, trie.NumNodes());
+  EXPECT_EQ("0x50000;libc.so+0x10;libfoo.so+0x20;libfoo.so+0x30 4\n", trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, symbolize_once) {
+  ElfFake* elf = new ElfFake(new MemoryFake);
+  elf->FakeSetInterface(new ElfInterfaceFake(nullptr));
+  libfoo_->set_elf(elf);
+  ElfInterfaceFake::FakePushFunctionData(FunctionData("_Z3foov", 4));
+
+  CallingContextTrie trie;
+  trie.AddSample({Frame(libfoo_, 0x20)});
+  trie.AddSample({Frame(libfoo_, 0x20)});
+  EXPECT_EQ("foo() 2\n", trie.DumpFolded());
+
+  // The fake only returns the name once, so it is not looked up again.
+  trie.AddSample({Frame(libfoo_, 0x20)});
+  EXPECT_EQ("foo() 3\n", trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, threads) {
+  CallingContextTrie trie(16);
+  constexpr size_t kNumThreads = 4;
+  constexpr size_t kNumSamples = 1000;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([this, &trie]() {
+      for (size_t j = 0; j < kNumSamples; j++) {
+        trie.AddSample({Frame(libfoo_, 0x100 + j % 10, "leaf"), Frame(libc_, 0x10, "main")});
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(11U, trie.NumNodes());
+  EXPECT_EQ(kNumThreads * kNumSamples, trie.NumSamples());
+  std::string expected;
+  for (size_t i = 0; i < 10; i++) {
+    expected += "main;leaf 400\n";
+  }
+  EXPECT_EQ(expected, trie.DumpFolded());
+}
+
+TEST_F(CallingContextTrieTest, threads_rehash) {
+  CallingContextTrie trie(1);
+  constexpr size_t kNumThreads = 4;
+  constexpr size_t kNumLeaves = 200;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([this, &trie]() {
+      for (size_t j = 0; j < kNumLeaves; j++) {
+        trie.AddSample({Frame(libfoo_, 0x100 + j), Frame(libc_, 0x10, "main")});
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(kNumLeaves + 1, trie.NumNodes());
+  EXPECT_EQ(kNumThreads * kNumLeaves, trie.NumSamples());
+  std::string folded = trie.DumpFolded();
+  EXPECT_EQ(kNumLeaves, static_cast<size_t>(std::count(folded.begin(), folded.end(), '\n')));
+  EXPECT_NE(std::string::npos, folded.find("main;libfoo.so+0x100 4\n"));
+  EXPECT_NE(std::string::npos, folded.find("main;libfoo.so+0x1c7 4\n"));
+}
+
+}  // namespace unwindstack
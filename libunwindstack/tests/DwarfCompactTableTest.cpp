@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/Arch.h>
+#include <unwindstack/DwarfCompactTable.h>
+#include <unwindstack/DwarfLocation.h>
+#include <unwindstack/DwarfSection.h>
+#include <unwindstack/DwarfStructs.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/ElfInterface.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsArm64.h>
+#include <unwindstack/RegsX86_64.h>
+
+#include "utils/MemoryFake.h"
+
+namespace unwindstack {
+
+class DwarfCompactTableTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    cie_.return_address_register = X86_64_REG_RIP;
+    // The usual locations after a push %rbp; mov %rsp, %rbp.
+    loc_regs_[CFA_REG] = {.type = DWARF_LOCATION_REGISTER, .values = {X86_64_REG_RBP, 16}};
+    loc_regs_[X86_64_REG_RIP] = {.type = DWARF_LOCATION_OFFSET,
+                                 .values = {static_cast<uint64_t>(-8)}};
+    loc_regs_[X86_64_REG_RBP] = {.type = DWARF_LOCATION_OFFSET,
+                                 .values = {static_cast<uint64_t>(-16)}};
+  }
+
+  static DwarfCompactTable::Entry SpEntry(int16_t cfa_offset) {
+    DwarfCompactTable::Entry entry;
+    entry.cfa_reg = DwarfCompactTable::CFA_SP;
+    entry.cfa_offset = cfa_offset;
+    entry.ra_offset = -8;
+    entry.flags = DwarfCompactTable::RA_SAVED;
+    return entry;
+  }
+
+  DwarfCie cie_;
+  DwarfLocations loc_regs_;
+};
+
+TEST_F(DwarfCompactTableTest, convert_row) {
+  DwarfCompactTable table(ARCH_X86_64);
+  DwarfCompactTable::Entry entry;
+  ASSERT_TRUE(table.ConvertRow(&cie_, loc_regs_, &entry));
+  EXPECT_EQ(DwarfCompactTable::CFA_FP, entry.cfa_reg);
+  EXPECT_EQ(16, entry.cfa_offset);
+  EXPECT_EQ(-8, entry.ra_offset);
+  EXPECT_EQ(-16, entry.fp_offset);
+  EXPECT_EQ(DwarfCompactTable::RA_SAVED | DwarfCompactTable::FP_SAVED, entry.flags);
+  EXPECT_EQ(0U, entry.saved_regs);
+  EXPECT_EQ(0U, table.saved_regs(entry).mask);
+
+  // Other saved registers go in the table of sets.
+  loc_regs_[X86_64_REG_R12] = {.type = DWARF_LOCATION_OFFSET,
+                               .values = {static_cast<uint64_t>(-32)}};
+  loc_regs_[X86_64_REG_RBX] = {.type = DWARF_LOCATION_OFFSET,
+                               .values = {static_cast<uint64_t>(-24)}};
+  ASSERT_TRUE(table.ConvertRow(&cie_, loc_regs_, &entry));
+  EXPECT_EQ(1U, entry.saved_regs);
+  const DwarfCompactTable::SavedRegs& saved = table.saved_regs(entry);
+  EXPECT_EQ((1ULL << X86_64_REG_RBX) | (1ULL << X86_64_REG_R12), saved.mask);
+  EXPECT_EQ(-24, saved.offsets[0]);
+  EXPECT_EQ(-32, saved.offsets[1]);
+
+  // The same set is shared.
+  loc_regs_[X86_64_REG_RIP] = {.type = DWARF_LOCATION_UNDEFINED};
+  ASSERT_TRUE(table.ConvertRow(&cie_, loc_regs_, &entry));
+  EXPECT_EQ(DwarfCompactTable::RA_UNDEFINED | DwarfCompactTable::FP_SAVED, entry.flags);
+  EXPECT_EQ(1U, entry.saved_regs);
+}
+
+TEST_F(DwarfCompactTableTest, convert_row_not_representable) {
+  DwarfCompactTable table(ARCH_X86_64);
+  DwarfCompactTable::Entry entry;
+
+  DwarfLocations loc_regs = loc_regs_;
+  loc_regs[CFA_REG] = {.type = DWARF_LOCATION_REGISTER, .values = {X86_64_REG_RBX, 16}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[CFA_REG] = {.type = DWARF_LOCATION_REGISTER, .values = {X86_64_REG_RSP, 0x10000}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[CFA_REG] = {.type = DWARF_LOCATION_VAL_EXPRESSION, .values = {2, 0x100}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs.erase(CFA_REG);
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[X86_64_REG_RIP] = {.type = DWARF_LOCATION_REGISTER, .values = {X86_64_REG_RAX, 0}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[X86_64_REG_RBP] = {.type = DWARF_LOCATION_VAL_OFFSET, .values = {0}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[X86_64_REG_RBX] = {.type = DWARF_LOCATION_EXPRESSION, .values = {2, 0x100}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[X86_64_REG_RBX] = {.type = DWARF_LOCATION_REGISTER, .values = {X86_64_REG_RAX, 0}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  loc_regs = loc_regs_;
+  loc_regs[X86_64_REG_RBX] = {.type = DWARF_LOCATION_OFFSET, .values = {0x10000}};
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  // More saved registers than an entry can hold.
+  loc_regs = loc_regs_;
+  for (uint16_t reg = X86_64_REG_RAX; reg <= X86_64_REG_R15; reg++) {
+    if (reg != X86_64_REG_RBP && reg != X86_64_REG_RSP) {
+      loc_regs[reg] = {.type = DWARF_LOCATION_OFFSET, .values = {static_cast<uint64_t>(-24)}};
+    }
+  }
+  EXPECT_FALSE(table.ConvertRow(&cie_, loc_regs, &entry));
+
+  DwarfCie cie = cie_;
+  cie.is_signal_frame = true;
+  EXPECT_FALSE(table.ConvertRow(&cie, loc_regs_, &entry));
+
+  cie = cie_;
+  cie.return_address_register = X86_64_REG_RAX;
+  EXPECT_FALSE(table.ConvertRow(&cie, loc_regs_, &entry));
+
+  DwarfCompactTable arm_table(ARCH_ARM);
+  EXPECT_FALSE(arm_table.ConvertRow(&cie_, loc_regs_, &entry));
+}
+
+TEST_F(DwarfCompactTableTest, find) {
+  DwarfCompactTable table(ARCH_X86_64);
+  ASSERT_TRUE(table.Find(0x1000) == nullptr);
+
+  table.AddRow(0x1000, 0x1004, SpEntry(8));
+  table.AddRow(0x1004, 0x1010, SpEntry(16));
+  // Same as the previous row, merged with it.
+  table.AddRow(0x1010, 0x1020, SpEntry(16));
+  // Leaves a gap at 0x1020-0x1100.
+  table.AddRow(0x1100, 0x1200, SpEntry(8));
+  // Ignored.
+  table.AddRow(0x1300, 0x1300, SpEntry(8));
+  table.AddRow(0x1300, 0x1400, DwarfCompactTable::Entry());
+  ASSERT_TRUE(table.Find(0x1000) == nullptr);
+  table.Finalize();
+  EXPECT_EQ(5U, table.NumRows());
+
+  EXPECT_TRUE(table.Find(0xfff) == nullptr);
+  ASSERT_TRUE(table.Find(0x1000) != nullptr);
+  EXPECT_EQ(8, table.Find(0x1003)->cfa_offset);
+  ASSERT_TRUE(table.Find(0x1004) != nullptr);
+  EXPECT_EQ(16, table.Find(0x1004)->cfa_offset);
+  EXPECT_EQ(16, table.Find(0x101f)->cfa_offset);
+  EXPECT_TRUE(table.Find(0x1020) == nullptr);
+  EXPECT_TRUE(table.Find(0x10ff) == nullptr);
+  ASSERT_TRUE(table.Find(0x1100) != nullptr);
+  EXPECT_EQ(8, table.Find(0x11ff)->cfa_offset);
+  EXPECT_TRUE(table.Find(0x1200) == nullptr);
+  EXPECT_TRUE(table.Find(0x1300) == nullptr);
+  EXPECT_TRUE(table.Find(UINT64_MAX) == nullptr);
+}
+
+TEST_F(DwarfCompactTableTest, find_incremental) {
+  DwarfCompactTable table(ARCH_X86_64);
+  table.AddRow(0x2000, 0x2100, SpEntry(8));
+  table.Finalize();
+  ASSERT_TRUE(table.Find(0x1000) == nullptr);
+
+  // Fills in before, and overlaps the existing row which is kept.
+  table.AddRow(0x1000, 0x1100, SpEntry(16));
+  table.AddRow(0x2000, 0x2200, SpEntry(24));
+  table.Finalize();
+  ASSERT_TRUE(table.Find(0x1000) != nullptr);
+  EXPECT_EQ(16, table.Find(0x1000)->cfa_offset);
+  EXPECT_TRUE(table.Find(0x1100) == nullptr);
+  ASSERT_TRUE(table.Find(0x2000) != nullptr);
+  EXPECT_EQ(8, table.Find(0x20ff)->cfa_offset);
+  ASSERT_TRUE(table.Find(0x2100) != nullptr);
+  EXPECT_EQ(24, table.Find(0x21ff)->cfa_offset);
+  EXPECT_TRUE(table.Find(0x2200) == nullptr);
+
+  // Rows too far away from the start of the table are dropped.
+  table.AddRow(0x100001000, 0x100001100, SpEntry(8));
+  table.Finalize();
+  EXPECT_TRUE(table.Find(0x100001000) == nullptr);
+  EXPECT_TRUE(table.Find(0x2000) != nullptr);
+}
+
+TEST_F(DwarfCompactTableTest, step_x86_64) {
+  DwarfCompactTable table(ARCH_X86_64);
+  DwarfCompactTable::Entry entry;
+  ASSERT_TRUE(table.ConvertRow(&cie_, loc_regs_, &entry));
+  table.AddRow(0x1000, 0x2000, entry);
+  loc_regs_[X86_64_REG_RBX] = {.type = DWARF_LOCATION_OFFSET,
+                               .values = {static_cast<uint64_t>(-24)}};
+  ASSERT_TRUE(table.ConvertRow(&cie_, loc_regs_, &entry));
+  table.AddRow(0x5000, 0x6000, entry);
+  table.Finalize();
+
+  MemoryFake memory;
+  memory.SetData64(0x8000, 0x9100);
+  memory.SetData64(0x8008, 0x5400);
+
+  RegsX86_64 regs;
+  regs[X86_64_REG_RBX] = 0x1234;
+  regs.set_pc(0x1500);
+  regs.set_sp(0x7f00);
+  regs.SetFramePointer(0x8000);
+
+  bool finished;
+  ASSERT_FALSE(table.Step(0x3000, &regs, &memory, &finished));
+  ASSERT_TRUE(table.Step(0x1500, &regs, &memory, &finished));
+  EXPECT_FALSE(finished);
+  EXPECT_EQ(0x5400U, regs.pc());
+  EXPECT_EQ(0x8010U, regs.sp());
+  uint64_t fp;
+  ASSERT_TRUE(regs.GetFramePointer(&fp));
+  EXPECT_EQ(0x9100U, fp);
+  EXPECT_EQ(0x1234U, regs[X86_64_REG_RBX]);
+
+  // A failed read leaves the registers alone.
+  ASSERT_FALSE(table.Step(0x1500, &regs, &memory, &finished));
+  EXPECT_EQ(0x5400U, regs.pc());
+  EXPECT_EQ(0x8010U, regs.sp());
+
+  // The saved rbx is restored along with the frame pointer.
+  memory.SetData64(0x90f8, 0x5678);
+  memory.SetData64(0x9100, 0x9200);
+  memory.SetData64(0x9108, 0x5800);
+  ASSERT_TRUE(table.Step(0x5400, &regs, &memory, &finished));
+  EXPECT_EQ(0x5800U, regs.pc());
+  EXPECT_EQ(0x9110U, regs.sp());
+  ASSERT_TRUE(regs.GetFramePointer(&fp));
+  EXPECT_EQ(0x9200U, fp);
+  EXPECT_EQ(0x5678U, regs[X86_64_REG_RBX]);
+
+  // The table is only used for the arch it was built for.
+  RegsArm64 arm64_regs;
+  ASSERT_FALSE(table.Step(0x1500, &arm64_regs, &memory, &finished));
+}
+
+TEST_F(DwarfCompactTableTest, step_arm64) {
+  DwarfCie cie;
+  cie.return_address_register = ARM64_REG_LR;
+  DwarfLocations loc_regs;
+  loc_regs[CFA_REG] = {.type = DWARF_LOCATION_REGISTER, .values = {ARM64_REG_SP, 0}};
+
+  DwarfCompactTable table(ARCH_ARM64);
+  DwarfCompactTable::Entry entry;
+  // A leaf function, the return address is still in lr.
+  ASSERT_TRUE(table.ConvertRow(&cie, loc_regs, &entry));
+  table.AddRow(0x1000, 0x1100, entry);
+  // The end of the stack.
+  loc_regs[ARM64_REG_LR] = {.type = DWARF_LOCATION_UNDEFINED};
+  ASSERT_TRUE(table.ConvertRow(&cie, loc_regs, &entry));
+  table.AddRow(0x2000, 0x2100, entry);
+  table.Finalize();
+
+  MemoryFake memory;
+  RegsArm64 regs;
+  regs.set_pc(0x1010);
+  regs.set_sp(0x7000);
+  regs[ARM64_REG_LR] = 0x2040;
+
+  bool finished;
+  ASSERT_TRUE(table.Step(0x1010, &regs, &memory, &finished));
+  EXPECT_FALSE(finished);
+  EXPECT_EQ(0x2040U, regs.pc());
+  EXPECT_EQ(0x7000U, regs.sp());
+
+  ASSERT_TRUE(table.Step(0x2040, &regs, &memory, &finished));
+  EXPECT_TRUE(finished);
+  EXPECT_EQ(0U, regs.pc());
+}
+
+// Every compact step has to give the same registers as the full evaluation
+// of the same row.
+TEST_F(DwarfCompactTableTest, matches_dwarf_eval) {
+  if (!DwarfCompactTable::IsArchSupported(Regs::CurrentArch())) {
+    GTEST_SKIP() << "Compact tables are not supported on this arch.";
+  }
+
+  Elf dwarf_elf(Memory::CreateFileMemory("/proc/self/exe", 0).release());
+  ASSERT_TRUE(dwarf_elf.Init());
+  Elf compact_elf(Memory::CreateFileMemory("/proc/self/exe", 0).release());
+  ASSERT_TRUE(compact_elf.Init());
+  DwarfSection* dwarf_section = dwarf_elf.interface()->eh_frame();
+  DwarfSection* compact_section = compact_elf.interface()->eh_frame();
+  ASSERT_TRUE(dwarf_section != nullptr);
+  ASSERT_TRUE(compact_section != nullptr);
+  ASSERT_TRUE(compact_section->BuildCompactTable(compact_elf.arch()));
+  const DwarfCompactTable* table = compact_section->compact_table();
+  ASSERT_TRUE(table != nullptr);
+  ASSERT_NE(0U, table->stats().compact_rows);
+
+  // All registers point into the middle of readable memory, which holds
+  // values that differ from all of the registers.
+  MemoryFake memory;
+  for (uint64_t addr = 0x100000 - 0x10000; addr < 0x100000 + 0x10000; addr += 8) {
+    memory.SetData64(addr, addr ^ 0x4a00000000);
+  }
+  std::unique_ptr<Regs> initial_regs(Regs::CreateFromLocal());
+  uint64_t* raw_regs = reinterpret_cast<uint64_t*>(initial_regs->RawData());
+  for (size_t i = 0; i < initial_regs->total_regs(); i++) {
+    raw_regs[i] = 0x100000 + i * 0x10;
+  }
+
+  std::vector<const DwarfFde*> fdes;
+  compact_section->GetFdes(&fdes);
+  // Only check a sample of the fdes to keep the test fast.
+  size_t stride = std::max<size_t>(1, fdes.size() / 1000);
+  size_t compared = 0;
+  for (size_t i = 0; i < fdes.size(); i += stride) {
+    const DwarfFde* fde = fdes[i];
+    for (uint64_t pc : {fde->pc_start, (fde->pc_start + fde->pc_end) / 2, fde->pc_end - 1}) {
+      if (pc < fde->pc_start || table->Find(pc) == nullptr) {
+        continue;
+      }
+      std::unique_ptr<Regs> compact_regs(initial_regs->Clone());
+      bool compact_finished;
+      bool is_signal_frame;
+      ASSERT_TRUE(compact_section->Step(pc, compact_regs.get(), &memory, &compact_finished,
+                                        &is_signal_frame));
+      std::unique_ptr<Regs> dwarf_regs(initial_regs->Clone());
+      bool dwarf_finished;
+      ASSERT_TRUE(dwarf_section->Step(pc, dwarf_regs.get(), &memory, &dwarf_finished,
+                                      &is_signal_frame))
+          << "Failed at pc 0x" << std::hex << pc;
+      EXPECT_EQ(dwarf_regs->pc(), compact_regs->pc()) << "Failed at pc 0x" << std::hex << pc;
+      EXPECT_EQ(dwarf_regs->sp(), compact_regs->sp()) << "Failed at pc 0x" << std::hex << pc;
+      uint64_t* dwarf_raw_regs = reinterpret_cast<uint64_t*>(dwarf_regs->RawData());
+      uint64_t* compact_raw_regs = reinterpret_cast<uint64_t*>(compact_regs->RawData());
+      for (size_t reg = 0; reg < dwarf_regs->total_regs(); reg++) {
+        EXPECT_EQ(dwarf_raw_regs[reg], compact_raw_regs[reg])
+            << "Failed at pc 0x" << std::hex << pc << " reg " << std::dec << reg;
+      }
+      EXPECT_EQ(dwarf_finished, compact_finished) << "Failed at pc 0x" << std::hex << pc;
+      compared++;
+    }
+  }
+  ASSERT_NE(0U, compared);
+}
+
+TEST_F(DwarfCompactTableTest, step_compiles_fdes_when_enabled) {
+  if (!DwarfCompactTable::IsArchSupported(Regs::CurrentArch())) {
+    GTEST_SKIP() << "Compact tables are not supported on this arch.";
+  }
+
+  Elf elf(Memory::CreateFileMemory("/proc/self/exe", 0).release());
+  ASSERT_TRUE(elf.Init());
+  DwarfSection* section = elf.interface()->eh_frame();
+  ASSERT_TRUE(section != nullptr);
+  std::vector<const DwarfFde*> fdes;
+  section->GetFdes(&fdes);
+  ASSERT_LT(1U, fdes.size());
+
+  MemoryFake memory;
+  for (uint64_t addr = 0x100000 - 0x10000; addr < 0x100000 + 0x10000; addr += 8) {
+    memory.SetData64(addr, addr ^ 0x4a00000000);
+  }
+  std::unique_ptr<Regs> initial_regs(Regs::CreateFromLocal());
+  uint64_t* raw_regs = reinterpret_cast<uint64_t*>(initial_regs->RawData());
+  for (size_t i = 0; i < initial_regs->total_regs(); i++) {
+    raw_regs[i] = 0x100000 + i * 0x10;
+  }
+
+  bool finished;
+  bool is_signal_frame;
+  std::unique_ptr<Regs> regs(initial_regs->Clone());
+  section->Step(fdes.back()->pc_start, regs.get(), &memory, &finished, &is_signal_frame);
+  EXPECT_TRUE(section->compact_table() == nullptr);
+
+  DwarfSection::SetCompactTables(true);
+  size_t stepped = 0;
+  uint64_t compact_pc = 0;
+  for (size_t i = 0; i + 1 < fdes.size() && compact_pc == 0; i++) {
+    uint64_t pc = fdes[i]->pc_start;
+    regs.reset(initial_regs->Clone());
+    section->Step(pc, regs.get(), &memory, &finished, &is_signal_frame);
+    stepped++;
+    const DwarfCompactTable* table = section->compact_table();
+    if (table != nullptr && table->Find(pc) != nullptr) {
+      compact_pc = pc;
+    }
+  }
+  DwarfSection::SetCompactTables(false);
+  ASSERT_NE(0U, compact_pc);
+
+  // Only the fdes that were stepped through are compiled.
+  EXPECT_EQ(stepped, section->compact_table()->stats().fdes);
+
+  // The next step is done by the table, and agrees with a full evaluation.
+  std::unique_ptr<Regs> compact_regs(initial_regs->Clone());
+  ASSERT_TRUE(section->Step(compact_pc, compact_regs.get(), &memory, &finished, &is_signal_frame));
+  Elf dwarf_elf(Memory::CreateFileMemory("/proc/self/exe", 0).release());
+  ASSERT_TRUE(dwarf_elf.Init());
+  std::unique_ptr<Regs> dwarf_regs(initial_regs->Clone());
+  ASSERT_TRUE(dwarf_elf.interface()->eh_frame()->Step(compact_pc, dwarf_regs.get(), &memory,
+                                                       &finished, &is_signal_frame));
+  EXPECT_EQ(dwarf_regs->pc(), compact_regs->pc());
+  EXPECT_EQ(dwarf_regs->sp(), compact_regs->sp());
+}
+
+}  // namespace unwindstack
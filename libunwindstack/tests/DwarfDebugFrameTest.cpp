@@ -905,6 +905,82 @@ TYPED_TEST_P(DwarfDebugFrameTest, GetFdeFromPc_overlap) {
   ASSERT_TRUE(fde == nullptr);
 }
 
+TYPED_TEST_P(DwarfDebugFrameTest, GetPcRanges) {
+  SetCie32(&this->memory_, 0x5000, 0xfc, std::vector<uint8_t>{1, '\0', 0, 0, 1});
+
+  // FDE 0 (0x100 - 0x200)
+  SetFde32(&this->memory_, 0x5100, 0xfc, 0, 0x100, 0x100);
+  // FDE 1 (0x150 - 0xb50)
+  SetFde32(&this->memory_, 0x5200, 0xfc, 0, 0x150, 0xa00);
+  // FDE 2 (0x50 - 0xa0)
+  SetFde32(&this->memory_, 0x5300, 0xfc, 0, 0x50, 0x50);
+  // FDE 3 (0x0 - 0x50)
+  SetFde32(&this->memory_, 0x5400, 0xfc, 0, 0, 0x50);
+  // FDE 4 (0x1000 - 0x1000)
+  SetFde32(&this->memory_, 0x5500, 0xfc, 0, 0x1000, 0);
+
+  this->debug_frame_->Init(0x5000, 0x600, 0);
+
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  ASSERT_TRUE(this->debug_frame_->GetPcRanges(&ranges));
+  // The gap between 0xa0 and 0x100 is not known from the index.
+  std::vector<std::pair<uint64_t, uint64_t>> expected{{0, 0xb50}};
+  ASSERT_EQ(expected, ranges);
+
+  // The walk does not change the fdes that are found.
+  const DwarfFde* fde = this->debug_frame_->GetFdeFromPc(0x210);
+  ASSERT_TRUE(fde != nullptr);
+  EXPECT_EQ(0x150U, fde->pc_start);
+  EXPECT_EQ(0xb50U, fde->pc_end);
+  ASSERT_TRUE(this->debug_frame_->GetFdeFromPc(0xc00) == nullptr);
+
+  // The ranges come from the fde index, not from the section.
+  DwarfSection::FdeIndexEntry index[] = {{.pc_end = 0x200, .fde_offset = 0x5100},
+                                          {.pc_end = 0x2200, .fde_offset = 0x5200}};
+  this->debug_frame_->SetFdeIndex(index, 2);
+  ASSERT_TRUE(this->debug_frame_->GetPcRanges(&ranges));
+  expected = {{0x100, 0x2200}};
+  ASSERT_EQ(expected, ranges);
+}
+
+TYPED_TEST_P(DwarfDebugFrameTest, GetFdes_index_threads) {
+  // Enough fdes to split the section into several chunks.
+  constexpr uint64_t kNumFdes = 3 * DwarfSectionImpl<TypeParam>::kMinIndexChunkSize / 0x20;
+  constexpr uint64_t kSize = 0x20 + kNumFdes * 0x20;
+  this->memory_.SetMemory(0x5000, std::vector<uint8_t>(kSize + 0x20, 0));
+  SetCie32(&this->memory_, 0x5000, 0x1c, std::vector<uint8_t>{1, '\0', 0, 0, 1});
+  // A cie after the end of the section, which a chunk cannot read.
+  SetCie32(&this->memory_, 0x5000 + kSize, 0x1c, std::vector<uint8_t>{1, '\0', 0, 0, 1});
+  for (uint64_t i = 0; i < kNumFdes; i++) {
+    uint64_t cie_offset = (i == kNumFdes / 2) ? kSize : 0;
+    SetFde32(&this->memory_, 0x5020 + i * 0x20, 0x1c, cie_offset, 0x100000 - i * 0x10, 0x10);
+  }
+
+  DwarfDebugFrame<TypeParam> serial(&this->memory_);
+  ASSERT_TRUE(serial.Init(0x5000, kSize, 0));
+  std::vector<const DwarfFde*> expected;
+  serial.GetFdes(&expected);
+  ASSERT_EQ(kNumFdes, expected.size());
+
+  DwarfSection::SetIndexThreads(4);
+  ASSERT_TRUE(this->debug_frame_->Init(0x5000, kSize, 0));
+  std::vector<const DwarfFde*> fdes;
+  this->debug_frame_->GetFdes(&fdes);
+  DwarfSection::SetIndexThreads(1);
+
+  ASSERT_EQ(expected.size(), fdes.size());
+  for (size_t i = 0; i < fdes.size(); i++) {
+    SCOPED_TRACE(i);
+    EXPECT_EQ(expected[i]->pc_start, fdes[i]->pc_start);
+    EXPECT_EQ(expected[i]->pc_end, fdes[i]->pc_end);
+    EXPECT_EQ(expected[i]->cie_offset, fdes[i]->cie_offset);
+  }
+
+  const DwarfFde* fde = this->debug_frame_->GetFdeFromPc(0x100000 - kNumFdes / 2 * 0x10);
+  ASSERT_TRUE(fde != nullptr);
+  EXPECT_EQ(0x5000 + kSize, fde->cie_offset);
+}
+
 REGISTER_TYPED_TEST_SUITE_P(
     DwarfDebugFrameTest, GetFdes32, GetFdes32_after_GetFdeFromPc, GetFdes32_not_in_section,
     GetFdes32_big_function_address, GetFdeFromPc32, GetFdeFromPc32_reverse,
@@ -918,7 +994,7 @@ REGISTER_TYPED_TEST_SUITE_P(
     GetCieFromOffset64_version5, GetCieFromOffset_version_invalid, GetCieFromOffset32_augment,
     GetCieFromOffset64_augment, GetFdeFromOffset32_augment, GetFdeFromOffset64_augment,
     GetFdeFromOffset32_lsda_address, GetFdeFromOffset64_lsda_address, GetFdeFromPc_interleaved,
-    GetFdeFromPc_overlap);
+    GetFdeFromPc_overlap, GetPcRanges, GetFdes_index_threads);
 
 typedef ::testing::Types<uint32_t, uint64_t> DwarfDebugFrameTestTypes;
 INSTANTIATE_TYPED_TEST_SUITE_P(Libunwindstack, DwarfDebugFrameTest, DwarfDebugFrameTestTypes);
@@ -313,6 +313,63 @@ TYPED_TEST_P(DwarfEhFrameWithHdrTest, GetFdes) {
   EXPECT_EQ(0x7900U, fdes[3]->pc_end);
 }
 
+TYPED_TEST_P(DwarfEhFrameWithHdrTest, GetPcRanges) {
+  this->memory_.SetMemory(
+      0x1000, std::vector<uint8_t>{1, DW_EH_PE_udata2, DW_EH_PE_udata4, DW_EH_PE_sdata4});
+  this->memory_.SetData16(0x1004, 0x500);
+  this->memory_.SetData32(0x1006, 3);
+
+  // Header information.
+  this->memory_.SetData32(0x100a, 0x4600);
+  this->memory_.SetData32(0x100e, 0x1500);
+  this->memory_.SetData32(0x1012, 0x4800);
+  this->memory_.SetData32(0x1016, 0x1400);
+  this->memory_.SetData32(0x101a, 0x6800);
+  this->memory_.SetData32(0x101e, 0x1600);
+
+  // CIE 32 information.
+  this->memory_.SetData32(0x1300, 0xfc);
+  this->memory_.SetData32(0x1304, 0);
+  this->memory_.SetMemory(0x1308, std::vector<uint8_t>{1, '\0', 0, 0, 0});
+
+  // FDE 32 information.
+  // pc 0x4800 - 0x4a00
+  this->memory_.SetData32(0x1400, 0xfc);
+  this->memory_.SetData32(0x1404, 0x104);
+  this->memory_.SetData32(0x1408, 0x33f8);
+  this->memory_.SetData32(0x140c, 0x200);
+
+  // pc 0x4600 - 0x4800
+  this->memory_.SetData32(0x1500, 0xfc);
+  this->memory_.SetData32(0x1504, 0x204);
+  this->memory_.SetData32(0x1508, 0x30f8);
+  this->memory_.SetData32(0x150c, 0x200);
+
+  // pc 0x6800 - 0x6a00
+  this->memory_.SetData32(0x1600, 0xfc);
+  this->memory_.SetData32(0x1604, 0x304);
+  this->memory_.SetData32(0x1608, 0x51f8);
+  this->memory_.SetData32(0x160c, 0x200);
+
+  ASSERT_TRUE(this->eh_frame_->EhFrameInit(0x1300, 0x400, 0));
+  ASSERT_TRUE(this->eh_frame_->Init(0x1000, 0x100, 0));
+
+  // The table only has fde starts, so the range goes from the first start
+  // to the end of the last fde.
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  ASSERT_TRUE(this->eh_frame_->GetPcRanges(&ranges));
+  std::vector<std::pair<uint64_t, uint64_t>> expected{{0x4600, 0x6a00}};
+  ASSERT_EQ(expected, ranges);
+  ASSERT_EQ(DWARF_ERROR_NONE, this->eh_frame_->LastErrorCode());
+
+  // If the last fde is zero length, the ranges are unknown.
+  this->memory_.SetData32(0x160c, 0);
+  TestDwarfEhFrameWithHdr<TypeParam> zero_length(&this->memory_);
+  ASSERT_TRUE(zero_length.EhFrameInit(0x1300, 0x400, 0));
+  ASSERT_TRUE(zero_length.Init(0x1000, 0x100, 0));
+  ASSERT_FALSE(zero_length.GetPcRanges(&ranges));
+}
+
 TYPED_TEST_P(DwarfEhFrameWithHdrTest, GetFdeInfoFromIndex_expect_cache_fail) {
   this->eh_frame_->TestSetTableEntrySize(0x10);
   this->eh_frame_->TestSetTableEncoding(DW_EH_PE_udata4);
@@ -549,7 +606,7 @@ REGISTER_TYPED_TEST_SUITE_P(DwarfEhFrameWithHdrTest, Init, Init_non_zero_load_bi
                             GetFdeInfoFromIndex_read_datarel, GetFdeInfoFromIndex_cached,
                             GetFdeOffsetFromPc_verify, GetFdeOffsetFromPc_index_fail,
                             GetFdeOffsetFromPc_fail_fde_count, GetFdeOffsetFromPc_search,
-                            GetCieFde32, GetCieFde64, GetFdeFromPc_fde_not_found);
+                            GetCieFde32, GetCieFde64, GetFdeFromPc_fde_not_found, GetPcRanges);
 
 typedef ::testing::Types<uint32_t, uint64_t> DwarfEhFrameWithHdrTestTypes;
 INSTANTIATE_TYPED_TEST_SUITE_P(Libunwindstack, DwarfEhFrameWithHdrTest, DwarfEhFrameWithHdrTestTypes);
@@ -21,6 +21,8 @@
 
 #include <unwindstack/DwarfSection.h>
 #include <unwindstack/Elf.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/RegsX86_64.h>
 
 #include "RegsFake.h"
 #include "utils/MemoryFake.h"
@@ -177,4 +179,65 @@ TEST_F(DwarfSectionTest, Step_cache_not_in_pc) {
   ASSERT_TRUE(section_->Step(0x700, &regs_, &process, &finished, &is_signal_frame));
 }
 
+TEST_F(DwarfSectionTest, Step_compact_table) {
+  DwarfCie cie{};
+  cie.return_address_register = X86_64_REG_RIP;
+  DwarfFde fde0{};
+  fde0.pc_start = 0x1000;
+  fde0.pc_end = 0x2000;
+  fde0.cie = &cie;
+  DwarfFde fde1{};
+  fde1.pc_start = 0x3000;
+  fde1.pc_end = 0x3100;
+  fde1.cie = &cie;
+  EXPECT_CALL(*section_, GetFdes(::testing::_))
+      .WillOnce(::testing::Invoke([&](std::vector<const DwarfFde*>* fdes) {
+        fdes->push_back(&fde0);
+        fdes->push_back(&fde1);
+      }));
+  EXPECT_CALL(*section_, GetCfaLocationInfo(::testing::_, ::testing::_, ::testing::_, ARCH_X86_64))
+      .WillRepeatedly(::testing::Invoke(
+          [](uint64_t, const DwarfFde* fde, DwarfLocations* loc_regs, ArchEnum) {
+            loc_regs->pc_start = fde->pc_start;
+            loc_regs->pc_end = fde->pc_end;
+            if (fde->pc_start == 0x1000) {
+              (*loc_regs)[CFA_REG] = {.type = DWARF_LOCATION_REGISTER,
+                                      .values = {X86_64_REG_RSP, 8}};
+              (*loc_regs)[X86_64_REG_RIP] = {.type = DWARF_LOCATION_OFFSET,
+                                             .values = {static_cast<uint64_t>(-8)}};
+            } else {
+              (*loc_regs)[CFA_REG] = {.type = DWARF_LOCATION_VAL_EXPRESSION, .values = {2, 0}};
+            }
+            return true;
+          }));
+
+  ASSERT_FALSE(section_->BuildCompactTable(ARCH_ARM));
+  ASSERT_TRUE(section_->compact_table() == nullptr);
+  ASSERT_TRUE(section_->BuildCompactTable(ARCH_X86_64));
+  ASSERT_TRUE(section_->compact_table() != nullptr);
+  EXPECT_EQ(2U, section_->compact_table()->stats().rows);
+  EXPECT_EQ(1U, section_->compact_table()->stats().compact_rows);
+
+  MemoryFake process;
+  process.SetData64(0x8000, 0x1500);
+  RegsX86_64 regs;
+  regs.set_pc(0x1800);
+  regs.set_sp(0x8000);
+
+  // Stepped from the compact table only.
+  bool finished;
+  bool is_signal_frame;
+  ASSERT_TRUE(section_->Step(0x1800, &regs, &process, &finished, &is_signal_frame));
+  EXPECT_FALSE(finished);
+  EXPECT_FALSE(is_signal_frame);
+  EXPECT_EQ(0x1500U, regs.pc());
+  EXPECT_EQ(0x8008U, regs.sp());
+
+  // Not in the table, uses the full evaluation.
+  EXPECT_CALL(*section_, GetFdeFromPc(0x3010)).WillOnce(::testing::Return(&fde1));
+  EXPECT_CALL(*section_, Eval(&cie, &process, ::testing::_, &regs, ::testing::_))
+      .WillOnce(::testing::Return(true));
+  ASSERT_TRUE(section_->Step(0x3010, &regs, &process, &finished, &is_signal_frame));
+}
+
 }  // namespace unwindstack
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/DwarfSection.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/ElfInterface.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/SharedString.h>
+
+#include "ElfCacheFile.h"
+
+namespace unwindstack {
+
+class ElfCacheFileTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = std::string(dir_.path) + "/test.unwind_cache";
+    for (uint32_t i = 0; i < 100; i++) {
+      table1_.push_back(i * 3);
+    }
+    table2_ = "Some table data of an odd length";
+  }
+
+  void TearDown() override { Elf::SetCacheDirectory(""); }
+
+  bool WriteFile() {
+    ElfCacheFileWriter writer;
+    writer.AddTable(ElfCacheFile::TABLE_SYMBOL_REMAP, 1, table1_.data(),
+                    table1_.size() * sizeof(uint32_t));
+    writer.AddTable(ElfCacheFile::TABLE_GNU_DEBUGDATA, 0, table2_.data(), table2_.size());
+    writer.AddTable(ElfCacheFile::TABLE_FDE_INDEX, 2, nullptr, 0);
+    return writer.Write(path_, kBuildId, kFingerprint);
+  }
+
+  static std::unique_ptr<Elf> CreateElf() {
+    std::string file = android::base::GetExecutableDirectory() + "/tests/files/boot_arm.oat";
+    std::unique_ptr<Elf> elf(new Elf(Memory::CreateFileMemory(file, 0).release()));
+    EXPECT_TRUE(elf->Init());
+    return elf;
+  }
+
+  static constexpr const char* kBuildId = "\x01\x02\x03\x04\x05\x06\x07\x08";
+  static constexpr uint64_t kFingerprint = 0x1234;
+
+  TemporaryDir dir_;
+  std::string path_;
+  std::vector<uint32_t> table1_;
+  std::string table2_;
+};
+
+TEST_F(ElfCacheFileTest, get_path) {
+  ASSERT_EQ("/cache/0102030405060708-0000000000001234.unwind_cache",
+            ElfCacheFile::GetPath("/cache", kBuildId, kFingerprint));
+  ASSERT_EQ("", ElfCacheFile::GetPath("", kBuildId, kFingerprint));
+  ASSERT_EQ("", ElfCacheFile::GetPath("/cache", "", kFingerprint));
+  ASSERT_EQ("", ElfCacheFile::GetPath("/cache", std::string(ElfCacheFile::kMaxBuildIdSize + 1, 'a'),
+                                      kFingerprint));
+}
+
+TEST_F(ElfCacheFileTest, write_and_load) {
+  ASSERT_TRUE(WriteFile());
+
+  std::shared_ptr<ElfCacheFile> file = ElfCacheFile::Load(path_, kBuildId, kFingerprint);
+  ASSERT_TRUE(file != nullptr);
+
+  size_t size;
+  const void* data = file->FindTable(ElfCacheFile::TABLE_SYMBOL_REMAP, 1, &size);
+  ASSERT_TRUE(data != nullptr);
+  ASSERT_EQ(table1_.size() * sizeof(uint32_t), size);
+  ASSERT_EQ(0, memcmp(table1_.data(), data, size));
+  ASSERT_EQ(0U, reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t));
+
+  data = file->FindTable(ElfCacheFile::TABLE_GNU_DEBUGDATA, 0, &size);
+  ASSERT_TRUE(data != nullptr);
+  ASSERT_EQ(table2_, std::string(reinterpret_cast<const char*>(data), size));
+
+  data = file->FindTable(ElfCacheFile::TABLE_FDE_INDEX, 2, &size);
+  ASSERT_TRUE(data != nullptr);
+  ASSERT_EQ(0U, size);
+
+  ASSERT_TRUE(file->FindTable(ElfCacheFile::TABLE_SYMBOL_REMAP, 2, &size) == nullptr);
+  ASSERT_TRUE(file->FindTable(ElfCacheFile::TABLE_FDE_INDEX, 1, &size) == nullptr);
+
+  // The memory uses the data in the file directly.
+  std::unique_ptr<Memory> memory = file->CreateTableMemory(ElfCacheFile::TABLE_GNU_DEBUGDATA, 0);
+  ASSERT_TRUE(memory != nullptr);
+  std::string read_data(table2_.size(), '\0');
+  ASSERT_TRUE(memory->ReadFully(0, read_data.data(), read_data.size()));
+  ASSERT_EQ(table2_, read_data);
+  ASSERT_FALSE(memory->ReadFully(1, read_data.data(), read_data.size()));
+  ASSERT_TRUE(file->CreateTableMemory(ElfCacheFile::TABLE_FDE_INDEX, 2) == nullptr);
+}
+
+TEST_F(ElfCacheFileTest, load_mismatch) {
+  ASSERT_TRUE(WriteFile());
+
+  ASSERT_TRUE(ElfCacheFile::Load(path_, "\x01\x02\x03\x04\x05\x06\x07\x09", kFingerprint) ==
+              nullptr);
+  ASSERT_TRUE(ElfCacheFile::Load(path_, "\x01\x02\x03\x04", kFingerprint) == nullptr);
+  ASSERT_TRUE(ElfCacheFile::Load(path_, kBuildId, kFingerprint + 1) == nullptr);
+  ASSERT_TRUE(ElfCacheFile::Load(path_ + ".missing", kBuildId, kFingerprint) == nullptr);
+}
+
+TEST_F(ElfCacheFileTest, load_corrupt) {
+  ASSERT_TRUE(WriteFile());
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path_, &contents));
+
+  // A change to any byte of the file is caught.
+  for (size_t offset : {size_t(20), sizeof(ElfCacheFile::Header) + 4, contents.size() - 1}) {
+    std::string corrupt(contents);
+    corrupt[offset] ^= 0x10;
+    ASSERT_TRUE(android::base::WriteStringToFile(corrupt, path_));
+    ASSERT_TRUE(ElfCacheFile::Load(path_, kBuildId, kFingerprint) == nullptr)
+        << "Failed at offset " << offset;
+  }
+
+  ASSERT_TRUE(android::base::WriteStringToFile(contents.substr(0, contents.size() - 1), path_));
+  ASSERT_TRUE(ElfCacheFile::Load(path_, kBuildId, kFingerprint) == nullptr);
+
+  ASSERT_TRUE(android::base::WriteStringToFile(contents.substr(0, 16), path_));
+  ASSERT_TRUE(ElfCacheFile::Load(path_, kBuildId, kFingerprint) == nullptr);
+
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, path_));
+  ASSERT_TRUE(ElfCacheFile::Load(path_, kBuildId, kFingerprint) != nullptr);
+}
+
+TEST_F(ElfCacheFileTest, checksum) {
+  std::vector<uint8_t> data(1000);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = i;
+  }
+  uint64_t checksum = ElfCacheFile::Checksum(data.data(), data.size());
+  ASSERT_EQ(checksum, ElfCacheFile::Checksum(data.data(), data.size()));
+  ASSERT_NE(checksum, ElfCacheFile::Checksum(data.data(), data.size() - 1));
+  ASSERT_NE(checksum, ElfCacheFile::Checksum(data.data(), data.size(), 1));
+  for (size_t i : {0, 31, 32, 999}) {
+    data[i] ^= 1;
+    ASSERT_NE(checksum, ElfCacheFile::Checksum(data.data(), data.size())) << "Failed at " << i;
+    data[i] ^= 1;
+  }
+}
+
+TEST_F(ElfCacheFileTest, elf_uses_cache_file) {
+  std::unique_ptr<Elf> uncached_elf = CreateElf();
+  ASSERT_FALSE(uncached_elf->loaded_from_cache_file());
+  ASSERT_TRUE(uncached_elf->gnu_debugdata_interface() != nullptr);
+
+  // The first elf writes the file and then switches to it, the second one
+  // only reads it.
+  Elf::SetCacheDirectory(dir_.path);
+  std::unique_ptr<Elf> first_elf = CreateElf();
+  ASSERT_TRUE(first_elf->loaded_from_cache_file());
+  std::unique_ptr<Elf> elf = CreateElf();
+  ASSERT_TRUE(elf->loaded_from_cache_file());
+  ASSERT_TRUE(elf->gnu_debugdata_interface() != nullptr);
+
+  // The results must not depend on the cache.
+  DwarfSection* uncached_debug_frame = uncached_elf->gnu_debugdata_interface()->debug_frame();
+  DwarfSection* debug_frame = elf->gnu_debugdata_interface()->debug_frame();
+  ASSERT_TRUE(uncached_debug_frame != nullptr);
+  ASSERT_TRUE(debug_frame != nullptr);
+  size_t names_found = 0;
+  for (const auto& entry : elf->interface()->pt_loads()) {
+    uint64_t start = entry.table_offset;
+    uint64_t end = start + entry.table_size;
+    for (uint64_t addr = start; addr < end; addr += 0x40) {
+      SharedString uncached_name;
+      uint64_t uncached_offset = 0;
+      bool found = uncached_elf->GetFunctionName(addr, &uncached_name, &uncached_offset);
+      SharedString name;
+      uint64_t offset = 0;
+      ASSERT_EQ(found, elf->GetFunctionName(addr, &name, &offset)) << "Failed at " << addr;
+      if (found) {
+        ASSERT_EQ(std::string(uncached_name), std::string(name)) << "Failed at " << addr;
+        ASSERT_EQ(uncached_offset, offset) << "Failed at " << addr;
+        names_found++;
+      }
+
+      const DwarfFde* uncached_fde = uncached_debug_frame->GetFdeFromPc(addr);
+      const DwarfFde* fde = debug_frame->GetFdeFromPc(addr);
+      ASSERT_EQ(uncached_fde == nullptr, fde == nullptr) << "Failed at " << addr;
+      if (fde != nullptr) {
+        ASSERT_EQ(uncached_fde->pc_start, fde->pc_start) << "Failed at " << addr;
+        ASSERT_EQ(uncached_fde->pc_end, fde->pc_end) << "Failed at " << addr;
+      }
+    }
+  }
+  ASSERT_NE(0U, names_found);
+}
+
+TEST_F(ElfCacheFileTest, elf_rewrites_bad_cache_file) {
+  Elf::SetCacheDirectory(dir_.path);
+  std::unique_ptr<Elf> elf = CreateElf();
+  ASSERT_TRUE(elf->loaded_from_cache_file());
+
+  std::string build_id = elf->GetBuildID();
+  std::string path = ElfCacheFile::GetPath(dir_.path, build_id,
+                                           elf->interface()->GetCacheFingerprint());
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &contents));
+  ASSERT_TRUE(android::base::WriteStringToFile(contents.substr(0, contents.size() / 2), path));
+
+  elf = CreateElf();
+  ASSERT_TRUE(elf->loaded_from_cache_file());
+  std::string new_contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &new_contents));
+  ASSERT_EQ(contents, new_contents);
+}
+
+}  // namespace unwindstack
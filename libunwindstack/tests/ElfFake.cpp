@@ -68,6 +68,9 @@ bool ElfInterfaceFake::Step(uint64_t, Regs* regs, Memory*, bool* finished, bool*
   RegsFake* fake_regs = reinterpret_cast<RegsFake*>(regs);
   fake_regs->set_pc(entry.pc);
   fake_regs->set_sp(entry.sp);
+  if (entry.fp != 0) {
+    regs->SetFramePointer(entry.fp);
+  }
   *finished = entry.finished;
   *is_signal_frame = false;
   return true;
@@ -33,10 +33,13 @@
 namespace unwindstack {
 
 struct StepData {
-  StepData(uint64_t pc, uint64_t sp, bool finished) : pc(pc), sp(sp), finished(finished) {}
+  StepData(uint64_t pc, uint64_t sp, bool finished, uint64_t fp = 0)
+      : pc(pc), sp(sp), finished(finished), fp(fp) {}
   uint64_t pc;
   uint64_t sp;
   bool finished;
+  // If non-zero, the frame pointer restored by the step.
+  uint64_t fp;
 };
 
 struct FunctionData {
@@ -128,6 +131,9 @@ class ElfInterface32Fake : public ElfInterface32 {
   void FakeSetEhFrameSize(uint64_t size) { eh_frame_size_ = size; }
   void FakeSetDebugFrameOffset(uint64_t offset) { debug_frame_offset_ = offset; }
   void FakeSetDebugFrameSize(uint64_t size) { debug_frame_size_ = size; }
+  void FakeSetEhFrameHdrOffset(uint64_t offset) { eh_frame_hdr_offset_ = offset; }
+  void FakeSetEhFrameHdrSize(uint64_t size) { eh_frame_hdr_size_ = size; }
+  void FakeAddSymbols(Symbols* symbols) { symbols_.push_back(symbols); }
 };
 
 class ElfInterface64Fake : public ElfInterface64 {
@@ -139,6 +145,9 @@ class ElfInterface64Fake : public ElfInterface64 {
   void FakeSetEhFrameSize(uint64_t size) { eh_frame_size_ = size; }
   void FakeSetDebugFrameOffset(uint64_t offset) { debug_frame_offset_ = offset; }
   void FakeSetDebugFrameSize(uint64_t size) { debug_frame_size_ = size; }
+  void FakeSetEhFrameHdrOffset(uint64_t offset) { eh_frame_hdr_offset_ = offset; }
+  void FakeSetEhFrameHdrSize(uint64_t size) { eh_frame_hdr_size_ = size; }
+  void FakeAddSymbols(Symbols* symbols) { symbols_.push_back(symbols); }
 };
 
 class ElfInterfaceArmFake : public ElfInterfaceArm {
@@ -146,8 +155,14 @@ class ElfInterfaceArmFake : public ElfInterfaceArm {
   ElfInterfaceArmFake(Memory* memory) : ElfInterfaceArm(memory) {}
   virtual ~ElfInterfaceArmFake() = default;
 
-  void FakeSetStartOffset(uint64_t offset) { start_offset_ = offset; }
-  void FakeSetTotalEntries(size_t entries) { total_entries_ = entries; }
+  void FakeSetStartOffset(uint64_t offset) {
+    start_offset_ = offset;
+    table_state_ = TABLE_UNREAD;
+  }
+  void FakeSetTotalEntries(size_t entries) {
+    total_entries_ = entries;
+    table_state_ = TABLE_UNREAD;
+  }
 };
 
 }  // namespace unwindstack
@@ -202,6 +202,85 @@ TEST_F(ElfInterfaceArmTest, FindEntry_multiple_entries_odd) {
   ASSERT_EQ(0x1010U, entry_offset);
 }
 
+TEST_F(ElfInterfaceArmTest, FindEntry_from_table) {
+  ElfInterfaceArmFake interface(&memory_);
+  interface.FakeSetStartOffset(0x1000);
+  interface.FakeSetTotalEntries(5);
+  for (size_t i = 0; i < 5; i++) {
+    memory_.SetData32(0x1000 + i * 8, 0x5000 + i * 0xff8);
+    memory_.SetData32(0x1004 + i * 8, 0x80b0b0b0);
+  }
+  // The first entry has a negative offset.
+  memory_.SetData32(0x1000, 0x7fffff00);
+
+  uint64_t entry_offset;
+  ASSERT_TRUE(interface.FindEntry(0x8100, &entry_offset));
+  ASSERT_EQ(0x1010U, entry_offset);
+
+  // The whole table was read, so changes to the memory are not seen.
+  for (size_t i = 0; i < 5; i++) {
+    memory_.SetData32(0x1000 + i * 8, 0x15000);
+  }
+  ASSERT_TRUE(interface.FindEntry(0x6000, &entry_offset));
+  ASSERT_EQ(0x1000U, entry_offset);
+  ASSERT_TRUE(interface.FindEntry(0x8fff, &entry_offset));
+  ASSERT_EQ(0x1010U, entry_offset);
+  ASSERT_TRUE(interface.FindEntry(0x9000, &entry_offset));
+  ASSERT_EQ(0x1018U, entry_offset);
+  ASSERT_TRUE(interface.FindEntry(0x20000, &entry_offset));
+  ASSERT_EQ(0x1020U, entry_offset);
+  ASSERT_TRUE(interface.FindEntry(0xf00, &entry_offset));
+  ASSERT_EQ(0x1000U, entry_offset);
+  ASSERT_FALSE(interface.FindEntry(0xeff, &entry_offset));
+  ASSERT_EQ(ERROR_UNWIND_INFO, interface.LastErrorCode());
+
+  std::vector<uint32_t> entries;
+  for (auto addr : interface) {
+    entries.push_back(addr);
+  }
+  ASSERT_EQ(5U, entries.size());
+  ASSERT_EQ(0xf00U, entries[0]);
+  ASSERT_EQ(0xa000U, entries[4]);
+}
+
+TEST_F(ElfInterfaceArmTest, StepExidx_from_table) {
+  ElfInterfaceArmFake interface(&memory_);
+
+  interface.FakeSetStartOffset(0x1000);
+  interface.FakeSetTotalEntries(2);
+  memory_.SetData32(0x1000, 0x6000);
+  memory_.SetData32(0x1004, 0x808800b0);
+  memory_.SetData32(0x1008, 0x8000);
+  // The extab data of the second entry.
+  memory_.SetData32(0x100c, 0x1000);
+  memory_.SetData32(0x200c, 0x8100a8b0);
+  process_memory_.SetData32(0x10000, 0x10);
+  process_memory_.SetData32(0x10004, 0x20);
+
+  RegsArm regs;
+  regs[ARM_REG_SP] = 0x10000;
+  regs[ARM_REG_LR] = 0x30000;
+  regs.set_sp(regs[ARM_REG_SP]);
+  regs.set_pc(0x1234);
+
+  bool finished;
+  ASSERT_TRUE(interface.StepExidx(0x7000, &regs, &process_memory_, &finished));
+  EXPECT_EQ(ERROR_NONE, interface.LastErrorCode());
+  ASSERT_FALSE(finished);
+  ASSERT_EQ(0x10004U, regs.sp());
+  ASSERT_EQ(0x10U, regs.pc());
+
+  // pop {r4, r14}
+  regs[ARM_REG_SP] = 0x10000;
+  regs.set_sp(regs[ARM_REG_SP]);
+  ASSERT_TRUE(interface.StepExidx(0x9100, &regs, &process_memory_, &finished));
+  EXPECT_EQ(ERROR_NONE, interface.LastErrorCode());
+  ASSERT_FALSE(finished);
+  ASSERT_EQ(0x10008U, regs.sp());
+  ASSERT_EQ(0x10U, regs[ARM_REG_R4]);
+  ASSERT_EQ(0x20U, regs.pc());
+}
+
 TEST_F(ElfInterfaceArmTest, iterate) {
   ElfInterfaceArmFake interface(&memory_);
   interface.FakeSetStartOffset(0x1000);
@@ -405,8 +484,10 @@ TEST_F(ElfInterfaceArmTest, StepExidx_pc_zero) {
   ASSERT_TRUE(finished);
   ASSERT_EQ(0U, regs.pc());
 
-  // Now set the pc from the lr register (pop r14).
+  // Now set the pc from the lr register (pop r14). The table holds the
+  // old entry data, force it to be read again.
   memory_.SetData32(0x1004, 0x808400b0);
+  interface.FakeSetTotalEntries(1);
 
   regs[ARM_REG_SP] = 0x10000;
   regs[ARM_REG_LR] = 0x20000;
@@ -16,7 +16,11 @@
 
 #include <elf.h>
 
+#include <atomic>
 #include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -24,9 +28,11 @@
 
 #include "DwarfEncoding.h"
 #include "ElfInterfaceArm.h"
+#include "Symbols.h"
 
 #include "ElfFake.h"
 #include "utils/MemoryFake.h"
+#include "utils/RegsFake.h"
 
 #if !defined(PT_ARM_EXIDX)
 #define PT_ARM_EXIDX 0x70000001
@@ -96,6 +102,9 @@ class ElfInterfaceTest : public ::testing::Test {
   template <typename ElfType>
   void InitHeadersEhFrameTest();
 
+  template <typename ElfType>
+  void PrefetchSections();
+
   template <typename ElfType>
   void InitHeadersDebugFrame();
 
@@ -145,6 +154,9 @@ class ElfInterfaceTest : public ::testing::Test {
   template <typename Ehdr, typename Shdr, typename Nhdr, typename ElfInterfaceType>
   void BuildIDTwoNotes();
 
+  template <typename Ehdr, typename Phdr, typename Nhdr, typename ElfInterfaceType>
+  void BuildIDFromProgramHeader();
+
   template <typename Ehdr, typename Shdr, typename Nhdr, typename ElfInterfaceType>
   void BuildIDSectionTooSmallForName();
 
@@ -199,9 +211,9 @@ void ElfInterfaceTest::SinglePtLoad() {
   ASSERT_TRUE(elf->Init(&load_bias));
   EXPECT_EQ(0x2000, load_bias);
 
-  const std::unordered_map<uint64_t, LoadInfo>& pt_loads = elf->pt_loads();
+  const std::vector<LoadInfo>& pt_loads = elf->pt_loads();
   ASSERT_EQ(1U, pt_loads.size());
-  LoadInfo load_data = pt_loads.at(0);
+  LoadInfo load_data = pt_loads[0];
   ASSERT_EQ(0U, load_data.offset);
   ASSERT_EQ(0x2000U, load_data.table_offset);
   ASSERT_EQ(0x10000U, load_data.table_size);
@@ -255,20 +267,20 @@ void ElfInterfaceTest::MultipleExecutablePtLoads() {
   ASSERT_TRUE(elf->Init(&load_bias));
   EXPECT_EQ(0x2000, load_bias);
 
-  const std::unordered_map<uint64_t, LoadInfo>& pt_loads = elf->pt_loads();
+  const std::vector<LoadInfo>& pt_loads = elf->pt_loads();
   ASSERT_EQ(3U, pt_loads.size());
 
-  LoadInfo load_data = pt_loads.at(0);
+  LoadInfo load_data = pt_loads[0];
   ASSERT_EQ(0U, load_data.offset);
   ASSERT_EQ(0x2000U, load_data.table_offset);
   ASSERT_EQ(0x10000U, load_data.table_size);
 
-  load_data = pt_loads.at(0x1000);
+  load_data = pt_loads[1];
   ASSERT_EQ(0x1000U, load_data.offset);
   ASSERT_EQ(0x2001U, load_data.table_offset);
   ASSERT_EQ(0x10001U, load_data.table_size);
 
-  load_data = pt_loads.at(0x2000);
+  load_data = pt_loads[2];
   ASSERT_EQ(0x2000U, load_data.offset);
   ASSERT_EQ(0x2002U, load_data.table_offset);
   ASSERT_EQ(0x10002U, load_data.table_size);
@@ -322,20 +334,20 @@ void ElfInterfaceTest::MultipleExecutablePtLoadsIncrementsNotSizeOfPhdr() {
   ASSERT_TRUE(elf->Init(&load_bias));
   EXPECT_EQ(0x2000, load_bias);
 
-  const std::unordered_map<uint64_t, LoadInfo>& pt_loads = elf->pt_loads();
+  const std::vector<LoadInfo>& pt_loads = elf->pt_loads();
   ASSERT_EQ(3U, pt_loads.size());
 
-  LoadInfo load_data = pt_loads.at(0);
+  LoadInfo load_data = pt_loads[0];
   ASSERT_EQ(0U, load_data.offset);
   ASSERT_EQ(0x2000U, load_data.table_offset);
   ASSERT_EQ(0x10000U, load_data.table_size);
 
-  load_data = pt_loads.at(0x1000);
+  load_data = pt_loads[1];
   ASSERT_EQ(0x1000U, load_data.offset);
   ASSERT_EQ(0x2001U, load_data.table_offset);
   ASSERT_EQ(0x10001U, load_data.table_size);
 
-  load_data = pt_loads.at(0x2000);
+  load_data = pt_loads[2];
   ASSERT_EQ(0x2000U, load_data.offset);
   ASSERT_EQ(0x2002U, load_data.table_offset);
   ASSERT_EQ(0x10002U, load_data.table_size);
@@ -391,10 +403,10 @@ void ElfInterfaceTest::NonExecutablePtLoads() {
   ASSERT_TRUE(elf->Init(&load_bias));
   EXPECT_EQ(0x1001, load_bias);
 
-  const std::unordered_map<uint64_t, LoadInfo>& pt_loads = elf->pt_loads();
+  const std::vector<LoadInfo>& pt_loads = elf->pt_loads();
   ASSERT_EQ(1U, pt_loads.size());
 
-  LoadInfo load_data = pt_loads.at(0x1000);
+  LoadInfo load_data = pt_loads[0];
   ASSERT_EQ(0x1000U, load_data.offset);
   ASSERT_EQ(0x2001U, load_data.table_offset);
   ASSERT_EQ(0x10001U, load_data.table_size);
@@ -462,10 +474,10 @@ void ElfInterfaceTest::ManyPhdrs() {
   ASSERT_TRUE(elf->Init(&load_bias));
   EXPECT_EQ(0x2000, load_bias);
 
-  const std::unordered_map<uint64_t, LoadInfo>& pt_loads = elf->pt_loads();
+  const std::vector<LoadInfo>& pt_loads = elf->pt_loads();
   ASSERT_EQ(1U, pt_loads.size());
 
-  LoadInfo load_data = pt_loads.at(0);
+  LoadInfo load_data = pt_loads[0];
   ASSERT_EQ(0U, load_data.offset);
   ASSERT_EQ(0x2000U, load_data.table_offset);
   ASSERT_EQ(0x10000U, load_data.table_size);
@@ -689,6 +701,58 @@ TEST_F(ElfInterfaceTest, init_headers_eh_frame_64) {
   InitHeadersEhFrameTest<ElfInterface64Fake>();
 }
 
+class MemoryFakePrefetch : public MemoryFake {
+ public:
+  bool Prefetch(uint64_t addr, uint64_t size, PrefetchMode mode) override {
+    prefetches_.emplace_back(addr, size);
+    last_mode_ = mode;
+    return true;
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> prefetches_;
+  PrefetchMode last_mode_ = PREFETCH_NONE;
+};
+
+template <typename ElfType>
+void ElfInterfaceTest::PrefetchSections() {
+  MemoryFakePrefetch memory;
+  ElfType elf(&memory);
+
+  elf.FakeSetEhFrameHdrOffset(0x1000);
+  elf.FakeSetEhFrameHdrSize(0x100);
+  elf.FakeSetEhFrameOffset(0x2000);
+  elf.FakeSetEhFrameSize(0x800);
+  elf.FakeSetDebugFrameOffset(0x3000);
+  elf.FakeSetDebugFrameSize(0x200);
+  elf.FakeAddSymbols(new Symbols(0x4000, 0x300, 0x10, 0x5000, 0x80));
+
+  elf.Prefetch(Memory::PREFETCH_NONE);
+  ASSERT_TRUE(memory.prefetches_.empty());
+
+  // Only the search table of the eh_frame is needed when there is one.
+  elf.Prefetch(Memory::PREFETCH_POPULATE);
+  ASSERT_EQ(Memory::PREFETCH_POPULATE, memory.last_mode_);
+  std::vector<std::pair<uint64_t, uint64_t>> expected{
+      {0x1000, 0x100}, {0x3000, 0x200}, {0x4000, 0x300}, {0x5000, 0x80}};
+  ASSERT_EQ(expected, memory.prefetches_);
+
+  memory.prefetches_.clear();
+  elf.FakeSetEhFrameHdrOffset(0);
+  elf.FakeSetDebugFrameOffset(0);
+  elf.Prefetch(Memory::PREFETCH_ASYNC);
+  ASSERT_EQ(Memory::PREFETCH_ASYNC, memory.last_mode_);
+  expected = {{0x2000, 0x800}, {0x4000, 0x300}, {0x5000, 0x80}};
+  ASSERT_EQ(expected, memory.prefetches_);
+}
+
+TEST_F(ElfInterfaceTest, prefetch_sections_32) {
+  PrefetchSections<ElfInterface32Fake>();
+}
+
+TEST_F(ElfInterfaceTest, prefetch_sections_64) {
+  PrefetchSections<ElfInterface64Fake>();
+}
+
 template <typename ElfType>
 void ElfInterfaceTest::InitHeadersDebugFrame() {
   ElfType elf(&memory_);
@@ -1409,6 +1473,67 @@ TEST_F(ElfInterfaceTest, is_valid_pc_from_pt_load_non_zero_load_bias) {
   EXPECT_FALSE(elf->IsValidPc(0x12000));
 }
 
+TEST_F(ElfInterfaceTest, is_valid_pc_from_multiple_pt_loads) {
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+
+  // Enough headers that they do not all fit in a single read.
+  constexpr size_t kNumPhdrs = 200;
+  Elf32_Ehdr ehdr = {};
+  ehdr.e_phoff = 0x100;
+  ehdr.e_phnum = kNumPhdrs;
+  ehdr.e_phentsize = sizeof(Elf32_Phdr);
+  memory_.SetMemory(0, &ehdr, sizeof(ehdr));
+
+  for (size_t i = 0; i < kNumPhdrs; i++) {
+    Elf32_Phdr phdr = {};
+    phdr.p_type = PT_NULL;
+    memory_.SetMemory(0x100 + i * sizeof(phdr), &phdr, sizeof(phdr));
+  }
+
+  // The segments are added out of order, the last two overlap and the
+  // last one is past the first read.
+  auto add_load = [this](size_t index, uint32_t offset, uint32_t vaddr, uint32_t memsz) {
+    Elf32_Phdr phdr = {};
+    phdr.p_type = PT_LOAD;
+    phdr.p_offset = offset;
+    phdr.p_vaddr = vaddr;
+    phdr.p_memsz = memsz;
+    phdr.p_flags = PF_R | PF_X;
+    phdr.p_align = 0x1000;
+    memory_.SetMemory(0x100 + index * sizeof(phdr), &phdr, sizeof(phdr));
+  };
+  add_load(0, 0x1000, 0x11000, 0x1000);
+  add_load(1, 0, 0x10000, 0x800);
+  add_load(2, 0x3000, 0x20000, 0x2000);
+  add_load(kNumPhdrs - 1, 0x4000, 0x21000, 0x3000);
+
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+  EXPECT_EQ(0x10000, load_bias);
+
+  const std::vector<LoadInfo>& pt_loads = elf->pt_loads();
+  ASSERT_EQ(4U, pt_loads.size());
+  EXPECT_EQ(0x10000U, pt_loads[0].table_offset);
+  EXPECT_EQ(0x11000U, pt_loads[1].table_offset);
+  EXPECT_EQ(0x20000U, pt_loads[2].table_offset);
+  EXPECT_EQ(0x21000U, pt_loads[3].table_offset);
+
+  EXPECT_FALSE(elf->IsValidPc(0));
+  EXPECT_FALSE(elf->IsValidPc(0xffff));
+  EXPECT_TRUE(elf->IsValidPc(0x10000));
+  EXPECT_TRUE(elf->IsValidPc(0x107ff));
+  EXPECT_FALSE(elf->IsValidPc(0x10800));
+  EXPECT_FALSE(elf->IsValidPc(0x10fff));
+  EXPECT_TRUE(elf->IsValidPc(0x11000));
+  EXPECT_TRUE(elf->IsValidPc(0x11fff));
+  EXPECT_FALSE(elf->IsValidPc(0x12000));
+  EXPECT_TRUE(elf->IsValidPc(0x20000));
+  EXPECT_TRUE(elf->IsValidPc(0x21800));
+  EXPECT_TRUE(elf->IsValidPc(0x23fff));
+  EXPECT_FALSE(elf->IsValidPc(0x24000));
+  EXPECT_FALSE(elf->IsValidPc(UINT64_MAX));
+}
+
 TEST_F(ElfInterfaceTest, is_valid_pc_from_debug_frame) {
   std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
 
@@ -1523,6 +1648,248 @@ TEST_F(ElfInterfaceTest, is_valid_pc_from_eh_frame) {
   EXPECT_FALSE(elf->IsValidPc(0x2a00));
 }
 
+// Creates an elf with a .debug_frame and an .eh_frame section, each with
+// one fde. A size of zero leaves the section out.
+static void SetCoverageElf(MemoryFake* memory, uint32_t debug_frame_pc, uint32_t debug_frame_size,
+                           uint32_t eh_frame_pc, uint32_t eh_frame_size) {
+  uint64_t sh_offset = 0x100;
+
+  Elf32_Ehdr ehdr = {};
+  ehdr.e_shstrndx = 1;
+  ehdr.e_shoff = sh_offset;
+  ehdr.e_shentsize = sizeof(Elf32_Shdr);
+  ehdr.e_shnum = 2 + (debug_frame_size != 0) + (eh_frame_size != 0);
+  memory->SetMemory(0, &ehdr, sizeof(ehdr));
+
+  Elf32_Shdr shdr = {};
+  shdr.sh_type = SHT_NULL;
+  memory->SetMemory(sh_offset, &shdr, sizeof(shdr));
+
+  sh_offset += sizeof(shdr);
+  memset(&shdr, 0, sizeof(shdr));
+  shdr.sh_type = SHT_STRTAB;
+  shdr.sh_name = 1;
+  shdr.sh_offset = 0x500;
+  shdr.sh_size = 0x100;
+  memory->SetMemory(sh_offset, &shdr, sizeof(shdr));
+  memory->SetMemory(0x500, std::vector<uint8_t>{'.', 'd', 'e', 'b', 'u', 'g', '_', 'f', 'r', 'a',
+                                                'm', 'e', '\0', '.', 'e', 'h', '_', 'f', 'r',
+                                                'a', 'm', 'e', '\0'});
+
+  if (debug_frame_size != 0) {
+    sh_offset += sizeof(shdr);
+    memset(&shdr, 0, sizeof(shdr));
+    shdr.sh_type = SHT_PROGBITS;
+    shdr.sh_name = 0;
+    shdr.sh_addr = 0x600;
+    shdr.sh_offset = 0x600;
+    shdr.sh_size = 0x200;
+    memory->SetMemory(sh_offset, &shdr, sizeof(shdr));
+
+    // CIE 32.
+    memory->SetData32(0x600, 0xfc);
+    memory->SetData32(0x604, 0xffffffff);
+    memory->SetMemory(0x608, std::vector<uint8_t>{1, '\0', 4, 4, 1});
+
+    // FDE 32.
+    memory->SetData32(0x700, 0xfc);
+    memory->SetData32(0x704, 0);
+    memory->SetData32(0x708, debug_frame_pc);
+    memory->SetData32(0x70c, debug_frame_size);
+  }
+
+  if (eh_frame_size != 0) {
+    sh_offset += sizeof(shdr);
+    memset(&shdr, 0, sizeof(shdr));
+    shdr.sh_type = SHT_PROGBITS;
+    shdr.sh_name = 13;
+    shdr.sh_addr = 0x800;
+    shdr.sh_offset = 0x800;
+    shdr.sh_size = 0x200;
+    memory->SetMemory(sh_offset, &shdr, sizeof(shdr));
+
+    // CIE 32.
+    memory->SetData32(0x800, 0xfc);
+    memory->SetData32(0x804, 0);
+    memory->SetMemory(0x808, std::vector<uint8_t>{1, '\0', 4, 4, 1});
+
+    // FDE 32.
+    memory->SetData32(0x900, 0xfc);
+    memory->SetData32(0x904, 0x104);
+    memory->SetData32(0x908, eh_frame_pc - 0x908);
+    memory->SetData32(0x90c, eh_frame_size);
+  }
+}
+
+TEST_F(ElfInterfaceTest, coverage) {
+  SetCoverageElf(&memory_, 0x2100, 0x200, 0x2200, 0x200);
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+  elf->InitHeaders();
+  ASSERT_TRUE(elf->debug_frame() != nullptr);
+  ASSERT_TRUE(elf->eh_frame() != nullptr);
+
+  EXPECT_EQ(0, elf->GetCoverage(0));
+  EXPECT_EQ(0, elf->GetCoverage(0x20ff));
+  EXPECT_EQ(ElfInterface::COVERAGE_DEBUG_FRAME, elf->GetCoverage(0x2100));
+  EXPECT_EQ(ElfInterface::COVERAGE_DEBUG_FRAME, elf->GetCoverage(0x21ff));
+  EXPECT_EQ(ElfInterface::COVERAGE_DEBUG_FRAME | ElfInterface::COVERAGE_EH_FRAME,
+            elf->GetCoverage(0x2200));
+  EXPECT_EQ(ElfInterface::COVERAGE_DEBUG_FRAME | ElfInterface::COVERAGE_EH_FRAME,
+            elf->GetCoverage(0x22ff));
+  EXPECT_EQ(ElfInterface::COVERAGE_EH_FRAME, elf->GetCoverage(0x2300));
+  EXPECT_EQ(ElfInterface::COVERAGE_EH_FRAME, elf->GetCoverage(0x23ff));
+  EXPECT_EQ(0, elf->GetCoverage(0x2400));
+  EXPECT_EQ(0, elf->GetCoverage(UINT64_MAX));
+
+  // A pc that no section covers fails without trying any of them, and
+  // reports the same error as a section that has no fde for it.
+  RegsFake regs(10);
+  bool finished;
+  bool is_signal_frame;
+  ASSERT_FALSE(elf->Step(0x2400, &regs, &memory_, &finished, &is_signal_frame));
+  EXPECT_EQ(ERROR_UNWIND_INFO, elf->LastErrorCode());
+
+  // The gnu_debugdata sections are added to the map.
+  MemoryFake gnu_memory;
+  SetCoverageElf(&gnu_memory, 0x3000, 0x100, 0, 0);
+  std::unique_ptr<ElfInterface> gnu(new ElfInterface32(&gnu_memory));
+  ASSERT_TRUE(gnu->Init(&load_bias));
+  gnu->InitHeaders();
+  elf->SetGnuDebugdataInterface(gnu.get());
+
+  EXPECT_EQ(0, elf->GetCoverage(0x20ff));
+  EXPECT_EQ(ElfInterface::COVERAGE_DEBUG_FRAME, elf->GetCoverage(0x2100));
+  EXPECT_EQ(ElfInterface::COVERAGE_EH_FRAME, elf->GetCoverage(0x2300));
+  EXPECT_EQ(0, elf->GetCoverage(0x2400));
+  EXPECT_EQ(ElfInterface::COVERAGE_GNU_DEBUGDATA, elf->GetCoverage(0x3000));
+  EXPECT_EQ(ElfInterface::COVERAGE_GNU_DEBUGDATA, elf->GetCoverage(0x30ff));
+  EXPECT_EQ(0, elf->GetCoverage(0x3100));
+  elf->SetGnuDebugdataInterface(nullptr);
+}
+
+TEST_F(ElfInterfaceTest, init_stages) {
+  SetCoverageElf(&memory_, 0x2100, 0x200, 0x2200, 0x200);
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+  EXPECT_FALSE(elf->sections_read());
+  EXPECT_FALSE(elf->headers_initialized());
+
+  // Anything that comes from the section headers reads them.
+  EXPECT_EQ(0x600U, elf->debug_frame_offset());
+  EXPECT_TRUE(elf->sections_read());
+  EXPECT_FALSE(elf->headers_initialized());
+
+  // The unwind sections are set up by the first step.
+  RegsFake regs(10);
+  bool finished;
+  bool is_signal_frame;
+  ASSERT_FALSE(elf->Step(0x2400, &regs, &memory_, &finished, &is_signal_frame));
+  EXPECT_TRUE(elf->headers_initialized());
+  EXPECT_TRUE(elf->debug_frame() != nullptr);
+  EXPECT_TRUE(elf->eh_frame() != nullptr);
+}
+
+TEST_F(ElfInterfaceTest, init_stages_unwind_sections_first) {
+  SetCoverageElf(&memory_, 0x2100, 0x200, 0x2200, 0x200);
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+
+  // The unwind sections need the section headers.
+  ASSERT_TRUE(elf->eh_frame() != nullptr);
+  EXPECT_TRUE(elf->sections_read());
+  EXPECT_TRUE(elf->headers_initialized());
+  EXPECT_EQ(0x800U, elf->eh_frame_offset());
+}
+
+TEST_F(ElfInterfaceTest, init_stages_multiple_threads) {
+  SetCoverageElf(&memory_, 0x2100, 0x200, 0x2200, 0x200);
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+
+  // Every thread sees the stages fully done, whichever thread runs them.
+  constexpr size_t kNumThreads = 8;
+  std::atomic_bool wait = true;
+  std::vector<DwarfSection*> eh_frames(kNumThreads);
+  std::vector<uint64_t> debug_frame_offsets(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([&, i]() {
+      while (wait) {
+      }
+      if (i % 2 == 0) {
+        debug_frame_offsets[i] = elf->debug_frame_offset();
+        eh_frames[i] = elf->eh_frame();
+      } else {
+        eh_frames[i] = elf->eh_frame();
+        debug_frame_offsets[i] = elf->debug_frame_offset();
+      }
+    });
+  }
+  wait = false;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_TRUE(elf->eh_frame() != nullptr);
+  for (size_t i = 0; i < kNumThreads; i++) {
+    EXPECT_EQ(elf->eh_frame(), eh_frames[i]) << "Thread " << i;
+    EXPECT_EQ(0x600U, debug_frame_offsets[i]) << "Thread " << i;
+  }
+}
+
+TEST_F(ElfInterfaceTest, coverage_single_section) {
+  SetCoverageElf(&memory_, 0x2100, 0x200, 0, 0);
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+  elf->InitHeaders();
+  ASSERT_TRUE(elf->debug_frame() != nullptr);
+  ASSERT_TRUE(elf->eh_frame() == nullptr);
+
+  // With one section there is nothing to skip, so the section is always
+  // tried.
+  EXPECT_EQ(ElfInterface::COVERAGE_ALL, elf->GetCoverage(0));
+  EXPECT_EQ(ElfInterface::COVERAGE_ALL, elf->GetCoverage(0x2100));
+  EXPECT_EQ(ElfInterface::COVERAGE_ALL, elf->GetCoverage(0x2400));
+}
+
+TEST_F(ElfInterfaceTest, step_error_after_gnu_debugdata_loader) {
+  SetCoverageElf(&memory_, 0x2100, 0x200, 0, 0);
+  int64_t load_bias = 0;
+  RegsFake regs(10);
+  regs.set_pc(0x2400);
+  regs.set_sp(0x1000);
+  bool finished;
+  bool is_signal_frame;
+
+  std::unique_ptr<ElfInterface> expected(new ElfInterface32(&memory_));
+  ASSERT_TRUE(expected->Init(&load_bias));
+  ASSERT_FALSE(expected->Step(0x2400, &regs, &memory_, &finished, &is_signal_frame));
+
+  // With a single section there is no coverage table, so the debug_frame
+  // is tried. Loading the gnu_debugdata builds the table, which leaves out
+  // the debug_frame for this pc, but the error still comes from the
+  // debug_frame that was tried.
+  MemoryFake gnu_memory;
+  SetCoverageElf(&gnu_memory, 0x3000, 0x100, 0, 0);
+  std::unique_ptr<ElfInterface> gnu(new ElfInterface32(&gnu_memory));
+  ASSERT_TRUE(gnu->Init(&load_bias));
+  gnu->InitHeaders();
+  std::unique_ptr<ElfInterface> elf(new ElfInterface32(&memory_));
+  ASSERT_TRUE(elf->Init(&load_bias));
+  elf->SetGnuDebugdataLoader([&elf, &gnu]() { elf->SetGnuDebugdataInterface(gnu.get()); });
+  ASSERT_FALSE(elf->Step(0x2400, &regs, &memory_, &finished, &is_signal_frame));
+  EXPECT_EQ(0, elf->GetCoverage(0x2400) & ElfInterface::COVERAGE_DEBUG_FRAME);
+  EXPECT_EQ(expected->LastErrorCode(), elf->LastErrorCode());
+  EXPECT_EQ(expected->LastErrorAddress(), elf->LastErrorAddress());
+  elf->SetGnuDebugdataInterface(nullptr);
+}
+
 template <typename Ehdr, typename Shdr, typename Nhdr, typename ElfInterfaceType>
 void ElfInterfaceTest::BuildID() {
   std::unique_ptr<ElfInterfaceType> elf(new ElfInterfaceType(&memory_));
@@ -1654,6 +2021,59 @@ TEST_F(ElfInterfaceTest, build_id_two_notes_64) {
   BuildIDTwoNotes<Elf64_Ehdr, Elf64_Shdr, Elf64_Nhdr, ElfInterface64>();
 }
 
+template <typename Ehdr, typename Phdr, typename Nhdr, typename ElfInterfaceType>
+void ElfInterfaceTest::BuildIDFromProgramHeader() {
+  std::unique_ptr<ElfInterfaceType> elf(new ElfInterfaceType(&memory_));
+
+  Ehdr ehdr = {};
+  ehdr.e_phoff = 0x100;
+  ehdr.e_phnum = 2;
+  ehdr.e_phentsize = sizeof(Phdr);
+  // Section headers that cannot be read.
+  ehdr.e_shoff = 0x10000;
+  ehdr.e_shnum = 3;
+  ehdr.e_shentsize = 0x40;
+  ehdr.e_shstrndx = 2;
+  memory_.SetMemory(0, &ehdr, sizeof(ehdr));
+
+  auto set_note = [this](uint64_t offset, const char* desc) {
+    Nhdr note_header = {};
+    note_header.n_namesz = 4;  // "GNU"
+    note_header.n_descsz = 8;
+    note_header.n_type = NT_GNU_BUILD_ID;
+    memory_.SetMemory(offset, &note_header, sizeof(note_header));
+    memory_.SetMemory(offset + sizeof(note_header), "GNU", sizeof("GNU"));
+    memory_.SetMemory(offset + sizeof(note_header) + 4, desc, 8);
+  };
+
+  // A note segment with a larger alignment is not used.
+  Phdr phdr = {};
+  phdr.p_type = PT_NOTE;
+  phdr.p_offset = 0x1000;
+  phdr.p_filesz = 0x20;
+  phdr.p_align = 8;
+  memory_.SetMemory(0x100, &phdr, sizeof(phdr));
+  set_note(0x1000, "NOTUSED!");
+
+  phdr.p_offset = 0x2000;
+  phdr.p_align = 4;
+  memory_.SetMemory(0x100 + sizeof(phdr), &phdr, sizeof(phdr));
+  set_note(0x2000, "BUILDID!");
+
+  int64_t load_bias = 0;
+  ASSERT_TRUE(elf->Init(&load_bias));
+  ASSERT_EQ("BUILDID!", elf->GetBuildID());
+  EXPECT_FALSE(elf->sections_read());
+}
+
+TEST_F(ElfInterfaceTest, build_id_from_program_header_32) {
+  BuildIDFromProgramHeader<Elf32_Ehdr, Elf32_Phdr, Elf32_Nhdr, ElfInterface32>();
+}
+
+TEST_F(ElfInterfaceTest, build_id_from_program_header_64) {
+  BuildIDFromProgramHeader<Elf64_Ehdr, Elf64_Phdr, Elf64_Nhdr, ElfInterface64>();
+}
+
 template <typename Ehdr, typename Shdr, typename Nhdr, typename ElfInterfaceType>
 void ElfInterfaceTest::BuildIDSectionTooSmallForName () {
   std::unique_ptr<ElfInterfaceType> elf(new ElfInterfaceType(&memory_));
@@ -285,6 +285,31 @@ TEST_F(ElfTest, gnu_debugdata_init32) {
   EXPECT_EQ(0x8cU, elf.interface()->gnu_debugdata_size());
 }
 
+TEST_F(ElfTest, gnu_debugdata_init_on_demand) {
+  TestInitGnuDebugdata<Elf64_Ehdr, Elf64_Shdr>(ELFCLASS64, EM_AARCH64, true,
+                                               [&](uint64_t offset, const void* ptr, size_t size) {
+                                                 memory_->SetMemory(offset, ptr, size);
+                                               });
+
+  Elf elf(memory_);
+  ASSERT_TRUE(elf.Init());
+  ASSERT_TRUE(elf.interface() != nullptr);
+  // Init only reads the elf and program headers.
+  EXPECT_FALSE(elf.interface()->sections_read());
+  EXPECT_FALSE(elf.interface()->headers_initialized());
+
+  // Looking up a function name that is not in the main symbol tables
+  // decompresses the .gnu_debugdata.
+  SharedString name;
+  uint64_t func_offset;
+  ASSERT_FALSE(elf.GetFunctionName(0x1000, &name, &func_offset));
+  EXPECT_TRUE(elf.interface()->sections_read());
+  ElfInterface* gnu = elf.gnu_debugdata_interface();
+  ASSERT_TRUE(gnu != nullptr);
+  EXPECT_TRUE(gnu->headers_initialized());
+  ASSERT_EQ(gnu, elf.gnu_debugdata_interface());
+}
+
 TEST_F(ElfTest, gnu_debugdata_init64) {
   TestInitGnuDebugdata<Elf64_Ehdr, Elf64_Shdr>(ELFCLASS64, EM_AARCH64, true,
                                                [&](uint64_t offset, const void* ptr, size_t size) {
@@ -563,6 +588,25 @@ TEST_F(ElfTest, error_code_valid) {
   EXPECT_EQ(0x1000U, elf.GetLastErrorAddress());
 }
 
+TEST_F(ElfTest, frame_pointer_checks) {
+  ElfFake elf(memory_);
+  EXPECT_EQ(Elf::FRAME_POINTER_UNKNOWN, elf.frame_pointer_state());
+  for (uint32_t i = 1; i < Elf::kFramePointerChecks; i++) {
+    elf.AddFramePointerCheck(true);
+    EXPECT_EQ(Elf::FRAME_POINTER_UNKNOWN, elf.frame_pointer_state());
+  }
+  elf.AddFramePointerCheck(true);
+  EXPECT_EQ(Elf::FRAME_POINTER_SAFE, elf.frame_pointer_state());
+
+  // A single mismatch is enough to stop using frame pointers.
+  elf.AddFramePointerCheck(false);
+  EXPECT_EQ(Elf::FRAME_POINTER_UNSAFE, elf.frame_pointer_state());
+  for (uint32_t i = 0; i < Elf::kFramePointerChecks; i++) {
+    elf.AddFramePointerCheck(true);
+  }
+  EXPECT_EQ(Elf::FRAME_POINTER_UNSAFE, elf.frame_pointer_state());
+}
+
 TEST(ElfBuildIdTest, get_printable_build_id_empty) {
   std::string empty;
   ASSERT_EQ("", Elf::GetPrintableBuildID(empty));
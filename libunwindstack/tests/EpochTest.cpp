@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/Epoch.h>
+
+namespace unwindstack {
+
+TEST(EpochTest, retire_without_read_section) {
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  Epoch::Retire(std::move(object));
+  ASSERT_FALSE(weak.expired());
+
+  Epoch::Reclaim();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(EpochTest, retire_in_read_section) {
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  Epoch::Enter();
+  Epoch::Retire(std::move(object));
+  Epoch::Reclaim();
+  ASSERT_FALSE(weak.expired());
+
+  Epoch::Exit();
+  Epoch::Reclaim();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(EpochTest, exit_reclaims) {
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  {
+    EpochReadSection outer;
+    Epoch::Retire(std::move(object));
+    {
+      EpochReadSection inner;
+    }
+    ASSERT_FALSE(weak.expired());
+  }
+  // Ending the outermost read section releases the object without a call
+  // to Reclaim.
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(EpochTest, read_section_after_retire) {
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  Epoch::Retire(std::move(object));
+
+  // A read section that starts after the object was retired cannot be
+  // using it.
+  EpochReadSection read_section;
+  Epoch::Reclaim();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(EpochTest, nested_read_sections) {
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  {
+    EpochReadSection outer;
+    Epoch::Retire(std::move(object));
+    {
+      EpochReadSection inner;
+    }
+    Epoch::Reclaim();
+    ASSERT_FALSE(weak.expired());
+  }
+  Epoch::Reclaim();
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(EpochTest, read_section_on_other_thread) {
+  std::atomic_bool entered = false;
+  std::atomic_bool exit = false;
+  std::atomic_bool exited = false;
+  std::thread thread([&] {
+    Epoch::Enter();
+    entered = true;
+    while (!exit) {
+    }
+    Epoch::Exit();
+    exited = true;
+  });
+  while (!entered) {
+  }
+
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  size_t num_retired = Epoch::NumRetired();
+  Epoch::Retire(std::move(object));
+  EXPECT_EQ(num_retired + 1, Epoch::NumRetired());
+  Epoch::Reclaim();
+  ASSERT_FALSE(weak.expired());
+
+  exit = true;
+  while (!exited) {
+  }
+  Epoch::Reclaim();
+  EXPECT_TRUE(weak.expired());
+  thread.join();
+}
+
+TEST(EpochTest, thread_exit_ends_read_section) {
+  std::atomic_bool entered = false;
+  std::atomic_bool exit = false;
+  std::thread thread([&] {
+    Epoch::Enter();
+    entered = true;
+    while (!exit) {
+    }
+  });
+  while (!entered) {
+  }
+
+  auto object = std::make_shared<int>(1);
+  std::weak_ptr<int> weak = object;
+  Epoch::Retire(std::move(object));
+  Epoch::Reclaim();
+  ASSERT_FALSE(weak.expired());
+
+  // A thread that exits inside a read section does not keep objects alive.
+  exit = true;
+  thread.join();
+  Epoch::Reclaim();
+  EXPECT_TRUE(weak.expired());
+}
+
+}  // namespace unwindstack
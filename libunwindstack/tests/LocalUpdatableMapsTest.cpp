@@ -23,6 +23,7 @@
 #include <gtest/gtest.h>
 
 #include <android-base/file.h>
+#include <unwindstack/Epoch.h>
 #include <unwindstack/Maps.h>
 
 namespace unwindstack {
@@ -377,4 +378,30 @@ TEST_F(LocalUpdatableMapsTest, add_map_prev_real_name_updated) {
   EXPECT_EQ(nullptr, map_info->next_map());
 }
 
+TEST_F(LocalUpdatableMapsTest, find_map_info_removed_in_read_section) {
+  std::weak_ptr<MapInfo> removed_map = maps_.Get(0);
+  {
+    EpochReadSection read_section;
+    MapInfo* map_info = maps_.FindMapInfo(0x3100);
+    ASSERT_TRUE(map_info != nullptr);
+    ASSERT_EQ(maps_.Get(0).get(), map_info);
+
+    TemporaryFile tf;
+    ASSERT_TRUE(android::base::WriteStringToFile("8000-9000 r-xp 00000 00:00 0\n", tf.path));
+    maps_.TestSetMapsFile(tf.path);
+    ASSERT_TRUE(maps_.Reparse());
+    ASSERT_EQ(1U, maps_.Total());
+    EXPECT_TRUE(maps_.FindMapInfo(0x3100) == nullptr);
+
+    // The map is kept until the read section ends.
+    Epoch::Reclaim();
+    ASSERT_FALSE(removed_map.expired());
+    EXPECT_EQ(0x3000U, map_info->start());
+    EXPECT_EQ(0x4000U, map_info->end());
+  }
+
+  Epoch::Reclaim();
+  EXPECT_TRUE(removed_map.expired());
+}
+
 }  // namespace unwindstack
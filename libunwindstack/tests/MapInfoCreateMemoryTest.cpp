@@ -353,11 +353,15 @@ TEST_F(MapInfoCreateMemoryTest, valid_rosegment_non_zero_offset) {
   // Verify that reading values from this memory works properly.
   std::vector<uint8_t> buffer(0x4000);
   size_t bytes = mem->Read(0, buffer.data(), buffer.size());
-  ASSERT_EQ(0x1000UL, bytes);
+  // The read continues into the adjacent executable map.
+  ASSERT_EQ(0x2000UL, bytes);
   ASSERT_EQ(0, memcmp(&ehdr, buffer.data(), sizeof(ehdr)));
-  for (size_t i = sizeof(ehdr); i < bytes; i++) {
+  for (size_t i = sizeof(ehdr); i < 0x1000; i++) {
     ASSERT_EQ(0x34, buffer[i]) << "Failed at byte " << i;
   }
+  for (size_t i = 0x1000; i < bytes; i++) {
+    ASSERT_EQ(0x43, buffer[i]) << "Failed at byte " << i;
+  }
 
   bytes = mem->Read(0x1000, buffer.data(), buffer.size());
   ASSERT_EQ(0x1000UL, bytes);
@@ -366,6 +370,59 @@ TEST_F(MapInfoCreateMemoryTest, valid_rosegment_non_zero_offset) {
   }
 }
 
+// The read-only map is rounded up to a page boundary past the offset of
+// the executable map, so the two overlap in the elf.
+TEST_F(MapInfoCreateMemoryTest, valid_rosegment_overlapping_pages) {
+  Maps maps;
+  maps.Add(0x1000, 0x3000, 0, PROT_READ, "/only/in/memory.so", 0);
+  maps.Add(0x3000, 0x5000, 0x1000, PROT_READ | PROT_EXEC, "/only/in/memory.so", 0);
+
+  Elf64_Ehdr ehdr = {};
+  TestInitEhdr<Elf64_Ehdr>(&ehdr, ELFCLASS64, EM_X86_64);
+  memory_->SetMemory(0x1000, &ehdr, sizeof(ehdr));
+  memory_->SetMemoryBlock(0x1000 + sizeof(ehdr), 0x2000 - sizeof(ehdr), 0x12);
+  memory_->SetMemoryBlock(0x3000, 0x2000, 0x23);
+
+  auto map_info = maps.Find(0x3000).get();
+  ASSERT_TRUE(map_info != nullptr);
+
+  std::unique_ptr<Memory> mem(map_info->CreateMemory(process_memory_));
+  ASSERT_TRUE(mem.get() != nullptr);
+  EXPECT_TRUE(map_info->memory_backed_elf());
+  EXPECT_EQ(0x1000UL, map_info->elf_offset());
+  EXPECT_EQ(0UL, map_info->elf_start_offset());
+
+  // The read-only map is read where they overlap, and the executable map
+  // only for the rest.
+  std::vector<uint8_t> buffer(0x4000);
+  size_t bytes = mem->Read(0, buffer.data(), buffer.size());
+  ASSERT_EQ(0x3000UL, bytes);
+  ASSERT_EQ(0, memcmp(&ehdr, buffer.data(), sizeof(ehdr)));
+  for (size_t i = sizeof(ehdr); i < 0x2000; i++) {
+    ASSERT_EQ(0x12, buffer[i]) << "Failed at byte " << i;
+  }
+  for (size_t i = 0x2000; i < bytes; i++) {
+    ASSERT_EQ(0x23, buffer[i]) << "Failed at byte " << i;
+  }
+
+  // The executable map is entirely covered, so only the read-only map is used.
+  maps.Add(0x5000, 0x7000, 0, PROT_READ, "/only/in/memory2.so", 0);
+  maps.Add(0x7000, 0x8000, 0x1000, PROT_READ | PROT_EXEC, "/only/in/memory2.so", 0);
+  memory_->SetMemory(0x5000, &ehdr, sizeof(ehdr));
+  memory_->SetMemoryBlock(0x5000 + sizeof(ehdr), 0x2000 - sizeof(ehdr), 0x34);
+  memory_->SetMemoryBlock(0x7000, 0x1000, 0x45);
+
+  map_info = maps.Find(0x7000).get();
+  ASSERT_TRUE(map_info != nullptr);
+  mem.reset(map_info->CreateMemory(process_memory_));
+  ASSERT_TRUE(mem.get() != nullptr);
+  bytes = mem->Read(0, buffer.data(), buffer.size());
+  ASSERT_EQ(0x2000UL, bytes);
+  for (size_t i = sizeof(ehdr); i < bytes; i++) {
+    ASSERT_EQ(0x34, buffer[i]) << "Failed at byte " << i;
+  }
+}
+
 TEST_F(MapInfoCreateMemoryTest, valid_single_rx_non_zero_offset) {
   Maps maps;
   maps.Add(0x3000, 0x5000, 0xa000, PROT_READ | PROT_EXEC, "/only/in/memory.apk", 0);
@@ -99,6 +99,28 @@ TEST(MapsTest, map_move) {
   ASSERT_EQ(0U, info->load_bias().load());
 }
 
+TEST(MapsTest, generation) {
+  Maps maps;
+  maps.Add(0x1000, 0x2000, 0, PROT_READ, "fake_map", 0);
+  uint64_t generation = maps.Generation();
+  EXPECT_NE(0U, generation);
+
+  // Lookups do not change the maps.
+  ASSERT_TRUE(maps.FindMapInfo(0x1000) != nullptr);
+  EXPECT_EQ(generation, maps.Generation());
+
+  maps.Add(0x3000, 0x4000, 0, PROT_READ, "fake_map", 0);
+  EXPECT_NE(generation, maps.Generation());
+  generation = maps.Generation();
+  maps.Sort();
+  EXPECT_NE(generation, maps.Generation());
+
+  // Every object has its own generations.
+  Maps other_maps;
+  other_maps.Add(0x1000, 0x2000, 0, PROT_READ, "fake_map", 0);
+  EXPECT_NE(maps.Generation(), other_maps.Generation());
+}
+
 TEST(MapsTest, verify_parse_line) {
   auto info = MapInfo::Create(0, 0, 0, 0, "");
 
@@ -635,6 +657,87 @@ TEST(MapsTest, find) {
   EXPECT_EQ("/system/lib/fake5.so", info->name());
 }
 
+TEST(MapsTest, find_all_sizes) {
+  // Verify the search index for every tree shape, including the lookaside
+  // entries left behind by previous finds.
+  for (size_t total = 1; total < 70; total++) {
+    Maps maps;
+    for (size_t i = 0; i < total; i++) {
+      maps.Add(0x1000 + i * 0x2000, 0x2000 + i * 0x2000, 0, PROT_READ, "fake", 0);
+    }
+    maps.Sort();
+
+    for (size_t i = 0; i < total; i++) {
+      uint64_t start = 0x1000 + i * 0x2000;
+      ASSERT_TRUE(maps.Find(start - 1) == nullptr) << "Failed at map " << i << " of " << total;
+      auto info = maps.Find(start);
+      ASSERT_TRUE(info != nullptr) << "Failed at map " << i << " of " << total;
+      ASSERT_EQ(start, info->start());
+      info = maps.Find(start + 0xfff);
+      ASSERT_TRUE(info != nullptr) << "Failed at map " << i << " of " << total;
+      ASSERT_EQ(start, info->start());
+      ASSERT_TRUE(maps.Find(start + 0x1000) == nullptr) << "Failed at map " << i << " of "
+                                                        << total;
+    }
+    // Walk backwards so the lookaside is hit from the other direction.
+    for (size_t i = total; i > 0; i--) {
+      uint64_t start = 0x1000 + (i - 1) * 0x2000;
+      auto info = maps.Find(start + 0x800);
+      ASSERT_TRUE(info != nullptr) << "Failed at map " << i - 1 << " of " << total;
+      ASSERT_EQ(start, info->start());
+    }
+    ASSERT_TRUE(maps.Find(0) == nullptr);
+    ASSERT_TRUE(maps.Find(UINT64_MAX) == nullptr);
+  }
+}
+
+TEST(MapsTest, find_after_add) {
+  Maps maps;
+  maps.Add(0x1000, 0x2000, 0, PROT_READ, "fake1", 0);
+  maps.Add(0x3000, 0x4000, 0, PROT_READ, "fake2", 0);
+  maps.Sort();
+
+  auto info = maps.Find(0x3500);
+  ASSERT_TRUE(info != nullptr);
+  EXPECT_EQ(0x3000U, info->start());
+  EXPECT_TRUE(maps.Find(0x5500) == nullptr);
+
+  // Adding a map must not leave a stale search index behind.
+  maps.Add(0x5000, 0x6000, 0, PROT_READ, "fake3", 0);
+  info = maps.Find(0x5500);
+  ASSERT_TRUE(info != nullptr);
+  EXPECT_EQ(0x5000U, info->start());
+
+  maps.Sort();
+  info = maps.Find(0x5500);
+  ASSERT_TRUE(info != nullptr);
+  EXPECT_EQ(0x5000U, info->start());
+}
+
+TEST(MapsTest, find_multiple_maps_objects) {
+  Maps maps1;
+  maps1.Add(0x1000, 0x2000, 0, PROT_READ, "fake1", 0);
+  maps1.Add(0x3000, 0x4000, 0, PROT_READ, "fake2", 0);
+  maps1.Sort();
+
+  Maps maps2;
+  maps2.Add(0x1000, 0x1800, 0, PROT_READ, "other1", 0);
+  maps2.Add(0x3000, 0x3800, 0, PROT_READ, "other2", 0);
+  maps2.Sort();
+
+  // A lookaside hit from one object must never be used by another.
+  auto info = maps1.Find(0x1100);
+  ASSERT_TRUE(info != nullptr);
+  EXPECT_EQ("fake1", info->name());
+  EXPECT_TRUE(maps2.Find(0x1900) == nullptr);
+  info = maps2.Find(0x1100);
+  ASSERT_TRUE(info != nullptr);
+  EXPECT_EQ("other1", info->name());
+  info = maps1.Find(0x1900);
+  ASSERT_TRUE(info != nullptr);
+  EXPECT_EQ("fake1", info->name());
+}
+
 TEST(MapsTest, sort) {
   Maps maps;
 
@@ -706,4 +809,44 @@ TEST(MapsTest, sort_empty) {
   EXPECT_EQ(0ULL, maps.Total());
 }
 
+TEST(MapsTest, incremental_map) {
+  IncrementalMaps maps(getpid());
+  maps.Map(0x1000, 0x4000, 0x10000, PROT_READ, "/system/lib/fake.so");
+  maps.Map(0x8000, 0x9000, 0, PROT_READ | PROT_WRITE, "");
+  std::shared_ptr<MapInfo> replaced = maps.Find(0x1000);
+
+  // Splits the first map in two.
+  maps.Map(0x2000, 0x3000, 0, PROT_READ | PROT_EXEC, "/dev/fake");
+  ASSERT_EQ(4U, maps.Total());
+
+  MapInfo* info = maps.Get(0).get();
+  EXPECT_EQ(0x1000U, info->start());
+  EXPECT_EQ(0x2000U, info->end());
+  EXPECT_EQ(0x10000U, info->offset());
+  EXPECT_EQ(PROT_READ, info->flags());
+  EXPECT_EQ("/system/lib/fake.so", info->name());
+  EXPECT_NE(replaced.get(), info);
+
+  info = maps.Get(1).get();
+  EXPECT_EQ(0x2000U, info->start());
+  EXPECT_EQ(0x3000U, info->end());
+  EXPECT_EQ(PROT_READ | PROT_EXEC | MAPS_FLAGS_DEVICE_MAP, info->flags());
+  EXPECT_EQ(maps.Get(0).get(), info->prev_map().get());
+
+  info = maps.Get(2).get();
+  EXPECT_EQ(0x3000U, info->start());
+  EXPECT_EQ(0x4000U, info->end());
+  EXPECT_EQ(0x12000U, info->offset());
+  EXPECT_EQ("/system/lib/fake.so", info->name());
+
+  // Covers the rest of the old maps completely.
+  maps.Map(0x1000, 0x2000, 0, PROT_READ, "/system/lib/other.so");
+  maps.Map(0x3000, 0x9000, 0, PROT_READ, "");
+  ASSERT_EQ(3U, maps.Total());
+  EXPECT_EQ("/system/lib/other.so", maps.Find(0x1000)->name());
+  EXPECT_EQ("/dev/fake", maps.Find(0x2000)->name());
+  EXPECT_EQ(0x9000U, maps.Find(0x8000)->end());
+  EXPECT_TRUE(maps.Find(0x9000) == nullptr);
+}
+
 }  // namespace unwindstack
@@ -15,7 +15,10 @@
  */
 
 #include <stdint.h>
+#include <string.h>
 
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -114,4 +117,31 @@ TEST_F(MemoryBufferTest, Resize_too_large) {
   ASSERT_FALSE(memory_->Resize(SIZE_MAX));
 }
 
+TEST_F(MemoryBufferTest, read_string_view) {
+  ASSERT_TRUE(memory_->Resize(32));
+  memcpy(memory_->GetPtr(0), "first\0second\0third", 20);
+
+  std::string storage;
+  std::string_view view;
+  ASSERT_TRUE(memory_->ReadStringView(0, &view, 32, &storage));
+  ASSERT_EQ("first", view);
+  // The view points into the buffer, nothing is copied.
+  ASSERT_EQ(reinterpret_cast<char*>(memory_->GetPtr(0)), view.data());
+  ASSERT_TRUE(storage.empty());
+
+  ASSERT_TRUE(memory_->ReadStringView(6, &view, 7, &storage));
+  ASSERT_EQ("second", view);
+  ASSERT_FALSE(memory_->ReadStringView(6, &view, 6, &storage));
+  ASSERT_FALSE(memory_->ReadStringView(32, &view, 10, &storage));
+
+  std::string name;
+  ASSERT_TRUE(memory_->ReadString(13, &name, 100));
+  ASSERT_EQ("third", name);
+
+  // No terminator before the end of the buffer.
+  memset(memory_->GetPtr(0), 'a', 32);
+  ASSERT_FALSE(memory_->ReadStringView(0, &view, 100, &storage));
+  ASSERT_FALSE(memory_->ReadString(0, &name, 100));
+}
+
 }  // namespace unwindstack
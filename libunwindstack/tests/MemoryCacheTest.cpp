@@ -16,6 +16,8 @@
 
 #include <stdint.h>
 
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -94,7 +96,7 @@ TEST_F(MemoryCacheTest, cached_read_across_caches) {
   ASSERT_EQ(expect, buffer);
 }
 
-TEST_F(MemoryCacheTest, no_cache_read) {
+TEST_F(MemoryCacheTest, cached_read_large) {
   for (size_t i = kMaxCachedSize + 1; i < 2 * kMaxCachedSize; i++) {
     std::vector<uint8_t> buffer(i);
     ASSERT_TRUE(memory_cache_->ReadFully(0x8000 + i, buffer.data(), i))
@@ -102,12 +104,48 @@ TEST_F(MemoryCacheTest, no_cache_read) {
     ASSERT_EQ(std::vector<uint8_t>(i, 0xab), buffer) << "Failed at size " << i;
   }
 
-  // Verify the cached data is not used.
+  // Verify the cached data is used for reads that fit in a page.
   memory_->SetMemoryBlock(0x8000, 4096, 0xff);
   for (size_t i = kMaxCachedSize + 1; i < 2 * kMaxCachedSize; i++) {
     std::vector<uint8_t> buffer(i);
     ASSERT_TRUE(memory_cache_->ReadFully(0x8000 + i, buffer.data(), i))
         << "Read failed at size " << i;
+    ASSERT_EQ(std::vector<uint8_t>(i, 0xab), buffer) << "Failed at size " << i;
+  }
+}
+
+TEST_F(MemoryCacheTest, cached_read_large_across_caches) {
+  std::vector<uint8_t> expect(1000, 0xab);
+  expect.resize(4096, 0xde);
+
+  std::vector<uint8_t> buffer(4096);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8c18, buffer.data(), buffer.size()));
+  ASSERT_EQ(expect, buffer);
+
+  // Verify the cached data is used.
+  memory_->SetMemoryBlock(0x8000, 4096, 0xff);
+  memory_->SetMemoryBlock(0x9000, 4096, 0xff);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8c18, buffer.data(), buffer.size()));
+  ASSERT_EQ(expect, buffer);
+}
+
+TEST_F(MemoryCacheTest, no_cache_read) {
+  for (size_t i = 4097; i < 4097 + kMaxCachedSize; i++) {
+    std::vector<uint8_t> buffer(i);
+    ASSERT_TRUE(memory_cache_->ReadFully(0x8000, buffer.data(), i))
+        << "Read failed at size " << i;
+    std::vector<uint8_t> expect(4096, 0xab);
+    expect.resize(i, 0xde);
+    ASSERT_EQ(expect, buffer) << "Failed at size " << i;
+  }
+
+  // Verify the cached data is not used.
+  memory_->SetMemoryBlock(0x8000, 4096, 0xff);
+  memory_->SetMemoryBlock(0x9000, 4096, 0xff);
+  for (size_t i = 4097; i < 4097 + kMaxCachedSize; i++) {
+    std::vector<uint8_t> buffer(i);
+    ASSERT_TRUE(memory_cache_->ReadFully(0x8000, buffer.data(), i))
+        << "Read failed at size " << i;
     ASSERT_EQ(std::vector<uint8_t>(i, 0xff), buffer) << "Failed at size " << i;
   }
 }
@@ -139,4 +177,191 @@ TEST_F(MemoryCacheTest, read_for_cache_fail_cross) {
   ASSERT_EQ(expect, buffer);
 }
 
+TEST_F(MemoryCacheTest, stats) {
+  MemoryFake* memory = new MemoryFake;
+  memory->SetMemoryBlock(0x8000, 4096, 0xab);
+  memory->SetMemoryBlock(0x9000, 4096, 0xde);
+  MemoryCache cache(memory, MemoryCache::kDefaultMaxCachedBytes, true);
+
+  uint8_t value;
+  ASSERT_TRUE(cache.ReadFully(0x8000, &value, 1));
+  ASSERT_TRUE(cache.ReadFully(0x8010, &value, 1));
+  ASSERT_TRUE(cache.ReadFully(0x9010, &value, 1));
+  ASSERT_TRUE(cache.ReadFully(0x8020, &value, 1));
+
+  MemoryCacheStats stats = cache.GetStats();
+  EXPECT_EQ(2U, stats.hits);
+  EXPECT_EQ(2U, stats.misses);
+  EXPECT_EQ(0U, stats.evictions);
+}
+
+TEST_F(MemoryCacheTest, no_stats_by_default) {
+  uint8_t value;
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8000, &value, 1));
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8010, &value, 1));
+
+  MemoryCacheStats stats = memory_cache_->GetStats();
+  EXPECT_EQ(0U, stats.hits);
+  EXPECT_EQ(0U, stats.misses);
+}
+
+TEST_F(MemoryCacheTest, bounded_size) {
+  // A cache with a single set.
+  MemoryFake* memory = new MemoryFake;
+  MemoryCache cache(memory, 1, true);
+  ASSERT_EQ(MemoryCache::kCacheWays, cache.MaxCachedPages());
+
+  constexpr size_t kTotalPages = MemoryCache::kCacheWays + 1;
+  for (size_t i = 0; i < kTotalPages; i++) {
+    memory->SetMemoryBlock(0x10000 + i * 4096, 4096, i);
+  }
+  for (size_t i = 0; i < kTotalPages; i++) {
+    uint8_t value;
+    ASSERT_TRUE(cache.ReadFully(0x10000 + i * 4096, &value, 1));
+    ASSERT_EQ(i, value);
+  }
+  MemoryCacheStats stats = cache.GetStats();
+  EXPECT_EQ(0U, stats.hits);
+  EXPECT_EQ(kTotalPages, stats.misses);
+  EXPECT_EQ(1U, stats.evictions);
+
+  // Change the memory, only the first page should have been evicted.
+  for (size_t i = 0; i < kTotalPages; i++) {
+    memory->SetMemoryBlock(0x10000 + i * 4096, 4096, 0xff);
+  }
+  for (size_t i = 1; i < kTotalPages; i++) {
+    uint8_t value;
+    ASSERT_TRUE(cache.ReadFully(0x10000 + i * 4096, &value, 1));
+    ASSERT_EQ(i, value);
+  }
+  uint8_t value;
+  ASSERT_TRUE(cache.ReadFully(0x10000, &value, 1));
+  ASSERT_EQ(0xffU, value);
+}
+
+TEST_F(MemoryCacheTest, clock_keeps_referenced_pages) {
+  MemoryFake* memory = new MemoryFake;
+  MemoryCache cache(memory, 1);
+  for (size_t i = 0; i < 8; i++) {
+    memory->SetMemoryBlock(0x10000 + i * 4096, 4096, i);
+  }
+
+  // Fill the set, then keep touching page 0 while streaming new pages.
+  uint8_t value;
+  for (size_t i = 0; i < MemoryCache::kCacheWays; i++) {
+    ASSERT_TRUE(cache.ReadFully(0x10000 + i * 4096, &value, 1));
+  }
+  for (size_t i = MemoryCache::kCacheWays; i < 8; i++) {
+    ASSERT_TRUE(cache.ReadFully(0x10000, &value, 1));
+    ASSERT_TRUE(cache.ReadFully(0x10000 + i * 4096, &value, 1));
+    ASSERT_EQ(i, value);
+  }
+
+  memory->SetMemoryBlock(0x10000, 4096, 0xff);
+  ASSERT_TRUE(cache.ReadFully(0x10000, &value, 1));
+  ASSERT_EQ(0U, value);
+}
+
+TEST_F(MemoryCacheTest, multiple_threads) {
+  constexpr size_t kTotalPages = 64;
+  MemoryFake* memory = new MemoryFake;
+  for (size_t i = 0; i < kTotalPages; i++) {
+    memory->SetMemoryBlock(0x100000 + i * 4096, 4096, i);
+  }
+  // Use fewer cached pages than touched pages so that evictions happen.
+  MemoryCache cache(memory, 16 * 4096, true);
+
+  std::vector<std::thread*> threads;
+  std::atomic_bool failed = false;
+  for (size_t i = 0; i < 8; i++) {
+    threads.push_back(new std::thread([&cache, &failed, i]() {
+      for (size_t loop = 0; loop < 1000; loop++) {
+        // Read across a page boundary.
+        size_t page = (loop * 7 + i * 13) % (kTotalPages - 1);
+        uint8_t buffer[128];
+        if (!cache.ReadFully(0x100000 + page * 4096 + 4000, buffer, sizeof(buffer))) {
+          failed = true;
+          return;
+        }
+        for (size_t j = 0; j < sizeof(buffer); j++) {
+          if (buffer[j] != (j < 96 ? page : page + 1)) {
+            failed = true;
+            return;
+          }
+        }
+      }
+    }));
+  }
+  for (auto thread : threads) {
+    thread->join();
+    delete thread;
+  }
+  ASSERT_FALSE(failed);
+
+  MemoryCacheStats stats = cache.GetStats();
+  EXPECT_EQ(8U * 1000U * 2U, stats.hits + stats.misses);
+}
+
+TEST_F(MemoryCacheTest, read_many) {
+  // Only the page at 0x8000 is cached.
+  uint8_t value;
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8000, &value, 1));
+  memory_->SetMemoryBlock(0x8000, 4096, 0xff);
+  memory_->SetMemoryBlock(0x9000, 4096, 0xee);
+
+  uint64_t values[4] = {};
+  Memory::ReadRequest requests[] = {
+      {.addr = 0x8100, .dst = &values[0], .size = sizeof(uint64_t), .success = false},
+      {.addr = 0x9100, .dst = &values[1], .size = sizeof(uint64_t), .success = false},
+      {.addr = 0x8ffc, .dst = &values[2], .size = sizeof(uint64_t), .success = false},
+      {.addr = 0xc000, .dst = &values[3], .size = sizeof(uint64_t), .success = false},
+  };
+  ASSERT_FALSE(memory_cache_->ReadMany(requests, 4));
+  ASSERT_TRUE(requests[0].success);
+  ASSERT_EQ(0xababababababababULL, values[0]);
+  ASSERT_TRUE(requests[1].success);
+  ASSERT_EQ(0xeeeeeeeeeeeeeeeeULL, values[1]);
+  // Crosses into a page that is not cached, so it is read from the
+  // underlying memory.
+  ASSERT_TRUE(requests[2].success);
+  ASSERT_EQ(0xeeeeeeeeffffffffULL, values[2]);
+  ASSERT_FALSE(requests[3].success);
+
+  // The pages read for the requests that missed are cached.
+  memory_->SetMemoryBlock(0x9000, 4096, 0x11);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x9100, &value, 1));
+  ASSERT_EQ(0xee, value);
+}
+
+// Reads from a cache while it is being read from, like a second thread
+// that uses the same set while the first waits on the underlying memory.
+class MemoryReentrant : public MemoryFake {
+ public:
+  size_t Read(uint64_t addr, void* dst, size_t size) override {
+    if (addr == 0x9000 && cache_ != nullptr) {
+      uint8_t value;
+      reentrant_read_ = cache_->ReadFully(0x8000, &value, 1) && value == 0xab;
+    }
+    return MemoryFake::Read(addr, dst, size);
+  }
+
+  MemoryCache* cache_ = nullptr;
+  bool reentrant_read_ = false;
+};
+
+TEST_F(MemoryCacheTest, no_lock_during_underlying_read) {
+  MemoryReentrant* memory = new MemoryReentrant;
+  memory->SetMemoryBlock(0x8000, 4096, 0xab);
+  memory->SetMemoryBlock(0x9000, 4096, 0xde);
+  // A single set, so both pages use the same lock.
+  MemoryCache cache(memory, MemoryCache::kCacheWays * 4096);
+  uint8_t value;
+  ASSERT_TRUE(cache.ReadFully(0x8000, &value, 1));
+
+  memory->cache_ = &cache;
+  ASSERT_TRUE(cache.ReadFully(0x9000, &value, 1));
+  ASSERT_EQ(0xde, value);
+  ASSERT_TRUE(memory->reentrant_read_);
+}
+
 }  // namespace unwindstack
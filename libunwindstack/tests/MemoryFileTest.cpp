@@ -273,4 +273,85 @@ TEST_F(MemoryFileTest, init_reinit) {
   }
 }
 
+TEST_F(MemoryFileTest, mapping_shared) {
+  size_t pagesize = getpagesize();
+  std::vector<uint8_t> buffer(pagesize * 4);
+  for (size_t i = 0; i < buffer.size(); i++) {
+    buffer[i] = i / pagesize + 1;
+  }
+  ASSERT_TRUE(android::base::WriteFully(tf_->fd, buffer.data(), buffer.size()));
+
+  ASSERT_TRUE(memory_.Init(tf_->path, 0));
+
+  // The same part of the file.
+  MemoryFileAtOffset memory_same;
+  ASSERT_TRUE(memory_same.Init(tf_->path, 0));
+  ASSERT_EQ(memory_.GetPtr(0), memory_same.GetPtr(0));
+
+  // A window inside the existing mapping, including an unaligned offset.
+  MemoryFileAtOffset memory_window;
+  ASSERT_TRUE(memory_window.Init(tf_->path, pagesize + 0x10, pagesize));
+  ASSERT_EQ(memory_.GetPtr(pagesize + 0x10), memory_window.GetPtr(0));
+  ASSERT_EQ(pagesize, memory_window.Size());
+  uint8_t value;
+  ASSERT_TRUE(memory_window.ReadFully(pagesize - 0x11, &value, 1));
+  ASSERT_EQ(2, value);
+  ASSERT_TRUE(memory_window.ReadFully(pagesize - 1, &value, 1));
+  ASSERT_EQ(3, value);
+  ASSERT_FALSE(memory_window.ReadFully(pagesize, &value, 1));
+
+  // The mapping stays valid after the object that created it goes away.
+  memory_.Clear();
+  MemoryFileAtOffset memory_after;
+  ASSERT_TRUE(memory_after.Init(tf_->path, 3 * pagesize));
+  ASSERT_EQ(memory_same.GetPtr(3 * pagesize), memory_after.GetPtr(0));
+  ASSERT_TRUE(memory_after.ReadFully(0, &value, 1));
+  ASSERT_EQ(4, value);
+}
+
+TEST_F(MemoryFileTest, mapping_not_shared_after_file_changes) {
+  size_t pagesize = getpagesize();
+  std::vector<uint8_t> buffer(pagesize, 1);
+  ASSERT_TRUE(android::base::WriteFully(tf_->fd, buffer.data(), buffer.size()));
+
+  ASSERT_TRUE(memory_.Init(tf_->path, 0));
+  ASSERT_EQ(pagesize, memory_.Size());
+
+  // Grow the file, the existing mapping cannot cover the new size.
+  buffer.assign(pagesize, 2);
+  ASSERT_TRUE(android::base::WriteFully(tf_->fd, buffer.data(), buffer.size()));
+
+  MemoryFileAtOffset memory_grown;
+  ASSERT_TRUE(memory_grown.Init(tf_->path, 0));
+  ASSERT_EQ(2 * pagesize, memory_grown.Size());
+  ASSERT_NE(memory_.GetPtr(0), memory_grown.GetPtr(0));
+  uint8_t value;
+  ASSERT_TRUE(memory_grown.ReadFully(pagesize, &value, 1));
+  ASSERT_EQ(2, value);
+
+  // A different file never shares a mapping.
+  TemporaryFile other;
+  ASSERT_TRUE(android::base::WriteFully(other.fd, buffer.data(), buffer.size()));
+  MemoryFileAtOffset memory_other;
+  ASSERT_TRUE(memory_other.Init(other.path, 0));
+  ASSERT_NE(memory_.GetPtr(0), memory_other.GetPtr(0));
+}
+
+TEST_F(MemoryFileTest, prefetch) {
+  size_t pagesize = getpagesize();
+  std::vector<uint8_t> buffer(3 * pagesize, 1);
+  ASSERT_TRUE(android::base::WriteFully(tf_->fd, buffer.data(), buffer.size()));
+
+  ASSERT_TRUE(memory_.Init(tf_->path, pagesize + 10));
+  ASSERT_EQ(2 * pagesize - 10, memory_.Size());
+
+  ASSERT_TRUE(memory_.Prefetch(0, 100, Memory::PREFETCH_ASYNC));
+  ASSERT_TRUE(memory_.Prefetch(pagesize, UINT64_MAX, Memory::PREFETCH_ASYNC));
+  ASSERT_TRUE(memory_.Prefetch(0, memory_.Size(), Memory::PREFETCH_POPULATE));
+
+  ASSERT_FALSE(memory_.Prefetch(0, 100, Memory::PREFETCH_NONE));
+  ASSERT_FALSE(memory_.Prefetch(0, 0, Memory::PREFETCH_ASYNC));
+  ASSERT_FALSE(memory_.Prefetch(memory_.Size(), 100, Memory::PREFETCH_ASYNC));
+}
+
 }  // namespace unwindstack
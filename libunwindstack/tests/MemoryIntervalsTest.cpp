@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "MemoryIntervals.h"
+#include "utils/MemoryFake.h"
+
+namespace unwindstack {
+
+TEST(MemoryIntervalsTest, insert) {
+  MemoryIntervals intervals;
+  MemoryFake memory;
+  ASSERT_FALSE(intervals.Insert(0x1000, 0x1000, &memory));
+  ASSERT_TRUE(intervals.Insert(0x2000, 0x3000, &memory));
+  ASSERT_TRUE(intervals.Insert(0x1000, 0x2000, &memory));
+  ASSERT_TRUE(intervals.Insert(0x4000, 0x5000, &memory));
+  ASSERT_FALSE(intervals.Insert(0x2fff, 0x3001, &memory));
+  ASSERT_FALSE(intervals.Insert(0x3fff, 0x4001, &memory));
+  ASSERT_FALSE(intervals.Insert(0x800, 0x6000, &memory));
+  ASSERT_TRUE(intervals.Insert(0x3000, 0x4000, &memory));
+  ASSERT_EQ(4U, intervals.Size());
+}
+
+TEST(MemoryIntervalsTest, find) {
+  MemoryIntervals intervals;
+  MemoryFake memory;
+  // Insert in reverse order, with a gap after every interval.
+  for (size_t i = 100; i > 0; i--) {
+    ASSERT_TRUE(intervals.Insert(i * 0x1000, i * 0x1000 + 0x800, &memory));
+  }
+
+  ASSERT_TRUE(intervals.Find(0) == nullptr);
+  ASSERT_TRUE(intervals.Find(0xfff) == nullptr);
+  ASSERT_TRUE(intervals.Find(0x101000) == nullptr);
+  for (uint64_t i = 1; i <= 100; i++) {
+    const MemoryIntervals::Interval* interval = intervals.Find(i * 0x1000);
+    ASSERT_TRUE(interval != nullptr) << "Failed at interval " << i;
+    ASSERT_EQ(i * 0x1000, interval->start);
+    ASSERT_EQ(interval, intervals.Find(i * 0x1000 + 0x7ff)) << "Failed at interval " << i;
+    ASSERT_TRUE(intervals.Find(i * 0x1000 + 0x800) == nullptr) << "Failed at interval " << i;
+  }
+}
+
+TEST(MemoryIntervalsTest, insert_uncovered) {
+  MemoryIntervals intervals;
+  MemoryFake first;
+  MemoryFake second;
+  ASSERT_TRUE(intervals.Insert(0x2000, 0x3000, &first));
+  ASSERT_TRUE(intervals.Insert(0x4000, 0x5000, &first));
+
+  ASSERT_TRUE(intervals.InsertUncovered(0x1000, 0x6000, &second));
+  ASSERT_EQ(5U, intervals.Size());
+  std::vector<std::pair<uint64_t, Memory*>> expected{{0x1000, &second}, {0x2000, &first},
+                                                     {0x3000, &second}, {0x4000, &first},
+                                                     {0x5000, &second}};
+  for (const auto& [addr, memory] : expected) {
+    const MemoryIntervals::Interval* interval = intervals.Find(addr);
+    ASSERT_TRUE(interval != nullptr) << "Failed at address " << addr;
+    ASSERT_EQ(addr, interval->start);
+    ASSERT_EQ(addr + 0x1000, interval->end);
+    ASSERT_EQ(memory, interval->memory) << "Failed at address " << addr;
+  }
+
+  // Entirely covered, nothing to add.
+  ASSERT_FALSE(intervals.InsertUncovered(0x1800, 0x4800, &second));
+  ASSERT_EQ(5U, intervals.Size());
+}
+
+TEST(MemoryIntervalsTest, read) {
+  MemoryIntervals intervals;
+  MemoryFake first;
+  first.SetMemoryBlock(0x1000, 0x1000, 0x11);
+  MemoryFake second;
+  second.SetMemoryBlock(0x2000, 0x800, 0x22);
+  ASSERT_TRUE(intervals.Insert(0x1000, 0x2000, &first));
+  ASSERT_TRUE(intervals.Insert(0x2000, 0x3000, &second));
+  ASSERT_TRUE(intervals.Insert(0x4000, 0x5000, &first));
+
+  std::vector<uint8_t> dst(0x2000);
+  ASSERT_EQ(0U, intervals.Read(0x800, dst.data(), dst.size()));
+  ASSERT_EQ(0U, intervals.Read(0x3000, dst.data(), dst.size()));
+  ASSERT_EQ(0U, intervals.Read(0x4000, dst.data(), dst.size()));
+
+  // Spans both intervals, and stops where the second memory ends.
+  ASSERT_EQ(0x1000U, intervals.Read(0x1800, dst.data(), dst.size()));
+  for (size_t i = 0; i < 0x800; i++) {
+    ASSERT_EQ(0x11U, dst[i]) << "Failed at byte " << i;
+  }
+  for (size_t i = 0x800; i < 0x1000; i++) {
+    ASSERT_EQ(0x22U, dst[i]) << "Failed at byte " << i;
+  }
+
+  ASSERT_EQ(0x10U, intervals.Read(0x1ff8, dst.data(), 0x10));
+}
+
+}  // namespace unwindstack
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <sys/mman.h>
 
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -108,4 +109,128 @@ TEST(MemoryLocalTest, read_hole) {
   ASSERT_EQ(0, munmap(mapping, 3 * 4096));
 }
 
+TEST(MemoryLocalTest, read_many) {
+  size_t page_size = getpagesize();
+  char* mapping = static_cast<char*>(
+      mmap(nullptr, 3 * page_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+  ASSERT_NE(MAP_FAILED, mapping);
+  for (size_t i = 0; i < 3 * page_size; i++) {
+    mapping[i] = i % 251;
+  }
+  ASSERT_EQ(0, mprotect(mapping + page_size, page_size, PROT_NONE));
+
+  MemoryLocal local;
+
+  // Enough requests to need more than one batch, with a failing request
+  // in the middle of each batch.
+  static constexpr size_t kNumRequests = 200;
+  std::vector<Memory::ReadRequest> requests(kNumRequests);
+  std::vector<uint64_t> values(kNumRequests, 0);
+  for (size_t i = 0; i < kNumRequests; i++) {
+    uint64_t offset;
+    if (i % 10 == 5) {
+      // Crosses from a readable page into the protected page.
+      offset = page_size - 4;
+    } else if (i % 2) {
+      offset = i * 8;
+    } else {
+      offset = 2 * page_size + i * 8;
+    }
+    requests[i] = {.addr = reinterpret_cast<uint64_t>(mapping) + offset,
+                   .dst = &values[i],
+                   .size = sizeof(uint64_t)};
+  }
+  ASSERT_FALSE(local.ReadMany(requests.data(), requests.size()));
+  for (size_t i = 0; i < kNumRequests; i++) {
+    if (i % 10 == 5) {
+      ASSERT_FALSE(requests[i].success) << "Failed at request " << i;
+      continue;
+    }
+    ASSERT_TRUE(requests[i].success) << "Failed at request " << i;
+    uint64_t expected;
+    memcpy(&expected, reinterpret_cast<void*>(requests[i].addr), sizeof(expected));
+    ASSERT_EQ(expected, values[i]) << "Failed at request " << i;
+  }
+
+  // A single request that covers more pages than fit in one batch.
+  static constexpr size_t kLargeSize = 100 * 4096;
+  std::vector<uint8_t> src(kLargeSize);
+  for (size_t i = 0; i < kLargeSize; i++) {
+    src[i] = i % 253;
+  }
+  std::vector<uint8_t> dst(kLargeSize);
+  uint32_t small;
+  Memory::ReadRequest large_requests[] = {
+      {.addr = reinterpret_cast<uint64_t>(&src[4]), .dst = &small, .size = sizeof(small)},
+      {.addr = reinterpret_cast<uint64_t>(src.data()), .dst = dst.data(), .size = kLargeSize},
+      {.addr = 0, .dst = &small, .size = 0},
+  };
+  ASSERT_TRUE(local.ReadMany(large_requests, 3));
+  ASSERT_EQ(0, memcmp(&src[4], &small, sizeof(small)));
+  ASSERT_TRUE(src == dst);
+
+  ASSERT_EQ(0, munmap(mapping, 3 * page_size));
+}
+
+TEST(MemoryLocalTest, read_many_overflow) {
+  MemoryLocal local;
+
+  uint64_t value;
+  Memory::ReadRequest requests[] = {
+      {.addr = UINT64_MAX - 3, .dst = &value, .size = sizeof(value)},
+      {.addr = reinterpret_cast<uint64_t>(&value), .dst = &value, .size = sizeof(value)},
+  };
+  ASSERT_FALSE(local.ReadMany(requests, 2));
+  ASSERT_FALSE(requests[0].success);
+  ASSERT_TRUE(requests[1].success);
+}
+
+TEST(MemoryLocalTest, read_directly) {
+  uint8_t stack_data[256];
+  memset(stack_data, 0x5a, sizeof(stack_data));
+  uint64_t stack_addr = reinterpret_cast<uint64_t>(stack_data);
+  if (!MemoryLocal::CanReadDirectly(stack_addr, sizeof(stack_data))) {
+    GTEST_SKIP() << "Direct reads are not supported in this configuration";
+  }
+
+  std::vector<uint8_t> heap_data(256, 0x6b);
+  uint64_t heap_addr = reinterpret_cast<uint64_t>(heap_data.data());
+  ASSERT_FALSE(MemoryLocal::CanReadDirectly(heap_addr, heap_data.size()));
+  ASSERT_FALSE(MemoryLocal::CanReadDirectly(0, 8));
+  ASSERT_FALSE(MemoryLocal::CanReadDirectly(stack_addr, SIZE_MAX));
+
+  // Another thread's stack is never read directly.
+  uint64_t thread_stack_addr = 0;
+  std::thread thread([&thread_stack_addr]() {
+    uint64_t value = 0;
+    thread_stack_addr = reinterpret_cast<uint64_t>(&value);
+  });
+  thread.join();
+  ASSERT_FALSE(MemoryLocal::CanReadDirectly(thread_stack_addr, 8));
+
+  MemoryLocal local;
+  std::vector<uint8_t> dst(256);
+  ASSERT_TRUE(local.ReadFully(stack_addr, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(0x5aU, dst[i]) << "Failed at byte " << i;
+  }
+
+  uint8_t stack_dst[16];
+  uint8_t heap_dst[16];
+  uint8_t bad_dst[16];
+  Memory::ReadRequest requests[] = {
+      {.addr = heap_addr, .dst = heap_dst, .size = sizeof(heap_dst)},
+      {.addr = stack_addr + 16, .dst = stack_dst, .size = sizeof(stack_dst)},
+      {.addr = 0, .dst = bad_dst, .size = sizeof(bad_dst)},
+  };
+  ASSERT_FALSE(local.ReadMany(requests, 3));
+  ASSERT_TRUE(requests[0].success);
+  ASSERT_TRUE(requests[1].success);
+  ASSERT_FALSE(requests[2].success);
+  for (size_t i = 0; i < 16; i++) {
+    ASSERT_EQ(0x6bU, heap_dst[i]) << "Failed at byte " << i;
+    ASSERT_EQ(0x5aU, stack_dst[i]) << "Failed at byte " << i;
+  }
+}
+
 }  // namespace unwindstack
@@ -64,4 +64,39 @@ TEST_F(MemoryOfflineTest, read_values) {
   ASSERT_EQ(buf, data);
 }
 
+TEST_F(MemoryOfflineTest, parts) {
+  MemoryOfflineParts parts;
+  char buf[16];
+  ASSERT_EQ(0U, parts.Read(offset, buf, sizeof(buf)));
+
+  // Three parts from the same file, the second adjacent to the first and
+  // the third overlapping the second.
+  auto add_part = [&](uint64_t start, uint64_t size) {
+    MemoryOffline* part = new MemoryOffline;
+    ASSERT_TRUE(part->Init(temp_file.path, sizeof(offset), start, size));
+    parts.Add(part);
+  };
+  add_part(0x1000, 0x100);
+  add_part(0x1100, 0x100);
+  add_part(0x1180, 0x100);
+
+  ASSERT_EQ(0U, parts.Read(0xfff, buf, 1));
+  ASSERT_EQ(0U, parts.Read(0x1280, buf, 1));
+
+  // A read that spans two parts is served in one call.
+  ASSERT_EQ(sizeof(buf), parts.Read(0x10f8, buf, sizeof(buf)));
+  ASSERT_EQ(data[0xf8], buf[0]);
+  ASSERT_EQ(data[0xff], buf[7]);
+  ASSERT_EQ(data[0], buf[8]);
+
+  // Where parts overlap, the part added first is read.
+  ASSERT_EQ(1U, parts.Read(0x1180, buf, 1));
+  ASSERT_EQ(data[0x80], buf[0]);
+  ASSERT_EQ(1U, parts.Read(0x1200, buf, 1));
+  ASSERT_EQ(data[0x80], buf[0]);
+
+  std::vector<char> all(0x400);
+  ASSERT_EQ(0x280U, parts.Read(0x1000, all.data(), all.size()));
+}
+
 }  // namespace unwindstack
@@ -76,14 +76,20 @@ TEST_F(MemoryRangesTest, read_fail) {
 }
 
 TEST_F(MemoryRangesTest, read_across_ranges) {
-  // The MemoryRanges object does not support reading across a range,
-  // so this will only read in the first range.
+  // Reads continue into the next range when it is adjacent.
   std::vector<uint8_t> dst(4096);
   size_t bytes = ranges_->Read(6000, dst.data(), dst.size());
-  ASSERT_EQ(1000UL, bytes);
-  for (size_t i = 0; i < bytes; i++) {
+  ASSERT_EQ(2000UL, bytes);
+  for (size_t i = 0; i < 1000; i++) {
     ASSERT_EQ(0x37U, dst[i]) << "Failed at byte " << i;
   }
+  for (size_t i = 1000; i < bytes; i++) {
+    ASSERT_EQ(0x48U, dst[i]) << "Failed at byte " << i;
+  }
+
+  // But not when there is a gap.
+  bytes = ranges_->Read(0, dst.data(), dst.size());
+  ASSERT_EQ(1000UL, bytes);
 }
 
 TEST_F(MemoryRangesTest, duplicate_last_addr) {
@@ -92,4 +98,34 @@ TEST_F(MemoryRangesTest, duplicate_last_addr) {
   ASSERT_FALSE(ranges.Insert(new MemoryRange(nullptr, 0x2000, 0x1000, 0x2000)));
 }
 
+TEST_F(MemoryRangesTest, overlapping_ranges) {
+  MemoryRanges ranges;
+  ASSERT_TRUE(ranges.Insert(new MemoryRange(nullptr, 0x1000, 0x2000, 0x1000)));
+  ASSERT_FALSE(ranges.Insert(new MemoryRange(nullptr, 0x1000, 0x100, 0x1800)));
+  ASSERT_FALSE(ranges.Insert(new MemoryRange(nullptr, 0x1000, 0x10, 0x1000)));
+  ASSERT_TRUE(ranges.Insert(new MemoryRange(nullptr, 0x1000, 0x1000, 0x2800)));
+  ASSERT_TRUE(ranges.Insert(new MemoryRange(nullptr, 0x1000, 0x1000, 0x800)));
+  ASSERT_FALSE(ranges.Insert(new MemoryRange(nullptr, 0x1000, 0x3000, 0x800)));
+}
+
+TEST_F(MemoryRangesTest, overlapping_ranges_first_wins) {
+  MemoryFake* memory = new MemoryFake;
+  std::shared_ptr<Memory> process_memory(memory);
+  memory->SetMemoryBlock(0x1000, 0x2000, 0x11);
+  memory->SetMemoryBlock(0x10000, 0x2000, 0x22);
+
+  MemoryRanges ranges;
+  ASSERT_TRUE(ranges.Insert(new MemoryRange(process_memory, 0x1000, 0x2000, 0)));
+  ASSERT_TRUE(ranges.Insert(new MemoryRange(process_memory, 0x10000, 0x2000, 0x1000)));
+
+  std::vector<uint8_t> dst(0x4000);
+  ASSERT_EQ(0x3000U, ranges.Read(0, dst.data(), dst.size()));
+  for (size_t i = 0; i < 0x2000; i++) {
+    ASSERT_EQ(0x11U, dst[i]) << "Failed at byte " << i;
+  }
+  for (size_t i = 0x2000; i < 0x3000; i++) {
+    ASSERT_EQ(0x22U, dst[i]) << "Failed at byte " << i;
+  }
+}
+
 }  // namespace unwindstack
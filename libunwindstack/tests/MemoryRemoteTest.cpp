@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <string>
 #include <vector>
 
 #include <android-base/file.h>
@@ -288,7 +289,7 @@ TEST(MemoryRemoteTest, read_munmap_hole) {
 }
 
 // Verify that the memory remote object chooses a memory read function
-// properly. Either process_vm_readv or ptrace.
+// properly. Either process_vm_readv, /proc/<pid>/mem or ptrace.
 TEST(MemoryRemoteTest, read_choose_correctly) {
   size_t page_size = getpagesize();
   void* mapping =
@@ -340,4 +341,163 @@ TEST(MemoryRemoteTest, read_choose_correctly) {
   ASSERT_TRUE(Detach(pid));
 }
 
+TEST(MemoryRemoteTest, read_many) {
+  size_t page_size = getpagesize();
+  char* mapping = static_cast<char*>(
+      mmap(nullptr, 3 * page_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+  ASSERT_NE(MAP_FAILED, mapping);
+  memset(mapping, 0x4c, 3 * page_size);
+  ASSERT_EQ(0, munmap(mapping + page_size, page_size));
+
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    while (true)
+      ;
+    exit(1);
+  }
+  ASSERT_LT(0, pid);
+  TestScopedPidReaper reap(pid);
+
+  ASSERT_EQ(0, munmap(mapping, page_size));
+  ASSERT_EQ(0, munmap(mapping + 2 * page_size, page_size));
+
+  ASSERT_TRUE(Attach(pid));
+
+  uint64_t addr = reinterpret_cast<uint64_t>(mapping);
+  for (bool first_read : {false, true}) {
+    SCOPED_TRACE(first_read ? "process_vm_readv chosen" : "no read function chosen");
+    MemoryRemote remote(pid);
+    uint32_t value;
+    if (first_read) {
+      ASSERT_TRUE(remote.Read32(addr, &value));
+      ASSERT_EQ(0x4c4c4c4cU, value);
+    }
+
+    uint64_t values[3] = {};
+    Memory::ReadRequest requests[] = {
+        {.addr = addr + 8, .dst = &values[0], .size = sizeof(uint64_t)},
+        {.addr = addr + page_size, .dst = &values[1], .size = sizeof(uint64_t)},
+        {.addr = addr + 2 * page_size - 4, .dst = &values[2], .size = sizeof(uint64_t)},
+    };
+    ASSERT_FALSE(remote.ReadMany(requests, 3));
+    ASSERT_TRUE(requests[0].success);
+    ASSERT_FALSE(requests[1].success);
+    ASSERT_FALSE(requests[2].success);
+    ASSERT_EQ(0x4c4c4c4c4c4c4c4cULL, values[0]);
+
+    requests[1].addr = addr + 2 * page_size + 16;
+    requests[2].addr = addr + page_size - 8;
+    ASSERT_TRUE(remote.ReadMany(requests, 3));
+    ASSERT_EQ(0x4c4c4c4c4c4c4c4cULL, values[1]);
+    ASSERT_EQ(0x4c4c4c4c4c4c4c4cULL, values[2]);
+  }
+
+  ASSERT_TRUE(Detach(pid));
+}
+
+TEST(MemoryRemoteTest, read_backends) {
+  static constexpr size_t kTotalPages = 40;
+  size_t page_size = getpagesize();
+  char* mapping = static_cast<char*>(mmap(nullptr, (kTotalPages + 1) * page_size,
+                                          PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0));
+  ASSERT_NE(MAP_FAILED, mapping);
+  for (size_t i = 0; i < kTotalPages; i++) {
+    memset(&mapping[i * page_size], i, page_size);
+  }
+  ASSERT_EQ(0, munmap(mapping + kTotalPages * page_size, page_size));
+
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    while (true)
+      ;
+    exit(1);
+  }
+  ASSERT_LT(0, pid);
+  TestScopedPidReaper reap(pid);
+
+  ASSERT_EQ(0, munmap(mapping, kTotalPages * page_size));
+
+  ASSERT_TRUE(Attach(pid));
+
+  for (auto backend : {MemoryRemote::BACKEND_PROCESS_VM_READV, MemoryRemote::BACKEND_PROC_MEM,
+                       MemoryRemote::BACKEND_PTRACE}) {
+    SCOPED_TRACE("Backend " + std::to_string(backend));
+    MemoryRemote remote(pid, true);
+    remote.SetBackend(backend);
+
+    std::vector<uint8_t> dst((kTotalPages + 1) * page_size);
+    // Reads stop at the end of the map.
+    ASSERT_EQ(kTotalPages * page_size,
+              remote.Read(reinterpret_cast<uint64_t>(mapping) + 8, dst.data(), dst.size() - 8) + 8);
+    for (size_t i = 0; i < kTotalPages * page_size - 8; i++) {
+      ASSERT_EQ((i + 8) / page_size, dst[i]) << "Failed at byte " << i;
+    }
+    ASSERT_EQ(0U, remote.Read(reinterpret_cast<uint64_t>(mapping) + kTotalPages * page_size,
+                              dst.data(), 8));
+
+    MemoryRemote::BackendStats stats = remote.GetStats(backend);
+    ASSERT_EQ(2U, stats.reads);
+    ASSERT_EQ(kTotalPages * page_size - 8, stats.bytes);
+    if (backend == MemoryRemote::BACKEND_PROCESS_VM_READV) {
+      ASSERT_EQ(2U, stats.syscalls);
+    } else if (backend == MemoryRemote::BACKEND_PROC_MEM) {
+      // The first read needs a second pread to find the end of the map.
+      ASSERT_EQ(3U, stats.syscalls);
+    } else {
+      ASSERT_EQ(kTotalPages * page_size / sizeof(long) + 1, stats.syscalls);
+    }
+    ASSERT_EQ(backend, remote.backend());
+    for (auto other : {MemoryRemote::BACKEND_PROCESS_VM_READV, MemoryRemote::BACKEND_PROC_MEM,
+                       MemoryRemote::BACKEND_PTRACE}) {
+      if (other != backend) {
+        ASSERT_EQ(0U, remote.GetStats(other).reads);
+      }
+    }
+  }
+
+  ASSERT_TRUE(Detach(pid));
+}
+
+TEST(MemoryRemoteTest, read_choose_backend) {
+  size_t page_size = getpagesize();
+  void* mapping =
+      mmap(nullptr, 2 * page_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  ASSERT_NE(MAP_FAILED, mapping);
+  memset(mapping, 0xFC, 2 * page_size);
+  ASSERT_EQ(0, mprotect(static_cast<char*>(mapping), page_size, PROT_NONE));
+
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    while (true)
+      ;
+    exit(1);
+  }
+  ASSERT_LT(0, pid);
+  TestScopedPidReaper reap(pid);
+
+  ASSERT_EQ(0, munmap(mapping, 2 * page_size));
+
+  ASSERT_TRUE(Attach(pid));
+
+  uint32_t value;
+  MemoryRemote remote_readv(pid);
+  ASSERT_EQ(MemoryRemote::BACKEND_NONE, remote_readv.backend());
+  ASSERT_TRUE(remote_readv.Read32(reinterpret_cast<uint64_t>(mapping) + page_size, &value));
+  ASSERT_EQ(MemoryRemote::BACKEND_PROCESS_VM_READV, remote_readv.backend());
+  // Not collected by default.
+  ASSERT_EQ(0U, remote_readv.GetStats(MemoryRemote::BACKEND_PROCESS_VM_READV).reads);
+
+  // process_vm_readv cannot read a PROT_NONE map, /proc/<pid>/mem can.
+  MemoryRemote remote_proc_mem(pid, true);
+  ASSERT_TRUE(remote_proc_mem.Read32(reinterpret_cast<uint64_t>(mapping), &value));
+  ASSERT_EQ(0xfcfcfcfcU, value);
+  ASSERT_EQ(MemoryRemote::BACKEND_PROC_MEM, remote_proc_mem.backend());
+  ASSERT_EQ(1U, remote_proc_mem.GetStats(MemoryRemote::BACKEND_PROCESS_VM_READV).reads);
+  ASSERT_EQ(0U, remote_proc_mem.GetStats(MemoryRemote::BACKEND_PROCESS_VM_READV).bytes);
+  ASSERT_EQ(1U, remote_proc_mem.GetStats(MemoryRemote::BACKEND_PROC_MEM).reads);
+  ASSERT_EQ(4U, remote_proc_mem.GetStats(MemoryRemote::BACKEND_PROC_MEM).bytes);
+
+  ASSERT_TRUE(Detach(pid));
+}
+
 }  // namespace unwindstack
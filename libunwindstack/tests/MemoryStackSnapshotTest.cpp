@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/Maps.h>
+
+#include "MemoryStackSnapshot.h"
+#include "utils/MemoryFake.h"
+
+namespace unwindstack {
+
+class MemoryStackSnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    memory_fake_ = new MemoryFake;
+    process_memory_.reset(memory_fake_);
+    memory_fake_->SetMemoryBlock(0x10000, 0x4000, 0x11);
+  }
+
+  std::shared_ptr<Memory> process_memory_;
+  MemoryFake* memory_fake_ = nullptr;
+};
+
+TEST_F(MemoryStackSnapshotTest, read_from_snapshot) {
+  MemoryStackSnapshot snapshot(process_memory_);
+  ASSERT_TRUE(snapshot.Snapshot(0x10100, 0x14000, 0x1000));
+  ASSERT_EQ(0x10100U, snapshot.start());
+  ASSERT_EQ(0x11100U, snapshot.end());
+
+  // Change the underlying memory, the snapshot should not see it.
+  memory_fake_->SetMemoryBlock(0x10000, 0x4000, 0x22);
+
+  std::vector<uint8_t> dst(0x100);
+  ASSERT_TRUE(snapshot.ReadFully(0x10100, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(0x11U, dst[i]) << "Failed at byte " << i;
+  }
+
+  // Below the snapshot.
+  ASSERT_TRUE(snapshot.ReadFully(0x10000, dst.data(), dst.size()));
+  for (size_t i = 0; i < dst.size(); i++) {
+    ASSERT_EQ(0x22U, dst[i]) << "Failed at byte " << i;
+  }
+
+  // Straddles the end of the snapshot.
+  ASSERT_TRUE(snapshot.ReadFully(0x11080, dst.data(), dst.size()));
+  for (size_t i = 0; i < 0x80; i++) {
+    ASSERT_EQ(0x11U, dst[i]) << "Failed at byte " << i;
+  }
+  for (size_t i = 0x80; i < dst.size(); i++) {
+    ASSERT_EQ(0x22U, dst[i]) << "Failed at byte " << i;
+  }
+
+  // Past the end of readable memory.
+  ASSERT_FALSE(snapshot.ReadFully(0x13f80, dst.data(), dst.size()));
+}
+
+TEST_F(MemoryStackSnapshotTest, snapshot_bounded) {
+  MemoryStackSnapshot snapshot(process_memory_);
+  ASSERT_TRUE(snapshot.Snapshot(0x13000, 0x13800, 0x4000));
+  ASSERT_EQ(0x13000U, snapshot.start());
+  ASSERT_EQ(0x13800U, snapshot.end());
+
+  // Only part of the range is readable.
+  ASSERT_TRUE(snapshot.Snapshot(0x13000, 0x20000, 0x4000));
+  ASSERT_EQ(0x13000U, snapshot.start());
+  ASSERT_EQ(0x14000U, snapshot.end());
+
+  ASSERT_FALSE(snapshot.Snapshot(0x13000, 0x13000, 0x4000));
+  ASSERT_FALSE(snapshot.Snapshot(0x20000, 0x30000, 0x4000));
+
+  uint64_t value;
+  ASSERT_TRUE(snapshot.Read64(0x10000, &value));
+  ASSERT_EQ(0x1111111111111111ULL, value);
+}
+
+TEST_F(MemoryStackSnapshotTest, read_many) {
+  MemoryStackSnapshot snapshot(process_memory_);
+  ASSERT_TRUE(snapshot.Snapshot(0x11000, 0x14000, 0x1000));
+  memory_fake_->SetMemoryBlock(0x10000, 0x4000, 0x22);
+
+  uint64_t values[4];
+  Memory::ReadRequest requests[] = {
+      {.addr = 0x11000, .dst = &values[0], .size = sizeof(uint64_t)},
+      {.addr = 0x12000, .dst = &values[1], .size = sizeof(uint64_t)},
+      {.addr = 0x20000, .dst = &values[2], .size = sizeof(uint64_t)},
+      {.addr = 0x11ff8, .dst = &values[3], .size = sizeof(uint64_t)},
+  };
+  ASSERT_FALSE(snapshot.ReadMany(requests, 4));
+  ASSERT_TRUE(requests[0].success);
+  ASSERT_TRUE(requests[1].success);
+  ASSERT_FALSE(requests[2].success);
+  ASSERT_TRUE(requests[3].success);
+  ASSERT_EQ(0x1111111111111111ULL, values[0]);
+  ASSERT_EQ(0x2222222222222222ULL, values[1]);
+  ASSERT_EQ(0x1111111111111111ULL, values[3]);
+
+  // More requests than are forwarded in one batch.
+  std::vector<Memory::ReadRequest> many_requests(100);
+  std::vector<uint64_t> many_values(100);
+  for (size_t i = 0; i < many_requests.size(); i++) {
+    many_requests[i] = {.addr = 0x11000 + i * 0x20, .dst = &many_values[i], .size = 8};
+  }
+  ASSERT_TRUE(snapshot.ReadMany(many_requests.data(), many_requests.size()));
+  for (size_t i = 0; i < many_requests.size(); i++) {
+    ASSERT_TRUE(many_requests[i].success) << "Failed at request " << i;
+    uint64_t expected = i < 0x80 ? 0x1111111111111111ULL : 0x2222222222222222ULL;
+    ASSERT_EQ(expected, many_values[i]) << "Failed at request " << i;
+  }
+}
+
+TEST_F(MemoryStackSnapshotTest, stack_bytes_used) {
+  MemoryStackSnapshot snapshot(process_memory_);
+  ASSERT_TRUE(snapshot.Snapshot(0x11000, 0x13000, 0x1000));
+  ASSERT_EQ(0U, snapshot.StackBytesUsed());
+
+  uint64_t value;
+  ASSERT_TRUE(snapshot.Read64(0x11100, &value));
+  ASSERT_EQ(0x108U, snapshot.StackBytesUsed());
+
+  // Reads below sp or past the end of the stack are not counted.
+  ASSERT_TRUE(snapshot.Read64(0x10000, &value));
+  ASSERT_TRUE(snapshot.Read64(0x13100, &value));
+  ASSERT_EQ(0x108U, snapshot.StackBytesUsed());
+
+  // Reads past the end of the snapshot are.
+  ASSERT_TRUE(snapshot.Read64(0x11800, &value));
+  ASSERT_EQ(0x808U, snapshot.StackBytesUsed());
+  // Only counted up to the end of the stack.
+  Memory::ReadRequest request = {.addr = 0x12ffc, .dst = &value, .size = sizeof(value)};
+  ASSERT_TRUE(snapshot.ReadMany(&request, 1));
+  ASSERT_EQ(0x2000U, snapshot.StackBytesUsed());
+}
+
+TEST_F(MemoryStackSnapshotTest, next_size) {
+  size_t page_size = getpagesize();
+  ASSERT_EQ(MemoryStackSnapshot::kMinSize, MemoryStackSnapshot::NextSize(0, 0));
+  ASSERT_EQ(MemoryStackSnapshot::kMaxSize,
+            MemoryStackSnapshot::NextSize(0, 2 * MemoryStackSnapshot::kMaxSize));
+
+  // Grows to cover what was used.
+  size_t size = MemoryStackSnapshot::NextSize(MemoryStackSnapshot::kMinSize, 64 * 1024);
+  ASSERT_LE(64U * 1024, size);
+  ASSERT_EQ(0U, size % page_size);
+
+  // Shrinks by at most half.
+  ASSERT_EQ(128U * 1024, MemoryStackSnapshot::NextSize(256 * 1024, 100));
+}
+
+TEST_F(MemoryStackSnapshotTest, create) {
+  BufferMaps maps(
+      "10000-14000 rw-p 00000000 00:00 0 [stack]\n"
+      "20000-21000 ---p 00000000 00:00 0\n");
+  ASSERT_TRUE(maps.Parse());
+
+  std::shared_ptr<MemoryStackSnapshot> snapshot =
+      MemoryStackSnapshot::Create(process_memory_, &maps, 0x13000, 0x4000);
+  ASSERT_TRUE(snapshot != nullptr);
+  ASSERT_EQ(0x13000U, snapshot->start());
+  ASSERT_EQ(0x14000U, snapshot->end());
+
+  ASSERT_TRUE(MemoryStackSnapshot::Create(process_memory_, &maps, 0x20000, 0x1000) == nullptr);
+  ASSERT_TRUE(MemoryStackSnapshot::Create(process_memory_, &maps, 0x30000, 0x1000) == nullptr);
+}
+
+}  // namespace unwindstack
@@ -16,8 +16,10 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -134,4 +136,68 @@ TEST(MemoryTest, read_string_long) {
   ASSERT_EQ(expected_str, dst_name);
 }
 
+TEST(MemoryTest, read_string_across_pages) {
+  size_t page_size = getpagesize();
+  MemoryFake memory;
+  // Start close to the end of a page and end a few pages later.
+  uint64_t addr = 2 * page_size - 10;
+  std::string expected(2 * page_size + 100, 'x');
+  memory.SetMemory(addr, expected);
+
+  std::string dst_name;
+  ASSERT_TRUE(memory.ReadString(addr, &dst_name, expected.size() + 1));
+  ASSERT_EQ(expected, dst_name);
+  ASSERT_FALSE(memory.ReadString(addr, &dst_name, expected.size()));
+
+  // The memory ends before the string does.
+  memory.Clear();
+  memory.SetMemory(addr, expected.data(), expected.size());
+  ASSERT_FALSE(memory.ReadString(addr, &dst_name, 4 * page_size));
+}
+
+TEST(MemoryTest, read_string_view) {
+  MemoryFake memory;
+  memory.SetMemory(100, std::string("string_in_memory"));
+
+  // Memory that is not contiguous reads into the storage.
+  std::string storage;
+  std::string_view view;
+  ASSERT_TRUE(memory.ReadStringView(107, &view, 100, &storage));
+  ASSERT_EQ("in_memory", view);
+  ASSERT_EQ(storage.data(), view.data());
+
+  ASSERT_FALSE(memory.ReadStringView(107, &view, 9, &storage));
+  ASSERT_FALSE(memory.ReadStringView(200, &view, 100, &storage));
+}
+
+TEST(MemoryTest, read_many) {
+  MemoryFake memory;
+  memory.SetMemoryBlock(0x1000, 0x100, 0x12);
+  memory.SetMemoryBlock(0x3000, 0x100, 0x34);
+
+  uint8_t dst1[0x10];
+  uint8_t dst2[0x20];
+  uint64_t dst3;
+  Memory::ReadRequest requests[] = {
+      {.addr = 0x1000, .dst = dst1, .size = sizeof(dst1)},
+      {.addr = 0x2000, .dst = &dst3, .size = sizeof(dst3)},
+      {.addr = 0x30f0, .dst = dst2, .size = sizeof(dst2)},
+      {.addr = 0x3010, .dst = dst2, .size = 0x10},
+  };
+  ASSERT_FALSE(memory.ReadMany(requests, 4));
+  EXPECT_TRUE(requests[0].success);
+  EXPECT_FALSE(requests[1].success);
+  EXPECT_FALSE(requests[2].success);
+  EXPECT_TRUE(requests[3].success);
+  for (size_t i = 0; i < sizeof(dst1); i++) {
+    ASSERT_EQ(0x12U, dst1[i]) << "Failed at byte " << i;
+  }
+  for (size_t i = 0; i < 0x10; i++) {
+    ASSERT_EQ(0x34U, dst2[i]) << "Failed at byte " << i;
+  }
+
+  ASSERT_TRUE(memory.ReadMany(requests, 1));
+  ASSERT_TRUE(memory.ReadMany(nullptr, 0));
+}
+
 }  // namespace unwindstack
@@ -16,6 +16,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <thread>
 #include <vector>
 
@@ -218,4 +219,113 @@ TEST_F(MemoryThreadCacheTest, clear_cache_when_no_cache) {
   }
 }
 
+TEST_F(MemoryThreadCacheTest, bounded_size_lru) {
+  MemoryFake* fake = new MemoryFake;
+  MemoryThreadCache memory(fake, 2 * 4096);
+  ASSERT_EQ(2U, memory.MaxCachedPages());
+  fake->SetMemoryBlock(0x10000, 4096, 0x10);
+  fake->SetMemoryBlock(0x11000, 4096, 0x11);
+  fake->SetMemoryBlock(0x12000, 4096, 0x12);
+
+  uint8_t value;
+  ASSERT_TRUE(memory.ReadFully(0x10000, &value, 1));
+  ASSERT_TRUE(memory.ReadFully(0x11000, &value, 1));
+  // Touch the first page so the second one is the least recently used.
+  ASSERT_TRUE(memory.ReadFully(0x10000, &value, 1));
+  ASSERT_TRUE(memory.ReadFully(0x12000, &value, 1));
+  ASSERT_EQ(0x12, value);
+
+  fake->SetMemoryBlock(0x10000, 4096, 0xff);
+  fake->SetMemoryBlock(0x11000, 4096, 0xff);
+  fake->SetMemoryBlock(0x12000, 4096, 0xff);
+  ASSERT_TRUE(memory.ReadFully(0x10000, &value, 1));
+  ASSERT_EQ(0x10, value);
+  ASSERT_TRUE(memory.ReadFully(0x12000, &value, 1));
+  ASSERT_EQ(0x12, value);
+  ASSERT_TRUE(memory.ReadFully(0x11000, &value, 1));
+  ASSERT_EQ(0xff, value);
+}
+
+TEST_F(MemoryThreadCacheTest, bounded_size_read_across_caches) {
+  MemoryFake* fake = new MemoryFake;
+  MemoryThreadCache memory(fake, 1);
+  ASSERT_EQ(1U, memory.MaxCachedPages());
+  fake->SetMemoryBlock(0x10000, 4096, 0x10);
+  fake->SetMemoryBlock(0x11000, 4096, 0x11);
+
+  std::vector<uint8_t> expect(16, 0x10);
+  expect.resize(32, 0x11);
+  std::vector<uint8_t> buffer(32);
+  ASSERT_TRUE(memory.ReadFully(0x10ff0, buffer.data(), buffer.size()));
+  ASSERT_EQ(expect, buffer);
+  ASSERT_TRUE(memory.ReadFully(0x10ff0, buffer.data(), buffer.size()));
+  ASSERT_EQ(expect, buffer);
+}
+
+TEST_F(MemoryThreadCacheTest, clear_all_threads) {
+  std::vector<uint8_t> buffer(kMaxCachedSize);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8000, buffer.data(), kMaxCachedSize));
+
+  std::atomic_bool cached = false;
+  std::atomic_bool invalidated = false;
+  std::thread thread([this, &cached, &invalidated] {
+    std::vector<uint8_t> buffer(kMaxCachedSize);
+    EXPECT_TRUE(this->memory_cache_->ReadFully(0x8000, buffer.data(), kMaxCachedSize));
+    EXPECT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xab), buffer);
+    cached = true;
+
+    // Wait for the main thread to invalidate all caches.
+    while (!invalidated) {
+      std::this_thread::yield();
+    }
+    ASSERT_TRUE(this->memory_cache_->ReadFully(0x8000, buffer.data(), kMaxCachedSize));
+    ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+  });
+  while (!cached) {
+    std::this_thread::yield();
+  }
+
+  memory_->SetMemoryBlock(0x8000, 4096, 0xff);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8000, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xab), buffer);
+
+  memory_cache_->ClearAllThreads();
+  invalidated = true;
+  thread.join();
+
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8000, buffer.data(), kMaxCachedSize));
+  ASSERT_EQ(std::vector<uint8_t>(kMaxCachedSize, 0xff), buffer);
+}
+
+TEST_F(MemoryThreadCacheTest, read_many) {
+  // Only the page at 0x8000 is cached.
+  uint8_t value;
+  ASSERT_TRUE(memory_cache_->ReadFully(0x8000, &value, 1));
+  memory_->SetMemoryBlock(0x8000, 4096, 0xff);
+  memory_->SetMemoryBlock(0x9000, 4096, 0xee);
+
+  uint64_t values[4] = {};
+  Memory::ReadRequest requests[] = {
+      {.addr = 0x8100, .dst = &values[0], .size = sizeof(uint64_t), .success = false},
+      {.addr = 0x9100, .dst = &values[1], .size = sizeof(uint64_t), .success = false},
+      {.addr = 0x8ffc, .dst = &values[2], .size = sizeof(uint64_t), .success = false},
+      {.addr = 0xc000, .dst = &values[3], .size = sizeof(uint64_t), .success = false},
+  };
+  ASSERT_FALSE(memory_cache_->ReadMany(requests, 4));
+  ASSERT_TRUE(requests[0].success);
+  ASSERT_EQ(0xababababababababULL, values[0]);
+  ASSERT_TRUE(requests[1].success);
+  ASSERT_EQ(0xeeeeeeeeeeeeeeeeULL, values[1]);
+  // Crosses into a page that is not cached, so it is read from the
+  // underlying memory.
+  ASSERT_TRUE(requests[2].success);
+  ASSERT_EQ(0xeeeeeeeeffffffffULL, values[2]);
+  ASSERT_FALSE(requests[3].success);
+
+  // The pages read for the requests that missed are cached.
+  memory_->SetMemoryBlock(0x9000, 4096, 0x11);
+  ASSERT_TRUE(memory_cache_->ReadFully(0x9100, &value, 1));
+  ASSERT_EQ(0xee, value);
+}
+
 }  // namespace unwindstack
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/PerfSampleUnwinder.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsGetLocal.h>
+
+namespace unwindstack {
+
+// Builds a record the way the kernel writes it to the ring buffer.
+class PerfRecord {
+ public:
+  PerfRecord(uint32_t type, uint16_t misc = 0) {
+    perf_event_header header{.type = type, .misc = misc, .size = 0};
+    Add(header);
+  }
+
+  template <typename T>
+  PerfRecord& Add(const T& value) {
+    return AddBytes(&value, sizeof(value));
+  }
+
+  PerfRecord& AddBytes(const void* data, size_t size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    data_.insert(data_.end(), bytes, bytes + size);
+    return *this;
+  }
+
+  // Adds a nul terminated string, padded to a multiple of 8 bytes.
+  PerfRecord& AddString(const std::string& str) {
+    AddBytes(str.c_str(), str.size() + 1);
+    data_.resize((data_.size() + 7) & ~7);
+    return *this;
+  }
+
+  const std::vector<uint8_t>& Get() {
+    reinterpret_cast<perf_event_header*>(data_.data())->size = data_.size();
+    return data_;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+};
+
+static std::vector<uint8_t> Mmap2Record(uint32_t pid, uint64_t start, uint64_t end,
+                                        const std::string& name) {
+  PerfRecord record(PERF_RECORD_MMAP2);
+  record.Add(pid).Add(pid).Add(start).Add(end - start).Add(uint64_t(0));
+  uint8_t file_id[24] = {};
+  record.Add(file_id).Add(uint32_t(PROT_READ | PROT_EXEC)).Add(uint32_t(MAP_PRIVATE));
+  return record.AddString(name).Get();
+}
+
+static std::vector<uint8_t> TaskRecord(uint32_t type, uint32_t pid, uint32_t ppid, uint32_t tid) {
+  return PerfRecord(type).Add(pid).Add(ppid).Add(tid).Add(ppid).Add(uint64_t(0)).Get();
+}
+
+// Creates an arm64 sample of a thread stopped at pc, with a small stack.
+static std::vector<uint8_t> Arm64SampleRecord(uint32_t pid, uint64_t pc) {
+  PerfRecord record(PERF_RECORD_SAMPLE);
+  record.Add(pid).Add(pid).Add(uint64_t(0)).Add(uint64_t(PERF_SAMPLE_REGS_ABI_64));
+  for (size_t reg = 0; reg <= ARM64_REG_PC; reg++) {
+    uint64_t value = 0;
+    if (reg == ARM64_REG_PC || reg == ARM64_REG_LR) {
+      // Keep the unwind from using the return address.
+      value = pc;
+    } else if (reg == ARM64_REG_SP) {
+      value = 0x10000;
+    }
+    record.Add(value);
+  }
+  uint64_t stack[4] = {};
+  return record.Add(uint64_t(sizeof(stack))).Add(stack).Add(uint64_t(sizeof(stack))).Get();
+}
+
+static bool Process(PerfSampleUnwinder* unwinder, const std::vector<uint8_t>& record) {
+  return unwinder->ProcessRecord(record.data(), record.size());
+}
+
+TEST(PerfSampleUnwinderTest, init_attr) {
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(ARCH_ARM64, &trie);
+  perf_event_attr attr = {};
+  ASSERT_TRUE(unwinder.InitAttr(&attr, 8190));
+  EXPECT_EQ(uint64_t(PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_REGS_USER |
+                     PERF_SAMPLE_STACK_USER),
+            attr.sample_type);
+  EXPECT_EQ(1U, attr.sample_id_all);
+  EXPECT_EQ((1ULL << 33) - 1, attr.sample_regs_user);
+  EXPECT_EQ(8184U, attr.sample_stack_user);
+  EXPECT_EQ(1U, attr.mmap2);
+  EXPECT_EQ(1U, attr.task);
+
+  PerfSampleUnwinder x86_64_unwinder(ARCH_X86_64, &trie);
+  ASSERT_TRUE(x86_64_unwinder.InitAttr(&attr, 8192));
+  EXPECT_EQ(0xff01ffU, attr.sample_regs_user);
+
+  PerfSampleUnwinder mips_unwinder(ARCH_MIPS, &trie);
+  EXPECT_FALSE(mips_unwinder.InitAttr(&attr, 8192));
+}
+
+TEST(PerfSampleUnwinderTest, mmap_and_sample) {
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(ARCH_ARM64, &trie);
+  ASSERT_TRUE(Process(&unwinder, Mmap2Record(100, 0x1000, 0x3000, "/fake/libold.so")));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(100, 0x1100)));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(100, 0x2100)));
+
+  // Replaces the first half of the old map.
+  ASSERT_TRUE(Process(&unwinder, Mmap2Record(100, 0x1000, 0x2000, "/fake/libnew.so")));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(100, 0x1200)));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(100, 0x2200)));
+  // Not in any map.
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(100, 0x5000)));
+
+  EXPECT_EQ(
+      "0x5000 1\n"
+      "libnew.so+0x200 1\n"
+      "libold.so+0x100 1\n"
+      "libold.so+0x1100 1\n"
+      "libold.so+0x200 1\n",
+      trie.DumpFolded());
+
+  const PerfSampleStats& stats = unwinder.stats();
+  EXPECT_EQ(5U, stats.samples);
+  EXPECT_EQ(2U, stats.mmaps);
+  EXPECT_EQ(0U, stats.malformed_records);
+}
+
+TEST(PerfSampleUnwinderTest, process_lifetime) {
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(ARCH_ARM64, &trie);
+  ASSERT_TRUE(Process(&unwinder, Mmap2Record(100, 0x1000, 0x2000, "/fake/libparent.so")));
+  EXPECT_EQ(1U, unwinder.NumProcesses());
+
+  // A new thread does not create a process.
+  ASSERT_TRUE(Process(&unwinder, TaskRecord(PERF_RECORD_FORK, 100, 100, 101)));
+  EXPECT_EQ(1U, unwinder.NumProcesses());
+
+  // A new process starts with the maps of its parent.
+  ASSERT_TRUE(Process(&unwinder, TaskRecord(PERF_RECORD_FORK, 200, 100, 200)));
+  EXPECT_EQ(2U, unwinder.NumProcesses());
+  ASSERT_TRUE(Process(&unwinder, Mmap2Record(200, 0x1800, 0x2000, "/fake/libchild.so")));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(200, 0x1100)));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(200, 0x1900)));
+  ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(100, 0x1900)));
+  EXPECT_EQ(
+      "libchild.so+0x100 1\n"
+      "libparent.so+0x100 1\n"
+      "libparent.so+0x900 1\n",
+      trie.DumpFolded());
+
+  // The exit of a thread keeps the maps, the exit of the process drops them.
+  ASSERT_TRUE(Process(&unwinder, TaskRecord(PERF_RECORD_EXIT, 200, 100, 201)));
+  EXPECT_EQ(2U, unwinder.NumProcesses());
+  ASSERT_TRUE(Process(&unwinder, TaskRecord(PERF_RECORD_EXIT, 200, 100, 200)));
+  EXPECT_EQ(1U, unwinder.NumProcesses());
+
+  // An exec drops the maps.
+  std::vector<uint8_t> comm = PerfRecord(PERF_RECORD_COMM, PERF_RECORD_MISC_COMM_EXEC)
+                                  .Add(uint32_t(100))
+                                  .Add(uint32_t(100))
+                                  .AddString("new")
+                                  .Get();
+  ASSERT_TRUE(Process(&unwinder, comm));
+  EXPECT_EQ(0U, unwinder.NumProcesses());
+}
+
+TEST(PerfSampleUnwinderTest, many_forks) {
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(ARCH_ARM64, &trie);
+  ASSERT_TRUE(Process(&unwinder, Mmap2Record(100, 0x1000, 0x2000, "/fake/libparent.so")));
+
+  // Enough processes that the table of processes is rehashed while a child
+  // is being created.
+  constexpr uint32_t kNumChildren = 1000;
+  for (uint32_t pid = 1000; pid < 1000 + kNumChildren; pid++) {
+    ASSERT_TRUE(Process(&unwinder, TaskRecord(PERF_RECORD_FORK, pid, 100, pid)));
+  }
+  EXPECT_EQ(kNumChildren + 1, unwinder.NumProcesses());
+  for (uint32_t pid = 1000; pid < 1000 + kNumChildren; pid++) {
+    ASSERT_TRUE(Process(&unwinder, Arm64SampleRecord(pid, 0x1100)));
+  }
+
+  // Every child has its own copy of the parent map.
+  std::string expected;
+  for (uint32_t i = 0; i < kNumChildren; i++) {
+    expected += "libparent.so+0x100 1\n";
+  }
+  EXPECT_EQ(expected, trie.DumpFolded());
+}
+
+TEST(PerfSampleUnwinderTest, malformed_records) {
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(ARCH_ARM64, &trie);
+
+  std::vector<uint8_t> sample = Arm64SampleRecord(100, 0x1000);
+  EXPECT_FALSE(unwinder.ProcessRecord(sample.data(), sample.size() - 8));
+  // The header claims the record is shorter than it is.
+  std::vector<uint8_t> truncated(sample);
+  reinterpret_cast<perf_event_header*>(truncated.data())->size = sample.size() - 8;
+  EXPECT_FALSE(Process(&unwinder, truncated));
+
+  // The name is not nul terminated.
+  std::vector<uint8_t> mmap = Mmap2Record(100, 0x1000, 0x2000, "/fake/libfake.so");
+  size_t name_offset = sizeof(perf_event_header) + 64;
+  memset(&mmap[name_offset], 'x', mmap.size() - name_offset);
+  EXPECT_FALSE(Process(&unwinder, mmap));
+
+  EXPECT_EQ(3U, unwinder.stats().malformed_records);
+  EXPECT_EQ(0U, unwinder.stats().samples);
+  EXPECT_EQ(0U, trie.NumSamples());
+
+  // Records that are not used are skipped.
+  std::vector<uint8_t> lost = PerfRecord(PERF_RECORD_LOST).Add(uint64_t(1)).Add(uint64_t(7)).Get();
+  EXPECT_TRUE(Process(&unwinder, lost));
+  EXPECT_TRUE(Process(&unwinder, PerfRecord(PERF_RECORD_THROTTLE).Add(uint64_t(0)).Get()));
+  EXPECT_EQ(7U, unwinder.stats().lost_samples);
+  EXPECT_EQ(3U, unwinder.stats().malformed_records);
+}
+
+TEST(PerfSampleUnwinderTest, record_time) {
+  std::vector<uint8_t> sample = PerfRecord(PERF_RECORD_SAMPLE)
+                                    .Add(uint32_t(100))
+                                    .Add(uint32_t(101))
+                                    .Add(uint64_t(0x1234))
+                                    .Add(uint64_t(PERF_SAMPLE_REGS_ABI_NONE))
+                                    .Add(uint64_t(0))
+                                    .Get();
+  uint64_t time;
+  ASSERT_TRUE(PerfSampleUnwinder::GetRecordTime(sample.data(), sample.size(), &time));
+  EXPECT_EQ(0x1234U, time);
+
+  // The other records end with the pid, tid and time.
+  std::vector<uint8_t> exit = PerfRecord(PERF_RECORD_EXIT)
+                                  .Add(uint32_t(100))
+                                  .Add(uint32_t(1))
+                                  .Add(uint32_t(100))
+                                  .Add(uint32_t(1))
+                                  .Add(uint64_t(0x5000))
+                                  .Add(uint32_t(100))
+                                  .Add(uint32_t(100))
+                                  .Add(uint64_t(0x5678))
+                                  .Get();
+  ASSERT_TRUE(PerfSampleUnwinder::GetRecordTime(exit.data(), exit.size(), &time));
+  EXPECT_EQ(0x5678U, time);
+
+  std::vector<uint8_t> empty = PerfRecord(PERF_RECORD_THROTTLE).Add(uint64_t(0)).Get();
+  EXPECT_FALSE(PerfSampleUnwinder::GetRecordTime(empty.data(), empty.size(), &time));
+  EXPECT_FALSE(PerfSampleUnwinder::GetRecordTime(exit.data(), exit.size() - 8, &time));
+}
+
+TEST(PerfSampleUnwinderTest, sample_without_regs) {
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(ARCH_ARM64, &trie);
+  std::vector<uint8_t> sample = PerfRecord(PERF_RECORD_SAMPLE)
+                                    .Add(uint32_t(0))
+                                    .Add(uint32_t(0))
+                                    .Add(uint64_t(0))
+                                    .Add(uint64_t(PERF_SAMPLE_REGS_ABI_NONE))
+                                    .Add(uint64_t(0))
+                                    .Get();
+  ASSERT_TRUE(Process(&unwinder, sample));
+  EXPECT_EQ(1U, unwinder.stats().samples);
+  EXPECT_EQ(1U, unwinder.stats().samples_without_regs);
+  EXPECT_EQ(0U, trie.NumSamples());
+}
+
+// The perf register numbers of the registers of x86_64.
+static constexpr uint8_t kX86_64PerfRegs[] = {
+    X86_64_REG_RAX, X86_64_REG_RBX, X86_64_REG_RCX, X86_64_REG_RDX, X86_64_REG_RSI,
+    X86_64_REG_RDI, X86_64_REG_RBP, X86_64_REG_RSP, X86_64_REG_RIP, 0xff,
+    0xff,           0xff,           0xff,           0xff,           0xff,
+    0xff,           X86_64_REG_R8,  X86_64_REG_R9,  X86_64_REG_R10, X86_64_REG_R11,
+    X86_64_REG_R12, X86_64_REG_R13, X86_64_REG_R14, X86_64_REG_R15,
+};
+
+// Creates a sample of the current thread, like the kernel would for a
+// sample taken right here.
+static __attribute__((__noinline__)) std::vector<uint8_t> CreateLocalSample(uint64_t regs_mask,
+                                                                             size_t stack_size) {
+  std::unique_ptr<Regs> regs(Regs::CreateFromLocal());
+  RegsGetLocal(regs.get());
+
+  std::vector<uint8_t> stack(stack_size);
+  size_t bytes = Memory::CreateProcessMemory(getpid())->Read(regs->sp(), stack.data(), stack_size);
+
+  PerfRecord record(PERF_RECORD_SAMPLE);
+  record.Add(uint32_t(getpid())).Add(uint32_t(gettid())).Add(uint64_t(0));
+  record.Add(uint64_t(PERF_SAMPLE_REGS_ABI_64));
+  const uint64_t* values = reinterpret_cast<const uint64_t*>(regs->RawData());
+  for (size_t perf_reg = 0; perf_reg < 64; perf_reg++) {
+    if ((regs_mask & (1ULL << perf_reg)) == 0) {
+      continue;
+    }
+    size_t reg = perf_reg;
+    if (regs->Arch() == ARCH_X86_64) {
+      reg = perf_reg < sizeof(kX86_64PerfRegs) ? kX86_64PerfRegs[perf_reg] : 0xff;
+    }
+    record.Add(reg < regs->total_regs() ? values[reg] : uint64_t(0));
+  }
+  record.Add(uint64_t(stack_size)).AddBytes(stack.data(), stack_size).Add(uint64_t(bytes));
+  return record.Get();
+}
+
+TEST(PerfSampleUnwinderTest, local_sample) {
+  ArchEnum arch = Regs::CurrentArch();
+  if (arch != ARCH_ARM64 && arch != ARCH_X86_64) {
+    GTEST_SKIP() << "Only supported on arm64 and x86_64.";
+  }
+
+  CallingContextTrie trie;
+  PerfSampleUnwinder unwinder(arch, &trie);
+  unwinder.SetReadProcesses(true);
+  perf_event_attr attr = {};
+  ASSERT_TRUE(unwinder.InitAttr(&attr, 16384));
+  std::vector<uint8_t> sample = CreateLocalSample(attr.sample_regs_user, attr.sample_stack_user);
+  ASSERT_TRUE(Process(&unwinder, sample));
+  ASSERT_TRUE(Process(&unwinder, sample));
+
+  EXPECT_EQ(2U, trie.NumSamples());
+  std::string folded = trie.DumpFolded();
+  // One stack, with the frames from the test body to where the sample was
+  // created.
+  ASSERT_EQ(1U, std::count(folded.begin(), folded.end(), '\n')) << folded;
+  EXPECT_NE(std::string::npos, folded.find("PerfSampleUnwinderTest_local_sample_Test::TestBody"))
+      << folded;
+  EXPECT_NE(std::string::npos, folded.find(";unwindstack::CreateLocalSample(")) << folded;
+  EXPECT_EQ(" 2\n", folded.substr(folded.size() - 3));
+}
+
+}  // namespace unwindstack
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <android-base/file.h>
+#include <android-base/threads.h>
+
+#include <unwindstack/UnwindService.h>
+
+#include "TestUtils.h"
+
+namespace unwindstack {
+
+static pid_t ForkWaitForever() {
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    bool run = true;
+    while (run) {
+      DoNotOptimize(run = true);
+    }
+    exit(1);
+  }
+  return pid;
+}
+
+TEST(UnwindServiceTest, remote_process) {
+  pid_t pid = ForkWaitForever();
+  ASSERT_NE(-1, pid);
+  TestScopedPidReaper reap(pid);
+
+  UnwindService service(2, 16);
+  std::vector<std::future<UnwindServiceResult>> futures;
+  for (size_t i = 0; i < 4; i++) {
+    futures.emplace_back(service.Submit(UnwindServiceRequest{.pid = pid}));
+  }
+  for (auto& future : futures) {
+    UnwindServiceResult result = future.get();
+    ASSERT_EQ(UNWIND_SERVICE_OK, result.status) << GetErrorCodeString(result.error.code);
+    EXPECT_EQ(pid, result.pid);
+    EXPECT_EQ(pid, result.tid);
+    EXPECT_NE(0U, result.frames.size());
+    EXPECT_LT(0, result.unwind_time.count());
+  }
+
+  UnwindServiceStats stats = service.GetStats();
+  EXPECT_EQ(4U, stats.completed);
+  EXPECT_EQ(0U, stats.failed);
+}
+
+TEST(UnwindServiceTest, local_thread) {
+  std::atomic<pid_t> tid = 0;
+  std::atomic_bool keep_running = true;
+  std::thread thread([&tid, &keep_running] {
+    tid = android::base::GetThreadId();
+    while (keep_running) {
+      usleep(1000);
+    }
+  });
+  while (tid == 0) {
+    usleep(1000);
+  }
+
+  UnwindService service(1, 16);
+  UnwindServiceResult result =
+      service.Submit(UnwindServiceRequest{.pid = getpid(), .tid = tid, .max_frames = 2}).get();
+  keep_running = false;
+  thread.join();
+
+  ASSERT_EQ(UNWIND_SERVICE_OK, result.status) << GetErrorCodeString(result.error.code);
+  EXPECT_EQ(tid, result.tid);
+  EXPECT_EQ(2U, result.frames.size());
+}
+
+TEST(UnwindServiceTest, attach_fails) {
+  UnwindService service(1, 16);
+  pid_t pid = ForkWaitForever();
+  ASSERT_NE(-1, pid);
+  TestScopedPidReaper reap(pid);
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+
+  UnwindServiceResult result = service.Submit(UnwindServiceRequest{.pid = pid}).get();
+  EXPECT_EQ(UNWIND_SERVICE_ATTACH_FAILED, result.status);
+  EXPECT_EQ(1U, service.GetStats().failed);
+}
+
+TEST(UnwindServiceTest, deadline_exceeded) {
+  UnwindService service(1, 16);
+  UnwindServiceRequest request{
+      .pid = getpid(), .deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1)};
+  UnwindServiceResult result = service.Submit(request).get();
+  EXPECT_EQ(UNWIND_SERVICE_DEADLINE_EXCEEDED, result.status);
+  EXPECT_EQ(0U, result.frames.size());
+  EXPECT_EQ(1U, service.GetStats().deadline_exceeded);
+}
+
+TEST(UnwindServiceTest, backpressure_and_cancel) {
+  UnwindService service(1, 1);
+  // Keep the only worker busy in the callback of the first request.
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  UnwindServiceRequest request{
+      .pid = getpid(), .deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1)};
+  ASSERT_NE(0U, service.Submit(request, [&started, released](UnwindServiceResult&) {
+    started.set_value();
+    released.wait();
+  }));
+  started.get_future().wait();
+
+  std::vector<UnwindServiceStatus> statuses;
+  uint64_t id = service.Submit(
+      request, [&statuses](UnwindServiceResult& result) { statuses.push_back(result.status); });
+  ASSERT_NE(0U, id);
+  EXPECT_EQ(1U, service.NumQueued());
+
+  // The queue is full.
+  EXPECT_EQ(0U, service.Submit(request, [](UnwindServiceResult&) { FAIL(); }));
+  EXPECT_EQ(UNWIND_SERVICE_REJECTED, service.Submit(request).get().status);
+
+  ASSERT_TRUE(service.Cancel(id));
+  ASSERT_EQ(1U, statuses.size());
+  EXPECT_EQ(UNWIND_SERVICE_CANCELLED, statuses[0]);
+  EXPECT_FALSE(service.Cancel(id));
+  EXPECT_EQ(0U, service.NumQueued());
+  release.set_value();
+
+  UnwindServiceStats stats = service.GetStats();
+  EXPECT_EQ(2U, stats.rejected);
+  EXPECT_EQ(1U, stats.cancelled);
+}
+
+TEST(UnwindServiceTest, destructor_cancels_queued) {
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<size_t> cancelled = 0;
+  UnwindServiceRequest request{
+      .pid = getpid(), .deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1)};
+  std::thread releaser;
+  {
+    UnwindService service(1, 16);
+    std::promise<void> started;
+    service.Submit(request, [&started, released](UnwindServiceResult&) {
+      started.set_value();
+      released.wait();
+    });
+    started.get_future().wait();
+    for (size_t i = 0; i < 4; i++) {
+      service.Submit(request, [&cancelled](UnwindServiceResult& result) {
+        if (result.status == UNWIND_SERVICE_CANCELLED) {
+          cancelled++;
+        }
+      });
+    }
+    // The busy worker cannot empty the queue, only the destructor can, so
+    // let the first request finish once that happened.
+    releaser = std::thread([&service, &release] {
+      while (service.NumQueued() != 0) {
+        usleep(1000);
+      }
+      release.set_value();
+    });
+  }
+  releaser.join();
+  EXPECT_EQ(4U, cancelled);
+}
+
+// The process waits for a byte on fd, then maps a new page of code that
+// jumps to itself and runs it. Returns zero if the arch has no such code.
+static pid_t ForkSpinInNewMap(int fd) {
+#if defined(__i386__) || defined(__x86_64__)
+  static const uint8_t kSpin[] = {0xeb, 0xfe};
+#elif defined(__aarch64__)
+  static const uint8_t kSpin[] = {0x00, 0x00, 0x00, 0x14};
+#else
+  return 0;
+#endif
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    char c;
+    if (!android::base::ReadFully(fd, &c, 1)) {
+      exit(1);
+    }
+    void* code = mmap(nullptr, getpagesize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (code == MAP_FAILED) {
+      exit(1);
+    }
+    memcpy(code, kSpin, sizeof(kSpin));
+    __builtin___clear_cache(reinterpret_cast<char*>(code),
+                            reinterpret_cast<char*>(code) + sizeof(kSpin));
+    if (mprotect(code, getpagesize(), PROT_READ | PROT_EXEC) == -1) {
+      exit(1);
+    }
+    reinterpret_cast<void (*)()>(code)();
+    exit(1);
+  }
+  return pid;
+}
+
+TEST(UnwindServiceTest, remote_process_maps_changed) {
+  android::base::unique_fd read_fd;
+  android::base::unique_fd write_fd;
+  ASSERT_TRUE(android::base::Pipe(&read_fd, &write_fd));
+  pid_t pid = ForkSpinInNewMap(read_fd.get());
+  if (pid == 0) {
+    GTEST_SKIP() << "No spin code for this arch.";
+  }
+  ASSERT_NE(-1, pid);
+  TestScopedPidReaper reap(pid);
+
+  UnwindService service(1, 16);
+  UnwindServiceResult result = service.Submit(UnwindServiceRequest{.pid = pid}).get();
+  ASSERT_EQ(UNWIND_SERVICE_OK, result.status) << GetErrorCodeString(result.error.code);
+
+  // Wait until the process runs in the new map.
+  ASSERT_TRUE(android::base::WriteFully(write_fd.get(), "x", 1));
+  bool in_new_map = false;
+  for (size_t i = 0; i < 1000 && !in_new_map; i++) {
+    std::string maps;
+    ASSERT_TRUE(android::base::ReadFileToString("/proc/" + std::to_string(pid) + "/maps", &maps));
+    in_new_map = maps.find(" r-xp 00000000 00:00 0 ") != std::string::npos;
+    usleep(1000);
+  }
+  ASSERT_TRUE(in_new_map);
+  usleep(10000);
+
+  // The maps from the first request do not have the new map, so they are
+  // read again.
+  result = service.Submit(UnwindServiceRequest{.pid = pid}).get();
+  ASSERT_NE(0U, result.frames.size());
+  EXPECT_NE(ERROR_INVALID_MAP, result.error.code) << GetErrorCodeString(result.error.code);
+  ASSERT_TRUE(result.frames[0].map_info != nullptr);
+  EXPECT_TRUE(result.frames[0].map_info->flags() & PROT_EXEC);
+}
+
+}  // namespace unwindstack
@@ -291,6 +291,32 @@ TEST_F(UnwindTest, unwind_from_pid_remote) {
   ASSERT_TRUE(Detach(pid));
 }
 
+TEST_F(UnwindTest, unwind_from_pid_remote_stack_prefetch) {
+  pid_t pid;
+  if ((pid = fork()) == 0) {
+    OuterFunction(TEST_TYPE_REMOTE);
+    exit(0);
+  }
+  ASSERT_NE(-1, pid);
+  TestScopedPidReaper reap(pid);
+
+  ASSERT_TRUE(WaitForRemote(pid, true, reinterpret_cast<uint64_t>(&g_ready_for_remote)));
+
+  std::unique_ptr<Regs> regs(Regs::RemoteGet(pid));
+  ASSERT_TRUE(regs.get() != nullptr);
+
+  UnwinderFromPid unwinder(512, pid);
+  unwinder.SetStackPrefetch(true);
+  // The second unwind uses a prefetch size based on the first one.
+  for (size_t i = 0; i < 2; i++) {
+    std::unique_ptr<Regs> unwind_regs(regs->Clone());
+    unwinder.SetRegs(unwind_regs.get());
+    VerifyUnwind(&unwinder, kFunctionOrder);
+  }
+
+  ASSERT_TRUE(Detach(pid));
+}
+
 static void RemoteCheckForLeaks(void (*unwind_func)(void*)) {
   pid_t pid;
   if ((pid = fork()) == 0) {
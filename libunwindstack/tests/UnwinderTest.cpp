@@ -26,6 +26,8 @@
 
 #include <android-base/silent_death_test.h>
 #include <unwindstack/Elf.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineX86.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
 #include <unwindstack/Regs.h>
@@ -333,6 +335,189 @@ TEST_F(UnwinderTest, multiple_frames_dont_resolve_names) {
   EXPECT_EQ(PROT_READ | PROT_WRITE, frame->map_info->flags());
 }
 
+TEST_F(UnwinderTest, stack_memo_reuses_outer_frames) {
+  // The words below each caller sp, which hold the return address. The
+  // process memory is cleared on every unwind, so use the step memory.
+  MemoryFake* stack_memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(stack_memory);
+  stack_memory->SetData32(0x10018, 0x1204);
+  stack_memory->SetData32(0x1001c, 0x10020);
+  stack_memory->SetData32(0x10028, 0x1304);
+  stack_memory->SetData32(0x1002c, 0x10030);
+
+  StackMemo memo;
+  regs_.FakeSetArch(ARCH_X86);
+  regs_.set_pc(0x1000);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1204, 0x10020, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1304, 0x10030, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, maps_.get(), &regs_, process_memory_);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetStackMemo(&memo);
+  unwinder.Unwind();
+  EXPECT_EQ(ERROR_NONE, unwinder.LastErrorCode());
+  ASSERT_EQ(4U, unwinder.NumFrames());
+  EXPECT_EQ(4U, memo.NumFrames());
+  EXPECT_EQ(0U, memo.reused_frames());
+  std::vector<FrameData> first_frames = unwinder.ConsumeFrames();
+
+  // Only the innermost frame changed, and only its step is available, so
+  // the other frames have to come from the memo.
+  ElfInterfaceFake::FakeClear();
+  regs_.set_pc(0x1020);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  unwinder.Unwind();
+  EXPECT_EQ(ERROR_NONE, unwinder.LastErrorCode());
+  ASSERT_EQ(4U, unwinder.NumFrames());
+  EXPECT_EQ(3U, memo.reused_frames());
+  EXPECT_EQ(0x1020U, unwinder.frames()[0].pc);
+  for (size_t i = 1; i < 4; i++) {
+    const FrameData& frame = unwinder.frames()[i];
+    SCOPED_TRACE(i);
+    EXPECT_EQ(i, frame.num);
+    EXPECT_EQ(first_frames[i].pc, frame.pc);
+    EXPECT_EQ(first_frames[i].rel_pc, frame.rel_pc);
+    EXPECT_EQ(first_frames[i].sp, frame.sp);
+    EXPECT_EQ(first_frames[i].map_info, frame.map_info);
+  }
+
+  // The return address of the frame changed, so nothing is reused.
+  ElfInterfaceFake::FakeClear();
+  stack_memory->SetData32(0x10018, 0x1208);
+  regs_.set_pc(0x1000);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  unwinder.Unwind();
+  EXPECT_EQ(0U, memo.reused_frames());
+  ASSERT_EQ(2U, unwinder.NumFrames());
+  EXPECT_EQ(2U, memo.NumFrames());
+}
+
+TEST_F(UnwinderTest, stack_memo_max_frames) {
+  MemoryFake* stack_memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(stack_memory);
+  stack_memory->SetData32(0x10018, 0x1204);
+  stack_memory->SetData32(0x1001c, 0x10020);
+  stack_memory->SetData32(0x10028, 0x1304);
+  stack_memory->SetData32(0x1002c, 0x10030);
+
+  StackMemo memo;
+  regs_.FakeSetArch(ARCH_X86);
+  regs_.set_pc(0x1000);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1204, 0x10020, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1304, 0x10030, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, maps_.get(), &regs_, process_memory_);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetStackMemo(&memo);
+  unwinder.Unwind();
+  ASSERT_EQ(4U, unwinder.NumFrames());
+
+  ElfInterfaceFake::FakeClear();
+  regs_.set_pc(0x1000);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  Unwinder short_unwinder(3, maps_.get(), &regs_, process_memory_);
+  short_unwinder.SetStepMemory(step_memory);
+  short_unwinder.SetStackMemo(&memo);
+  short_unwinder.Unwind();
+  EXPECT_EQ(ERROR_MAX_FRAMES_EXCEEDED, short_unwinder.LastErrorCode());
+  ASSERT_EQ(3U, short_unwinder.NumFrames());
+  EXPECT_EQ(2U, memo.reused_frames());
+  EXPECT_EQ(0x10020U, short_unwinder.frames()[2].sp);
+}
+
+TEST_F(UnwinderTest, stack_memo_compares_callee_saved_regs) {
+  MemoryFake* stack_memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(stack_memory);
+  stack_memory->SetData32(0x10018, 0x1204);
+  stack_memory->SetData32(0x1001c, 0x10020);
+  stack_memory->SetData32(0x10028, 0x1304);
+  stack_memory->SetData32(0x1002c, 0x10030);
+
+  StackMemo memo;
+  RegsX86 regs;
+  regs.set_pc(0x1000);
+  regs.set_sp(0x10000);
+  regs[X86_REG_EBX] = 0x1234;
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1204, 0x10020, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1304, 0x10030, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, maps_.get(), &regs, process_memory_);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetStackMemo(&memo);
+  unwinder.Unwind();
+  ASSERT_EQ(4U, unwinder.NumFrames());
+
+  // The callers could use ebx, so a frame with a different ebx is not
+  // the same frame.
+  ElfInterfaceFake::FakeClear();
+  regs.set_pc(0x1020);
+  regs.set_sp(0x10000);
+  regs[X86_REG_EBX] = 0x5678;
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  unwinder.Unwind();
+  EXPECT_EQ(0U, memo.reused_frames());
+  ASSERT_EQ(2U, unwinder.NumFrames());
+
+  // With the same ebx, the memo of the last unwind is reused.
+  ElfInterfaceFake::FakeClear();
+  regs.set_pc(0x1000);
+  regs.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1204, 0x10020, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1304, 0x10030, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+  unwinder.Unwind();
+  ASSERT_EQ(4U, unwinder.NumFrames());
+  ElfInterfaceFake::FakeClear();
+  regs.set_pc(0x1020);
+  regs.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  unwinder.Unwind();
+  EXPECT_EQ(3U, memo.reused_frames());
+  ASSERT_EQ(4U, unwinder.NumFrames());
+}
+
+TEST_F(UnwinderTest, stack_memo_not_used_on_arm) {
+  MemoryFake* stack_memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(stack_memory);
+  stack_memory->SetData32(0x10018, 0x1204);
+  stack_memory->SetData32(0x1001c, 0x10020);
+
+  StackMemo memo;
+  regs_.set_pc(0x1000);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0x1204, 0x10020, false));
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, maps_.get(), &regs_, process_memory_);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetStackMemo(&memo);
+  unwinder.Unwind();
+  ASSERT_EQ(3U, unwinder.NumFrames());
+  EXPECT_EQ(0U, memo.NumFrames());
+
+  // Every frame is stepped again.
+  ElfInterfaceFake::FakeClear();
+  regs_.set_pc(0x1000);
+  regs_.set_sp(0x10000);
+  ElfInterfaceFake::FakePushStepData(StepData(0x1104, 0x10010, false));
+  unwinder.Unwind();
+  EXPECT_EQ(0U, memo.reused_frames());
+  ASSERT_EQ(2U, unwinder.NumFrames());
+}
+
 TEST_F(UnwinderTest, non_zero_load_bias) {
   ElfInterfaceFake::FakePushFunctionData(FunctionData("Frame0", 0));
 
@@ -1774,6 +1959,163 @@ TEST_F(UnwinderTest, unwinder_from_pid_set_process_memory) {
   ASSERT_EQ(process_memory.get(), unwinder.GetProcessMemory().get());
 }
 
+// Creates a chain of frame records starting at 0x10100, each one pointing
+// at a return address in 0x1000-0x8000 and at the next record, 0x100
+// bytes further up the stack.
+static void SetFrameRecords(MemoryFake* memory, size_t num_records) {
+  for (size_t i = 0; i < num_records; i++) {
+    uint64_t fp = 0x10100 + i * 0x100;
+    uint64_t next_fp = i + 1 == num_records ? 0 : fp + 0x100;
+    memory->SetData64(fp, next_fp);
+    memory->SetData64(fp + 8, 0x2000 + i * 0x100);
+  }
+}
+
+TEST_F(UnwinderTest, frame_pointer_unwind) {
+  Maps maps;
+  ElfFake* elf = new ElfFake(new MemoryFake);
+  elf->FakeSetInterface(new ElfInterfaceFake(nullptr));
+  maps.Add(0x1000, 0x8000, 0, PROT_READ | PROT_EXEC, "/fake/libfp.so");
+  maps.Find(0x1000)->set_elf(elf);
+  maps.Add(0x10000, 0x12000, 0, PROT_READ | PROT_WRITE, "[stack]");
+
+  // The process memory is cleared at the start of every unwind, so keep
+  // the frame records in a separate step memory.
+  std::shared_ptr<Memory> process_memory(new MemoryFake);
+  MemoryFake* memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(memory);
+  constexpr size_t kNumRecords = 12;
+  SetFrameRecords(memory, kNumRecords);
+
+  RegsX86_64 regs;
+  regs.set_pc(0x1100);
+  regs.set_sp(0x10000);
+  regs.SetFramePointer(0x10100);
+
+  // The first frame is always stepped using the unwind information, the
+  // next ones are checked against the frame records until the elf is
+  // considered safe to use frame pointers.
+  ElfInterfaceFake::FakePushStepData(StepData(0x2000, 0x10110, false, 0x10200));
+  for (size_t i = 1; i <= Elf::kFramePointerChecks; i++) {
+    ElfInterfaceFake::FakePushStepData(
+        StepData(0x2000 + i * 0x100, 0x10110 + i * 0x100, false, 0x10200 + i * 0x100));
+  }
+  // The last record ends the chain, so the last step uses the unwind
+  // information.
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, &maps, &regs, process_memory);
+  unwinder.SetResolveNames(false);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetFramePointerUnwind(true);
+  unwinder.Unwind();
+  EXPECT_EQ(ERROR_NONE, unwinder.LastErrorCode());
+  EXPECT_EQ(Elf::FRAME_POINTER_SAFE, elf->frame_pointer_state());
+
+  ASSERT_EQ(kNumRecords + 1, unwinder.NumFrames());
+  for (size_t i = 1; i < unwinder.NumFrames(); i++) {
+    const FrameData& frame = unwinder.frames()[i];
+    // The pc of each caller frame is adjusted back by one byte.
+    EXPECT_EQ(0x2000 + (i - 1) * 0x100 - 1, frame.pc) << "Failed at frame " << i;
+    EXPECT_EQ(0x10110 + (i - 1) * 0x100, frame.sp) << "Failed at frame " << i;
+  }
+
+  std::vector<FramePointerStats> stats = unwinder.GetFramePointerStats();
+  ASSERT_EQ(1U, stats.size());
+  EXPECT_EQ("/fake/libfp.so", stats[0].library);
+  EXPECT_EQ(kNumRecords + 1, stats[0].steps);
+  EXPECT_EQ(kNumRecords - Elf::kFramePointerChecks - 1, stats[0].frame_pointer_steps);
+  EXPECT_DOUBLE_EQ(
+      static_cast<double>(kNumRecords - Elf::kFramePointerChecks - 1) / (kNumRecords + 1),
+      stats[0].HitRatio());
+
+  unwinder.ClearFramePointerStats();
+  EXPECT_TRUE(unwinder.GetFramePointerStats().empty());
+}
+
+TEST_F(UnwinderTest, frame_pointer_unwind_mismatch) {
+  Maps maps;
+  ElfFake* elf = new ElfFake(new MemoryFake);
+  elf->FakeSetInterface(new ElfInterfaceFake(nullptr));
+  maps.Add(0x1000, 0x8000, 0, PROT_READ | PROT_EXEC, "/fake/libfp.so");
+  maps.Find(0x1000)->set_elf(elf);
+  maps.Add(0x10000, 0x12000, 0, PROT_READ | PROT_WRITE, "[stack]");
+
+  // The process memory is cleared at the start of every unwind, so keep
+  // the frame records in a separate step memory.
+  std::shared_ptr<Memory> process_memory(new MemoryFake);
+  MemoryFake* memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(memory);
+  SetFrameRecords(memory, 4);
+
+  RegsX86_64 regs;
+  regs.set_pc(0x1100);
+  regs.set_sp(0x10000);
+  regs.SetFramePointer(0x10100);
+
+  // The second step does not agree with the frame record.
+  ElfInterfaceFake::FakePushStepData(StepData(0x2000, 0x10110, false, 0x10200));
+  ElfInterfaceFake::FakePushStepData(StepData(0x2300, 0x10210, false, 0x10300));
+  ElfInterfaceFake::FakePushStepData(StepData(0x2400, 0x10310, false, 0x10400));
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, &maps, &regs, process_memory);
+  unwinder.SetResolveNames(false);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetFramePointerUnwind(true);
+  unwinder.Unwind();
+  EXPECT_EQ(ERROR_NONE, unwinder.LastErrorCode());
+  EXPECT_EQ(Elf::FRAME_POINTER_UNSAFE, elf->frame_pointer_state());
+
+  // Every frame came from the unwind information.
+  ASSERT_EQ(4U, unwinder.NumFrames());
+  EXPECT_EQ(0x22ffU, unwinder.frames()[2].pc);
+  EXPECT_EQ(0x23ffU, unwinder.frames()[3].pc);
+  std::vector<FramePointerStats> stats = unwinder.GetFramePointerStats();
+  ASSERT_EQ(1U, stats.size());
+  EXPECT_EQ(4U, stats[0].steps);
+  EXPECT_EQ(0U, stats[0].frame_pointer_steps);
+}
+
+TEST_F(UnwinderTest, frame_pointer_unwind_not_used_on_arm64) {
+  Maps maps;
+  ElfFake* elf = new ElfFake(new MemoryFake);
+  elf->FakeSetInterface(new ElfInterfaceFake(nullptr));
+  maps.Add(0x1000, 0x8000, 0, PROT_READ | PROT_EXEC, "/fake/libfp.so");
+  maps.Find(0x1000)->set_elf(elf);
+  maps.Add(0x10000, 0x12000, 0, PROT_READ | PROT_WRITE, "[stack]");
+
+  std::shared_ptr<Memory> process_memory(new MemoryFake);
+  MemoryFake* memory = new MemoryFake;
+  std::shared_ptr<Memory> step_memory(memory);
+  constexpr size_t kNumRecords = Elf::kFramePointerChecks + 3;
+  SetFrameRecords(memory, kNumRecords);
+
+  RegsArm64 regs;
+  regs.set_pc(0x1100);
+  regs.set_sp(0x10000);
+  regs[ARM64_REG_R29] = 0x10100;
+
+  for (size_t i = 0; i < kNumRecords; i++) {
+    ElfInterfaceFake::FakePushStepData(
+        StepData(0x2000 + i * 0x100, 0x10110 + i * 0x100, false, 0x10200 + i * 0x100));
+  }
+  ElfInterfaceFake::FakePushStepData(StepData(0, 0, true));
+
+  Unwinder unwinder(64, &maps, &regs, process_memory);
+  unwinder.SetResolveNames(false);
+  unwinder.SetStepMemory(step_memory);
+  unwinder.SetFramePointerUnwind(true);
+  unwinder.Unwind();
+  EXPECT_EQ(ERROR_NONE, unwinder.LastErrorCode());
+  EXPECT_EQ(Elf::FRAME_POINTER_UNKNOWN, elf->frame_pointer_state());
+  ASSERT_EQ(kNumRecords + 1, unwinder.NumFrames());
+  std::vector<FramePointerStats> stats = unwinder.GetFramePointerStats();
+  ASSERT_EQ(1U, stats.size());
+  EXPECT_EQ(kNumRecords + 1, stats[0].steps);
+  EXPECT_EQ(0U, stats[0].frame_pointer_steps);
+}
+
 using UnwinderDeathTest = SilentDeathTest;
 
 TEST_F(UnwinderDeathTest, unwinder_from_pid_init_error) {
@@ -103,8 +103,15 @@ void DoUnwind(pid_t pid) {
 }
 
 int main(int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "--cache-dir") == 0) {
+    unwindstack::Elf::SetCacheDirectory(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if (argc != 2) {
-    printf("Usage: unwind <PID>\n");
+    printf("Usage: unwind [--cache-dir DIR] <PID>\n");
+    printf("  --cache-dir DIR\n");
+    printf("    Keep the unwind and symbol tables of the libraries in DIR.\n");
     return 1;
   }
 
@@ -26,6 +26,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <unwindstack/DwarfCompactTable.h>
 #include <unwindstack/DwarfSection.h>
 #include <unwindstack/DwarfStructs.h>
 #include <unwindstack/Elf.h>
@@ -47,8 +48,8 @@ void DumpArm(Elf* elf, ElfInterfaceArm* interface) {
   printf("ARM Unwind Information:\n");
   uint64_t load_bias = elf->GetLoadBias();
   for (const auto& entry : interface->pt_loads()) {
-    printf(" PC Range 0x%" PRIx64 " - 0x%" PRIx64 "\n", entry.second.offset + load_bias,
-           entry.second.offset + entry.second.table_size + load_bias);
+    printf(" PC Range 0x%" PRIx64 " - 0x%" PRIx64 "\n", entry.offset + load_bias,
+           entry.offset + entry.table_size + load_bias);
     for (auto pc : *interface) {
       SharedString name;
       printf("  PC 0x%" PRIx64, pc + load_bias);
@@ -102,6 +103,57 @@ void DumpDwarfSection(Elf* elf, DwarfSection* section, uint64_t) {
   }
 }
 
+static double Percent(uint64_t value, uint64_t total) {
+  return total == 0 ? 0.0 : 100.0 * value / total;
+}
+
+void DumpCompactCoverage(const char* name, Elf* elf, DwarfSection* section) {
+  printf("%s compact coverage:\n", name);
+  if (!section->BuildCompactTable(elf->arch())) {
+    printf("  Compact tables are not supported for this architecture.\n");
+    return;
+  }
+  const DwarfCompactTable* table = section->compact_table();
+  if (table == nullptr) {
+    printf("  No fdes.\n");
+    return;
+  }
+  const DwarfCompactTable::Stats& stats = table->stats();
+  printf("  FDEs: %" PRIu64 "\n", stats.fdes);
+  printf("  Rows: %" PRIu64 " compact: %" PRIu64 " (%.1f%%)\n", stats.rows, stats.compact_rows,
+         Percent(stats.compact_rows, stats.rows));
+  printf("  Code bytes: %" PRIu64 " compact: %" PRIu64 " (%.1f%%)\n", stats.bytes,
+         stats.compact_bytes, Percent(stats.compact_bytes, stats.bytes));
+  printf("  Table rows: %zu size: %zu bytes\n", table->NumRows(), table->MemoryUsage());
+}
+
+int GetCompactCoverage(const char* file, uint64_t offset) {
+  Elf elf(Memory::CreateFileMemory(file, offset).release());
+  if (!elf.Init() || !elf.valid()) {
+    printf("%s is not a valid elf file.\n", file);
+    return 1;
+  }
+
+  ElfInterface* interface = elf.interface();
+  if (interface->eh_frame() != nullptr) {
+    DumpCompactCoverage("eh_frame", &elf, interface->eh_frame());
+  }
+  if (interface->debug_frame() != nullptr) {
+    DumpCompactCoverage("debug_frame", &elf, interface->debug_frame());
+  }
+  ElfInterface* gnu_debugdata_interface = elf.gnu_debugdata_interface();
+  if (gnu_debugdata_interface != nullptr) {
+    if (gnu_debugdata_interface->eh_frame() != nullptr) {
+      DumpCompactCoverage("gnu_debugdata (eh_frame)", &elf, gnu_debugdata_interface->eh_frame());
+    }
+    if (gnu_debugdata_interface->debug_frame() != nullptr) {
+      DumpCompactCoverage("gnu_debugdata (debug_frame)", &elf,
+                          gnu_debugdata_interface->debug_frame());
+    }
+  }
+  return 0;
+}
+
 int GetElfInfo(const char* file, uint64_t offset) {
   Elf elf(Memory::CreateFileMemory(file, offset).release());
   if (!elf.Init() || !elf.valid()) {
@@ -168,8 +220,15 @@ int GetElfInfo(const char* file, uint64_t offset) {
 }  // namespace unwindstack
 
 int main(int argc, char** argv) {
+  bool compact = argc > 1 && strcmp(argv[1], "--compact") == 0;
+  if (compact) {
+    argc--;
+    argv++;
+  }
   if (argc != 2 && argc != 3) {
-    printf("Usage: unwind_info ELF_FILE [OFFSET]\n");
+    printf("Usage: unwind_info [--compact] ELF_FILE [OFFSET]\n");
+    printf("  --compact\n");
+    printf("    Only display how much of the cfa information fits in a compact table.\n");
     printf("  ELF_FILE\n");
     printf("    The path to an elf file.\n");
     printf("  OFFSET\n");
@@ -197,5 +256,8 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (compact) {
+    return unwindstack::GetCompactCoverage(argv[1], offset);
+  }
   return unwindstack::GetElfInfo(argv[1], offset);
 }
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <unwindstack/CallingContextTrie.h>
+#include <unwindstack/PerfSampleUnwinder.h>
+#include <unwindstack/Regs.h>
+
+// The ring buffer of every event, not counting the header page.
+static constexpr size_t kBufferPages = 128;
+// A sample has to fit in a record, whose size is 16 bits.
+static constexpr uint32_t kMaxStackSize = 60000;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void SignalHandler(int) {
+  g_stop = 1;
+}
+
+struct EventBuffer {
+  int fd;
+  perf_event_mmap_page* page;
+  uint8_t* data;
+  size_t size;
+};
+
+static bool OpenEvent(perf_event_attr* attr, pid_t tid, int cpu, EventBuffer* buffer) {
+  int fd = syscall(__NR_perf_event_open, attr, tid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  size_t page_size = getpagesize();
+  size_t map_size = (kBufferPages + 1) * page_size;
+  void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  buffer->fd = fd;
+  buffer->page = reinterpret_cast<perf_event_mmap_page*>(map);
+  buffer->data = reinterpret_cast<uint8_t*>(map) + page_size;
+  buffer->size = kBufferPages * page_size;
+  return true;
+}
+
+static std::vector<pid_t> GetThreads(pid_t pid) {
+  std::vector<pid_t> tids;
+  std::string task_dir = "/proc/" + std::to_string(pid) + "/task";
+  DIR* dir = opendir(task_dir.c_str());
+  if (dir == nullptr) {
+    return tids;
+  }
+  dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] != '.') {
+      tids.push_back(atoi(entry->d_name));
+    }
+  }
+  closedir(dir);
+  return tids;
+}
+
+// A record copied out of a ring buffer.
+struct QueuedRecord {
+  uint64_t time;
+  std::vector<uint8_t> data;
+};
+
+// Copies all of the records in the ring buffer to records, and frees
+// their space.
+static void ReadRecords(EventBuffer* buffer, std::vector<QueuedRecord>* records) {
+  uint64_t head = __atomic_load_n(&buffer->page->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = buffer->page->data_tail;
+  while (tail < head) {
+    // Records are 8 byte aligned, so the header never wraps around.
+    size_t offset = tail % buffer->size;
+    const perf_event_header* header =
+        reinterpret_cast<const perf_event_header*>(&buffer->data[offset]);
+    size_t record_size = header->size;
+    if (record_size == 0) {
+      break;
+    }
+    QueuedRecord& record = records->emplace_back();
+    record.data.resize(record_size);
+    if (offset + record_size <= buffer->size) {
+      memcpy(record.data.data(), &buffer->data[offset], record_size);
+    } else {
+      size_t first_size = buffer->size - offset;
+      memcpy(record.data.data(), &buffer->data[offset], first_size);
+      memcpy(&record.data[first_size], buffer->data, record_size - first_size);
+    }
+    if (!unwindstack::PerfSampleUnwinder::GetRecordTime(record.data.data(), record_size,
+                                                        &record.time)) {
+      record.time = 0;
+    }
+    tail += record_size;
+  }
+  __atomic_store_n(&buffer->page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+// Passes the records up to max_time to the unwinder in the order of their
+// times, and removes them. The later records stay queued, since a ring
+// buffer can still get records from before them.
+static void ProcessRecords(std::vector<QueuedRecord>* records, uint64_t max_time,
+                           unwindstack::PerfSampleUnwinder* unwinder) {
+  std::stable_sort(records->begin(), records->end(),
+                   [](const QueuedRecord& a, const QueuedRecord& b) { return a.time < b.time; });
+  auto end = std::upper_bound(
+      records->begin(), records->end(), max_time,
+      [](uint64_t time, const QueuedRecord& record) { return time < record.time; });
+  for (auto it = records->begin(); it != end; ++it) {
+    unwinder->ProcessRecord(it->data.data(), it->data.size());
+  }
+  records->erase(records->begin(), end);
+}
+
+static void PrintUsage() {
+  printf("Usage: unwind_profile [OPTIONS] -p PID | -a\n");
+  printf("Samples the user stacks of a process, or of all processes, and prints them in\n");
+  printf("the folded format used by flame graph tools.\n");
+  printf("  -p PID\n");
+  printf("    Profile the threads that process PID has when the profile starts.\n");
+  printf("  -a\n");
+  printf("    Profile all processes, with one event for each cpu.\n");
+  printf("  -d SECONDS\n");
+  printf("    Stop after SECONDS, instead of when interrupted.\n");
+  printf("  -f FREQUENCY\n");
+  printf("    The number of samples per second of each thread or cpu, default 1000.\n");
+  printf("  -s STACK_SIZE\n");
+  printf("    The number of bytes of the stack to copy for each sample, default 16384.\n");
+  printf("  -o FILE\n");
+  printf("    Write the stacks to FILE instead of stdout.\n");
+}
+
+int main(int argc, char** argv) {
+  pid_t pid = 0;
+  bool all = false;
+  double duration = 0;
+  uint64_t frequency = 1000;
+  uint32_t stack_size = 16384;
+  const char* output = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:ad:f:s:o:")) != -1) {
+    switch (opt) {
+      case 'p':
+        pid = atoi(optarg);
+        break;
+      case 'a':
+        all = true;
+        break;
+      case 'd':
+        duration = atof(optarg);
+        break;
+      case 'f':
+        frequency = strtoull(optarg, nullptr, 10);
+        break;
+      case 's':
+        stack_size = strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        PrintUsage();
+        return 1;
+    }
+  }
+  if ((pid == 0) == !all || optind != argc || frequency == 0 || stack_size == 0 ||
+      stack_size > kMaxStackSize) {
+    PrintUsage();
+    return 1;
+  }
+
+  unwindstack::CallingContextTrie trie;
+  unwindstack::PerfSampleUnwinder unwinder(unwindstack::Regs::CurrentArch(), &trie);
+  unwinder.SetReadProcesses(true);
+
+  perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_CPU_CLOCK;
+  attr.freq = 1;
+  attr.sample_freq = frequency;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.disabled = 1;
+  // Wake up when a quarter of the buffer is used.
+  attr.watermark = 1;
+  attr.wakeup_watermark = kBufferPages * getpagesize() / 4;
+  if (!unwinder.InitAttr(&attr, stack_size)) {
+    printf("Profiling is not supported on this arch.\n");
+    return 1;
+  }
+
+  std::vector<EventBuffer> buffers;
+  if (all) {
+    for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); cpu++) {
+      EventBuffer buffer;
+      // Skip the cpus that are offline.
+      if (OpenEvent(&attr, -1, cpu, &buffer)) {
+        buffers.push_back(buffer);
+      } else if (errno != ENODEV) {
+        printf("Failed to open the event of cpu %d: %s\n", cpu, strerror(errno));
+        return 1;
+      }
+    }
+  } else {
+    for (pid_t tid : GetThreads(pid)) {
+      EventBuffer buffer;
+      // Skip the threads that exited already.
+      if (OpenEvent(&attr, tid, -1, &buffer)) {
+        buffers.push_back(buffer);
+      } else if (errno != ESRCH) {
+        printf("Failed to open the event of thread %d: %s\n", tid, strerror(errno));
+        return 1;
+      }
+    }
+  }
+  if (buffers.empty()) {
+    printf("Nothing to profile.\n");
+    return 1;
+  }
+
+  signal(SIGINT, SignalHandler);
+  signal(SIGTERM, SignalHandler);
+
+  std::vector<pollfd> fds;
+  for (auto& buffer : buffers) {
+    fds.push_back(pollfd{.fd = buffer.fd, .events = POLLIN, .revents = 0});
+    ioctl(buffer.fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::nanoseconds unwind_time(0);
+  std::vector<QueuedRecord> records;
+  // Every record up to the last time read in one round has been written
+  // by the end of the next round, in all of the ring buffers.
+  uint64_t flush_time = 0;
+  bool done = false;
+  while (!done) {
+    int timeout_ms = 100;
+    if (duration > 0) {
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (elapsed.count() >= duration) {
+        done = true;
+        timeout_ms = 0;
+      }
+    }
+    if (g_stop) {
+      done = true;
+      timeout_ms = 0;
+    }
+    if (poll(fds.data(), fds.size(), timeout_ms) == -1 && errno != EINTR) {
+      break;
+    }
+    if (done) {
+      for (auto& buffer : buffers) {
+        ioctl(buffer.fd, PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    auto unwind_start = std::chrono::steady_clock::now();
+    for (auto& buffer : buffers) {
+      ReadRecords(&buffer, &records);
+    }
+    uint64_t last_time = 0;
+    for (const auto& record : records) {
+      last_time = std::max(last_time, record.time);
+    }
+    ProcessRecords(&records, done ? UINT64_MAX : flush_time, &unwinder);
+    flush_time = std::max(flush_time, last_time);
+    unwind_time += std::chrono::steady_clock::now() - unwind_start;
+  }
+
+  size_t map_size = (kBufferPages + 1) * getpagesize();
+  for (auto& buffer : buffers) {
+    munmap(buffer.page, map_size);
+    close(buffer.fd);
+  }
+
+  std::string folded = trie.DumpFolded();
+  FILE* out = stdout;
+  if (output != nullptr) {
+    out = fopen(output, "w");
+    if (out == nullptr) {
+      printf("Failed to open %s: %s\n", output, strerror(errno));
+      return 1;
+    }
+  }
+  fwrite(folded.data(), 1, folded.size(), out);
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  const unwindstack::PerfSampleStats& stats = unwinder.stats();
+  double unwind_seconds = std::chrono::duration<double>(unwind_time).count();
+  fprintf(stderr, "%" PRIu64 " samples, %" PRIu64 " without registers, %" PRIu64 " lost\n",
+          stats.samples, stats.samples_without_regs, stats.lost_samples);
+  if (unwind_seconds > 0) {
+    fprintf(stderr, "Processed %.0f samples/sec\n", stats.samples / unwind_seconds);
+  }
+  return 0;
+}
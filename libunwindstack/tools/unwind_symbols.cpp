@@ -28,11 +28,18 @@
 #include <unwindstack/Memory.h>
 
 int main(int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "--cache-dir") == 0) {
+    unwindstack::Elf::SetCacheDirectory(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if (argc != 2 && argc != 3) {
-    printf("Usage: unwind_symbols <ELF_FILE> [<FUNC_ADDRESS>]\n");
+    printf("Usage: unwind_symbols [--cache-dir DIR] <ELF_FILE> [<FUNC_ADDRESS>]\n");
     printf("  Dump all function symbols in ELF_FILE. If FUNC_ADDRESS is\n");
     printf("  specified, then get the function at that address.\n");
     printf("  FUNC_ADDRESS must be a hex number.\n");
+    printf("  --cache-dir DIR\n");
+    printf("    Keep the symbol tables and decompressed .gnu_debugdata in DIR.\n");
     return 1;
   }
 
@@ -106,8 +113,8 @@ int main(int argc, char** argv) {
 
   // This is a crude way to get the symbols in order.
   for (const auto& entry : elf.interface()->pt_loads()) {
-    uint64_t start = entry.second.offset;
-    uint64_t end = entry.second.table_size;
+    uint64_t start = entry.offset;
+    uint64_t end = entry.table_size;
     for (uint64_t addr = start; addr < end; addr += 4) {
       unwindstack::SharedString cur_name;
       uint64_t func_offset;